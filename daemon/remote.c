@@ -15,6 +15,7 @@
 #include <string.h> /* strcmp */
 
 #include <event2/buffer.h>
+#include <event2/util.h> /* evutil_ascii_strncasecmp () */
 
 #define CURL_DISABLE_TYPECHECK /* otherwise -Wunreachable-code goes insane */
 #include <curl/curl.h>
@@ -241,6 +242,7 @@ static tr_option opts[] =
     { 911, "encryption-preferred",   "Prefer encrypted peer connections", "ep", 0, NULL },
     { 912, "encryption-tolerated",   "Prefer unencrypted peer connections", "et", 0, NULL },
     { 850, "exit",                   "Tell the transmission session to shut down", NULL, 0, NULL },
+    { 851, "monitor",                "List all torrents, and list them again whenever they change", NULL, 0, NULL },
     { 940, "files",                  "List the current torrent(s)' files", "f",  0, NULL },
     { 'g', "get",                    "Mark files for download", "g",  1, "<files>" },
     { 'G', "no-get",                 "Mark files for not downloading", "G",  1, "<files>" },
@@ -430,6 +432,7 @@ getOptMode (int val)
 
       case 'i': /* info */
       case 'l': /* list all torrents */
+      case 851: /* monitor */
       case 940: /* info-files */
       case 941: /* info-peer */
       case 942: /* info-pieces */
@@ -488,6 +491,8 @@ static bool debug = 0;
 static char * auth = NULL;
 static char * netrc = NULL;
 static char * sessionId = NULL;
+static bool serverSpeaksBenc = false; /* set once the server has answered in benc */
+static bool responseIsBenc = false; /* the format of the response being read */
 static bool UseSSL = false;
 
 static char*
@@ -709,7 +714,8 @@ writeFunc (void * ptr, size_t size, size_t nmemb, void * buf)
     return byteCount;
 }
 
-/* look for a session id in the header in case the server gives back a 409 */
+/* look for a session id in the header in case the server gives back a 409,
+ * and for the response's content type in case it's bencoded */
 static size_t
 parseResponseHeader (void *ptr, size_t size, size_t nmemb, void * stream UNUSED)
 {
@@ -717,6 +723,8 @@ parseResponseHeader (void *ptr, size_t size, size_t nmemb, void * stream UNUSED)
     const size_t line_len = size * nmemb;
     const char * key = TR_RPC_SESSION_ID_HEADER ": ";
     const size_t key_len = strlen (key);
+    const char * type_key = "Content-Type: " TR_RPC_BENC_CONTENT_TYPE;
+    const size_t type_key_len = strlen (type_key);
 
     if (line_len >= key_len && memcmp (line, key, key_len) == 0)
     {
@@ -727,14 +735,20 @@ parseResponseHeader (void *ptr, size_t size, size_t nmemb, void * stream UNUSED)
         tr_free (sessionId);
         sessionId = tr_strndup (begin, end-begin);
     }
+    else if (line_len >= type_key_len && evutil_ascii_strncasecmp (line, type_key, type_key_len) == 0)
+    {
+        responseIsBenc = true;
+    }
 
     return line_len;
 }
 
 static long
-getTimeoutSecs (const char * req)
+getTimeoutSecs (tr_variant * req)
 {
-  if (strstr (req, "\"method\":\"blocklist-update\"") != NULL)
+  const char * method;
+
+  if (tr_variantDictFindStr (req, TR_KEY_method, &method, NULL) && strcmp (method, "blocklist-update") == 0)
     return 300L;
 
   return 60L; /* default value */
@@ -1628,7 +1642,8 @@ processResponse (const char * rpcurl, const void * response, size_t len)
         fprintf (stderr, "got response (len %d):\n--------\n%*.*s\n--------\n",
                (int)len, (int)len, (int)len, (const char*) response);
 
-    if (tr_variantFromJson (&top, response, len))
+    if (tr_variantFromBuf (&top, responseIsBenc ? TR_VARIANT_FMT_BENC : TR_VARIANT_FMT_JSON,
+                           response, len, NULL, NULL, TR_VARIANT_PARSE_DEFAULT))
     {
         tr_logAddNamedError (MY_NAME, "Unable to parse response \"%*.*s\"", (int)len,
                (int)len, (const char*)response);
@@ -1709,7 +1724,7 @@ processResponse (const char * rpcurl, const void * response, size_t len)
 }
 
 static CURL*
-tr_curl_easy_init (struct evbuffer * writebuf)
+tr_curl_easy_init (struct evbuffer * writebuf, struct curl_slist ** custom_headers)
 {
     CURL * curl = curl_easy_init ();
     curl_easy_setopt (curl, CURLOPT_USERAGENT, MY_NAME "/" LONG_VERSION_STRING);
@@ -1730,12 +1745,16 @@ tr_curl_easy_init (struct evbuffer * writebuf)
         curl_easy_setopt (curl, CURLOPT_SSL_VERIFYHOST, 0); /* do not verify subject/hostname */
         curl_easy_setopt (curl, CURLOPT_SSL_VERIFYPEER, 0); /* since most certs will be self-signed, do not verify against CA */
     }
+    /* the server answers in benc if it can; otherwise in JSON */
+    *custom_headers = curl_slist_append (NULL, "Accept: " TR_RPC_BENC_CONTENT_TYPE ", application/json");
+    if (serverSpeaksBenc)
+        *custom_headers = curl_slist_append (*custom_headers, "Content-Type: " TR_RPC_BENC_CONTENT_TYPE);
     if (sessionId) {
         char * h = tr_strdup_printf ("%s: %s", TR_RPC_SESSION_ID_HEADER, sessionId);
-        struct curl_slist * custom_headers = curl_slist_append (NULL, h);
-        curl_easy_setopt (curl, CURLOPT_HTTPHEADER, custom_headers);
-        /* fixme: leaks */
+        *custom_headers = curl_slist_append (*custom_headers, h);
+        tr_free (h);
     }
+    curl_easy_setopt (curl, CURLOPT_HTTPHEADER, *custom_headers);
     return curl;
 }
 
@@ -1744,19 +1763,23 @@ flush (const char * rpcurl, tr_variant ** benc)
 {
     CURLcode res;
     CURL * curl;
+    struct curl_slist * custom_headers;
     int status = EXIT_SUCCESS;
     struct evbuffer * buf = evbuffer_new ();
-    char * json = tr_variantToStr (*benc, TR_VARIANT_FMT_JSON_LEAN, NULL);
+    size_t reqlen;
+    char * req = tr_variantToStr (*benc, serverSpeaksBenc ? TR_VARIANT_FMT_BENC : TR_VARIANT_FMT_JSON_LEAN, &reqlen);
     char *rpcurl_http =  tr_strdup_printf (UseSSL? "https://%s" : "http://%s", rpcurl);
 
-    curl = tr_curl_easy_init (buf);
+    curl = tr_curl_easy_init (buf, &custom_headers);
     curl_easy_setopt (curl, CURLOPT_URL, rpcurl_http);
-    curl_easy_setopt (curl, CURLOPT_POSTFIELDS, json);
-    curl_easy_setopt (curl, CURLOPT_TIMEOUT, getTimeoutSecs (json));
+    curl_easy_setopt (curl, CURLOPT_POSTFIELDS, req);
+    curl_easy_setopt (curl, CURLOPT_POSTFIELDSIZE, (long)reqlen);
+    curl_easy_setopt (curl, CURLOPT_TIMEOUT, getTimeoutSecs (*benc));
 
     if (debug)
-        fprintf (stderr, "posting:\n--------\n%s\n--------\n", json);
+        fprintf (stderr, "posting:\n--------\n%*.*s\n--------\n", (int)reqlen, (int)reqlen, req);
 
+    responseIsBenc = false;
     if ((res = curl_easy_perform (curl)))
     {
         tr_logAddNamedError (MY_NAME, " (%s) %s", rpcurl_http, curl_easy_strerror (res));
@@ -1768,6 +1791,8 @@ flush (const char * rpcurl, tr_variant ** benc)
         curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &response);
         switch (response) {
             case 200:
+                if (responseIsBenc)
+                    serverSpeaksBenc = true;
                 status |= processResponse (rpcurl, (const char*) evbuffer_pullup (buf, -1), evbuffer_get_length (buf));
                 break;
             case 409:
@@ -1788,10 +1813,11 @@ flush (const char * rpcurl, tr_variant ** benc)
 
     /* cleanup */
     tr_free (rpcurl_http);
-    tr_free (json);
+    tr_free (req);
     evbuffer_free (buf);
     if (curl != 0)
         curl_easy_cleanup (curl);
+    curl_slist_free_all (custom_headers);
     if (benc != NULL) {
         tr_variantFree (*benc);
         *benc = 0;
@@ -1799,6 +1825,223 @@ flush (const char * rpcurl, tr_variant ** benc)
     return status;
 }
 
+/***
+****  --monitor
+****
+****  Rather than polling, ask the server to push the torrent list to us
+****  whenever it changes. The first message is the whole list; after that
+****  each one has just the torrents and fields that changed, plus the ids
+****  of any torrents that were removed, so we merge them into our copy.
+***/
+
+struct monitor_state
+{
+    CURL * curl;
+    tr_variant top; /* a torrent-get response that printTorrentList () can use */
+    tr_variant * torrents;
+    struct evbuffer * buf; /* received but not yet parsed */
+    int status;
+};
+
+static int
+findTorrentIndex (tr_variant * torrents, int64_t id)
+{
+    int i;
+    int64_t test;
+    tr_variant * t;
+
+    for (i=0; (t = tr_variantListChild (torrents, i)); ++i)
+        if (tr_variantDictFindInt (t, TR_KEY_id, &test) && test == id)
+            return i;
+
+    return -1;
+}
+
+static void
+monitorMerge (struct monitor_state * state, tr_variant * response)
+{
+    int i;
+    int64_t id;
+    tr_variant * args;
+    tr_variant * list;
+    tr_variant * t;
+    const char * str;
+
+    if (!tr_variantDictFindStr (response, TR_KEY_result, &str, NULL) || strcmp (str, "success") != 0)
+    {
+        printf ("Error: %s\n", str ? str : "no result");
+        state->status |= EXIT_FAILURE;
+        return;
+    }
+
+    if (!tr_variantDictFindDict (response, ARGUMENTS, &args))
+        return;
+
+    if (tr_variantDictFindList (args, TR_KEY_removed, &list))
+        for (i=0; (t = tr_variantListChild (list, i)); ++i)
+        {
+            int index;
+            if (tr_variantGetInt (t, &id) && (index = findTorrentIndex (state->torrents, id)) >= 0)
+                tr_variantListRemove (state->torrents, index);
+        }
+
+    if (tr_variantDictFindList (args, TR_KEY_torrents, &list))
+        for (i=0; (t = tr_variantListChild (list, i)); ++i)
+            if (tr_variantDictFindInt (t, TR_KEY_id, &id))
+            {
+                const int index = findTorrentIndex (state->torrents, id);
+                tr_variant * target = index >= 0 ? tr_variantListChild (state->torrents, index)
+                                                 : tr_variantListAddDict (state->torrents, 0);
+                tr_variantMergeDicts (target, t);
+            }
+
+    printf ("\n");
+    printTorrentList (&state->top);
+    fflush (stdout);
+}
+
+/* split the stream into messages: lean JSON has one per line,
+ * and benc tells us where each one ends */
+static void
+monitorParse (struct monitor_state * state)
+{
+    for (;;)
+    {
+        tr_variant response;
+        const size_t len = evbuffer_get_length (state->buf);
+        const char * data = (const char *) evbuffer_pullup (state->buf, -1);
+        const char * end;
+
+        if (len == 0)
+            break;
+
+        if (responseIsBenc)
+        {
+            if (tr_variantFromBuf (&response, TR_VARIANT_FMT_BENC, data, len,
+                                   NULL, &end, TR_VARIANT_PARSE_DEFAULT) != 0)
+                break; /* wait for the rest of it */
+        }
+        else
+        {
+            if ((end = memchr (data, '\n', len)) == NULL)
+                break; /* wait for the rest of it */
+
+            if (tr_variantFromJson (&response, data, end - data) != 0)
+            {
+                tr_logAddNamedError (MY_NAME, "Unable to parse response \"%*.*s\"",
+                                     (int)(end - data), (int)(end - data), data);
+                state->status |= EXIT_FAILURE;
+                evbuffer_drain (state->buf, end + 1 - data);
+                continue;
+            }
+
+            ++end;
+        }
+
+        if (debug)
+            fprintf (stderr, "got message (len %d):\n--------\n%*.*s\n--------\n",
+                     (int)(end - data), (int)(end - data), (int)(end - data), data);
+
+        evbuffer_drain (state->buf, end - data);
+        monitorMerge (state, &response);
+        tr_variantFree (&response);
+    }
+}
+
+static size_t
+monitorWriteFunc (void * ptr, size_t size, size_t nmemb, void * vstate)
+{
+    long response = 0;
+    struct monitor_state * state = vstate;
+    const size_t byteCount = size * nmemb;
+
+    evbuffer_add (state->buf, ptr, byteCount);
+
+    /* a 409's body is just an explanation; flush () will retry */
+    curl_easy_getinfo (state->curl, CURLINFO_RESPONSE_CODE, &response);
+    if (response == 200)
+        monitorParse (state);
+
+    return byteCount;
+}
+
+static int
+monitor (const char * rpcurl, tr_variant ** benc)
+{
+    CURLcode res;
+    struct curl_slist * custom_headers;
+    struct monitor_state state;
+    tr_variant body;
+    tr_variant * requests;
+    tr_variant * args;
+    size_t reqlen;
+    char * req;
+    char * url = tr_strdup_printf ("%s://%s%smonitor", UseSSL ? "https" : "http", rpcurl,
+                                   *rpcurl && rpcurl[strlen (rpcurl) - 1] == '/' ? "" : "/");
+    int retries = 1;
+
+    tr_variantInitDict (&body, 2);
+    tr_variantDictAddInt (&body, TR_KEY_interval, 1);
+    requests = tr_variantDictAddList (&body, TR_KEY_requests, 1);
+    *tr_variantListAdd (requests) = **benc;
+    tr_free (*benc);
+    *benc = NULL;
+
+    memset (&state, 0, sizeof (state));
+    state.buf = evbuffer_new ();
+    tr_variantInitDict (&state.top, 1);
+    args = tr_variantDictAddDict (&state.top, ARGUMENTS, 1);
+    state.torrents = tr_variantDictAddList (args, TR_KEY_torrents, 0);
+
+    for (;;)
+    {
+        long response = 0;
+
+        req = tr_variantToStr (&body, serverSpeaksBenc ? TR_VARIANT_FMT_BENC : TR_VARIANT_FMT_JSON_LEAN, &reqlen);
+        state.curl = tr_curl_easy_init (state.buf, &custom_headers);
+        curl_easy_setopt (state.curl, CURLOPT_URL, url);
+        curl_easy_setopt (state.curl, CURLOPT_POSTFIELDS, req);
+        curl_easy_setopt (state.curl, CURLOPT_POSTFIELDSIZE, (long)reqlen);
+        curl_easy_setopt (state.curl, CURLOPT_WRITEFUNCTION, monitorWriteFunc);
+        curl_easy_setopt (state.curl, CURLOPT_WRITEDATA, &state);
+
+        responseIsBenc = false;
+        if ((res = curl_easy_perform (state.curl)))
+        {
+            tr_logAddNamedError (MY_NAME, " (%s) %s", url, curl_easy_strerror (res));
+            state.status |= EXIT_FAILURE;
+        }
+        else
+        {
+            curl_easy_getinfo (state.curl, CURLINFO_RESPONSE_CODE, &response);
+            if (response != 200 && response != 409)
+            {
+                fprintf (stderr, "Unexpected response: %s\n", evbuffer_pullup (state.buf, -1));
+                state.status |= EXIT_FAILURE;
+            }
+        }
+
+        curl_easy_cleanup (state.curl);
+        curl_slist_free_all (custom_headers);
+        tr_free (req);
+
+        /* our session id was stale; parseResponseHeader () has the new one */
+        if (res == CURLE_OK && response == 409 && retries-- > 0)
+        {
+            evbuffer_drain (state.buf, evbuffer_get_length (state.buf));
+            continue;
+        }
+
+        break;
+    }
+
+    tr_free (url);
+    evbuffer_free (state.buf);
+    tr_variantFree (&state.top);
+    tr_variantFree (&body);
+    return state.status;
+}
+
 static tr_variant*
 ensure_sset (tr_variant ** sset)
 {
@@ -1942,7 +2185,8 @@ processArgs (const char * rpcurl, int argc, const char * const * argv)
                           for (i=0; i<n; ++i) tr_variantListAddQuark (fields, details_keys[i]);
                           addIdArg (args, id, NULL);
                           break;
-                case 'l': tr_variantDictAddInt (top, TR_KEY_tag, TAG_LIST);
+                case 'l':
+                case 851: tr_variantDictAddInt (top, TR_KEY_tag, TAG_LIST);
                           n = TR_N_ELEMENTS (list_keys);
                           for (i=0; i<n; ++i) tr_variantListAddQuark (fields, list_keys[i]);
                           addIdArg (args, id, "all");
@@ -1968,7 +2212,10 @@ processArgs (const char * rpcurl, int argc, const char * const * argv)
                 default:  assert ("unhandled value" && 0);
             }
 
-            status |= flush (rpcurl, &top);
+            if (c == 851)
+                status |= monitor (rpcurl, &top);
+            else
+                status |= flush (rpcurl, &top);
         }
         else if (stepMode == MODE_SESSION_SET)
         {
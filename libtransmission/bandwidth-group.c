@@ -0,0 +1,227 @@
+/*
+ * This file Copyright (C) 2016 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <assert.h>
+#include <string.h> /* strcmp () */
+
+#include "transmission.h"
+#include "bandwidth-group.h"
+#include "log.h"
+#include "ptrarray.h"
+#include "save-queue.h"
+#include "session.h"
+#include "torrent.h" /* tr_torrentNext () */
+#include "utils.h"
+#include "variant.h"
+
+/***
+****
+***/
+
+static char*
+getFilename (const tr_session * session)
+{
+  return tr_buildPath (tr_sessionGetConfigDir (session), "bandwidth-groups.json", NULL);
+}
+
+static int
+compareGroupToName (const void * va, const void * vb)
+{
+  const tr_bandwidth_group * a = va;
+  const char * b = vb;
+  return strcmp (a->name, b);
+}
+
+static int
+compareGroups (const void * va, const void * vb)
+{
+  const tr_bandwidth_group * b = vb;
+  return compareGroupToName (va, b->name);
+}
+
+static void
+groupFree (void * vgroup)
+{
+  tr_bandwidth_group * group = vgroup;
+
+  tr_bandwidthDestruct (&group->bandwidth);
+  tr_free (group->name);
+  tr_free (group);
+}
+
+static tr_bandwidth_group *
+groupNew (tr_session * session, const char * name)
+{
+  tr_bandwidth_group * group = tr_new0 (tr_bandwidth_group, 1);
+
+  group->name = tr_strdup (name);
+  tr_bandwidthConstruct (&group->bandwidth, session, &session->bandwidth);
+  tr_ptrArrayInsertSorted (&session->bandwidthGroups, group, compareGroups);
+
+  return group;
+}
+
+/***
+****
+***/
+
+static void
+loadSingleLimit (tr_variant * d, tr_bandwidth * b, tr_direction dir)
+{
+  int64_t i;
+  bool boolVal;
+  const tr_quark limitKey   = dir == TR_UP ? TR_KEY_uploadLimit   : TR_KEY_downloadLimit;
+  const tr_quark limitedKey = dir == TR_UP ? TR_KEY_uploadLimited : TR_KEY_downloadLimited;
+
+  if (tr_variantDictFindInt (d, limitKey, &i))
+    tr_bandwidthSetDesiredSpeed_Bps (b, dir, toSpeedBytes (i));
+
+  if (tr_variantDictFindBool (d, limitedKey, &boolVal))
+    tr_bandwidthSetLimited (b, dir, boolVal);
+}
+
+static void
+loadGroups (tr_session * session)
+{
+  int i;
+  tr_quark key;
+  tr_variant top;
+  tr_variant * d;
+  char * filename = getFilename (session);
+
+  if (tr_saveQueueReadFile (session->saveQueue, filename, TR_VARIANT_FMT_JSON, &top))
+    {
+      for (i=0; tr_variantDictChild (&top, i, &key, &d); ++i)
+        {
+          bool boolVal;
+          tr_bandwidth_group * group;
+
+          if (!tr_variantIsDict (d))
+            continue;
+
+          group = groupNew (session, tr_quark_get_string (key, NULL));
+          loadSingleLimit (d, &group->bandwidth, TR_UP);
+          loadSingleLimit (d, &group->bandwidth, TR_DOWN);
+
+          if (tr_variantDictFindBool (d, TR_KEY_honorsSessionLimits, &boolVal))
+            {
+              tr_bandwidthHonorParentLimits (&group->bandwidth, TR_UP, boolVal);
+              tr_bandwidthHonorParentLimits (&group->bandwidth, TR_DOWN, boolVal);
+            }
+        }
+
+      tr_variantFree (&top);
+    }
+
+  tr_free (filename);
+}
+
+void
+tr_bandwidthGroupsSave (tr_session * session)
+{
+  int i, n;
+  char * filename;
+  tr_variant top;
+  tr_bandwidth_group ** groups;
+
+  groups = (tr_bandwidth_group**) tr_ptrArrayBase (&session->bandwidthGroups);
+  n = tr_ptrArraySize (&session->bandwidthGroups);
+
+  tr_variantInitDict (&top, n);
+  for (i=0; i<n; ++i)
+    {
+      const tr_bandwidth * b = &groups[i]->bandwidth;
+      tr_variant * d = tr_variantDictAddDict (&top, tr_quark_new (groups[i]->name, TR_BAD_SIZE), 5);
+      tr_variantDictAddInt  (d, TR_KEY_downloadLimit, (int64_t) toSpeedKBps (tr_bandwidthGetDesiredSpeed_Bps (b, TR_DOWN)));
+      tr_variantDictAddBool (d, TR_KEY_downloadLimited, tr_bandwidthIsLimited (b, TR_DOWN));
+      tr_variantDictAddBool (d, TR_KEY_honorsSessionLimits, tr_bandwidthAreParentLimitsHonored (b, TR_UP));
+      tr_variantDictAddInt  (d, TR_KEY_uploadLimit, (int64_t) toSpeedKBps (tr_bandwidthGetDesiredSpeed_Bps (b, TR_UP)));
+      tr_variantDictAddBool (d, TR_KEY_uploadLimited, tr_bandwidthIsLimited (b, TR_UP));
+    }
+
+  filename = getFilename (session);
+  tr_logAddDeep (__FILE__, __LINE__, NULL, "Saving bandwidth groups to \"%s\"", filename);
+  tr_saveQueueAdd (session->saveQueue, filename, &top, TR_VARIANT_FMT_JSON);
+
+  tr_free (filename);
+  tr_variantFree (&top);
+}
+
+/***
+****
+***/
+
+void
+tr_bandwidthGroupsInit (tr_session * session)
+{
+  session->bandwidthGroups = TR_PTR_ARRAY_INIT;
+  loadGroups (session);
+}
+
+void
+tr_bandwidthGroupsClose (tr_session * session)
+{
+  tr_bandwidthGroupsSave (session);
+  tr_ptrArrayDestruct (&session->bandwidthGroups, groupFree);
+}
+
+tr_bandwidth_group *
+tr_bandwidthGroupFind (tr_session * session, const char * name)
+{
+  assert (tr_isSession (session));
+
+  if (name == NULL || *name == '\0')
+    return NULL;
+
+  return tr_ptrArrayFindSorted (&session->bandwidthGroups, name, compareGroupToName);
+}
+
+tr_bandwidth_group *
+tr_bandwidthGroupGet (tr_session * session, const char * name)
+{
+  tr_bandwidth_group * group;
+
+  assert (name != NULL && *name != '\0');
+
+  if ((group = tr_bandwidthGroupFind (session, name)) == NULL)
+    {
+      group = groupNew (session, name);
+      tr_bandwidthGroupsSave (session);
+    }
+
+  return group;
+}
+
+bool
+tr_bandwidthGroupRemove (tr_session * session, const char * name)
+{
+  tr_torrent * tor = NULL;
+  tr_bandwidth_group * group;
+
+  if ((group = tr_bandwidthGroupFind (session, name)) == NULL)
+    return false;
+
+  /* move its torrents back under the session's limits */
+  while ((tor = tr_torrentNext (session, tor)))
+    if (!tr_strcmp0 (tr_torrentGetBandwidthGroup (tor), group->name))
+      tr_torrentSetBandwidthGroup (tor, NULL);
+
+  tr_ptrArrayRemoveSortedPointer (&session->bandwidthGroups, group, compareGroups);
+  groupFree (group);
+  tr_bandwidthGroupsSave (session);
+  return true;
+}
+
+tr_bandwidth_group **
+tr_bandwidthGroupList (tr_session * session, int * setmeCount)
+{
+  const int n = tr_ptrArraySize (&session->bandwidthGroups);
+
+  *setmeCount = n;
+  return tr_memdup (tr_ptrArrayBase (&session->bandwidthGroups), sizeof (tr_bandwidth_group*) * n);
+}
@@ -0,0 +1,60 @@
+/*
+ * This file Copyright (C) 2016 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#ifndef __TRANSMISSION__
+ #error only libtransmission should #include this header.
+#endif
+
+#pragma once
+
+#include "bandwidth.h"
+
+/**
+ * @addtogroup networked_io Networked IO
+ * @{
+ */
+
+/**
+ * A named bandwidth object that sits between the session and a set of
+ * torrents, so that one speed limit can be shared by all of them.
+ * The groups are saved in "bandwidth-groups.json" in the config dir;
+ * each torrent remembers its group's name in its .resume file.
+ */
+typedef struct tr_bandwidth_group
+{
+  char * name;
+  tr_bandwidth bandwidth;
+}
+tr_bandwidth_group;
+
+void                 tr_bandwidthGroupsInit  (tr_session * session);
+
+void                 tr_bandwidthGroupsClose (tr_session * session);
+
+void                 tr_bandwidthGroupsSave  (tr_session * session);
+
+/** @return the named group, or NULL if there isn't one */
+tr_bandwidth_group * tr_bandwidthGroupFind   (tr_session * session,
+                                              const char * name);
+
+/** @return the named group, creating and saving it if necessary */
+tr_bandwidth_group * tr_bandwidthGroupGet    (tr_session * session,
+                                              const char * name);
+
+/**
+ * @brief deletes the named group. Its torrents go back to the session's limits.
+ * @return false if there wasn't such a group
+ */
+bool                 tr_bandwidthGroupRemove (tr_session * session,
+                                              const char * name);
+
+/** @return a newly-allocated array of all the groups, sorted by name */
+tr_bandwidth_group ** tr_bandwidthGroupList  (tr_session * session,
+                                              int        * setmeCount);
+
+/* @} */
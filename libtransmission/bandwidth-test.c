@@ -0,0 +1,319 @@
+/*
+ * This file Copyright (C) 2016 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ * $Id$
+ */
+
+#include <string.h> /* memset () */
+
+#include <event2/buffer.h>
+#include <event2/event.h> /* EV_WRITE */
+#include <event2/util.h> /* evutil_closesocket () */
+
+#include "transmission.h"
+#include "bandwidth.h"
+#include "fdlimit.h" /* tr_fdSocketAccept () */
+#include "net.h"
+#include "peer-io.h"
+#include "trevent.h" /* tr_runInEventThread () */
+#include "utils.h"
+
+#include "libtransmission-test.h"
+
+/***
+****
+***/
+
+static int
+test_refill (void)
+{
+  tr_bandwidth b;
+  struct tr_band * band;
+
+  memset (&b, 0, sizeof (b));
+  tr_bandwidthConstruct (&b, NULL, NULL);
+  tr_bandwidthSetLimited (&b, TR_UP, true);
+  tr_bandwidthSetDesiredSpeed_Bps (&b, TR_UP, 10000);
+  band = &b.band[TR_UP];
+  band->bytesLeft = 0;
+  band->bytesLeftDate = 1000;
+
+  /* the bucket earns desiredSpeed_Bps tokens per second... */
+  tr_bandwidthUsed (&b, TR_UP, 0, true, 1100);
+  check_uint_eq (1000, band->bytesLeft);
+  check_uint_eq (1100, band->bytesLeftDate);
+
+  /* ...spends one per byte of piece data... */
+  tr_bandwidthUsed (&b, TR_UP, 400, true, 1100);
+  check_uint_eq (600, band->bytesLeft);
+
+  /* ...but not for protocol overhead... */
+  tr_bandwidthUsed (&b, TR_UP, 400, false, 1100);
+  check_uint_eq (600, band->bytesLeft);
+
+  /* ...and never holds more than BURST_MSEC's worth */
+  tr_bandwidthUsed (&b, TR_UP, 0, true, 1000000);
+  check_uint_eq (10000 * BURST_MSEC / 1000, band->bytesLeft);
+
+  /* spending more than there is leaves it empty, not negative */
+  tr_bandwidthUsed (&b, TR_UP, 100000, true, 1000000);
+  check_uint_eq (0, band->bytesLeft);
+
+  /* slow limits don't lose their fractional bytes to rounding */
+  tr_bandwidthSetDesiredSpeed_Bps (&b, TR_UP, 5);
+  tr_bandwidthUsed (&b, TR_UP, 0, true, 1000100);
+  check_uint_eq (0, band->bytesLeft);
+  check_uint_eq (1000000, band->bytesLeftDate);
+  tr_bandwidthUsed (&b, TR_UP, 0, true, 1000200);
+  check_uint_eq (1, band->bytesLeft);
+  check_uint_eq (1000200, band->bytesLeftDate);
+
+  tr_bandwidthDestruct (&b);
+  return 0;
+}
+
+static int
+test_clamp (void)
+{
+  tr_bandwidth parent;
+  tr_bandwidth child;
+
+  memset (&parent, 0, sizeof (parent));
+  memset (&child, 0, sizeof (child));
+  tr_bandwidthConstruct (&parent, NULL, NULL);
+  tr_bandwidthConstruct (&child, NULL, &parent);
+
+  /* nothing's limited, so nothing's clamped */
+  check_uint_eq (100000, tr_bandwidthClamp (&child, TR_UP, 100000));
+
+  /* a limited parent clamps its children, starting with a full bucket */
+  tr_bandwidthSetLimited (&parent, TR_UP, true);
+  tr_bandwidthSetDesiredSpeed_Bps (&parent, TR_UP, 20000);
+  check_uint_eq (10000, tr_bandwidthClamp (&child, TR_UP, 100000));
+  check_uint_eq (500, tr_bandwidthClamp (&child, TR_UP, 500));
+
+  /* the tighter of the two limits wins... */
+  tr_bandwidthSetLimited (&child, TR_UP, true);
+  tr_bandwidthSetDesiredSpeed_Bps (&child, TR_UP, 400000);
+  check_uint_eq (10000, tr_bandwidthClamp (&child, TR_UP, 100000));
+  tr_bandwidthSetDesiredSpeed_Bps (&child, TR_UP, 4000);
+  check_uint_eq (2000, tr_bandwidthClamp (&child, TR_UP, 100000));
+
+  /* ...unless the child ignores its parent's limits */
+  tr_bandwidthSetLimited (&child, TR_UP, false);
+  tr_bandwidthHonorParentLimits (&child, TR_UP, false);
+  check_uint_eq (100000, tr_bandwidthClamp (&child, TR_UP, 100000));
+
+  /* the other direction isn't affected */
+  check_uint_eq (100000, tr_bandwidthClamp (&child, TR_DOWN, 100000));
+
+  /* an empty bucket anywhere in the honored chain clamps to (almost) zero */
+  tr_bandwidthHonorParentLimits (&child, TR_UP, true);
+  tr_bandwidthUsed (&child, TR_UP, 1000000, true, tr_time_msec ());
+  check (tr_bandwidthClamp (&child, TR_UP, 100000) < 100);
+
+  tr_bandwidthDestruct (&child);
+  tr_bandwidthDestruct (&parent);
+  return 0;
+}
+
+/***
+****
+***/
+
+#define PEER_COUNT 3
+#define QUEUED_BYTES 20000u
+#define SHARED_SPEED_Bps 30000u
+
+struct share_test
+{
+  tr_session * session;
+  bool isLimited;
+  bool done;
+  bool ok;
+  size_t sent[PEER_COUNT];
+
+  /* peers with data queued that nothing will come back to */
+  int strandedCount;
+};
+
+static tr_socket_t
+openListener (tr_port * setme_port)
+{
+  struct sockaddr_in sin;
+  socklen_t len = sizeof (sin);
+  tr_socket_t fd = socket (AF_INET, SOCK_STREAM, 0);
+
+  memset (&sin, 0, sizeof (sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+  if ((fd != TR_BAD_SOCKET)
+      && ((bind (fd, (struct sockaddr*) &sin, sizeof (sin)) == -1)
+          || (listen (fd, PEER_COUNT) == -1)
+          || (getsockname (fd, (struct sockaddr*) &sin, &len) == -1)))
+    {
+      evutil_closesocket (fd);
+      fd = TR_BAD_SOCKET;
+    }
+
+  *setme_port = sin.sin_port;
+  return fd;
+}
+
+static tr_socket_t
+openClient (tr_port port)
+{
+  struct sockaddr_in sin;
+  tr_socket_t fd = socket (AF_INET, SOCK_STREAM, 0);
+
+  memset (&sin, 0, sizeof (sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  sin.sin_port = port;
+
+  if ((fd != TR_BAD_SOCKET) && (connect (fd, (struct sockaddr*) &sin, sizeof (sin)) == -1))
+    {
+      evutil_closesocket (fd);
+      fd = TR_BAD_SOCKET;
+    }
+
+  return fd;
+}
+
+/* queue piece data on a few connected peer-ios under a common bandwidth,
+ * then see how one bandwidth pulse shares it out */
+static void
+shareInEventThread (void * vdata)
+{
+  int i;
+  tr_port port;
+  tr_socket_t listener;
+  tr_bandwidth root;
+  tr_peerIo * ios[PEER_COUNT];
+  tr_socket_t clients[PEER_COUNT];
+  uint8_t payload[QUEUED_BYTES];
+  struct share_test * data = vdata;
+
+  memset (payload, 0, sizeof (payload));
+  memset (&root, 0, sizeof (root));
+  tr_bandwidthConstruct (&root, data->session, NULL);
+  tr_bandwidthSetLimited (&root, TR_UP, data->isLimited);
+  tr_bandwidthSetDesiredSpeed_Bps (&root, TR_UP, SHARED_SPEED_Bps);
+
+  data->ok = (listener = openListener (&port)) != TR_BAD_SOCKET;
+
+  for (i=0; i<PEER_COUNT; ++i)
+    {
+      tr_address addr;
+      tr_port peerPort;
+      tr_socket_t fd = TR_BAD_SOCKET;
+
+      ios[i] = NULL;
+      clients[i] = data->ok ? openClient (port) : TR_BAD_SOCKET;
+
+      if (clients[i] != TR_BAD_SOCKET)
+        fd = tr_fdSocketAccept (data->session, listener, &addr, &peerPort);
+
+      if (fd != TR_BAD_SOCKET)
+        {
+          ios[i] = tr_peerIoNewIncoming (data->session, &root, &addr, peerPort, fd, NULL);
+          tr_peerIoWriteBytes (ios[i], payload, sizeof (payload), true);
+        }
+
+      data->ok = ios[i] != NULL;
+    }
+
+  if (data->ok)
+    {
+      tr_bandwidthAllocate (&root, TR_UP);
+
+      for (i=0; i<PEER_COUNT; ++i)
+        {
+          tr_peerIo * io = ios[i];
+          data->sent[i] = QUEUED_BYTES - evbuffer_get_length (io->outbuf);
+          if ((evbuffer_get_length (io->outbuf) > 0)
+              && !io->bandwidth.band[TR_UP].isActive
+              && !(io->pendingEvents & EV_WRITE))
+            ++data->strandedCount;
+        }
+    }
+
+  for (i=0; i<PEER_COUNT; ++i)
+    {
+      if (ios[i] != NULL)
+        tr_peerIoUnref (ios[i]);
+      if (clients[i] != TR_BAD_SOCKET)
+        evutil_closesocket (clients[i]);
+    }
+  if (listener != TR_BAD_SOCKET)
+    evutil_closesocket (listener);
+  tr_bandwidthDestruct (&root);
+
+  data->done = true;
+}
+
+static int
+runShareTest (tr_session * session, bool isLimited, struct share_test * data)
+{
+  memset (data, 0, sizeof (struct share_test));
+  data->session = session;
+  data->isLimited = isLimited;
+
+  tr_runInEventThread (session, shareInEventThread, data);
+  while (!data->done)
+    tr_wait_msec (10);
+
+  check (data->ok);
+  return 0;
+}
+
+static int
+test_share (void)
+{
+  int i;
+  size_t total;
+  struct share_test data;
+  tr_session * session = libttest_session_init (NULL);
+
+  /* when nothing's limited, every peer sends everything it has queued */
+  if (runShareTest (session, false, &data))
+    return 1;
+  for (i=0; i<PEER_COUNT; ++i)
+    check_uint_eq (QUEUED_BYTES, data.sent[i]);
+  check_int_eq (0, data.strandedCount);
+
+  /* when they share a limit, no peer is starved, the bucket isn't
+   * overspent, and each is left waiting to send the rest */
+  if (runShareTest (session, true, &data))
+    return 1;
+  for (i=0, total=0; i<PEER_COUNT; ++i)
+    {
+      check (data.sent[i] > 0);
+      check (data.sent[i] < QUEUED_BYTES);
+      total += data.sent[i];
+    }
+  check (total >= SHARED_SPEED_Bps * BURST_MSEC / 1000);
+  check (total <= SHARED_SPEED_Bps * BURST_MSEC / 1000 + 1000);
+  check_int_eq (0, data.strandedCount);
+
+  libttest_session_close (session);
+  return 0;
+}
+
+/***
+****
+***/
+
+int
+main (void)
+{
+  const testFunc tests[] = { test_refill,
+                             test_clamp,
+                             test_share };
+
+  return runTests (tests, NUM_TESTS (tests));
+}
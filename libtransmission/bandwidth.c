@@ -10,9 +10,12 @@
 #include <assert.h>
 #include <string.h> /* memset () */
 
+#ifdef DEBUG_DIRECTION
+ #include <stdio.h> /* fprintf () */
+#endif
+
 #include "transmission.h"
 #include "bandwidth.h"
-#include "crypto-utils.h" /* tr_rand_int_weak () */
 #include "log.h"
 #include "peer-io.h"
 #include "utils.h"
@@ -30,56 +33,12 @@
 ***/
 
 static unsigned int
-getSpeed_Bps (const struct bratecontrol * r, unsigned int interval_msec, uint64_t now)
+getSpeed_Bps (const tr_recentHistory * r, uint64_t now)
 {
   if (!now)
     now = tr_time_msec ();
 
-  if (now != r->cache_time)
-    {
-      int i = r->newest;
-      uint64_t bytes = 0;
-      const uint64_t cutoff = now - interval_msec;
-      struct bratecontrol * rvolatile = (struct bratecontrol*) r;
-
-      for (;;)
-        {
-          if (r->transfers[i].date <= cutoff)
-            break;
-
-          bytes += r->transfers[i].size;
-
-          if (--i == -1)
-            i = HISTORY_SIZE - 1; /* circular history */
-
-          if (i == r->newest)
-            break; /* we've come all the way around */
-        }
-
-      rvolatile->cache_val = (unsigned int)((bytes * 1000u) / interval_msec);
-      rvolatile->cache_time = now;
-    }
-
-  return r->cache_val;
-}
-
-static void
-bytesUsed (const uint64_t now, struct bratecontrol * r, size_t size)
-{
-  if (r->transfers[r->newest].date + GRANULARITY_MSEC >= now)
-    {
-      r->transfers[r->newest].size += size;
-    }
-  else
-    {
-      if (++r->newest == HISTORY_SIZE)
-        r->newest = 0;
-      r->transfers[r->newest].date = now;
-      r->transfers[r->newest].size = size;
-    }
-
-  /* invalidate cache_val*/
-  r->cache_time = 0;
+  return (unsigned int)((tr_historyGet (r, now) * 1000u) / HISTORY_MSEC);
 }
 
 /******
@@ -106,10 +65,16 @@ tr_bandwidthConstruct (tr_bandwidth * b, tr_session * session, tr_bandwidth * pa
 
   b->session = session;
   b->children = TR_PTR_ARRAY_INIT;
+  b->active[TR_UP] = TR_PTR_ARRAY_INIT;
+  b->active[TR_DOWN] = TR_PTR_ARRAY_INIT;
   b->magicNumber = BANDWIDTH_MAGIC_NUMBER;
   b->uniqueKey = uniqueKey++;
   b->band[TR_UP].honorParentLimits = true;
   b->band[TR_DOWN].honorParentLimits = true;
+  tr_historyConstruct (&b->band[TR_UP].raw, HISTORY_MSEC);
+  tr_historyConstruct (&b->band[TR_UP].piece, HISTORY_MSEC);
+  tr_historyConstruct (&b->band[TR_DOWN].raw, HISTORY_MSEC);
+  tr_historyConstruct (&b->band[TR_DOWN].piece, HISTORY_MSEC);
   tr_bandwidthSetParent (b, parent);
 }
 
@@ -120,6 +85,8 @@ tr_bandwidthDestruct (tr_bandwidth * b)
 
   tr_bandwidthSetParent (b, NULL);
   tr_ptrArrayDestruct (&b->children, NULL);
+  tr_ptrArrayDestruct (&b->active[TR_UP], NULL);
+  tr_ptrArrayDestruct (&b->active[TR_DOWN], NULL);
 
   memset (b, ~0, sizeof (tr_bandwidth));
 }
@@ -128,13 +95,106 @@ tr_bandwidthDestruct (tr_bandwidth * b)
 ****
 ***/
 
+static tr_bandwidth *
+getRoot (tr_bandwidth * b)
+{
+  while (b->parent != NULL)
+    b = b->parent;
+
+  return b;
+}
+
+static void
+activeAdd (tr_bandwidth * root, tr_bandwidth * b, tr_direction dir)
+{
+  b->band[dir].activeIndex = tr_ptrArrayAppend (&root->active[dir], b);
+}
+
+static void
+activeRemove (tr_bandwidth * root, tr_bandwidth * b, tr_direction dir)
+{
+  tr_bandwidth ** active = (tr_bandwidth**) tr_ptrArrayBase (&root->active[dir]);
+  const int last = tr_ptrArraySize (&root->active[dir]) - 1;
+  const int pos = b->band[dir].activeIndex;
+
+  assert (0 <= pos && pos <= last);
+  assert (active[pos] == b);
+
+  /* swap the last item into b's slot so that removal is O(1) */
+  active[pos] = active[last];
+  active[pos]->band[dir].activeIndex = pos;
+  tr_ptrArrayPop (&root->active[dir]);
+}
+
+/* move the active entries of b's subtree from one top-level bandwidth to another */
+static void
+activeMove (tr_bandwidth * b, tr_bandwidth * from, tr_bandwidth * to)
+{
+  int i, n;
+  tr_direction dir;
+  tr_bandwidth ** children;
+
+  for (dir=TR_UP; dir<=TR_DOWN; ++dir)
+    {
+      if (b->band[dir].isActive)
+        {
+          if (from != NULL && from != b)
+            activeRemove (from, b, dir);
+          if (to != NULL && to != b)
+            activeAdd (to, b, dir);
+        }
+    }
+
+  children = (tr_bandwidth**) tr_ptrArrayBase (&b->children);
+  n = tr_ptrArraySize (&b->children);
+  for (i=0; i<n; ++i)
+    activeMove (children[i], from, to);
+}
+
+void
+tr_bandwidthSetActive (tr_bandwidth * b, tr_direction dir, bool isActive)
+{
+  struct tr_band * band;
+
+  assert (tr_isBandwidth (b));
+  assert (tr_isDirection (dir));
+
+  band = &b->band[dir];
+
+  if (band->isActive != isActive)
+    {
+      band->isActive = isActive;
+
+      if (b->parent != NULL)
+        {
+          if (isActive)
+            activeAdd (getRoot (b), b, dir);
+          else
+            activeRemove (getRoot (b), b, dir);
+        }
+    }
+}
+
+/***
+****
+***/
+
 void
 tr_bandwidthSetParent (tr_bandwidth  * b,
                        tr_bandwidth  * parent)
 {
+  tr_bandwidth * oldRoot;
+  tr_bandwidth * newRoot;
+
   assert (tr_isBandwidth (b));
   assert (b != parent);
 
+  oldRoot = getRoot (b);
+  newRoot = parent != NULL ? getRoot (parent) : b;
+
+  if (oldRoot != newRoot)
+    activeMove (b, oldRoot, NULL);
+
   if (b->parent)
     {
       assert (tr_isBandwidth (b->parent));
@@ -152,47 +212,46 @@ tr_bandwidthSetParent (tr_bandwidth  * b,
       assert (tr_ptrArrayFindSorted (&parent->children, b, compareBandwidth) == b);
       b->parent = parent;
     }
+
+  if (oldRoot != newRoot)
+    activeMove (b, NULL, newRoot);
 }
 
 /***
 ****
 ***/
 
-static void
-allocateBandwidth (tr_bandwidth  * b,
-                   tr_priority_t   parent_priority,
-                   tr_direction    dir,
-                   unsigned int    period_msec,
-                   tr_ptrArray   * peer_pool)
+static tr_priority_t
+getPriority (const tr_bandwidth * b)
 {
-  const tr_priority_t priority = MAX (parent_priority, b->priority);
+  tr_priority_t priority = TR_PRI_LOW;
 
-  assert (tr_isBandwidth (b));
-  assert (tr_isDirection (dir));
+  for (; b != NULL; b = b->parent)
+    priority = MAX (priority, b->priority);
 
-  /* set the available bandwidth */
-  if (b->band[dir].isLimited)
-    {
-      const uint64_t nextPulseSpeed = b->band[dir].desiredSpeed_Bps;
-      b->band[dir].bytesLeft = nextPulseSpeed * period_msec / 1000u;
-    }
+  return priority;
+}
 
-  /* add this bandwidth's peer, if any, to the peer pool */
-  if (b->peer != NULL)
-    {
-      b->peer->priority = priority;
-      tr_ptrArrayAppend (peer_pool, b->peer);
-    }
+/* value of 3000 bytes chosen so that when using uTP we'll send a full-size
+ * frame right away and leave enough buffered data for the next frame to go
+ * out in a timely manner. */
+#define MIN_QUANTUM 3000u
 
-  /* traverse & repeat for the subtree */
-  if (1)
-    {
-      int i;
-      struct tr_bandwidth ** children = (struct tr_bandwidth**) tr_ptrArrayBase (&b->children);
-      const int n = tr_ptrArraySize (&b->children);
-      for (i=0; i<n; ++i)
-        allocateBandwidth (children[i], priority, dir, period_msec, peer_pool);
-    }
+/* the most we'll hand a single peer in one pass. Also the largest input
+ * buffer we allow to build up, so this mirrors event_read_cb ()'s ceiling */
+#define MAX_QUANTUM (256u * 1024u)
+
+static size_t
+getQuantum (tr_peerIo * io, tr_direction dir, int peerCount)
+{
+  const unsigned int available = tr_bandwidthClamp (&io->bandwidth, dir, MAX_QUANTUM);
+
+  /* nothing is throttling this peer, so let it move as much as it can */
+  if (available == MAX_QUANTUM)
+    return MAX_QUANTUM;
+
+  /* otherwise give it a fair share of what's left */
+  return MAX (MIN_QUANTUM, available / (unsigned int)peerCount);
 }
 
 static void
@@ -204,38 +263,40 @@ phaseOne (tr_ptrArray * peerArray, tr_direction dir)
 
   /* First phase of IO. Tries to distribute bandwidth fairly to keep faster
    * peers from starving the others. Loop through the peers, giving each a
-   * small chunk of bandwidth. Keep looping until we run out of bandwidth
-   * and/or peers that can use it */
+   * fair share of the remaining bandwidth. Keep looping until we run out of
+   * bandwidth and/or peers that can use it */
   n = peerCount;
   dbgmsg ("%d peers to go round-robin for %s", n, (dir==TR_UP?"upload":"download"));
   while (n > 0)
     {
-      const int i = tr_rand_int_weak (n); /* pick a peer at random */
+      int i = 0;
 
-      /* value of 3000 bytes chosen so that when using uTP we'll send a full-size
-       * frame right away and leave enough buffered data for the next frame to go
-       * out in a timely manner. */
-      const size_t increment = 3000;
-
-      const int bytesUsed = tr_peerIoFlush (peers[i], dir, increment);
+      while (i < n)
+        {
+          const size_t quantum = getQuantum (peers[i], dir, n);
+          const int bytesUsed = tr_peerIoFlush (peers[i], dir, quantum);
 
-      dbgmsg ("peer #%d of %d used %d bytes in this pass", i, n, bytesUsed);
+          dbgmsg ("peer #%d of %d used %d of %zu bytes in this pass", i, n, bytesUsed, quantum);
 
-      if (bytesUsed != (int)increment)
-        {
-          /* peer is done writing for now; move it to the end of the list */
-          tr_peerIo * pio = peers[i];
-          peers[i] = peers[n-1];
-          peers[n-1] = pio;
-          --n;
+          if (bytesUsed != (int)quantum)
+            {
+              /* peer is done for now; move it to the end of the list */
+              tr_peerIo * pio = peers[i];
+              peers[i] = peers[n-1];
+              peers[n-1] = pio;
+              --n;
+            }
+          else
+            {
+              ++i;
+            }
         }
     }
 }
 
 void
 tr_bandwidthAllocate (tr_bandwidth  * b,
-                      tr_direction    dir,
-                      unsigned int    period_msec)
+                      tr_direction    dir)
 {
   int i, peerCount;
   tr_ptrArray tmp = TR_PTR_ARRAY_INIT;
@@ -244,10 +305,18 @@ tr_bandwidthAllocate (tr_bandwidth  * b,
   tr_ptrArray normal = TR_PTR_ARRAY_INIT;
   struct tr_peerIo ** peers;
 
-  /* allocateBandwidth () is a helper function with two purposes:
-   * 1. allocate bandwidth to b and its subtree
-   * 2. accumulate an array of all the peerIos from b and its subtree. */
-  allocateBandwidth (b, TR_PRI_LOW, dir, period_msec, &tmp);
+  assert (tr_isBandwidth (b));
+  assert (tr_isDirection (dir));
+  assert (b->parent == NULL);
+
+  /* snapshot the active peers, since flushing them changes the list */
+  peerCount = tr_ptrArraySize (&b->active[dir]);
+  for (i=0; i<peerCount; ++i)
+    {
+      tr_bandwidth * child = tr_ptrArrayNth (&b->active[dir], i);
+      if (child->peer != NULL)
+        tr_ptrArrayAppend (&tmp, child->peer);
+    }
   peers = (struct tr_peerIo**) tr_ptrArrayBase (&tmp);
   peerCount = tr_ptrArraySize (&tmp);
 
@@ -256,7 +325,16 @@ tr_bandwidthAllocate (tr_bandwidth  * b,
       tr_peerIo * io = peers[i];
       tr_peerIoRef (io);
 
-      tr_peerIoFlushOutgoingProtocolMsgs (io);
+      io->priority = getPriority (&io->bandwidth);
+
+      /* cork the uploaders for the rest of this pass, so that their
+       * protocol messages and piece data go out in full-sized segments
+       * instead of one small packet per write */
+      if (dir == TR_UP)
+        {
+          tr_peerIoSetCorked (io, true);
+          tr_peerIoFlushOutgoingProtocolMsgs (io);
+        }
 
       switch (io->priority)
         {
@@ -267,17 +345,19 @@ tr_bandwidthAllocate (tr_bandwidth  * b,
     }
 
   /* First phase of IO. Tries to distribute bandwidth fairly to keep faster
-   * peers from starving the others. Loop through the peers, giving each a
-   * small chunk of bandwidth. Keep looping until we run out of bandwidth
-   * and/or peers that can use it */
+   * peers from starving the others. */
   phaseOne (&high, dir);
   phaseOne (&normal, dir);
   phaseOne (&low, dir);
 
+  if (dir == TR_UP)
+    for (i=0; i<peerCount; ++i)
+      tr_peerIoSetCorked (peers[i], false);
+
   /* Second phase of IO. To help us scale in high bandwidth situations,
    * enable on-demand IO for peers with bandwidth left to burn.
-   * This on-demand IO is enabled until (1) the peer runs out of bandwidth,
-   * or (2) the next tr_bandwidthAllocate () call, when we start over again. */
+   * This on-demand IO is enabled until the peer runs out of bandwidth,
+   * at which point it puts itself back on the active list. */
   for (i=0; i<peerCount; ++i)
     tr_peerIoSetEnabled (peers[i], dir, tr_peerIoHasBandwidthLeft (peers[i], dir));
 
@@ -304,9 +384,50 @@ tr_bandwidthSetPeer (tr_bandwidth * b, tr_peerIo * peer)
 ****
 ***/
 
+/* top up a limited band's token bucket with what it's earned since the last refill */
+static void
+refillBand (struct tr_band * band, uint64_t now)
+{
+  if (band->isLimited)
+    {
+      const uint64_t capacity = (uint64_t)band->desiredSpeed_Bps * BURST_MSEC / 1000u;
+      const uint64_t earned = now > band->bytesLeftDate
+                            ? (uint64_t)band->desiredSpeed_Bps * (now - band->bytesLeftDate) / 1000u
+                            : 0;
+
+      /* only advance the clock when we credit something, so slow limits
+       * don't lose their fractional bytes to rounding */
+      if (earned > 0)
+        {
+          band->bytesLeft = (unsigned int) MIN (capacity, band->bytesLeft + earned);
+          band->bytesLeftDate = now;
+        }
+      else if (band->bytesLeft > capacity)
+        {
+          band->bytesLeft = (unsigned int) capacity;
+        }
+    }
+}
+
+/* top up every limited band that would clamp `b' in direction `dir' */
+static void
+bandwidthRefill (tr_bandwidth  * b,
+                 uint64_t        now,
+                 tr_direction    dir)
+{
+  for (;;)
+    {
+      refillBand (&b->band[dir], now);
+
+      if (!b->parent || !b->band[dir].honorParentLimits)
+        break;
+
+      b = b->parent;
+    }
+}
+
 static unsigned int
 bandwidthClamp (const tr_bandwidth  * b,
-                uint64_t              now,
                 tr_direction          dir,
                 unsigned int          byteCount)
 {
@@ -316,43 +437,26 @@ bandwidthClamp (const tr_bandwidth  * b,
   if (b)
     {
       if (b->band[dir].isLimited)
-        {
-          byteCount = MIN (byteCount, b->band[dir].bytesLeft);
-
-          /* if we're getting close to exceeding the speed limit,
-           * clamp down harder on the bytes available */
-          if (byteCount > 0)
-            {
-              double current;
-              double desired;
-              double r;
-
-              if (now == 0)
-                now = tr_time_msec ();
-
-              current = tr_bandwidthGetRawSpeed_Bps (b, now, TR_DOWN);
-              desired = tr_bandwidthGetDesiredSpeed_Bps (b, TR_DOWN);
-              r = desired >= 1 ? current / desired : 0;
-
-                   if (r > 1.0) byteCount = 0;
-              else if (r > 0.9) byteCount *= 0.8;
-              else if (r > 0.8) byteCount *= 0.9;
-            }
-        }
+        byteCount = MIN (byteCount, b->band[dir].bytesLeft);
 
       if (b->parent && b->band[dir].honorParentLimits && (byteCount > 0))
-        byteCount = bandwidthClamp (b->parent, now, dir, byteCount);
+        byteCount = bandwidthClamp (b->parent, dir, byteCount);
     }
 
   return byteCount;
 }
 
 unsigned int
-tr_bandwidthClamp (const tr_bandwidth  * b,
-                   tr_direction          dir,
-                   unsigned int          byteCount)
+tr_bandwidthClamp (tr_bandwidth  * b,
+                   tr_direction    dir,
+                   unsigned int    byteCount)
 {
-  return bandwidthClamp (b, 0, dir, byteCount);
+  assert (tr_isBandwidth (b));
+  assert (tr_isDirection (dir));
+
+  bandwidthRefill (b, tr_time_msec (), dir);
+
+  return bandwidthClamp (b, dir, byteCount);
 }
 
 
@@ -362,7 +466,7 @@ tr_bandwidthGetRawSpeed_Bps (const tr_bandwidth * b, const uint64_t now, const t
   assert (tr_isBandwidth (b));
   assert (tr_isDirection (dir));
 
-  return getSpeed_Bps (&b->band[dir].raw, HISTORY_MSEC, now);
+  return getSpeed_Bps (&b->band[dir].raw, now);
 }
 
 unsigned int
@@ -371,7 +475,7 @@ tr_bandwidthGetPieceSpeed_Bps (const tr_bandwidth * b, const uint64_t now, const
   assert (tr_isBandwidth (b));
   assert (tr_isDirection (dir));
 
-  return getSpeed_Bps (&b->band[dir].piece, HISTORY_MSEC, now);
+  return getSpeed_Bps (&b->band[dir].piece, now);
 }
 
 void
@@ -382,25 +486,35 @@ tr_bandwidthUsed (tr_bandwidth  * b,
                   uint64_t        now)
 {
   struct tr_band * band;
+#ifdef DEBUG_DIRECTION
+  unsigned int oldBytesLeft;
+#endif
 
   assert (tr_isBandwidth (b));
   assert (tr_isDirection (dir));
 
   band = &b->band[dir];
 
+  if (band->isLimited && isPieceData)
+    refillBand (band, now);
+
+#ifdef DEBUG_DIRECTION
+  oldBytesLeft = band->bytesLeft;
+#endif
+
   if (band->isLimited && isPieceData)
     band->bytesLeft -= MIN (band->bytesLeft, byteCount);
 
 #ifdef DEBUG_DIRECTION
 if ((dir == DEBUG_DIRECTION) && (band->isLimited))
-fprintf (stderr, "%p consumed %5zu bytes of %5s data... was %6zu, now %6zu left\n",
-         b, byteCount, (isPieceData?"piece":"raw"), oldBytesLeft, band->bytesLeft);
+fprintf (stderr, "%p consumed %5zu bytes of %5s data... was %6u, now %6u left\n",
+         (void*)b, byteCount, (isPieceData?"piece":"raw"), oldBytesLeft, band->bytesLeft);
 #endif
 
-  bytesUsed (now, &band->raw, byteCount);
+  tr_historyAdd (&band->raw, now, byteCount);
 
   if (isPieceData)
-    bytesUsed (now, &band->piece, byteCount);
+    tr_historyAdd (&band->piece, now, byteCount);
 
   if (b->parent != NULL)
     tr_bandwidthUsed (b->parent, dir, byteCount, isPieceData, now);
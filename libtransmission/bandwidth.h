@@ -16,6 +16,7 @@
 #include <assert.h>
 
 #include "transmission.h"
+#include "history.h"
 #include "ptrarray.h"
 #include "utils.h" /* tr_new (), tr_free () */
 
@@ -31,32 +32,23 @@ struct tr_peerIo;
 enum
 {
   HISTORY_MSEC = 2000u,
-  INTERVAL_MSEC = HISTORY_MSEC,
-  GRANULARITY_MSEC = 200,
-  HISTORY_SIZE = (INTERVAL_MSEC / GRANULARITY_MSEC),
+  BURST_MSEC = 500u,
   BANDWIDTH_MAGIC_NUMBER = 43143
 };
 
-/* these are PRIVATE IMPLEMENTATION details that should not be touched.
- * it's included in the header for inlining and composition. */
-struct bratecontrol
-{
-  int newest;
-  struct { uint64_t date, size; } transfers[HISTORY_SIZE];
-  uint64_t cache_time;
-  unsigned int cache_val;
-};
-
 /* these are PRIVATE IMPLEMENTATION details that should not be touched.
  * it's included in the header for inlining and composition. */
 struct tr_band
 {
   bool isLimited;
   bool honorParentLimits;
+  bool isActive;
+  int activeIndex;
   unsigned int bytesLeft;
+  uint64_t bytesLeftDate;
   unsigned int desiredSpeed_Bps;
-  struct bratecontrol raw;
-  struct bratecontrol piece;
+  tr_recentHistory raw;
+  tr_recentHistory piece;
 };
 
 /**
@@ -86,17 +78,27 @@ struct tr_band
  *
  * CONSTRAINING
  *
- *   Call tr_bandwidthAllocate () periodically. tr_bandwidth knows its current
- *   speed and will decide how many bytes to make available over the
- *   user-specified period to reach the user-specified desired speed.
- *   If appropriate, it notifies its peer-ios that new bandwidth is available.
- *
- *   tr_bandwidthAllocate () operates on the tr_bandwidth subtree, so usually
- *   you'll only need to invoke it for the top-level tr_session bandwidth.
+ *   Each limited bandwidth is a token bucket. It earns desiredSpeed_Bps
+ *   tokens per second, up to BURST_MSEC's worth, and spends one token per
+ *   byte of piece data. The bucket is topped up lazily whenever somebody
+ *   asks how much can be used, so there's no need to walk the tree to
+ *   hand out bandwidth.
  *
  *   The peer-ios all have a pointer to their associated tr_bandwidth object,
  *   and call tr_bandwidthClamp () before performing I/O to see how much
- *   bandwidth they can safely use.
+ *   bandwidth they can safely use. Any limited bandwidth in the tree can
+ *   act as a group limit (per-torrent, per-group, global...) this way.
+ *
+ * SCHEDULING
+ *
+ *   A peer-io that can't make progress on its own -- it has queued output
+ *   but isn't polling for writability, or it stopped reading because it
+ *   ran out of bandwidth -- marks itself active with tr_bandwidthSetActive ().
+ *   The top-level bandwidth keeps a list of these active peers, and
+ *   tr_bandwidthAllocate () only visits them, so the cost of a pulse
+ *   scales with the number of busy peers rather than with every connection.
+ *   Usually you'll only need to invoke it for the top-level tr_session
+ *   bandwidth.
  */
 typedef struct tr_bandwidth
 {
@@ -110,6 +112,7 @@ typedef struct tr_bandwidth
   unsigned int uniqueKey;
   tr_session * session;
   tr_ptrArray children; /* struct tr_bandwidth */
+  tr_ptrArray active[2]; /* struct tr_bandwidth; only used by the top-level bandwidth */
   struct tr_peerIo * peer;
 }
 tr_bandwidth;
@@ -187,16 +190,25 @@ tr_bandwidthIsLimited (const tr_bandwidth  * bandwidth,
 }
 
 /**
- * @brief allocate the next period_msec's worth of bandwidth for the peer-ios to consume
+ * @brief give the active peer-ios in this tree a chance to use their bandwidth
+ * @see tr_bandwidthSetActive
  */
 void tr_bandwidthAllocate (tr_bandwidth  * bandwidth,
-                           tr_direction    direction,
-                           unsigned int    period_msec);
+                           tr_direction    direction);
+
+/**
+ * @brief mark whether this bandwidth's peer-io is waiting on tr_bandwidthAllocate ()
+ */
+void tr_bandwidthSetActive (tr_bandwidth  * bandwidth,
+                            tr_direction    direction,
+                            bool            isActive);
 
 /**
  * @brief clamps byteCount down to a number that this bandwidth will allow to be consumed
+ *
+ * This first tops up the token buckets of `bandwidth' and the parents it honors.
  */
-unsigned int tr_bandwidthClamp (const tr_bandwidth  * bandwidth,
+unsigned int tr_bandwidthClamp (tr_bandwidth        * bandwidth,
                                 tr_direction          direction,
                                 unsigned int          byteCount);
 
@@ -0,0 +1,291 @@
+/*
+ * This file Copyright (C) 2016 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ * $Id$
+ */
+
+#include <assert.h>
+#include <string.h> /* memset () */
+
+#include "transmission.h"
+#include "bitfield.h"
+#include "completion.h"
+#include "net.h" /* tr_address_from_string () */
+#include "peer-common.h"
+#include "peer-mgr.h"
+#include "session.h" /* tr_sessionCountTorrents () */
+#include "torrent.h"
+#include "trevent.h" /* tr_runInEventThread () */
+
+#include "libtransmission-test.h"
+
+static tr_session * session = NULL;
+
+/***
+****
+***/
+
+static int
+test_incremental_counts (void)
+{
+  tr_torrent * tor;
+  tr_completion * cp;
+  uint64_t haveValid;
+  uint64_t sizeWhenDone;
+  const tr_file_index_t first[] = { 0 };
+
+  tor = libttest_zero_torrent_init (session);
+  libttest_zero_torrent_populate (tor, false);
+  cp = &tor->completion;
+
+  /* these are kept up to date without recounting every piece... */
+  tr_torrentSetFileDLs (tor, first, 1, false);
+  tr_cpPieceAdd (cp, 1);
+  tr_cpPieceRem (cp, 2);
+  check (!cp->sizeWhenDoneIsDirty);
+  check (!cp->haveValidIsDirty);
+
+  /* ...and should match what a recount would say */
+  sizeWhenDone = tr_cpSizeWhenDone (cp);
+  haveValid = tr_cpHaveValid (cp);
+  cp->sizeWhenDoneIsDirty = true;
+  cp->haveValidIsDirty = true;
+  check_uint_eq (sizeWhenDone, tr_cpSizeWhenDone (cp));
+  check_uint_eq (haveValid, tr_cpHaveValid (cp));
+  check_uint_eq (tor->info.totalSize - 2 * tor->info.pieceSize, haveValid);
+
+  tr_torrentSetFileDLs (tor, first, 1, true);
+  tr_cpPieceAdd (cp, 2);
+  check_uint_eq (tor->info.totalSize, tr_cpSizeWhenDone (cp));
+  check_uint_eq (tor->info.totalSize - tor->info.pieceSize, tr_cpHaveValid (cp));
+
+  tr_torrentRemove (tor, false, NULL);
+  return 0;
+}
+
+static void
+testPeerDestruct (tr_peer * peer)
+{
+  tr_peerDestruct (peer);
+}
+
+static bool
+testPeerIsTransferringPieces (const tr_peer * peer UNUSED,
+                              uint64_t        now UNUSED,
+                              tr_direction    direction UNUSED,
+                              unsigned int  * Bps UNUSED)
+{
+  return false;
+}
+
+static const struct tr_peer_virtual_funcs testPeerFuncs =
+{
+  .destruct = testPeerDestruct,
+  .is_transferring_pieces = testPeerIsTransferringPieces
+};
+
+static tr_peer *
+addTestPeer (tr_torrent * tor, const char * address)
+{
+  tr_address addr;
+  tr_peer * peer = tr_new0 (tr_peer, 1);
+
+  tr_peerConstruct (peer, tor);
+  peer->funcs = &testPeerFuncs;
+  tr_address_from_string (&addr, address);
+  tr_peerMgrAddTestPeer (tor, peer, &addr, htons (51413));
+  return peer;
+}
+
+static void
+sendHave (tr_peer * peer, tr_piece_index_t piece)
+{
+  tr_peer_event e = TR_PEER_EVENT_INIT;
+
+  tr_bitfieldAdd (&peer->have, piece);
+  e.eventType = TR_PEER_CLIENT_GOT_HAVE;
+  e.pieceIndex = piece;
+  tr_peerMgrFireTestEvent (peer, &e);
+}
+
+static void
+sendHaveAll (tr_peer * peer)
+{
+  tr_peer_event e = TR_PEER_EVENT_INIT;
+
+  tr_bitfieldSetHasAll (&peer->have);
+  e.eventType = TR_PEER_CLIENT_GOT_HAVE_ALL;
+  tr_peerMgrFireTestEvent (peer, &e);
+}
+
+static void
+sendBitfield (tr_peer * peer, const tr_piece_index_t * pieces, size_t n)
+{
+  size_t i;
+  tr_peer_event e = TR_PEER_EVENT_INIT;
+
+  for (i=0; i<n; ++i)
+    tr_bitfieldAdd (&peer->have, pieces[i]);
+  e.eventType = TR_PEER_CLIENT_GOT_BITFIELD;
+  e.bitfield = &peer->have;
+  tr_peerMgrFireTestEvent (peer, &e);
+}
+
+static void
+sendBlock (const tr_torrent * tor, tr_peer * peer, tr_piece_index_t piece, uint32_t offset)
+{
+  tr_peer_event e = TR_PEER_EVENT_INIT;
+
+  e.eventType = TR_PEER_CLIENT_GOT_BLOCK;
+  e.pieceIndex = piece;
+  e.offset = offset;
+  e.length = tr_torBlockCountBytes (tor, _tr_block (tor, piece, offset));
+  tr_peerMgrFireTestEvent (peer, &e);
+}
+
+#define SWARM_STEPS 10
+
+struct swarm_steps
+{
+  tr_torrent * tor;
+  bool was_clean[SWARM_STEPS];
+  uint64_t running[SWARM_STEPS];
+  uint64_t recount[SWARM_STEPS];
+  uint64_t piece_0_missing;
+  int n;
+  volatile bool done;
+};
+
+static void
+recordStep (struct swarm_steps * steps)
+{
+  const int i = steps->n++;
+
+  assert (i < SWARM_STEPS);
+
+  steps->was_clean[i] = tr_peerMgrRecountDesiredAvailable (steps->tor,
+                                                           &steps->running[i],
+                                                           &steps->recount[i]);
+}
+
+/* block receipt and tr_torrentGotBlock () must happen in the libtransmission
+ * thread, so the peers live and die there, between two of its callbacks */
+static void
+runSwarmSteps (void * vsteps)
+{
+  tr_peer * a;
+  tr_peer * b;
+  tr_peer * c;
+  struct swarm_steps * steps = vsteps;
+  tr_torrent * tor = steps->tor;
+  const tr_piece_index_t b_pieces[] = { 0, 2, 32 };
+
+  a = addTestPeer (tor, "127.0.0.2");
+  b = addTestPeer (tor, "127.0.0.3");
+  c = addTestPeer (tor, "127.0.0.4");
+  recordStep (steps);
+
+  sendHave (a, 1);
+  recordStep (steps);
+
+  sendBitfield (b, b_pieces, sizeof (b_pieces) / sizeof (*b_pieces));
+  recordStep (steps);
+
+  /* a block of a piece that someone has, of one that nobody has,
+   * and one that we already have */
+  sendBlock (tor, b, 2, 0);
+  sendBlock (tor, a, 4, 0);
+  sendBlock (tor, a, 3, 0);
+  recordStep (steps);
+
+  /* piece 0 fails its checksum once its last block arrives */
+  sendBlock (tor, b, 0, 0);
+  recordStep (steps);
+  sendBlock (tor, b, 0, MAX_BLOCK_SIZE);
+  steps->piece_0_missing = tr_torrentMissingBytesInPiece (tor, 0);
+  recordStep (steps);
+
+  tr_peerMgrRemoveTestPeer (b);
+  recordStep (steps);
+
+  sendHaveAll (c);
+  recordStep (steps);
+
+  tr_peerMgrRemoveTestPeer (a);
+  tr_peerMgrRemoveTestPeer (c);
+  recordStep (steps);
+
+  steps->done = true;
+}
+
+static int
+test_desired_available (void)
+{
+  int i;
+  tr_torrent * tor;
+  struct swarm_steps steps;
+  const tr_file_index_t small[] = { 1, 2 };
+
+  while (tr_sessionCountTorrents (session) > 0)
+    tr_wait_msec (10);
+
+  /* piece 0 is missing and corrupt on disk; 1, 2, 4 and 32 are missing,
+   * but nobody wants 32; and 3 is complete */
+  tor = libttest_zero_torrent_init (session);
+  libttest_zero_torrent_populate (tor, false);
+  tr_cpPieceRem (&tor->completion, 1);
+  tr_cpPieceRem (&tor->completion, 2);
+  tr_cpPieceRem (&tor->completion, 4);
+  tr_cpPieceRem (&tor->completion, 32);
+  tr_torrentSetFileDLs (tor, small, 2, false);
+
+  memset (&steps, 0, sizeof (steps));
+  steps.tor = tor;
+  tr_runInEventThread (session, runSwarmSteps, &steps);
+  while (!steps.done)
+    tr_wait_msec (10);
+
+  /* the running total matches a recount after every change... */
+  check_int_eq (9, steps.n);
+  for (i=1; i<steps.n; ++i)
+    {
+      check (steps.was_clean[i]);
+      check_uint_eq (steps.recount[i], steps.running[i]);
+    }
+
+  /* ...and those recounts are right */
+  check_uint_eq (0, steps.recount[0]);
+  check_uint_eq (tor->info.pieceSize, steps.recount[1]);
+  check_uint_eq (3 * tor->info.pieceSize, steps.recount[2]);
+  check_uint_eq (5 * MAX_BLOCK_SIZE, steps.recount[3]);
+  check_uint_eq (4 * MAX_BLOCK_SIZE, steps.recount[4]);
+  check_uint_eq (tor->info.pieceSize, steps.piece_0_missing);
+  check_uint_eq (5 * MAX_BLOCK_SIZE, steps.recount[5]);
+  check_uint_eq (tor->info.pieceSize, steps.recount[6]);
+  check_uint_eq (6 * MAX_BLOCK_SIZE, steps.recount[7]);
+  check_uint_eq (0, steps.recount[8]);
+
+  tr_torrentRemove (tor, false, NULL);
+  return 0;
+}
+
+/***
+****
+***/
+
+int
+main (void)
+{
+  int ret;
+  const testFunc tests[] = { test_incremental_counts,
+                             test_desired_available };
+
+  session = libttest_session_init (NULL);
+  ret = runTests (tests, NUM_TESTS (tests));
+  libttest_session_close (session);
+
+  return ret;
+}
@@ -25,6 +25,7 @@ tr_cpReset (tr_completion * cp)
   cp->sizeWhenDoneIsDirty = true;
   cp->haveValidIsDirty = true;
   tr_bitfieldSetHasNone (&cp->blockBitfield);
+  tr_torrentInvalidateStats (cp->tor, TR_STAT_PROGRESS);
 }
 
 void
@@ -76,17 +77,25 @@ void
 tr_cpPieceRem (tr_completion *  cp, tr_piece_index_t piece)
 {
   tr_block_index_t i, f, l;
+  uint64_t had = 0;
   const tr_torrent * tor = cp->tor;
 
   tr_torGetPieceBlockRange (cp->tor, piece, &f, &l);
 
   for (i=f; i<=l; ++i)
     if (tr_cpBlockIsComplete (cp, i))
-      cp->sizeNow -= tr_torBlockCountBytes (tor, i);
+      had += tr_torBlockCountBytes (tor, i);
+
+  cp->sizeNow -= had;
+
+  /* keep the lazy totals up to date rather than recounting every piece */
+  if (!cp->haveValidIsDirty && (had == tr_torPieceCountBytes (tor, piece)))
+    cp->haveValidLazy -= had;
+  if (!cp->sizeWhenDoneIsDirty && tor->pieceDND[piece])
+    cp->sizeWhenDoneLazy -= had;
 
-  cp->haveValidIsDirty = true;
-  cp->sizeWhenDoneIsDirty = true;
   tr_bitfieldRemRange (&cp->blockBitfield, f, l+1);
+  tr_torrentInvalidateStats (cp->tor, TR_STAT_PROGRESS);
 }
 
 void
@@ -107,13 +116,36 @@ tr_cpBlockAdd (tr_completion * cp, tr_block_index_t block)
   if (!tr_cpBlockIsComplete (cp, block))
     {
       const tr_piece_index_t piece = tr_torBlockPiece (cp->tor, block);
+      const uint32_t n = tr_torBlockCountBytes (tor, block);
 
       tr_bitfieldAdd (&cp->blockBitfield, block);
-      cp->sizeNow += tr_torBlockCountBytes (tor, block);
+      cp->sizeNow += n;
+
+      if (!cp->haveValidIsDirty && tr_cpPieceIsComplete (cp, piece))
+        cp->haveValidLazy += tr_torPieceCountBytes (tor, piece);
+      if (!cp->sizeWhenDoneIsDirty && tor->pieceDND[piece])
+        cp->sizeWhenDoneLazy += n;
+
+      tr_torrentInvalidateStats (cp->tor, TR_STAT_PROGRESS);
+    }
+}
 
-      cp->haveValidIsDirty = true;
-      cp->sizeWhenDoneIsDirty |= tor->info.pieces[piece].dnd;
+void
+tr_cpPieceDNDChanged (tr_completion * cp, tr_piece_index_t piece)
+{
+  /* a wanted piece counts in full towards sizeWhenDone,
+   * and an unwanted one only counts for the parts we have */
+  if (!cp->sizeWhenDoneIsDirty)
+    {
+      const uint64_t missing = tr_cpMissingBytesInPiece (cp, piece);
+
+      if (cp->tor->pieceDND[piece])
+        cp->sizeWhenDoneLazy -= missing;
+      else
+        cp->sizeWhenDoneLazy += missing;
     }
+
+  tr_torrentInvalidateStats (cp->tor, TR_STAT_PROGRESS);
 }
 
 /***
@@ -149,7 +181,7 @@ tr_cpSizeWhenDone (const tr_completion * ccp)
     {
       uint64_t size = 0;
       const tr_torrent * tor = ccp->tor;
-      const tr_info * inf = tr_torrentInfo (tor);
+      const tr_info * inf = &tor->info;
       tr_completion * cp = (tr_completion *) ccp; /* mutable */
 
       if (tr_cpHasAll (ccp))
@@ -165,7 +197,7 @@ tr_cpSizeWhenDone (const tr_completion * ccp)
               uint64_t n = 0;
               const uint64_t pieceSize = tr_torPieceCountBytes (tor, p);
 
-              if (!inf->pieces[p].dnd)
+              if (!tor->pieceDND[p])
                 {
                   n = pieceSize;
                 }
@@ -28,7 +28,8 @@ typedef struct tr_completion
      use tr_cpSizeWhenDone () instead! */
   uint64_t sizeWhenDoneLazy;
 
-  /* whether or not sizeWhenDone needs to be recalculated */
+  /* whether or not sizeWhenDone needs to be recalculated from scratch.
+     otherwise it's kept up to date as blocks and pieces come and go */
   bool sizeWhenDoneIsDirty;
 
   /* number of bytes we'll have when done downloading. [0..info.totalSize]
@@ -36,7 +37,7 @@ typedef struct tr_completion
      use tr_cpHaveValid () instead! */
   uint64_t haveValidLazy;
 
-  /* whether or not haveValidLazy needs to be recalculated */
+  /* whether or not haveValidLazy needs to be recalculated from scratch */
   bool haveValidIsDirty;
 
   /* number of bytes we want or have now. [0..sizeWhenDone] */
@@ -105,6 +106,9 @@ void    tr_cpPieceAdd (tr_completion * cp, tr_piece_index_t i);
 
 void    tr_cpPieceRem (tr_completion * cp, tr_piece_index_t i);
 
+/** @brief call this after changing the piece's entry in tor->pieceDND */
+void    tr_cpPieceDNDChanged (tr_completion * cp, tr_piece_index_t i);
+
 size_t  tr_cpMissingBlocksInPiece (const tr_completion *, tr_piece_index_t);
 
 size_t  tr_cpMissingBytesInPiece (const tr_completion *, tr_piece_index_t);
@@ -134,10 +138,3 @@ tr_cpBlockIsComplete (const tr_completion * cp, tr_block_index_t i)
 bool  tr_cpFileIsComplete (const tr_completion * cp, tr_file_index_t);
 
 void* tr_cpCreatePieceBitfield (const tr_completion * cp, size_t * byte_count);
-
-static inline void
-tr_cpInvalidateDND (tr_completion * cp)
-{
-  cp->sizeWhenDoneIsDirty = true;
-}
-
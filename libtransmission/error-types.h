@@ -24,6 +24,7 @@
 
 #define TR_ERROR_EINVAL ERROR_INVALID_PARAMETER
 #define TR_ERROR_EISDIR ERROR_DIRECTORY_NOT_SUPPORTED
+#define TR_ERROR_ECANCELED ERROR_CANCELLED
 
 #else /* _WIN32 */
 
@@ -34,6 +35,7 @@
 
 #define TR_ERROR_EINVAL EINVAL
 #define TR_ERROR_EISDIR EISDIR
+#define TR_ERROR_ECANCELED ECANCELED
 
 #endif /* _WIN32 */
 
@@ -19,17 +19,28 @@ test1 (void)
 {
     tr_recentHistory h;
 
-    memset (&h, 0, sizeof (tr_recentHistory));
+    tr_historyConstruct (&h, 60);
 
     tr_historyAdd (&h, 10000, 1);
-    check_int_eq (0, (int)tr_historyGet (&h, 12000, 1000));
-    check_int_eq (1, (int)tr_historyGet (&h, 12000, 3000));
-    check_int_eq (1, (int)tr_historyGet (&h, 12000, 5000));
+    check_int_eq (1, (int)tr_historyGet (&h, 10000));
+    check_int_eq (1, (int)tr_historyGet (&h, 10050));
+    check_int_eq (0, (int)tr_historyGet (&h, 10060));
+    check_int_eq (0, (int)tr_historyGet (&h, 12000));
+    tr_historyAdd (&h, 10030, 2);
+    tr_historyAdd (&h, 10031, 3);
+    check_int_eq (6, (int)tr_historyGet (&h, 10031));
+    check_int_eq (5, (int)tr_historyGet (&h, 10065));
+    check_int_eq (0, (int)tr_historyGet (&h, 10090));
+
+    /* adding after a gap drops the stale slices */
+    tr_historyAdd (&h, 10065, 4);
+    check_int_eq (9, (int)tr_historyGet (&h, 10065));
     tr_historyAdd (&h, 20000, 1);
-    check_int_eq (0, (int)tr_historyGet (&h, 22000,  1000));
-    check_int_eq (1, (int)tr_historyGet (&h, 22000,  3000));
-    check_int_eq (2, (int)tr_historyGet (&h, 22000, 15000));
-    check_int_eq (2, (int)tr_historyGet (&h, 22000, 20000));
+    check_int_eq (1, (int)tr_historyGet (&h, 20000));
+
+    /* a clock that goes backwards is counted in the newest slice */
+    tr_historyAdd (&h, 19990, 1);
+    check_int_eq (2, (int)tr_historyGet (&h, 20000));
 
     return 0;
 }
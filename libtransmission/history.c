@@ -12,43 +12,64 @@
 
 #include "transmission.h"
 #include "history.h"
-#include "utils.h"
 
 void
-tr_historyAdd (tr_recentHistory * h, time_t now, unsigned int n)
+tr_historyConstruct (tr_recentHistory * h, unsigned int period)
 {
-  if (h->slices[h->newest].date == now)
-    {
-      h->slices[h->newest].n += n;
-    }
-  else
+  assert (period >= TR_RECENT_HISTORY_SLICES);
+
+  memset (h, 0, sizeof (tr_recentHistory));
+  h->sliceWidth = period / TR_RECENT_HISTORY_SLICES;
+}
+
+void
+tr_historyAdd (tr_recentHistory * h, uint64_t now, unsigned int n)
+{
+  const uint64_t slot = now / h->sliceWidth;
+
+  assert (h->sliceWidth > 0);
+
+  if (slot > h->newestSlot)
     {
-      if (++h->newest == TR_RECENT_HISTORY_PERIOD_SEC)
-        h->newest = 0;
-      h->slices[h->newest].date = now;
-      h->slices[h->newest].n = n;
+      /* drop the slices that have aged out of the window */
+      if (slot - h->newestSlot >= TR_RECENT_HISTORY_SLICES)
+        {
+          memset (h->slices, 0, sizeof (h->slices));
+          h->total = 0;
+        }
+      else while (h->newestSlot < slot)
+        {
+          unsigned int * expired = &h->slices[++h->newestSlot % TR_RECENT_HISTORY_SLICES];
+          h->total -= *expired;
+          *expired = 0;
+        }
+
+      h->newestSlot = slot;
     }
+
+  /* if the clock went backwards, just count it in the newest slice */
+  h->slices[h->newestSlot % TR_RECENT_HISTORY_SLICES] += n;
+  h->total += n;
 }
 
-unsigned int
-tr_historyGet (const tr_recentHistory * h, time_t now, unsigned int sec)
+uint64_t
+tr_historyGet (const tr_recentHistory * h, uint64_t now)
 {
-  unsigned int n = 0;
-  const time_t cutoff = (now?now:tr_time ()) - sec;
-  int i = h->newest;
+  uint64_t n = h->total;
+  const uint64_t slot = now / h->sliceWidth;
 
-  for (;;)
-    {
-      if (h->slices[i].date <= cutoff)
-        break;
+  assert (h->sliceWidth > 0);
 
-      n += h->slices[i].n;
+  if (slot > h->newestSlot)
+    {
+      uint64_t i;
 
-      if (--i == -1)
-        i = TR_RECENT_HISTORY_PERIOD_SEC - 1; /* circular history */
+      if (slot - h->newestSlot >= TR_RECENT_HISTORY_SLICES)
+        return 0;
 
-      if (i == h->newest)
-        break; /* we've come all the way around */
+      /* don't count the slices that would've been dropped by now */
+      for (i=h->newestSlot+1; i<=slot; ++i)
+        n -= h->slices[i % TR_RECENT_HISTORY_SLICES];
     }
 
   return n;
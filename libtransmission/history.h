@@ -15,15 +15,23 @@
 
 /**
  * A generic short-term memory object that remembers how many times
- * something happened over the last N seconds.
+ * something happened over the last period of time.
  *
  * For example, it could count how many are bytes transferred
  * to estimate the speed over the last N seconds.
+ *
+ * The period is split into TR_RECENT_HISTORY_SLICES equal slices and a
+ * running total is kept, so both adding and reading are constant-time.
+ * The oldest slice is dropped as a whole, so the answer covers somewhere
+ * between (SLICES-1)/SLICES of the period and the full period.
+ *
+ * The unit of time is up to the caller -- seconds, msec, whatever --
+ * as long as it's used consistently.
  */
 
 enum
 {
-  TR_RECENT_HISTORY_PERIOD_SEC = 60
+  TR_RECENT_HISTORY_SLICES = 10
 };
 
 
@@ -32,26 +40,29 @@ typedef struct tr_recentHistory
   /* these are PRIVATE IMPLEMENTATION details included for composition only.
    * Don't access these directly! */
 
-  int newest;
-
-  struct {
-    unsigned int n;
-    time_t date;
-  } slices[TR_RECENT_HISTORY_PERIOD_SEC];
+  uint64_t total;
+  uint64_t newestSlot;
+  unsigned int sliceWidth;
+  unsigned int slices[TR_RECENT_HISTORY_SLICES];
 }
 tr_recentHistory;
 
+/**
+ * @brief initialize a recent history object.
+ * @param period how far back the history remembers, such as 60 sec.
+ *               Must be at least TR_RECENT_HISTORY_SLICES.
+ */
+void tr_historyConstruct (tr_recentHistory *, unsigned int period);
+
 /**
  * @brief add a counter to the recent history object.
- * @param when the current time in sec, such as from tr_time ()
+ * @param when the current time, such as from tr_time ()
  * @param n how many items to add to the history's counter
  */
-void tr_historyAdd (tr_recentHistory *, time_t when, unsigned int n);
+void tr_historyAdd (tr_recentHistory *, uint64_t when, unsigned int n);
 
 /**
- * @brief count how many events have occurred in the last N seconds.
- * @param when the current time in sec, such as from tr_time ()
- * @param seconds how many seconds to count back through.
+ * @brief count how many events have occurred in the history's period.
+ * @param when the current time, such as from tr_time ()
  */
-unsigned int tr_historyGet (const tr_recentHistory *, time_t when, unsigned int seconds);
-
+uint64_t tr_historyGet (const tr_recentHistory *, uint64_t when);
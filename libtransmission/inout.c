@@ -211,6 +211,10 @@ readOrWritePiece (tr_torrent       * tor,
   if (pieceIndex >= tor->info.pieceCount)
     return EINVAL;
 
+  /* startup may have skipped looking for the files. see useDataFingerprint () */
+  if (!tr_torrentCheckLocalData (tor))
+    return ENOENT;
+
   tr_ioFindFileLocation (tor, pieceIndex, pieceOffset,
                          &fileIndex, &fileOffset);
 
@@ -313,5 +317,5 @@ tr_ioTestPiece (tr_torrent * tor, tr_piece_index_t piece)
   uint8_t hash[SHA_DIGEST_LENGTH];
 
   return recalculateHash (tor, piece, hash)
-      && memcmp (hash, tor->info.pieces[piece].hash, SHA_DIGEST_LENGTH) == 0;
+      && memcmp (hash, tr_infoPieceHash (&tor->info, piece), SHA_DIGEST_LENGTH) == 0;
 }
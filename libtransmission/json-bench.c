@@ -0,0 +1,88 @@
+/*
+ * This file Copyright (C) 2016 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ * $Id$
+ */
+
+/* Measures how fast tr_variant strings are serialized to JSON,
+ * using torrent-get-like payloads: mostly-ASCII names and paths,
+ * plus some non-ASCII ones that need escaping.
+ *
+ * usage: json-bench [string-count] [iterations] */
+
+#include <stdio.h>
+#include <stdlib.h> /* atoi () */
+
+#include <event2/buffer.h>
+
+#include "transmission.h"
+#include "utils.h"
+#include "variant.h"
+
+#include "libtransmission-test.h"
+
+static const char * samples[] =
+{
+  "ubuntu-14.04.3-desktop-amd64.iso",
+  "Some.Linux.Distribution.2016.DVD/disc1/packages/base/libfoo-1.2.3-x86_64.pkg.tar.xz",
+  "The Collected Works of Somebody (1999-2015) [FLAC]/CD 03/07 - Track Number Seven.flac",
+  "Документы/Отчёт за 2015 год.pdf",
+  "音楽/アルバム/01 - 曲.mp3",
+  "path with \"quotes\" and \\backslashes\\ and a\ttab"
+};
+
+static void
+run (const char * label, tr_variant * top, int iterations)
+{
+  int i;
+  size_t bytes = 0;
+  const uint64_t begin = tr_time_msec ();
+  uint64_t msec;
+
+  for (i=0; i<iterations; ++i)
+    {
+      struct evbuffer * buf = tr_variantToBuf (top, TR_VARIANT_FMT_JSON_LEAN);
+      bytes += evbuffer_get_length (buf);
+      evbuffer_free (buf);
+    }
+
+  msec = tr_time_msec () - begin;
+  if (msec == 0)
+    msec = 1;
+
+  printf ("  %-10s %8.2f ms/iteration, %8.1f MB/s\n",
+          label,
+          (double)msec / iterations,
+          (bytes / (1024.0 * 1024.0)) / (msec / 1000.0));
+}
+
+int
+main (int argc, char ** argv)
+{
+  int i;
+  tr_variant ascii;
+  tr_variant mixed;
+  const int n_samples = sizeof (samples) / sizeof (*samples);
+  const int string_count = argc > 1 ? atoi (argv[1]) : 200000;
+  const int iterations = argc > 2 ? atoi (argv[2]) : 10;
+
+  /* only the ASCII samples that don't need escaping */
+  tr_variantInitList (&ascii, string_count);
+  for (i=0; i<string_count; ++i)
+    tr_variantListAddStr (&ascii, samples[i % 3]);
+
+  tr_variantInitList (&mixed, string_count);
+  for (i=0; i<string_count; ++i)
+    tr_variantListAddStr (&mixed, samples[i % n_samples]);
+
+  printf ("JSON serialization of %d strings, %d iterations\n", string_count, iterations);
+  run ("ascii:", &ascii, iterations);
+  run ("mixed:", &mixed, iterations);
+
+  tr_variantFree (&mixed);
+  tr_variantFree (&ascii);
+  return 0;
+}
@@ -223,6 +223,78 @@ test_unescape (void)
     return 0;
 }
 
+static int
+test_escape (void)
+{
+    size_t i;
+    char * json;
+    const char * str;
+    tr_variant top;
+    const tr_quark key = tr_quark_new ("key", 3);
+
+    /* put the specials at every offset so that they land in
+     * both the word-at-a-time scan and the byte-at-a-time tail */
+    for (i=0; i<17; ++i)
+      {
+        char in[64];
+        char expected[128];
+        memset (in, 'x', i);
+        strcpy (in + i, "a\"b\\c\n\x01\x7f");
+        memset (expected, 'x', i);
+        strcpy (expected + i, "a\\\"b\\\\c\\n\\u0001\\u007f");
+
+        tr_variantInitDict (&top, 1);
+        tr_variantDictAddStr (&top, key, in);
+        json = tr_variantToStr (&top, TR_VARIANT_FMT_JSON_LEAN, NULL);
+        check (strstr (json, expected) != NULL);
+        tr_variantFree (&top);
+        tr_free (json);
+      }
+
+    /* characters outside the BMP are written as surrogate pairs */
+    tr_variantInitDict (&top, 1);
+    tr_variantDictAddStr (&top, key, "smile \xf0\x9f\x98\x80!");
+    json = tr_variantToStr (&top, TR_VARIANT_FMT_JSON_LEAN, NULL);
+    tr_variantFree (&top);
+    check (strstr (json, "smile \\ud83d\\ude00!") != NULL);
+    check_int_eq (0, tr_variantFromJson (&top, json, strlen (json)));
+    check (tr_variantDictFindStr (&top, key, &str, NULL));
+    check_streq ("smile \xf0\x9f\x98\x80!", str);
+    tr_variantFree (&top);
+    tr_free (json);
+
+    return 0;
+}
+
+static int
+test_arena (void)
+{
+    size_t len;
+    tr_variant top;
+    tr_variant * list;
+    const char * str;
+    const char * in = "{ \"escaped\": \"tab\\there \\u00f6 \\\"quoted\\\"\", \"list\": [ \"plain\", \"\", 1.5, null ] }";
+    const tr_quark key_escaped = tr_quark_new ("escaped", TR_BAD_SIZE);
+    const tr_quark key_list = tr_quark_new ("list", TR_BAD_SIZE);
+
+    check_int_eq (0, tr_variantFromBuf (&top, TR_VARIANT_FMT_JSON, in, strlen (in),
+                                        NULL, NULL, TR_VARIANT_PARSE_ARENA));
+    check (tr_variantDictFindStr (&top, key_escaped, &str, &len));
+    check_streq ("tab\there \xc3\xb6 \"quoted\"", str);
+    check_uint_eq (strlen (str), len);
+    check (tr_variantDictFindList (&top, key_list, &list));
+    check_uint_eq (4, tr_variantListSize (list));
+    check (tr_variantGetStr (tr_variantListChild (list, 0), &str, &len));
+    check_streq ("plain", str);
+    check (tr_variantGetStr (tr_variantListChild (list, 1), &str, &len));
+    check_uint_eq (0, len);
+    check_streq ("", str);
+    check (tr_variantIsReal (tr_variantListChild (list, 2)));
+    tr_variantFree (&top);
+
+    return 0;
+}
+
 int
 main (void)
 {
@@ -239,7 +311,9 @@ main (void)
                              test1,
                              test2,
                              test3,
-                             test_unescape };
+                             test_unescape,
+                             test_escape,
+                             test_arena };
 
   /* run the tests in a locale with a decimal point of '.' */
   setlocale (LC_NUMERIC, "C");
@@ -436,6 +436,26 @@ libttest_blockingTorrentVerify (tr_torrent * tor)
     tr_wait_msec (10);
 }
 
+static void
+onRenameDone (tr_torrent * tor UNUSED, const char * oldpath UNUSED, const char * newname UNUSED, int error, void * user_data)
+{
+  *(int*)user_data = error;
+}
+
+int
+libttest_torrentRenameAndWait (tr_torrent * tor, const char * oldpath, const char * newname)
+{
+  int error = -1;
+
+  assert (!tr_amInEventThread (tor->session));
+
+  tr_torrentRenamePath (tor, oldpath, newname, onRenameDone, &error);
+  do {
+    tr_wait_msec (10);
+  } while (error == -1);
+  return error;
+}
+
 static void
 build_parent_dir (const char* path)
 {
@@ -90,6 +90,7 @@ void         libttest_zero_torrent_populate (tr_torrent * tor, bool complete);
 tr_torrent * libttest_zero_torrent_init (tr_session * session);
 
 void         libttest_blockingTorrentVerify (tr_torrent * tor);
+int          libttest_torrentRenameAndWait (tr_torrent * tor, const char * oldpath, const char * newname);
 
 void         libtest_create_file_with_contents (const char * path, const void* contents, size_t n);
 void         libtest_create_tmpfile_with_contents (char* tmpl, const void* payload, size_t n);
@@ -538,9 +538,7 @@ tr_metainfoParseImpl (const tr_session  * session,
         return "pieces";
 
       inf->pieceCount = len / SHA_DIGEST_LENGTH;
-      inf->pieces = tr_new0 (tr_piece, inf->pieceCount);
-      for (i=0; i<inf->pieceCount; i++)
-        memcpy (inf->pieces[i].hash, &raw[i * SHA_DIGEST_LENGTH], SHA_DIGEST_LENGTH);
+      inf->pieceHashes = tr_memdup (raw, len);
     }
 
   /* files */
@@ -603,11 +601,13 @@ tr_metainfoFree (tr_info * inf)
   for (i=0; i<inf->webseedCount; i++)
     tr_free (inf->webseeds[i]);
 
-  for (ff=0; ff<inf->fileCount; ff++)
+  /* files is NULL while an idle torrent's table is paged out */
+  if (inf->files != NULL)
+    for (ff=0; ff<inf->fileCount; ff++)
       tr_free (inf->files[ff].name);
 
   tr_free (inf->webseeds);
-  tr_free (inf->pieces);
+  tr_free ((void*)inf->pieceHashes);
   tr_free (inf->files);
   tr_free (inf->comment);
   tr_free (inf->creator);
@@ -16,6 +16,7 @@
 #include "transmission.h"
 #include "cache.h"
 #include "file.h"
+#include "inout.h" /* tr_ioRead() */
 #include "resume.h"
 #include "trevent.h"
 #include "torrent.h" /* tr_isTorrent() */
@@ -213,11 +214,365 @@ test_set_location (void)
 ****
 ***/
 
+static int
+test_data_fingerprint (void)
+{
+  int err;
+  tr_file_index_t file_index;
+  uint8_t buf[16];
+  char * path;
+  tr_torrent * tor;
+  tr_session * session;
+  tr_data_fingerprint fp;
+  tr_sys_path_info info;
+
+  /* init a complete torrent */
+  session = libttest_session_init (NULL);
+  tor = libttest_zero_torrent_init (session);
+  libttest_zero_torrent_populate (tor, true);
+  check (!tor->localDataUnchecked);
+
+  /* its files have been found, so there's a fingerprint to save */
+  check (tr_torrentGetDataFingerprint (tor, &fp));
+  check_streq (tor->downloadDir, fp.dir);
+  path = tr_buildPath (fp.dir, "files-filled-with-zeroes", NULL);
+  check (tr_sys_path_get_info (path, 0, &info, NULL));
+  check_int_eq (info.last_modified_at, fp.mtime);
+  tr_free (path);
+  tr_free (fp.dir);
+
+  /* save it, close the torrent, and add it again */
+  tr_torrentSaveResume (tor);
+  tr_torrentFree (tor);
+  while (tr_sessionCountTorrents (session) > 0)
+    tr_wait_msec (10);
+  tor = libttest_zero_torrent_init (session);
+
+  /* the fingerprint matched, so the files weren't looked for... */
+  check (tor->localDataUnchecked);
+  check_int_eq (TR_STAT_OK, tor->error);
+  check_streq (tor->downloadDir, tor->currentDir);
+
+  /* ...until the data's first read */
+  libttest_sync ();
+  for (file_index=0; file_index<tor->info.fileCount; ++file_index)
+    {
+      path = tr_torrentFindFile (tor, file_index);
+      check (tr_sys_path_remove (path, NULL));
+      tr_free (path);
+    }
+  tr_sessionLock (session);
+  err = tr_ioRead (tor, 0, 0, sizeof (buf), buf);
+  tr_sessionUnlock (session);
+  check (err != 0);
+  check (!tor->localDataUnchecked);
+  check_int_eq (TR_STAT_LOCAL_ERROR, tor->error);
+
+  /* cleanup */
+  tr_torrentRemove (tor, true, tr_sys_path_remove);
+  libttest_session_close (session);
+  return 0;
+}
+
+/***
+****
+***/
+
+static void
+waitForMove (volatile int * state)
+{
+  const time_t deadline = time (NULL) + 300;
+
+  while ((*state == TR_LOC_MOVING) && (time (NULL) <= deadline))
+    tr_wait_msec (10);
+}
+
+static void
+waitForMoverThreads (tr_session * session)
+{
+  const time_t deadline = time (NULL) + 300;
+
+  while ((tr_locationMoverCountThreads (session) > 0) && (time (NULL) <= deadline))
+    tr_wait_msec (10);
+}
+
+static void
+onEventThreadSynced (void * vdone)
+{
+  *(bool*)vdone = true;
+}
+
+/* waits for the libtransmission thread to run what's been queued for it */
+static void
+syncEventThread (tr_session * session)
+{
+  bool done = false;
+
+  tr_runInEventThread (session, onEventThreadSynced, &done);
+  while (!done)
+    tr_wait_msec (10);
+}
+
+/* starts moving `tor' into `dir' with copying paused,
+ * and waits for its files to be queued */
+static void
+startPausedMove (tr_torrent * tor, const char * dir, volatile int * state, volatile double * progress)
+{
+  tr_locationMoverSetLimits (tor->session, 0, true);
+  tr_torrentSetLocation (tor, dir, true, progress, state);
+
+  while (tor->locationMove == NULL && *state == TR_LOC_MOVING)
+    tr_wait_msec (10);
+}
+
+static bool
+dirHasTorrentFiles (const char * dir)
+{
+  bool ret;
+  char * path = tr_buildPath (dir, "files-filled-with-zeroes", NULL);
+
+  ret = tr_sys_path_exists (path, NULL);
+  tr_free (path);
+  return ret;
+}
+
+static int
+test_copy_location (void)
+{
+  tr_file_index_t file_index;
+  volatile int state;
+  volatile double progress;
+  char * old_dir;
+  char * target_dir;
+  tr_torrent * tor;
+  tr_session * session;
+
+  session = libttest_session_init (NULL);
+  target_dir = tr_buildPath (tr_sessionGetConfigDir (session), "target", NULL);
+  tor = libttest_zero_torrent_init (session);
+  libttest_zero_torrent_populate (tor, true);
+  old_dir = tr_strdup (tor->currentDir);
+
+  /* copy the files, as if the target were on another filesystem */
+  tr_locationMoverSetLimits (session, 2, true);
+  state = -1;
+  progress = 0;
+  tr_torrentSetLocation (tor, target_dir, true, &progress, &state);
+  waitForMove (&state);
+  check_int_eq (TR_LOC_DONE, state);
+  check (progress > 0.999);
+  check (tor->locationMove == NULL);
+  check_streq (target_dir, tor->currentDir);
+
+  /* the copies replaced the old files */
+  libttest_sync ();
+  check (!dirHasTorrentFiles (old_dir));
+  for (file_index=0; file_index<tor->info.fileCount; ++file_index)
+    check_file_location (tor, file_index, tr_buildPath (target_dir, tor->info.files[file_index].name, NULL));
+  libttest_blockingTorrentVerify (tor);
+  check_uint_eq (0, tr_torrentStat (tor)->leftUntilDone);
+
+  /* the threads exit once there's nothing left to copy */
+  waitForMoverThreads (session);
+  check_int_eq (0, tr_locationMoverCountThreads (session));
+
+  /* cleanup */
+  tr_free (target_dir);
+  tr_free (old_dir);
+  tr_torrentRemove (tor, true, tr_sys_path_remove);
+  libttest_session_close (session);
+  return 0;
+}
+
+static int
+test_cancel_copy (void)
+{
+  volatile int state;
+  char * old_dir;
+  char * target_dir;
+  tr_torrent * tor;
+  tr_session * session;
+
+  session = libttest_session_init (NULL);
+  target_dir = tr_buildPath (tr_sessionGetConfigDir (session), "target", NULL);
+  tor = libttest_zero_torrent_init (session);
+  libttest_zero_torrent_populate (tor, true);
+  old_dir = tr_strdup (tor->currentDir);
+
+  /* a cancelled move leaves the torrent where it was... */
+  state = -1;
+  startPausedMove (tor, target_dir, &state, NULL);
+  check (tor->locationMove != NULL);
+  tr_torrentCancelSetLocation (tor);
+  waitForMove (&state);
+  check_int_eq (TR_LOC_ERROR, state);
+  check (tor->locationMove == NULL);
+  check_streq (old_dir, tor->currentDir);
+  check (dirHasTorrentFiles (old_dir));
+  check (!dirHasTorrentFiles (target_dir));
+
+  /* ...and leaves nothing queued for the threads to copy */
+  tr_locationMoverSetLimits (session, 4, true);
+  check_int_eq (0, tr_locationMoverCountThreads (session));
+
+  /* closing the torrent cancels its move */
+  state = -1;
+  startPausedMove (tor, target_dir, &state, NULL);
+  check (tor->locationMove != NULL);
+  tr_torrentFree (tor);
+  while (tr_sessionCountTorrents (session) > 0)
+    tr_wait_msec (10);
+  check_int_eq (TR_LOC_ERROR, state);
+  check (dirHasTorrentFiles (old_dir));
+  check (!dirHasTorrentFiles (target_dir));
+  tr_locationMoverSetLimits (session, 4, true);
+  check_int_eq (0, tr_locationMoverCountThreads (session));
+
+  /* so does deleting its data */
+  tor = libttest_zero_torrent_init (session);
+  state = -1;
+  startPausedMove (tor, target_dir, &state, NULL);
+  check (tor->locationMove != NULL);
+  tr_torrentRemove (tor, true, tr_sys_path_remove);
+  while (tr_sessionCountTorrents (session) > 0)
+    tr_wait_msec (10);
+  check_int_eq (TR_LOC_ERROR, state);
+  check (!dirHasTorrentFiles (old_dir));
+  check (!dirHasTorrentFiles (target_dir));
+  tr_locationMoverSetLimits (session, 4, true);
+  check_int_eq (0, tr_locationMoverCountThreads (session));
+
+  /* cleanup */
+  tr_free (target_dir);
+  tr_free (old_dir);
+  libttest_session_close (session);
+  return 0;
+}
+
+static int
+test_copy_changed_file (void)
+{
+  size_t len;
+  char changed[512];
+  uint8_t * contents;
+  volatile int state;
+  volatile double progress;
+  char * old_path;
+  char * new_path;
+  char * target_dir;
+  tr_torrent * tor;
+  tr_session * session;
+
+  session = libttest_session_init (NULL);
+  target_dir = tr_buildPath (tr_sessionGetConfigDir (session), "target", NULL);
+  tor = libttest_zero_torrent_init (session);
+  libttest_zero_torrent_populate (tor, true);
+  check_uint_eq (sizeof (changed), tor->info.files[2].length);
+  old_path = tr_torrentFindFile (tor, 2);
+  new_path = tr_buildPath (target_dir, tor->info.files[2].name, NULL);
+
+  /* copy the files, but keep the libtransmission thread
+   * from swapping them in until one has changed */
+  state = -1;
+  progress = 0;
+  startPausedMove (tor, target_dir, &state, &progress);
+  tr_sessionLock (session);
+  tr_locationMoverSetLimits (session, 4, true);
+  waitForMoverThreads (session);
+  check (progress > 0.999);
+  check (tr_sys_path_exists (new_path, NULL));
+  memset (changed, 'x', sizeof (changed));
+  libtest_create_file_with_contents (old_path, changed, sizeof (changed));
+  tr_sessionUnlock (session);
+
+  /* the changed file is moved again instead of using its stale copy */
+  waitForMove (&state);
+  check_int_eq (TR_LOC_DONE, state);
+  libttest_sync ();
+  check (!tr_sys_path_exists (old_path, NULL));
+  contents = tr_loadFile (new_path, &len, NULL);
+  check (contents != NULL);
+  check_uint_eq (sizeof (changed), len);
+  check (memcmp (changed, contents, len) == 0);
+
+  /* cleanup */
+  tr_free (contents);
+  tr_free (new_path);
+  tr_free (old_path);
+  tr_free (target_dir);
+  tr_torrentRemove (tor, true, tr_sys_path_remove);
+  libttest_session_close (session);
+  return 0;
+}
+
+static int
+test_stale_copy_done (void)
+{
+  tr_file_index_t file_index;
+  volatile int first_state;
+  volatile int second_state;
+  char * first_dir;
+  char * second_dir;
+  tr_torrent * tor;
+  tr_session * session;
+
+  session = libttest_session_init (NULL);
+  first_dir = tr_buildPath (tr_sessionGetConfigDir (session), "first", NULL);
+  second_dir = tr_buildPath (tr_sessionGetConfigDir (session), "second", NULL);
+  tor = libttest_zero_torrent_init (session);
+  libttest_zero_torrent_populate (tor, true);
+
+  /* queue a second move while the first one's copies are made, so that
+   * the first move's "done" arrives after the second move has started */
+  first_state = second_state = -1;
+  startPausedMove (tor, first_dir, &first_state, NULL);
+  tr_sessionLock (session);
+  tr_torrentSetLocation (tor, second_dir, true, NULL, &second_state);
+  tr_locationMoverSetLimits (session, 4, true);
+  waitForMoverThreads (session);
+  tr_locationMoverSetLimits (session, 0, true);
+  tr_sessionUnlock (session);
+
+  /* the first move was cancelled, and its "done" didn't finish the second... */
+  syncEventThread (session);
+  check_int_eq (TR_LOC_ERROR, first_state);
+  check_int_eq (TR_LOC_MOVING, second_state);
+  check (tor->locationMove != NULL);
+
+  /* ...which finishes once its own files are copied */
+  tr_locationMoverSetLimits (session, 4, true);
+  waitForMove (&second_state);
+  check_int_eq (TR_LOC_DONE, second_state);
+  check_streq (second_dir, tor->currentDir);
+  libttest_sync ();
+  check (!dirHasTorrentFiles (first_dir));
+  for (file_index=0; file_index<tor->info.fileCount; ++file_index)
+    check_file_location (tor, file_index, tr_buildPath (second_dir, tor->info.files[file_index].name, NULL));
+  libttest_blockingTorrentVerify (tor);
+  check_uint_eq (0, tr_torrentStat (tor)->leftUntilDone);
+
+  /* cleanup */
+  tr_free (second_dir);
+  tr_free (first_dir);
+  tr_torrentRemove (tor, true, tr_sys_path_remove);
+  libttest_session_close (session);
+  return 0;
+}
+
+/***
+****
+***/
+
 int
 main (void)
 {
   const testFunc tests[] = { test_incomplete_dir,
-                             test_set_location };
+                             test_set_location,
+                             test_data_fingerprint,
+                             test_copy_location,
+                             test_cancel_copy,
+                             test_copy_changed_file,
+                             test_stale_copy_done };
 
   return runTests (tests, NUM_TESTS (tests));
 }
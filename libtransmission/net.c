@@ -32,7 +32,7 @@
 #ifdef _WIN32
  #include <ws2tcpip.h>
 #else
- #include <netinet/tcp.h>       /* TCP_CONGESTION */
+ #include <netinet/tcp.h>       /* TCP_CONGESTION, TCP_CORK */
 #endif
 
 #include <event2/util.h>
@@ -166,6 +166,26 @@ tr_netSetCongestionControl (tr_socket_t   s,
 #endif
 }
 
+bool
+tr_netSetCorked (tr_socket_t s,
+                 bool        corked)
+{
+#if defined (TCP_CORK) || defined (TCP_NOPUSH)
+  #ifdef TCP_CORK
+    const int opt = TCP_CORK;
+  #else
+    const int opt = TCP_NOPUSH;
+  #endif
+    const int val = corked ? 1 : 0;
+
+    return setsockopt (s, IPPROTO_TCP, opt, (const void *) &val, sizeof (val)) != -1;
+#else
+    (void) s;
+    (void) corked;
+    return false;
+#endif
+}
+
 bool
 tr_address_from_sockaddr_storage (tr_address                     * setme_addr,
                                   tr_port                        * setme_port,
@@ -157,6 +157,13 @@ void tr_netSetTOS (tr_socket_t s,
 void tr_netSetCongestionControl (tr_socket_t   s,
                                  const char  * algorithm);
 
+/**
+ * @brief hold back partial TCP segments (TCP_CORK or TCP_NOPUSH) until uncorked.
+ * @return true if the option was set, false if it's unsupported or failed
+ */
+bool tr_netSetCorked (tr_socket_t s,
+                      bool        corked);
+
 void tr_netClose (tr_session  * session,
                   tr_socket_t   s);
 
@@ -0,0 +1,100 @@
+/*
+ * This file Copyright (C) 2016 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ * $Id$
+ */
+
+/* Compares parsing into heap-allocated tr_variants with parsing
+ * into an arena, using a metainfo-like benc dict with many files
+ * and the same tree as JSON. Each round parses and then frees.
+ *
+ * usage: parse-bench [file-count] [iterations] */
+
+#include <stdio.h>
+#include <stdlib.h> /* atoi () */
+
+#include "transmission.h"
+#include "utils.h"
+#include "variant.h"
+
+#include "libtransmission-test.h"
+
+static void
+run (const char * label, tr_variant_fmt fmt, const char * text, size_t len, int iterations)
+{
+  int i;
+  uint64_t begin;
+  uint64_t heap_msec;
+  uint64_t arena_msec;
+
+  begin = tr_time_msec ();
+  for (i=0; i<iterations; ++i)
+    {
+      tr_variant top;
+      tr_variantFromBuf (&top, fmt, text, len, NULL, NULL, TR_VARIANT_PARSE_DEFAULT);
+      tr_variantFree (&top);
+    }
+  heap_msec = tr_time_msec () - begin;
+
+  begin = tr_time_msec ();
+  for (i=0; i<iterations; ++i)
+    {
+      tr_variant top;
+      tr_variantFromBuf (&top, fmt, text, len, NULL, NULL, TR_VARIANT_PARSE_ARENA);
+      tr_variantFree (&top);
+    }
+  arena_msec = tr_time_msec () - begin;
+
+  printf ("  %-5s %zu bytes: heap %8.2f ms, arena %8.2f ms\n",
+          label, len,
+          (double)heap_msec / iterations,
+          (double)arena_msec / iterations);
+}
+
+int
+main (int argc, char ** argv)
+{
+  int i;
+  size_t len;
+  char * text;
+  tr_variant top;
+  tr_variant * info;
+  tr_variant * files;
+  const int file_count = argc > 1 ? atoi (argv[1]) : 50000;
+  const int iterations = argc > 2 ? atoi (argv[2]) : 10;
+
+  tr_variantInitDict (&top, 3);
+  tr_variantDictAddStr (&top, TR_KEY_announce, "http://tracker.example.com:6969/announce");
+  tr_variantDictAddStr (&top, TR_KEY_comment, "a torrent with lots of files");
+  info = tr_variantDictAddDict (&top, TR_KEY_info, 3);
+  tr_variantDictAddStr (info, TR_KEY_name, "Some.Big.Collection.2016");
+  files = tr_variantDictAddList (info, TR_KEY_files, file_count);
+  for (i=0; i<file_count; ++i)
+    {
+      char buf[64];
+      tr_variant * file = tr_variantListAddDict (files, 2);
+      tr_variant * path = tr_variantDictAddList (file, TR_KEY_path, 3);
+      tr_variantDictAddInt (file, TR_KEY_length, 1048576 + i);
+      tr_snprintf (buf, sizeof (buf), "Disc %02d", i / 1000);
+      tr_variantListAddStr (path, buf);
+      tr_variantListAddStr (path, "Subfolder");
+      tr_snprintf (buf, sizeof (buf), "%06d - Some Track Or Chapter Name.flac", i);
+      tr_variantListAddStr (path, buf);
+    }
+
+  printf ("parse and free a tree with %d files, %d iterations\n", file_count, iterations);
+
+  text = tr_variantToStr (&top, TR_VARIANT_FMT_BENC, &len);
+  run ("benc:", TR_VARIANT_FMT_BENC, text, len, iterations);
+  tr_free (text);
+
+  text = tr_variantToStr (&top, TR_VARIANT_FMT_JSON_LEAN, &len);
+  run ("json:", TR_VARIANT_FMT_JSON, text, len, iterations);
+  tr_free (text);
+
+  tr_variantFree (&top);
+  return 0;
+}
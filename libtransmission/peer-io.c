@@ -261,6 +261,15 @@ event_read_cb (evutil_socket_t fd, short event UNUSED, void * vio)
     assert (tr_isPeerIo (io));
     assert (io->socket != TR_BAD_SOCKET);
 
+    if (io->isEdgeTriggered)
+    {
+        /* the kernel won't tell us again, so remember that it's readable
+         * even if we don't want to read right now */
+        io->readyEvents |= EV_READ;
+        if (! (io->pendingEvents & EV_READ))
+            return;
+    }
+
     io->pendingEvents &= ~EV_READ;
 
     curlen = evbuffer_get_length (io->inbuf);
@@ -281,6 +290,10 @@ event_read_cb (evutil_socket_t fd, short event UNUSED, void * vio)
 
     if (res > 0)
     {
+        /* a short read means we drained the socket */
+        if ((unsigned int)res < howmuch)
+            io->readyEvents &= ~EV_READ;
+
         tr_peerIoSetEnabled (io, dir, true);
 
         /* Invoke the user callback - must always be called last */
@@ -295,6 +308,8 @@ event_read_cb (evutil_socket_t fd, short event UNUSED, void * vio)
             what |= BEV_EVENT_EOF;
         else if (res == -1) {
             if (e == EAGAIN || e == EINTR) {
+                if (e == EAGAIN)
+                    io->readyEvents &= ~EV_READ;
                 tr_peerIoSetEnabled (io, dir, true);
                 return;
             }
@@ -338,6 +353,13 @@ event_write_cb (evutil_socket_t fd, short event UNUSED, void * vio)
     assert (tr_isPeerIo (io));
     assert (io->socket != TR_BAD_SOCKET);
 
+    if (io->isEdgeTriggered)
+    {
+        io->readyEvents |= EV_WRITE;
+        if (! (io->pendingEvents & EV_WRITE))
+            return;
+    }
+
     io->pendingEvents &= ~EV_WRITE;
 
     dbgmsg (io, "libevent says this peer is ready to write");
@@ -357,8 +379,11 @@ event_write_cb (evutil_socket_t fd, short event UNUSED, void * vio)
     e = EVUTIL_SOCKET_ERROR ();
 
     if (res == -1) {
-        if (!e || e == EAGAIN || e == EINTR || e == EINPROGRESS)
+        if (!e || e == EAGAIN || e == EINTR || e == EINPROGRESS) {
+            if (e == EAGAIN)
+                io->readyEvents &= ~EV_WRITE;
             goto reschedule;
+        }
         /* error case */
         what |= BEV_EVENT_ERROR;
     } else if (res == 0) {
@@ -368,6 +393,10 @@ event_write_cb (evutil_socket_t fd, short event UNUSED, void * vio)
     if (res <= 0)
         goto error;
 
+    /* a short write means the socket's send buffer is full */
+    if ((size_t)res < howmuch)
+        io->readyEvents &= ~EV_WRITE;
+
     if (evbuffer_get_length (io->outbuf))
         tr_peerIoSetEnabled (io, dir, true);
 
@@ -448,6 +477,11 @@ utp_get_rb_size (void *closure)
 
     bytes = tr_bandwidthClamp (&io->bandwidth, TR_DOWN, UTP_READ_BUFFER_SIZE);
 
+    /* if we're being throttled, let the bandwidth scheduler tell libutp
+     * when the read buffer has room again */
+    if (bytes < UTP_READ_BUFFER_SIZE)
+        tr_bandwidthSetActive (&io->bandwidth, TR_DOWN, true);
+
     dbgmsg (io, "utp_get_rb_size is saying it's ready to read %zu bytes", bytes);
     return UTP_READ_BUFFER_SIZE - bytes;
 }
@@ -458,11 +492,17 @@ static void
 utp_on_writable (tr_peerIo *io)
 {
     int n;
+    bool clamped;
+    const size_t queued = evbuffer_get_length (io->outbuf);
 
     dbgmsg (io, "libutp says this peer is ready to write");
 
+    clamped = tr_bandwidthClamp (&io->bandwidth, TR_UP, queued) < queued;
     n = tr_peerIoTryWrite (io, SIZE_MAX);
-    tr_peerIoSetEnabled (io, TR_UP, n && evbuffer_get_length (io->outbuf));
+
+    /* if we ran out of bandwidth before data, libutp has no reason to
+     * say it's writable again, so leave it to the bandwidth scheduler */
+    tr_peerIoSetEnabled (io, TR_UP, n && !clamped && evbuffer_get_length (io->outbuf));
 }
 
 static void
@@ -581,6 +621,48 @@ static struct UTPFunctionTable dummy_utp_function_table = {
 
 #endif /* #ifdef WITH_UTP */
 
+/* each of these costs an epoll_ctl () or equivalent syscall */
+
+static void
+poll_add (tr_peerIo * io, struct event * ev)
+{
+    event_add (ev, NULL);
+    ++io->session->peerPollChanges;
+}
+
+static void
+poll_del (tr_peerIo * io, struct event * ev)
+{
+    event_del (ev);
+    ++io->session->peerPollChanges;
+}
+
+static void
+io_create_events (tr_peerIo * io)
+{
+    short flags = 0;
+    tr_session * session = io->session;
+
+    /* if the backend supports it (e.g. epoll), register the socket once,
+     * edge-triggered, and do all the enabling & disabling in userspace */
+    io->isEdgeTriggered = (event_base_get_features (session->event_base) & EV_FEATURE_ET) != 0;
+    io->readyEvents = 0;
+
+    if (io->isEdgeTriggered)
+        flags = EV_PERSIST | EV_ET;
+
+    io->event_read = event_new (session->event_base,
+                                io->socket, EV_READ | flags, event_read_cb, io);
+    io->event_write = event_new (session->event_base,
+                                 io->socket, EV_WRITE | flags, event_write_cb, io);
+
+    if (io->isEdgeTriggered && io->socket != TR_BAD_SOCKET)
+    {
+        poll_add (io, io->event_read);
+        poll_add (io, io->event_write);
+    }
+}
+
 static tr_peerIo*
 tr_peerIoNew (tr_session       * session,
               tr_bandwidth     * parent,
@@ -625,14 +707,13 @@ tr_peerIoNew (tr_session       * session,
     io->outbuf = evbuffer_new ();
     tr_bandwidthConstruct (&io->bandwidth, session, parent);
     tr_bandwidthSetPeer (&io->bandwidth, io);
+    /* let the bandwidth scheduler decide when to start reading */
+    tr_bandwidthSetActive (&io->bandwidth, TR_DOWN, true);
     dbgmsg (io, "bandwidth is %p; its parent is %p", (void*)&io->bandwidth, (void*)parent);
     dbgmsg (io, "socket is %"TR_PRI_SOCK", utp_socket is %p", socket, (void*)utp_socket);
 
     if (io->socket != TR_BAD_SOCKET) {
-        io->event_read = event_new (session->event_base,
-                                    io->socket, EV_READ, event_read_cb, io);
-        io->event_write = event_new (session->event_base,
-                                     io->socket, EV_WRITE, event_write_cb, io);
+        io_create_events (io);
     }
 #ifdef WITH_UTP
     else {
@@ -718,7 +799,12 @@ event_enable (tr_peerIo * io, short event)
     {
         dbgmsg (io, "enabling ready-to-read polling");
         if (io->socket != TR_BAD_SOCKET)
-            event_add (io->event_read, NULL);
+        {
+            if (!io->isEdgeTriggered)
+                poll_add (io, io->event_read);
+            else if (io->readyEvents & EV_READ) /* no new edge is coming */
+                event_active (io->event_read, EV_READ, 1);
+        }
         io->pendingEvents |= EV_READ;
     }
 
@@ -726,7 +812,12 @@ event_enable (tr_peerIo * io, short event)
     {
         dbgmsg (io, "enabling ready-to-write polling");
         if (io->socket != TR_BAD_SOCKET)
-            event_add (io->event_write, NULL);
+        {
+            if (!io->isEdgeTriggered)
+                poll_add (io, io->event_write);
+            else if (io->readyEvents & EV_WRITE) /* no new edge is coming */
+                event_active (io->event_write, EV_WRITE, 1);
+        }
         io->pendingEvents |= EV_WRITE;
     }
 }
@@ -747,16 +838,16 @@ event_disable (struct tr_peerIo * io, short event)
     if ((event & EV_READ) && (io->pendingEvents & EV_READ))
     {
         dbgmsg (io, "disabling ready-to-read polling");
-        if (io->socket != TR_BAD_SOCKET)
-            event_del (io->event_read);
+        if (io->socket != TR_BAD_SOCKET && !io->isEdgeTriggered)
+            poll_del (io, io->event_read);
         io->pendingEvents &= ~EV_READ;
     }
 
     if ((event & EV_WRITE) && (io->pendingEvents & EV_WRITE))
     {
         dbgmsg (io, "disabling ready-to-write polling");
-        if (io->socket != TR_BAD_SOCKET)
-            event_del (io->event_write);
+        if (io->socket != TR_BAD_SOCKET && !io->isEdgeTriggered)
+            poll_del (io, io->event_write);
         io->pendingEvents &= ~EV_WRITE;
     }
 }
@@ -777,6 +868,11 @@ tr_peerIoSetEnabled (tr_peerIo    * io,
         event_enable (io, event);
     else
         event_disable (io, event);
+
+    /* if this direction can't make progress on its own,
+     * wait for the bandwidth scheduler to revisit it */
+    tr_bandwidthSetActive (&io->bandwidth, dir,
+                           !isEnabled && (dir == TR_DOWN || evbuffer_get_length (io->outbuf) > 0));
 }
 
 /***
@@ -785,9 +881,11 @@ tr_peerIoSetEnabled (tr_peerIo    * io,
 static void
 io_close_socket (tr_peerIo * io)
 {
-    if (io->socket != TR_BAD_SOCKET) {
-        tr_netClose (io->session, io->socket);
-        io->socket = TR_BAD_SOCKET;
+    /* in edge-triggered mode the events are still registered,
+     * so remove them before the socket goes away */
+    if (io->isEdgeTriggered && io->socket != TR_BAD_SOCKET) {
+        poll_del (io, io->event_read);
+        poll_del (io, io->event_write);
     }
 
     if (io->event_read != NULL) {
@@ -800,6 +898,12 @@ io_close_socket (tr_peerIo * io)
         io->event_write = NULL;
     }
 
+    if (io->socket != TR_BAD_SOCKET) {
+        tr_netClose (io->session, io->socket);
+        io->socket = TR_BAD_SOCKET;
+        io->isCorked = false;
+    }
+
 #ifdef WITH_UTP
     if (io->utp_socket) {
         UTP_SetCallbacks (io->utp_socket,
@@ -934,8 +1038,7 @@ tr_peerIoReconnect (tr_peerIo * io)
     io_close_socket (io);
 
     io->socket = tr_netOpenPeerSocket (session, &io->addr, io->port, io->isSeed);
-    io->event_read = event_new (session->event_base, io->socket, EV_READ, event_read_cb, io);
-    io->event_write = event_new (session->event_base, io->socket, EV_WRITE, event_write_cb, io);
+    io_create_events (io);
 
     if (io->socket != TR_BAD_SOCKET)
     {
@@ -1076,6 +1179,10 @@ addDatatype (tr_peerIo * io, size_t byteCount, bool isPieceData)
     d->isPieceData = isPieceData;
     d->length = byteCount;
     peer_io_push_datatype (io, d);
+
+    /* if nothing's polling for writability, queue this peer for the next bandwidth pulse */
+    if (!(io->pendingEvents & EV_WRITE))
+        tr_bandwidthSetActive (&io->bandwidth, TR_UP, true);
 }
 
 static inline void
@@ -1264,6 +1371,9 @@ tr_peerIoTryRead (tr_peerIo * io, size_t howmuch)
             dbgmsg (io, "read %d from peer (%s)", res,
                     (res==-1?tr_net_strerror (err_buf, sizeof (err_buf), e):""));
 
+            if ((res >= 0 && (size_t)res < howmuch) || (res == -1 && e == EAGAIN))
+                io->readyEvents &= ~EV_READ;
+
             if (evbuffer_get_length (io->inbuf))
                 canReadWrapper (io);
 
@@ -1307,6 +1417,9 @@ tr_peerIoTryWrite (tr_peerIo * io, size_t howmuch)
             n = tr_evbuffer_write (io, io->socket, howmuch);
             e = EVUTIL_SOCKET_ERROR ();
 
+            if ((n >= 0 && (size_t)n < howmuch) || (n == -1 && e == EAGAIN))
+                io->readyEvents &= ~EV_WRITE;
+
             if (n > 0)
                 didWriteWrapper (io, n);
 
@@ -1344,6 +1457,16 @@ tr_peerIoFlush (tr_peerIo  * io, tr_direction dir, size_t limit)
     return bytesUsed;
 }
 
+void
+tr_peerIoSetCorked (tr_peerIo * io, bool corked)
+{
+    assert (tr_isPeerIo (io));
+
+    if ((io->socket != TR_BAD_SOCKET) && (io->isCorked != corked))
+        if (tr_netSetCorked (io->socket, corked))
+            io->isCorked = corked;
+}
+
 int
 tr_peerIoFlushOutgoingProtocolMsgs (tr_peerIo * io)
 {
@@ -77,8 +77,19 @@ typedef struct tr_peerIo
 
     tr_priority_t         priority;
 
+    /* the events we want libevent to tell us about */
     short int             pendingEvents;
 
+    /* when isEdgeTriggered is set, the socket's events are registered once
+     * with EV_ET and never removed. pendingEvents is then tracked entirely
+     * in userspace, and readyEvents remembers which directions the kernel
+     * has said are ready but that we haven't drained yet. */
+    bool                  isEdgeTriggered;
+    short int             readyEvents;
+
+    /* true while partial TCP segments are being held back */
+    bool                  isCorked;
+
     int                   magicNumber;
 
     tr_encryption_type    encryption_type;
@@ -361,7 +372,7 @@ void      tr_peerIoBandwidthUsed (tr_peerIo           * io,
                                   int                   isPieceData);
 
 static inline bool
-tr_peerIoHasBandwidthLeft (const tr_peerIo * io, tr_direction dir)
+tr_peerIoHasBandwidthLeft (tr_peerIo * io, tr_direction dir)
 {
     return tr_bandwidthClamp (&io->bandwidth, dir, 1024) > 0;
 }
@@ -386,6 +397,14 @@ int       tr_peerIoFlush (tr_peerIo     * io,
 
 int       tr_peerIoFlushOutgoingProtocolMsgs (tr_peerIo * io);
 
+/**
+ * @brief while corked, a TCP peer's writes are only sent in full-sized
+ *        segments. Uncorking pushes out whatever's left.
+ *        This is a no-op for uTP peers and on platforms without TCP_CORK.
+ */
+void      tr_peerIoSetCorked (tr_peerIo * io,
+                              bool        corked);
+
 /**
 ***
 **/
@@ -214,6 +214,12 @@ typedef struct tr_swarm
   uint16_t                 * pieceReplication;
   size_t                     pieceReplicationSize;
 
+  /* how many bytes we want that connected peers have. While
+     pieceReplication exists this is kept up to date as pieces come
+     and go, either from us or from the peers. */
+  uint64_t                   desiredAvailable;
+  bool                       desiredAvailableIsDirty;
+
   int                        interestedCount;
   int                        maxPeers;
   time_t                     lastCancel;
@@ -301,6 +307,10 @@ tr_peerConstruct (tr_peer * peer, const tr_torrent * tor)
   peer->swarm = tor->swarm;
   tr_bitfieldConstruct (&peer->have, tor->info.pieceCount);
   tr_bitfieldConstruct (&peer->blame, tor->blockCount);
+  tr_historyConstruct (&peer->blocksSentToClient, CANCEL_HISTORY_SEC);
+  tr_historyConstruct (&peer->blocksSentToPeer, CANCEL_HISTORY_SEC);
+  tr_historyConstruct (&peer->cancelsSentToClient, CANCEL_HISTORY_SEC);
+  tr_historyConstruct (&peer->cancelsSentToPeer, CANCEL_HISTORY_SEC);
 }
 
 static void peerDeclinedAllRequests (tr_swarm *, const tr_peer *);
@@ -460,6 +470,27 @@ replicationFree (tr_swarm * s)
   tr_free (s->pieceReplication);
   s->pieceReplication = NULL;
   s->pieceReplicationSize = 0;
+  s->desiredAvailableIsDirty = true;
+}
+
+/* a piece's replication count went between zero and nonzero,
+ * so its missing bytes just became available or stopped being so */
+static void
+replicationChanged (tr_swarm * s, tr_piece_index_t piece, uint16_t before)
+{
+  const tr_torrent * tor = s->tor;
+  const bool was_available = before > 0;
+  const bool is_available = s->pieceReplication[piece] > 0;
+
+  if ((was_available != is_available) && !s->desiredAvailableIsDirty && !tor->pieceDND[piece])
+    {
+      const uint64_t missing = tr_torrentMissingBytesInPiece (tor, piece);
+
+      if (is_available)
+        s->desiredAvailable += missing;
+      else
+        s->desiredAvailable -= missing;
+    }
 }
 
 static void
@@ -473,6 +504,8 @@ replicationNew (tr_swarm * s)
 
   s->pieceReplicationSize = piece_count;
   s->pieceReplication = tr_new0 (uint16_t, piece_count);
+  s->desiredAvailable = 0;
+  s->desiredAvailableIsDirty = false;
 
   for (piece_i=0; piece_i<piece_count; ++piece_i)
     {
@@ -487,6 +520,7 @@ replicationNew (tr_swarm * s)
         }
 
       s->pieceReplication[piece_i] = r;
+      replicationChanged (s, piece_i, 0);
     }
 }
 
@@ -966,8 +1000,8 @@ comparePieceByWeight (const void * va, const void * vb)
   if (ia > ib) return 1;
 
   /* secondary key: higher priorities go first */
-  ia = tor->info.pieces[a->index].priority;
-  ib = tor->info.pieces[b->index].priority;
+  ia = tor->piecePriority[a->index];
+  ib = tor->piecePriority[b->index];
   if (ia > ib) return -1;
   if (ia < ib) return 1;
 
@@ -1084,14 +1118,14 @@ pieceListRebuild (tr_swarm * s)
       tr_piece_index_t * pool;
       tr_piece_index_t poolCount = 0;
       const tr_torrent * tor = s->tor;
-      const tr_info * inf = tr_torrentInfo (tor);
+      const tr_info * inf = &tor->info;
       struct weighted_piece * pieces;
       int pieceCount;
 
       /* build the new list */
       pool = tr_new (tr_piece_index_t, inf->pieceCount);
       for (i=0; i<inf->pieceCount; ++i)
-        if (!inf->pieces[i].dnd)
+        if (!tor->pieceDND[i])
           if (!tr_torrentPieceIsComplete (tor, i))
             pool[poolCount++] = i;
       pieceCount = poolCount;
@@ -1240,6 +1274,7 @@ tr_incrReplicationOfPiece (tr_swarm * s, const size_t index)
 
   /* One more replication of this piece is present in the swarm */
   ++s->pieceReplication[index];
+  replicationChanged (s, index, s->pieceReplication[index] - 1);
 
   /* we only resort the piece if the list is already sorted */
   if (s->pieceSortState == PIECES_SORTED_BY_WEIGHT)
@@ -1260,7 +1295,7 @@ tr_incrReplicationFromBitfield (tr_swarm * s, const tr_bitfield * b)
 
   for (i=0; i<n; ++i)
     if (tr_bitfieldHas (b, i))
-      ++rep[i];
+      replicationChanged (s, i, rep[i]++);
 
   if (s->pieceSortState == PIECES_SORTED_BY_WEIGHT)
     invalidatePieceSorting (s);
@@ -1279,7 +1314,7 @@ tr_incrReplication (tr_swarm * s)
   assert (s->pieceReplicationSize == s->tor->info.pieceCount);
 
   for (i=0; i<n; ++i)
-    ++s->pieceReplication[i];
+    replicationChanged (s, i, s->pieceReplication[i]++);
 }
 
 /**
@@ -1297,13 +1332,13 @@ tr_decrReplicationFromBitfield (tr_swarm * s, const tr_bitfield * b)
   if (tr_bitfieldHasAll (b))
     {
       for (i=0; i<n; ++i)
-        --s->pieceReplication[i];
+        replicationChanged (s, i, s->pieceReplication[i]--);
     }
   else if (!tr_bitfieldHasNone (b))
     {
       for (i=0; i<n; ++i)
         if (tr_bitfieldHas (b, i))
-          --s->pieceReplication[i];
+          replicationChanged (s, i, s->pieceReplication[i]--);
 
       if (s->pieceSortState == PIECES_SORTED_BY_WEIGHT)
         invalidatePieceSorting (s);
@@ -1319,6 +1354,8 @@ tr_peerMgrRebuildRequests (tr_torrent * tor)
 {
   assert (tr_isTorrent (tor));
 
+  /* this is called when the wanted pieces change */
+  tor->swarm->desiredAvailableIsDirty = true;
   pieceListRebuild (tor->swarm);
 }
 
@@ -1807,6 +1844,9 @@ peerCallbackFunc (tr_peer * peer, const tr_peer_event * e, void * vs)
           cancelAllRequestsForBlock (s, block, peer);
           tr_historyAdd (&peer->blocksSentToClient, tr_time(), 1);
           pieceListResortPiece (s, pieceListLookup (s, p));
+          if (replicationExists (s) && (s->pieceReplication[p] > 0) && !s->desiredAvailableIsDirty
+                                    && !tor->pieceDND[p] && !tr_torrentBlockIsComplete (tor, block))
+            s->desiredAvailable -= tr_torBlockCountBytes (tor, block);
           tr_torrentGotBlock (tor, block);
           break;
         }
@@ -1930,6 +1970,7 @@ createBitTorrentPeer (tr_torrent       * tor,
   tr_ptrArrayInsertSorted (&swarm->peers, peer, peerCompare);
   ++swarm->stats.peerCount;
   ++swarm->stats.peerFromCount[atom->fromFirst];
+  tr_torrentMarkChanged (tor, TR_FIELDS_STATS);
 
   assert (swarm->stats.peerCount == tr_ptrArraySize (&swarm->peers));
   assert (swarm->stats.peerFromCount[atom->fromFirst] <= swarm->stats.peerCount);
@@ -2234,6 +2275,11 @@ tr_peerMgrGotBadPiece (tr_torrent * tor, tr_piece_index_t pieceIndex)
     }
 
 
+  /* the piece was thrown away, so all of it is missing again */
+  if (replicationExists (s) && (s->pieceReplication[pieceIndex] > 0)
+                            && !s->desiredAvailableIsDirty && !tor->pieceDND[pieceIndex])
+    s->desiredAvailable += byteCount;
+
   tr_announcerAddBytes (tor, TR_ANN_CORRUPT, byteCount);
 }
 
@@ -2592,6 +2638,7 @@ tr_swarmIncrementActivePeers (tr_swarm * swarm, tr_direction direction, bool is_
   assert (n <= swarm->stats.peerCount);
 
   swarm->stats.activePeerCount[direction] = n;
+  tr_torrentMarkChanged (swarm->tor, TR_FIELDS_STATS);
 }
 
 bool
@@ -2606,14 +2653,28 @@ tr_peerIsSeed (const tr_peer * peer)
   return false;
 }
 
+static uint64_t
+countDesiredAvailable (const tr_swarm * s)
+{
+  size_t i;
+  size_t n;
+  uint64_t desiredAvailable = 0;
+  const tr_torrent * tor = s->tor;
+
+  for (i=0, n=MIN (tor->info.pieceCount, s->pieceReplicationSize); i<n; ++i)
+    if (!tor->pieceDND[i] && (s->pieceReplication[i] > 0))
+      desiredAvailable += tr_torrentMissingBytesInPiece (tor, i);
+
+  return desiredAvailable;
+}
+
 /* count how many bytes we want that connected peers have */
 uint64_t
 tr_peerMgrGetDesiredAvailable (const tr_torrent * tor)
 {
   size_t i;
   size_t n;
-  uint64_t desiredAvailable;
-  const tr_swarm * s;
+  tr_swarm * s;
 
   assert (tr_isTorrent (tor));
 
@@ -2643,15 +2704,15 @@ tr_peerMgrGetDesiredAvailable (const tr_torrent * tor)
   if (!s->pieceReplication || !s->pieceReplicationSize)
     return 0;
 
-  /* do it the hard way */
-
-  desiredAvailable = 0;
-  for (i=0, n=MIN (tor->info.pieceCount, s->pieceReplicationSize); i<n; ++i)
-    if (!tor->info.pieces[i].dnd && (s->pieceReplication[i] > 0))
-      desiredAvailable += tr_torrentMissingBytesInPiece (tor, i);
+  /* do it the hard way, if the wanted pieces have changed since last time */
+  if (s->desiredAvailableIsDirty)
+    {
+      s->desiredAvailable = countDesiredAvailable (s);
+      s->desiredAvailableIsDirty = false;
+    }
 
-  assert (desiredAvailable <= tor->info.totalSize);
-  return desiredAvailable;
+  assert (s->desiredAvailable <= tor->info.totalSize);
+  return s->desiredAvailable;
 }
 
 double*
@@ -2729,10 +2790,10 @@ tr_peerMgrPeerStats (const tr_torrent * tor, int * setmeCount)
       stat->isUploadingTo       = tr_peerMsgsIsActive (msgs, TR_CLIENT_TO_PEER);
       stat->isSeed              = tr_peerIsSeed (peer);
 
-      stat->blocksToPeer        = tr_historyGet (&peer->blocksSentToPeer,    now, CANCEL_HISTORY_SEC);
-      stat->blocksToClient      = tr_historyGet (&peer->blocksSentToClient,  now, CANCEL_HISTORY_SEC);
-      stat->cancelsToPeer       = tr_historyGet (&peer->cancelsSentToPeer,   now, CANCEL_HISTORY_SEC);
-      stat->cancelsToClient     = tr_historyGet (&peer->cancelsSentToClient, now, CANCEL_HISTORY_SEC);
+      stat->blocksToPeer        = tr_historyGet (&peer->blocksSentToPeer,    now);
+      stat->blocksToClient      = tr_historyGet (&peer->blocksSentToClient,  now);
+      stat->cancelsToPeer       = tr_historyGet (&peer->cancelsSentToPeer,   now);
+      stat->cancelsToClient     = tr_historyGet (&peer->cancelsSentToClient, now);
 
       stat->pendingReqsToPeer   = peer->pendingReqsToPeer;
       stat->pendingReqsToClient = peer->pendingReqsToClient;
@@ -2866,8 +2927,8 @@ rechokeDownloads (tr_swarm * s)
     for (i=0; i<peerCount; ++i)
       {
         const tr_peer * peer = tr_ptrArrayNth (&s->peers, i);
-        const int b = tr_historyGet (&peer->blocksSentToClient, now, CANCEL_HISTORY_SEC);
-        const int c = tr_historyGet (&peer->cancelsSentToPeer, now, CANCEL_HISTORY_SEC);
+        const int b = tr_historyGet (&peer->blocksSentToClient, now);
+        const int c = tr_historyGet (&peer->cancelsSentToPeer, now);
 
         if (b == 0) /* ignore unresponsive peers, as described above */
           continue;
@@ -2920,7 +2981,7 @@ rechokeDownloads (tr_swarm * s)
       /* build a bitfield of interesting pieces... */
       piece_is_interesting = tr_new (bool, n);
       for (i=0; i<n; i++)
-        piece_is_interesting[i] = !tor->info.pieces[i].dnd && !tr_torrentPieceIsComplete (tor, i);
+        piece_is_interesting[i] = !tor->pieceDND[i] && !tr_torrentPieceIsComplete (tor, i);
 
       /* decide WHICH peers to be interested in (based on their cancel-to-block ratio) */
       for (i=0; i<peerCount; ++i)
@@ -2934,8 +2995,8 @@ rechokeDownloads (tr_swarm * s)
           else
             {
               tr_rechoke_state rechoke_state;
-              const int blocks = tr_historyGet (&peer->blocksSentToClient, now, CANCEL_HISTORY_SEC);
-              const int cancels = tr_historyGet (&peer->cancelsSentToPeer, now, CANCEL_HISTORY_SEC);
+              const int blocks = tr_historyGet (&peer->blocksSentToClient, now);
+              const int cancels = tr_historyGet (&peer->cancelsSentToPeer, now);
 
               if (!blocks && !cancels)
                 rechoke_state = RECHOKE_STATE_UNTESTED;
@@ -3313,6 +3374,7 @@ removePeer (tr_swarm * s, tr_peer * peer)
   tr_ptrArrayRemoveSortedPointer (&s->peers, peer, peerCompare);
   --s->stats.peerCount;
   --s->stats.peerFromCount[atom->fromFirst];
+  tr_torrentMarkChanged (s->tor, TR_FIELDS_STATS);
 
   if (replicationExists (s))
     tr_decrReplicationFromBitfield (s, &peer->have);
@@ -3620,8 +3682,8 @@ bandwidthPulse (evutil_socket_t foo UNUSED, short bar UNUSED, void * vmgr)
   pumpAllPeers (mgr);
 
   /* allocate bandwidth to the peers */
-  tr_bandwidthAllocate (&session->bandwidth, TR_UP, BANDWIDTH_PERIOD_MSEC);
-  tr_bandwidthAllocate (&session->bandwidth, TR_DOWN, BANDWIDTH_PERIOD_MSEC);
+  tr_bandwidthAllocate (&session->bandwidth, TR_UP);
+  tr_bandwidthAllocate (&session->bandwidth, TR_DOWN);
 
   /* torrent upkeep */
   tor = NULL;
@@ -4082,3 +4144,69 @@ makeNewPeerConnections (struct tr_peerMgr * mgr, const int max)
 
   tr_free (candidates);
 }
+
+/***
+****
+***/
+
+void
+tr_peerMgrAddTestPeer (tr_torrent * tor, tr_peer * peer, const tr_address * addr, tr_port port)
+{
+  tr_swarm * s = tor->swarm;
+  struct peer_atom * atom;
+
+  swarmLock (s);
+
+  assert (tr_bitfieldHasNone (&peer->have));
+
+  ensureAtomExists (s, addr, port, 0, -1, TR_PEER_FROM_INCOMING);
+  atom = getExistingAtom (s, addr);
+  peer->atom = atom;
+  atom->peer = peer;
+
+  tr_ptrArrayInsertSorted (&s->peers, peer, peerCompare);
+  ++s->stats.peerCount;
+  ++s->stats.peerFromCount[atom->fromFirst];
+
+  if (!replicationExists (s))
+    replicationNew (s);
+
+  swarmUnlock (s);
+}
+
+void
+tr_peerMgrFireTestEvent (tr_peer * peer, const tr_peer_event * e)
+{
+  peerCallbackFunc (peer, e, peer->swarm);
+}
+
+void
+tr_peerMgrRemoveTestPeer (tr_peer * peer)
+{
+  tr_swarm * s = peer->swarm;
+
+  swarmLock (s);
+  removePeer (s, peer);
+  swarmUnlock (s);
+}
+
+bool
+tr_peerMgrRecountDesiredAvailable (tr_torrent * tor,
+                                   uint64_t   * setme_running,
+                                   uint64_t   * setme_recount)
+{
+  bool was_clean;
+  tr_swarm * s = tor->swarm;
+
+  swarmLock (s);
+
+  was_clean = replicationExists (s) && !s->desiredAvailableIsDirty;
+  *setme_running = s->desiredAvailable;
+
+  s->desiredAvailable = replicationExists (s) ? countDesiredAvailable (s) : 0;
+  s->desiredAvailableIsDirty = false;
+  *setme_recount = s->desiredAvailable;
+
+  swarmUnlock (s);
+  return was_clean;
+}
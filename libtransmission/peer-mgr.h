@@ -183,6 +183,28 @@ void         tr_peerMgrGotBadPiece          (tr_torrent         * tor,
 void         tr_peerMgrPieceCompleted       (tr_torrent         * tor,
                                              tr_piece_index_t     pieceIndex);
 
+/** @brief Private function that's exposed here only for unit tests.
+    Adds a peer that has no pieces yet to the torrent's swarm without
+    a connection, and starts counting piece replication if needed */
+void         tr_peerMgrAddTestPeer          (tr_torrent         * tor,
+                                             tr_peer            * peer,
+                                             const tr_address   * addr,
+                                             tr_port              port);
+
+/** @brief Private function that's exposed here only for unit tests */
+void         tr_peerMgrFireTestEvent        (tr_peer             * peer,
+                                             const tr_peer_event * e);
+
+/** @brief Private function that's exposed here only for unit tests */
+void         tr_peerMgrRemoveTestPeer       (tr_peer            * peer);
+
+/** @brief Private function that's exposed here only for unit tests.
+    Replaces the swarm's running desiredAvailable total with a recount.
+    Returns false if the running total wasn't being kept up to date */
+bool         tr_peerMgrRecountDesiredAvailable (tr_torrent      * tor,
+                                                uint64_t        * setme_running,
+                                                uint64_t        * setme_recount);
+
 
 
 /* @} */
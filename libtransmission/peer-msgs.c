@@ -83,9 +83,9 @@ enum
   MAGIC_NUMBER            = 21549,
 
   /* used in lowering the outMessages queue period */
-  IMMEDIATE_PRIORITY_INTERVAL_SECS = 0,
-  HIGH_PRIORITY_INTERVAL_SECS = 2,
-  LOW_PRIORITY_INTERVAL_SECS = 10,
+  IMMEDIATE_PRIORITY_INTERVAL_MSEC = 0,
+  HIGH_PRIORITY_INTERVAL_MSEC = 250,
+  LOW_PRIORITY_INTERVAL_MSEC = 10000,
 
   /* number of pieces we'll allow in our fast set */
   MAX_FAST_SET_SIZE = 3,
@@ -204,7 +204,7 @@ struct tr_peerMsgs
   /* how long the outMessages batch should be allowed to grow before
    * it's flushed -- some messages (like requests >:) should be sent
    * very quickly; others aren't as urgent. */
-  int8_t          outMessagesBatchPeriod;
+  int             outMessagesBatchPeriod;
 
   uint8_t         state;
   uint8_t         ut_pex_id;
@@ -242,8 +242,8 @@ struct tr_peerMsgs
 
   time_t chokeChangedAt;
 
-  /* when we started batching the outMessages */
-  time_t outMessagesBatchedAt;
+  /* when we started batching the outMessages, in msec */
+  uint64_t outMessagesBatchedAt;
 
   struct tr_incoming    incoming;
 
@@ -327,7 +327,7 @@ pokeBatchPeriod (tr_peerMsgs * msgs, int interval)
   if (msgs->outMessagesBatchPeriod > interval)
     {
       msgs->outMessagesBatchPeriod = interval;
-      dbgmsg (msgs, "lowering batch interval to %d seconds", interval);
+      dbgmsg (msgs, "lowering batch interval to %d msec", interval);
     }
 }
 
@@ -367,7 +367,7 @@ protocolSendRequest (tr_peerMsgs * msgs, const struct peer_request * req)
 
   dbgmsg (msgs, "requesting %u:%u->%u...", req->index, req->offset, req->length);
   dbgOutMessageLen (msgs);
-  pokeBatchPeriod (msgs, IMMEDIATE_PRIORITY_INTERVAL_SECS);
+  pokeBatchPeriod (msgs, IMMEDIATE_PRIORITY_INTERVAL_MSEC);
 }
 
 static void
@@ -383,7 +383,7 @@ protocolSendCancel (tr_peerMsgs * msgs, const struct peer_request * req)
 
   dbgmsg (msgs, "cancelling %u:%u->%u...", req->index, req->offset, req->length);
   dbgOutMessageLen (msgs);
-  pokeBatchPeriod (msgs, IMMEDIATE_PRIORITY_INTERVAL_SECS);
+  pokeBatchPeriod (msgs, IMMEDIATE_PRIORITY_INTERVAL_MSEC);
 }
 
 static void
@@ -408,7 +408,7 @@ protocolSendHave (tr_peerMsgs * msgs, uint32_t index)
 
   dbgmsg (msgs, "sending Have %u", index);
   dbgOutMessageLen (msgs);
-  pokeBatchPeriod (msgs, LOW_PRIORITY_INTERVAL_SECS);
+  pokeBatchPeriod (msgs, LOW_PRIORITY_INTERVAL_MSEC);
 }
 
 #if 0
@@ -439,7 +439,7 @@ protocolSendChoke (tr_peerMsgs * msgs, int choke)
 
   dbgmsg (msgs, "sending %s...", choke ? "Choke" : "Unchoke");
   dbgOutMessageLen (msgs);
-  pokeBatchPeriod (msgs, IMMEDIATE_PRIORITY_INTERVAL_SECS);
+  pokeBatchPeriod (msgs, IMMEDIATE_PRIORITY_INTERVAL_MSEC);
 }
 
 static void
@@ -454,7 +454,7 @@ protocolSendHaveAll (tr_peerMsgs * msgs)
 
   dbgmsg (msgs, "sending HAVE_ALL...");
   dbgOutMessageLen (msgs);
-  pokeBatchPeriod (msgs, IMMEDIATE_PRIORITY_INTERVAL_SECS);
+  pokeBatchPeriod (msgs, IMMEDIATE_PRIORITY_INTERVAL_MSEC);
 }
 
 static void
@@ -469,7 +469,7 @@ protocolSendHaveNone (tr_peerMsgs * msgs)
 
   dbgmsg (msgs, "sending HAVE_NONE...");
   dbgOutMessageLen (msgs);
-  pokeBatchPeriod (msgs, IMMEDIATE_PRIORITY_INTERVAL_SECS);
+  pokeBatchPeriod (msgs, IMMEDIATE_PRIORITY_INTERVAL_MSEC);
 }
 
 /**
@@ -782,7 +782,7 @@ sendInterest (tr_peerMsgs * msgs, bool b)
   evbuffer_add_uint32 (out, sizeof (uint8_t));
   evbuffer_add_uint8 (out, b ? BT_INTERESTED : BT_NOT_INTERESTED);
 
-  pokeBatchPeriod (msgs, HIGH_PRIORITY_INTERVAL_SECS);
+  pokeBatchPeriod (msgs, HIGH_PRIORITY_INTERVAL_MSEC);
   dbgOutMessageLen (msgs);
 }
 
@@ -974,7 +974,7 @@ sendLtepHandshake (tr_peerMsgs * msgs)
     evbuffer_add_uint8 (out, BT_LTEP);
     evbuffer_add_uint8 (out, LTEP_HANDSHAKE);
     evbuffer_add_buffer (out, payload);
-    pokeBatchPeriod (msgs, IMMEDIATE_PRIORITY_INTERVAL_SECS);
+    pokeBatchPeriod (msgs, IMMEDIATE_PRIORITY_INTERVAL_MSEC);
     dbgOutMessageLen (msgs);
 
     /* cleanup */
@@ -1151,7 +1151,7 @@ parseUtMetadata (tr_peerMsgs * msgs, uint32_t msglen, struct evbuffer * inbuf)
             evbuffer_add_uint8 (out, BT_LTEP);
             evbuffer_add_uint8 (out, msgs->ut_metadata_id);
             evbuffer_add_buffer (out, payload);
-            pokeBatchPeriod (msgs, HIGH_PRIORITY_INTERVAL_SECS);
+            pokeBatchPeriod (msgs, HIGH_PRIORITY_INTERVAL_MSEC);
             dbgOutMessageLen (msgs);
 
             /* cleanup */
@@ -1879,7 +1879,7 @@ updateMetadataRequests (tr_peerMsgs * msgs, time_t now)
         evbuffer_add_uint8 (out, BT_LTEP);
         evbuffer_add_uint8 (out, msgs->ut_metadata_id);
         evbuffer_add_buffer (out, payload);
-        pokeBatchPeriod (msgs, HIGH_PRIORITY_INTERVAL_SECS);
+        pokeBatchPeriod (msgs, HIGH_PRIORITY_INTERVAL_MSEC);
         dbgOutMessageLen (msgs);
 
         /* cleanup */
@@ -1918,7 +1918,21 @@ updateBlockRequests (tr_peerMsgs * msgs)
 }
 
 static size_t
-fillOutputBuffer (tr_peerMsgs * msgs, time_t now)
+flushOutMessages (tr_peerMsgs * msgs, time_t now)
+{
+    const size_t len = evbuffer_get_length (msgs->outMessages);
+
+    dbgmsg (msgs, "flushing outMessages... to %p (length is %zu)", (void*)msgs->io, len);
+    tr_peerIoWriteBuf (msgs->io, msgs->outMessages, false);
+    msgs->clientSentAnythingAt = now;
+    msgs->outMessagesBatchedAt = 0;
+    msgs->outMessagesBatchPeriod = LOW_PRIORITY_INTERVAL_MSEC;
+
+    return len;
+}
+
+static size_t
+fillOutputBuffer (tr_peerMsgs * msgs, time_t now, uint64_t now_msec)
 {
     int piece;
     size_t bytesWritten = 0;
@@ -1933,25 +1947,19 @@ fillOutputBuffer (tr_peerMsgs * msgs, time_t now)
     if (haveMessages && !msgs->outMessagesBatchedAt) /* fresh batch */
     {
         dbgmsg (msgs, "started an outMessages batch (length is %zu)", evbuffer_get_length (msgs->outMessages));
-        msgs->outMessagesBatchedAt = now;
+        msgs->outMessagesBatchedAt = now_msec;
     }
-    else if (haveMessages && ((now - msgs->outMessagesBatchedAt) >= msgs->outMessagesBatchPeriod))
+
+    if (haveMessages && ((now_msec - msgs->outMessagesBatchedAt) >= (uint64_t)msgs->outMessagesBatchPeriod))
     {
-        const size_t len = evbuffer_get_length (msgs->outMessages);
-        /* flush the protocol messages */
-        dbgmsg (msgs, "flushing outMessages... to %p (length is %zu)", (void*)msgs->io, len);
-        tr_peerIoWriteBuf (msgs->io, msgs->outMessages, false);
-        msgs->clientSentAnythingAt = now;
-        msgs->outMessagesBatchedAt = 0;
-        msgs->outMessagesBatchPeriod = LOW_PRIORITY_INTERVAL_SECS;
-        bytesWritten +=  len;
+        bytesWritten += flushOutMessages (msgs, now);
     }
 
     /**
     ***  Metadata Pieces
     **/
 
-    if ((tr_peerIoGetWriteBufferSpace (msgs->io, now) >= METADATA_PIECE_SIZE)
+    if ((tr_peerIoGetWriteBufferSpace (msgs->io, now_msec) >= METADATA_PIECE_SIZE)
         && popNextMetadataRequest (msgs, &piece))
     {
         char * data;
@@ -1978,7 +1986,7 @@ fillOutputBuffer (tr_peerMsgs * msgs, time_t now)
             evbuffer_add_uint8 (out, msgs->ut_metadata_id);
             evbuffer_add_buffer (out, payload);
             evbuffer_add     (out, data, dataLen);
-            pokeBatchPeriod (msgs, HIGH_PRIORITY_INTERVAL_SECS);
+            pokeBatchPeriod (msgs, HIGH_PRIORITY_INTERVAL_MSEC);
             dbgOutMessageLen (msgs);
 
             evbuffer_free (payload);
@@ -2005,7 +2013,7 @@ fillOutputBuffer (tr_peerMsgs * msgs, time_t now)
             evbuffer_add_uint8 (out, BT_LTEP);
             evbuffer_add_uint8 (out, msgs->ut_metadata_id);
             evbuffer_add_buffer (out, payload);
-            pokeBatchPeriod (msgs, HIGH_PRIORITY_INTERVAL_SECS);
+            pokeBatchPeriod (msgs, HIGH_PRIORITY_INTERVAL_MSEC);
             dbgOutMessageLen (msgs);
 
             evbuffer_free (payload);
@@ -2017,7 +2025,7 @@ fillOutputBuffer (tr_peerMsgs * msgs, time_t now)
     ***  Data Blocks
     **/
 
-    if ((tr_peerIoGetWriteBufferSpace (msgs->io, now) >= msgs->torrent->blockSize)
+    if ((tr_peerIoGetWriteBufferSpace (msgs->io, now_msec) >= msgs->torrent->blockSize)
         && popNextRequest (msgs, &req))
     {
         --msgs->prefetchCount;
@@ -2058,6 +2066,12 @@ fillOutputBuffer (tr_peerMsgs * msgs, time_t now)
                 const size_t n = evbuffer_get_length (out);
                 dbgmsg (msgs, "sending block %u:%u->%u", req.index, req.offset, req.length);
                 assert (n == msglen);
+
+                /* the block's going out now anyway, so let any batched
+                 * protocol messages ride along in the same segments */
+                if (evbuffer_get_length (msgs->outMessages) != 0)
+                    bytesWritten += flushOutMessages (msgs, now);
+
                 tr_peerIoWriteBuf (msgs->io, out, true);
                 bytesWritten += n;
                 msgs->clientSentAnythingAt = now;
@@ -2091,7 +2105,7 @@ fillOutputBuffer (tr_peerMsgs * msgs, time_t now)
     {
         dbgmsg (msgs, "sending a keepalive message");
         evbuffer_add_uint32 (msgs->outMessages, 0);
-        pokeBatchPeriod (msgs, IMMEDIATE_PRIORITY_INTERVAL_SECS);
+        pokeBatchPeriod (msgs, IMMEDIATE_PRIORITY_INTERVAL_MSEC);
     }
 
     return bytesWritten;
@@ -2102,6 +2116,7 @@ peerPulse (void * vmsgs)
 {
     tr_peerMsgs * msgs = vmsgs;
     const time_t  now = tr_time ();
+    const uint64_t now_msec = tr_time_msec ();
 
     if (tr_isPeerIo (msgs->io)) {
         updateDesiredRequestCount (msgs);
@@ -2110,7 +2125,7 @@ peerPulse (void * vmsgs)
     }
 
     for (;;)
-        if (fillOutputBuffer (msgs, now) < 1)
+        if (fillOutputBuffer (msgs, now, now_msec) < 1)
             break;
 
     return true; /* loop forever */
@@ -2148,7 +2163,7 @@ sendBitfield (tr_peerMsgs * msgs)
     evbuffer_add_uint8 (out, BT_BITFIELD);
     evbuffer_add     (out, bytes, byte_count);
     dbgmsg (msgs, "sending bitfield... outMessage size is now %zu", evbuffer_get_length (out));
-    pokeBatchPeriod (msgs, IMMEDIATE_PRIORITY_INTERVAL_SECS);
+    pokeBatchPeriod (msgs, IMMEDIATE_PRIORITY_INTERVAL_MSEC);
 
     tr_free (bytes);
 }
@@ -2441,7 +2456,7 @@ sendPex (tr_peerMsgs * msgs)
             evbuffer_add_uint8 (out, BT_LTEP);
             evbuffer_add_uint8 (out, msgs->ut_pex_id);
             evbuffer_add_buffer (out, payload);
-            pokeBatchPeriod (msgs, HIGH_PRIORITY_INTERVAL_SECS);
+            pokeBatchPeriod (msgs, HIGH_PRIORITY_INTERVAL_MSEC);
             dbgmsg (msgs, "sending a pex message; outMessage size is now %zu", evbuffer_get_length (out));
             dbgOutMessageLen (msgs);
 
@@ -2648,7 +2663,7 @@ tr_peerMsgsNew (struct tr_torrent    * torrent,
   m->state = AWAITING_BT_LENGTH;
   m->outMessages = evbuffer_new ();
   m->outMessagesBatchedAt = 0;
-  m->outMessagesBatchPeriod = LOW_PRIORITY_INTERVAL_SECS;
+  m->outMessagesBatchPeriod = LOW_PRIORITY_INTERVAL_MSEC;
 
   if (tr_torrentAllowsPex (torrent))
     {
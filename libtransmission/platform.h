@@ -51,6 +51,12 @@ typedef struct tr_thread tr_thread;
 /** @brief Instantiate a new process thread */
 tr_thread* tr_threadNew (void (*func)(void *), void * arg);
 
+/** @brief Like tr_threadNew (), but the thread must be waited for with tr_threadJoin () */
+tr_thread* tr_threadNewJoinable (void (*func)(void *), void * arg);
+
+/** @brief Wait for a thread from tr_threadNewJoinable () to finish, then free it */
+void tr_threadJoin (tr_thread * thread);
+
 /** @brief Return nonzero if this function is being called from `thread'
     @param thread the thread being tested */
 bool tr_amInThread (const tr_thread * thread);
@@ -12,6 +12,7 @@
 #include <string.h> /* memcmp() */
 
 #include "transmission.h"
+#include "platform.h" /* tr_lock */
 #include "ptrarray.h"
 #include "quark.h"
 #include "utils.h" /* tr_memdup(), tr_strndup() */
@@ -54,6 +55,7 @@ static const struct tr_key_struct my_static[] =
   { "blocklist-date", 14 },
   { "blocklist-enabled", 17 },
   { "blocklist-size", 14 },
+  { "blocklist-update", 16 },
   { "blocklist-updates-enabled", 25 },
   { "blocklist-url", 13 },
   { "blocks", 6 },
@@ -76,6 +78,7 @@ static const struct tr_key_struct my_static[] =
   { "creator", 7 },
   { "cumulative-stats", 16 },
   { "current-stats", 13 },
+  { "data-fingerprint", 16 },
   { "date", 4 },
   { "dateCreated", 11 },
   { "delete-local-data", 17 },
@@ -112,6 +115,7 @@ static const struct tr_key_struct my_static[] =
   { "etaIdle", 7 },
   { "failure reason", 14 },
   { "fields", 6 },
+  { "file-count", 10 },
   { "fileStats", 9 },
   { "filename", 8 },
   { "files", 5 },
@@ -124,6 +128,7 @@ static const struct tr_key_struct my_static[] =
   { "filter-trackers", 15 },
   { "flagStr", 7 },
   { "flags", 5 },
+  { "free-space", 10 },
   { "fromCache", 9 },
   { "fromDht", 7 },
   { "fromIncoming", 12 },
@@ -131,6 +136,10 @@ static const struct tr_key_struct my_static[] =
   { "fromLtep", 8 },
   { "fromPex", 7 },
   { "fromTracker", 11 },
+  { "group", 5 },
+  { "group-get", 9 },
+  { "group-remove", 12 },
+  { "group-set", 9 },
   { "hasAnnounced", 12 },
   { "hasScraped", 10 },
   { "hashString", 10 },
@@ -141,6 +150,7 @@ static const struct tr_key_struct my_static[] =
   { "host", 4 },
   { "id", 2 },
   { "idle-limit", 10 },
+  { "idle-metainfo-unload-minutes", 28 },
   { "idle-mode", 9 },
   { "idle-seeding-limit", 18 },
   { "idle-seeding-limit-enabled", 26 },
@@ -203,7 +213,9 @@ static const struct tr_key_struct my_static[] =
   { "min_request_interval", 20 },
   { "move", 4 },
   { "msg_type", 8 },
+  { "mtime", 5 },
   { "mtimes", 6 },
+  { "mtimesRead", 10 },
   { "name", 4 },
   { "name.utf-8", 10 },
   { "nextAnnounceTime", 16 },
@@ -247,6 +259,7 @@ static const struct tr_key_struct my_static[] =
   { "port", 4 },
   { "port-forwarding-enabled", 23 },
   { "port-is-open", 12 },
+  { "port-test", 9 },
   { "preallocation", 13 },
   { "prefetch-enabled", 16 },
   { "priorities", 10 },
@@ -285,7 +298,11 @@ static const struct tr_key_struct my_static[] =
   { "removed", 7 },
   { "rename-partial-files", 20 },
   { "reqq", 4 },
+  { "requests", 8 },
   { "result", 6 },
+  { "resume-database-enabled", 23 },
+  { "resume-save-stats", 17 },
+  { "revision", 8 },
   { "rpc-authentication-required", 27 },
   { "rpc-bind-address", 16 },
   { "rpc-enabled", 11 },
@@ -297,6 +314,9 @@ static const struct tr_key_struct my_static[] =
   { "rpc-version-minimum", 19 },
   { "rpc-whitelist", 13 },
   { "rpc-whitelist-enabled", 21 },
+  { "save-delay-seconds", 18 },
+  { "saveCount", 9 },
+  { "saveMicroseconds", 16 },
   { "scrape", 6 },
   { "scrape-paused-torrents-enabled", 30 },
   { "scrapeState", 11 },
@@ -306,6 +326,8 @@ static const struct tr_key_struct my_static[] =
   { "secondsActive", 13 },
   { "secondsDownloading", 18 },
   { "secondsSeeding", 14 },
+  { "sectionsRebuilt", 15 },
+  { "sectionsReused", 14 },
   { "seed-queue-enabled", 18 },
   { "seed-queue-size", 15 },
   { "seedIdleLimit", 13 },
@@ -315,7 +337,11 @@ static const struct tr_key_struct my_static[] =
   { "seedRatioMode", 13 },
   { "seederCount", 11 },
   { "seeding-time-seconds", 20 },
+  { "session-close", 13 },
   { "session-count", 13 },
+  { "session-get", 11 },
+  { "session-set", 11 },
+  { "session-stats", 13 },
   { "sessionCount", 12 },
   { "show-backup-trackers", 20 },
   { "show-extra-peer-details", 23 },
@@ -325,6 +351,7 @@ static const struct tr_key_struct my_static[] =
   { "show-statusbar", 14 },
   { "show-toolbar", 12 },
   { "show-tracker-scrapes", 20 },
+  { "since", 5 },
   { "size-bytes", 10 },
   { "size-units", 10 },
   { "sizeWhenDone", 12 },
@@ -346,6 +373,7 @@ static const struct tr_key_struct my_static[] =
   { "tag", 3 },
   { "tier", 4 },
   { "time-checked", 12 },
+  { "torrent-add", 11 },
   { "torrent-added", 13 },
   { "torrent-added-notification-command", 34 },
   { "torrent-added-notification-enabled", 34 },
@@ -355,8 +383,15 @@ static const struct tr_key_struct my_static[] =
   { "torrent-complete-sound-enabled", 30 },
   { "torrent-duplicate", 17 },
   { "torrent-get", 11 },
+  { "torrent-reannounce", 18 },
+  { "torrent-remove", 14 },
+  { "torrent-rename-path", 19 },
   { "torrent-set", 11 },
   { "torrent-set-location", 20 },
+  { "torrent-start", 13 },
+  { "torrent-start-now", 17 },
+  { "torrent-stop", 12 },
+  { "torrent-verify", 14 },
   { "torrentCount", 12 },
   { "torrentFile", 11 },
   { "torrents", 8 },
@@ -419,6 +454,70 @@ compareKeys (const void * va, const void * vb)
 
 static tr_ptrArray my_runtime = TR_PTR_ARRAY_INIT_STATIC;
 
+/* my_runtime and its hash can be grown by any thread that parses
+ * benc or JSON, e.g. while torrents are being loaded in parallel */
+static tr_lock *
+getRuntimeLock (void)
+{
+  static tr_lock * l = NULL;
+
+  if (!l)
+    l = tr_lockNew ();
+
+  return l;
+}
+
+/* open-addressed hash of my_runtime, so that parsing a file with
+ * thousands of unfamiliar keys doesn't scan my_runtime for each one.
+ * each slot holds an index into my_runtime + 1, or 0 if empty */
+static size_t * my_runtime_hash = NULL;
+static size_t my_runtime_hash_mask = 0;
+
+static size_t
+hashKey (const struct tr_key_struct * key)
+{
+  size_t i;
+  uint32_t h = 2166136261u; /* FNV-1a */
+
+  for (i=0; i<key->len; ++i)
+    {
+      h ^= (unsigned char) key->str[i];
+      h *= 16777619u;
+    }
+
+  return h;
+}
+
+static void
+runtimeHashInsert (size_t runtime_index)
+{
+  const struct tr_key_struct * key = tr_ptrArrayNth (&my_runtime, runtime_index);
+  size_t i = hashKey (key) & my_runtime_hash_mask;
+
+  while (my_runtime_hash[i] != 0)
+    i = (i + 1) & my_runtime_hash_mask;
+
+  my_runtime_hash[i] = runtime_index + 1;
+}
+
+static void
+runtimeHashRebuild (void)
+{
+  size_t i;
+  size_t n = 64;
+  const size_t n_runtime = tr_ptrArraySize (&my_runtime);
+
+  while (n < n_runtime * 2)
+    n *= 2u;
+
+  tr_free (my_runtime_hash);
+  my_runtime_hash = tr_new0 (size_t, n);
+  my_runtime_hash_mask = n - 1;
+
+  for (i=0; i<n_runtime; ++i)
+    runtimeHashInsert (i);
+}
+
 bool
 tr_quark_lookup (const void * str, size_t len, tr_quark * setme)
 {
@@ -427,6 +526,10 @@ tr_quark_lookup (const void * str, size_t len, tr_quark * setme)
   static const size_t n_static = sizeof(my_static) / sizeof(struct tr_key_struct);
   bool success = false;
 
+  /* fetched even when it isn't needed, so that the lock is created
+   * by the first lookup -- long before any worker threads exist */
+  tr_lock * const lock = getRuntimeLock ();
+
   assert (n_static == TR_N_KEYS);
 
   tmp.str = str;
@@ -441,20 +544,28 @@ tr_quark_lookup (const void * str, size_t len, tr_quark * setme)
     }
 
   /* was it added during runtime? */
-  if (!success && !tr_ptrArrayEmpty(&my_runtime))
+  if (!success)
     {
-      size_t i;
-      struct tr_key_struct ** runtime = (struct tr_key_struct **) tr_ptrArrayBase (&my_runtime);
-      const size_t n_runtime = tr_ptrArraySize (&my_runtime);
-      for (i=0; i<n_runtime; ++i)
+      tr_lockLock (lock);
+
+      if (!tr_ptrArrayEmpty(&my_runtime))
         {
-          if (compareKeys (&tmp, runtime[i]) == 0)
+          size_t i = hashKey (&tmp) & my_runtime_hash_mask;
+
+          for (; my_runtime_hash[i]!=0; i=(i+1)&my_runtime_hash_mask)
             {
-              *setme = TR_N_KEYS + i;
-              success = true;
-              break;
+              const size_t runtime_index = my_runtime_hash[i] - 1;
+
+              if (compareKeys (&tmp, tr_ptrArrayNth (&my_runtime, runtime_index)) == 0)
+                {
+                  *setme = TR_N_KEYS + runtime_index;
+                  success = true;
+                  break;
+                }
             }
         }
+
+      tr_lockUnlock (lock);
     }
 
   return success;
@@ -470,6 +581,12 @@ append_new_quark (const void * str, size_t len)
   tmp->len = len;
   ret = TR_N_KEYS + tr_ptrArraySize (&my_runtime);
   tr_ptrArrayAppend (&my_runtime, tmp);
+
+  if ((size_t)tr_ptrArraySize (&my_runtime) * 2 > my_runtime_hash_mask + 1)
+    runtimeHashRebuild ();
+  else
+    runtimeHashInsert (tr_ptrArraySize (&my_runtime) - 1);
+
   return ret;
 }
 
@@ -484,7 +601,15 @@ tr_quark_new (const void * str, size_t len)
     len = strlen (str);
 
   if (!tr_quark_lookup (str, len, &ret))
-    ret = append_new_quark (str, len);
+    {
+      /* look again while locked, in case another thread just added it */
+      tr_lockLock (getRuntimeLock ());
+
+      if (!tr_quark_lookup (str, len, &ret))
+        ret = append_new_quark (str, len);
+
+      tr_lockUnlock (getRuntimeLock ());
+    }
 
   return ret;
 }
@@ -495,9 +620,15 @@ tr_quark_get_string (tr_quark q, size_t * len)
   const struct tr_key_struct * tmp;
 
   if (q < TR_N_KEYS)
-    tmp = &my_static[q];
+    {
+      tmp = &my_static[q];
+    }
   else
-    tmp = tr_ptrArrayNth (&my_runtime, q-TR_N_KEYS);
+    {
+      tr_lockLock (getRuntimeLock ());
+      tmp = tr_ptrArrayNth (&my_runtime, q-TR_N_KEYS);
+      tr_lockUnlock (getRuntimeLock ());
+    }
 
   if (len != NULL)
     *len = tmp->len;
@@ -55,6 +55,7 @@ enum
   TR_KEY_blocklist_date,
   TR_KEY_blocklist_enabled,
   TR_KEY_blocklist_size,
+  TR_KEY_blocklist_update, /* rpc method */
   TR_KEY_blocklist_updates_enabled,
   TR_KEY_blocklist_url,
   TR_KEY_blocks,
@@ -77,6 +78,7 @@ enum
   TR_KEY_creator,
   TR_KEY_cumulative_stats,
   TR_KEY_current_stats,
+  TR_KEY_data_fingerprint,
   TR_KEY_date,
   TR_KEY_dateCreated,
   TR_KEY_delete_local_data,
@@ -113,6 +115,7 @@ enum
   TR_KEY_etaIdle,
   TR_KEY_failure_reason,
   TR_KEY_fields,
+  TR_KEY_file_count,
   TR_KEY_fileStats,
   TR_KEY_filename,
   TR_KEY_files,
@@ -125,6 +128,7 @@ enum
   TR_KEY_filter_trackers,
   TR_KEY_flagStr,
   TR_KEY_flags,
+  TR_KEY_free_space, /* rpc method */
   TR_KEY_fromCache,
   TR_KEY_fromDht,
   TR_KEY_fromIncoming,
@@ -132,6 +136,10 @@ enum
   TR_KEY_fromLtep,
   TR_KEY_fromPex,
   TR_KEY_fromTracker,
+  TR_KEY_group,
+  TR_KEY_group_get, /* rpc method */
+  TR_KEY_group_remove,
+  TR_KEY_group_set, /* rpc method */
   TR_KEY_hasAnnounced,
   TR_KEY_hasScraped,
   TR_KEY_hashString,
@@ -142,6 +150,7 @@ enum
   TR_KEY_host,
   TR_KEY_id,
   TR_KEY_idle_limit,
+  TR_KEY_idle_metainfo_unload_minutes,
   TR_KEY_idle_mode,
   TR_KEY_idle_seeding_limit,
   TR_KEY_idle_seeding_limit_enabled,
@@ -204,7 +213,9 @@ enum
   TR_KEY_min_request_interval,
   TR_KEY_move,
   TR_KEY_msg_type,
+  TR_KEY_mtime,
   TR_KEY_mtimes,
+  TR_KEY_mtimesRead,
   TR_KEY_name,
   TR_KEY_name_utf_8,
   TR_KEY_nextAnnounceTime,
@@ -248,6 +259,7 @@ enum
   TR_KEY_port,
   TR_KEY_port_forwarding_enabled,
   TR_KEY_port_is_open,
+  TR_KEY_port_test, /* rpc method */
   TR_KEY_preallocation,
   TR_KEY_prefetch_enabled,
   TR_KEY_priorities,
@@ -286,7 +298,11 @@ enum
   TR_KEY_removed,
   TR_KEY_rename_partial_files,
   TR_KEY_reqq,
+  TR_KEY_requests, /* rpc monitor */
   TR_KEY_result,
+  TR_KEY_resume_database_enabled,
+  TR_KEY_resume_save_stats,
+  TR_KEY_revision,
   TR_KEY_rpc_authentication_required,
   TR_KEY_rpc_bind_address,
   TR_KEY_rpc_enabled,
@@ -298,6 +314,9 @@ enum
   TR_KEY_rpc_version_minimum,
   TR_KEY_rpc_whitelist,
   TR_KEY_rpc_whitelist_enabled,
+  TR_KEY_save_delay_seconds,
+  TR_KEY_saveCount,
+  TR_KEY_saveMicroseconds,
   TR_KEY_scrape,
   TR_KEY_scrape_paused_torrents_enabled,
   TR_KEY_scrapeState,
@@ -307,6 +326,8 @@ enum
   TR_KEY_secondsActive,
   TR_KEY_secondsDownloading,
   TR_KEY_secondsSeeding,
+  TR_KEY_sectionsRebuilt,
+  TR_KEY_sectionsReused,
   TR_KEY_seed_queue_enabled,
   TR_KEY_seed_queue_size,
   TR_KEY_seedIdleLimit,
@@ -316,7 +337,11 @@ enum
   TR_KEY_seedRatioMode,
   TR_KEY_seederCount,
   TR_KEY_seeding_time_seconds,
+  TR_KEY_session_close, /* rpc method */
   TR_KEY_session_count,
+  TR_KEY_session_get, /* rpc method */
+  TR_KEY_session_set, /* rpc method */
+  TR_KEY_session_stats, /* rpc method */
   TR_KEY_sessionCount,
   TR_KEY_show_backup_trackers,
   TR_KEY_show_extra_peer_details,
@@ -326,6 +351,7 @@ enum
   TR_KEY_show_statusbar,
   TR_KEY_show_toolbar,
   TR_KEY_show_tracker_scrapes,
+  TR_KEY_since,
   TR_KEY_size_bytes,
   TR_KEY_size_units,
   TR_KEY_sizeWhenDone,
@@ -347,6 +373,7 @@ enum
   TR_KEY_tag,
   TR_KEY_tier,
   TR_KEY_time_checked,
+  TR_KEY_torrent_add, /* rpc method */
   TR_KEY_torrent_added,
   TR_KEY_torrent_added_notification_command,
   TR_KEY_torrent_added_notification_enabled,
@@ -356,8 +383,15 @@ enum
   TR_KEY_torrent_complete_sound_enabled,
   TR_KEY_torrent_duplicate,
   TR_KEY_torrent_get,
+  TR_KEY_torrent_reannounce, /* rpc method */
+  TR_KEY_torrent_remove, /* rpc method */
+  TR_KEY_torrent_rename_path, /* rpc method */
   TR_KEY_torrent_set,
   TR_KEY_torrent_set_location,
+  TR_KEY_torrent_start, /* rpc method */
+  TR_KEY_torrent_start_now, /* rpc method */
+  TR_KEY_torrent_stop, /* rpc method */
+  TR_KEY_torrent_verify, /* rpc method */
   TR_KEY_torrentCount,
   TR_KEY_torrentFile,
   TR_KEY_torrents,
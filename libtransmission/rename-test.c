@@ -66,25 +66,6 @@ testFileExistsAndConsistsOfThisString (const tr_torrent * tor, tr_file_index_t f
   return success;
 }
 
-static void
-onRenameDone (tr_torrent * tor UNUSED, const char * oldpath UNUSED, const char * newname UNUSED, int error, void * user_data)
-{
-  *(int*)user_data = error;
-}
-
-static int
-torrentRenameAndWait (tr_torrent * tor,
-                      const char * oldpath,
-                      const char * newname)
-{
-  int error = -1;
-  tr_torrentRenamePath (tor, oldpath, newname, onRenameDone, &error);
-  do {
-    tr_wait_msec (10);
-  } while (error == -1);
-  return error;
-}
-
 /***
 ****
 ***/
@@ -170,12 +151,12 @@ test_single_filename_torrent (void)
 
   /* confirm that bad inputs get caught */
 
-  check_int_eq (EINVAL, torrentRenameAndWait (tor, "hello-world.txt", NULL));
-  check_int_eq (EINVAL, torrentRenameAndWait (tor, "hello-world.txt", ""));
-  check_int_eq (EINVAL, torrentRenameAndWait (tor, "hello-world.txt", "."));
-  check_int_eq (EINVAL, torrentRenameAndWait (tor, "hello-world.txt", ".."));
-  check_int_eq (0, torrentRenameAndWait (tor, "hello-world.txt", "hello-world.txt"));
-  check_int_eq (EINVAL, torrentRenameAndWait (tor, "hello-world.txt", "hello/world.txt"));
+  check_int_eq (EINVAL, libttest_torrentRenameAndWait (tor, "hello-world.txt", NULL));
+  check_int_eq (EINVAL, libttest_torrentRenameAndWait (tor, "hello-world.txt", ""));
+  check_int_eq (EINVAL, libttest_torrentRenameAndWait (tor, "hello-world.txt", "."));
+  check_int_eq (EINVAL, libttest_torrentRenameAndWait (tor, "hello-world.txt", ".."));
+  check_int_eq (0, libttest_torrentRenameAndWait (tor, "hello-world.txt", "hello-world.txt"));
+  check_int_eq (EINVAL, libttest_torrentRenameAndWait (tor, "hello-world.txt", "hello/world.txt"));
 
   check (!tor->info.files[0].is_renamed);
   check_streq ("hello-world.txt", tor->info.files[0].name);
@@ -187,7 +168,7 @@ test_single_filename_torrent (void)
   tmpstr = tr_buildPath (tor->currentDir, "hello-world.txt", NULL);
   check (tr_sys_path_exists (tmpstr, NULL));
   check_streq ("hello-world.txt", tr_torrentName(tor));
-  check_int_eq (0, torrentRenameAndWait (tor, tor->info.name, "foobar"));
+  check_int_eq (0, libttest_torrentRenameAndWait (tor, tor->info.name, "foobar"));
   check (!tr_sys_path_exists (tmpstr, NULL)); /* confirm the old filename can't be found */
   tr_free (tmpstr);
   check (tor->info.files[0].is_renamed); /* confirm the file's 'renamed' flag is set */
@@ -212,7 +193,7 @@ test_single_filename_torrent (void)
 
   tmpstr = tr_buildPath (tor->currentDir, "foobar", NULL);
   check (tr_sys_path_exists (tmpstr, NULL));
-  check_int_eq (0, torrentRenameAndWait (tor, "foobar", "hello-world.txt"));
+  check_int_eq (0, libttest_torrentRenameAndWait (tor, "foobar", "hello-world.txt"));
   check (!tr_sys_path_exists (tmpstr, NULL));
   check (tor->info.files[0].is_renamed);
   check_streq ("hello-world.txt", tor->info.files[0].name);
@@ -326,17 +307,17 @@ test_multifile_torrent (void)
   **/
 
   /* rename a leaf... */
-  check_int_eq (0, torrentRenameAndWait (tor, "Felidae/Felinae/Felis/catus/Kyphi", "placeholder"));
+  check_int_eq (0, libttest_torrentRenameAndWait (tor, "Felidae/Felinae/Felis/catus/Kyphi", "placeholder"));
   check_streq (files[1].name, "Felidae/Felinae/Felis/catus/placeholder");
   check (testFileExistsAndConsistsOfThisString (tor, 1, "Inquisitive\n"));
 
   /* ...and back again */
-  check_int_eq (0, torrentRenameAndWait (tor, "Felidae/Felinae/Felis/catus/placeholder", "Kyphi"));
+  check_int_eq (0, libttest_torrentRenameAndWait (tor, "Felidae/Felinae/Felis/catus/placeholder", "Kyphi"));
   check_streq (files[1].name, "Felidae/Felinae/Felis/catus/Kyphi");
   testFileExistsAndConsistsOfThisString (tor, 1, "Inquisitive\n");
 
   /* rename a branch... */
-  check_int_eq (0, torrentRenameAndWait (tor, "Felidae/Felinae/Felis/catus", "placeholder"));
+  check_int_eq (0, libttest_torrentRenameAndWait (tor, "Felidae/Felinae/Felis/catus", "placeholder"));
   check_streq (expected_files[0],                           files[0].name);
   check_streq ("Felidae/Felinae/Felis/placeholder/Kyphi",   files[1].name);
   check_streq ("Felidae/Felinae/Felis/placeholder/Saffron", files[2].name);
@@ -361,7 +342,7 @@ test_multifile_torrent (void)
   check_streq (expected_files[3],                           files[3].name);
 
   /* ...and back again */
-  check_int_eq (0, torrentRenameAndWait (tor, "Felidae/Felinae/Felis/placeholder", "catus"));
+  check_int_eq (0, libttest_torrentRenameAndWait (tor, "Felidae/Felinae/Felis/placeholder", "catus"));
   for (i=0; i<4; ++i)
     {
       check_streq (expected_files[i], files[i].name);
@@ -400,18 +381,18 @@ test_multifile_torrent (void)
   testFileExistsAndConsistsOfThisString (tor, 3, expected_contents[3]);
 
   /* rename a branch... */
-  check_int_eq (0, torrentRenameAndWait (tor, "Felidae/Felinae/Felis/catus", "foo"));
+  check_int_eq (0, libttest_torrentRenameAndWait (tor, "Felidae/Felinae/Felis/catus", "foo"));
   check_streq (expected_files[0],                   files[0].name);
   check_streq ("Felidae/Felinae/Felis/foo/Kyphi",   files[1].name);
   check_streq ("Felidae/Felinae/Felis/foo/Saffron", files[2].name);
   check_streq (expected_files[3],                   files[3].name);
 
   /* ...and back again */
-  check_int_eq (0, torrentRenameAndWait (tor, "Felidae/Felinae/Felis/foo", "catus"));
+  check_int_eq (0, libttest_torrentRenameAndWait (tor, "Felidae/Felinae/Felis/foo", "catus"));
   for (i=0; i<4; ++i)
     check_streq (expected_files[i], files[i].name);
 
-  check_int_eq (0, torrentRenameAndWait (tor, "Felidae", "gabba"));
+  check_int_eq (0, libttest_torrentRenameAndWait (tor, "Felidae", "gabba"));
   strings[0] = "gabba/Felinae/Acinonyx/Cheetah/Chester";
   strings[1] = "gabba/Felinae/Felis/catus/Kyphi";
   strings[2] = "gabba/Felinae/Felis/catus/Saffron";
@@ -423,9 +404,9 @@ test_multifile_torrent (void)
     }
 
   /* rename the root, then a branch, and then a leaf... */
-  check_int_eq (0, torrentRenameAndWait (tor, "gabba", "Felidae"));
-  check_int_eq (0, torrentRenameAndWait (tor, "Felidae/Pantherinae/Panthera/Tiger", "Snow Leopard"));
-  check_int_eq (0, torrentRenameAndWait (tor, "Felidae/Pantherinae/Panthera/Snow Leopard/Tony", "10.6"));
+  check_int_eq (0, libttest_torrentRenameAndWait (tor, "gabba", "Felidae"));
+  check_int_eq (0, libttest_torrentRenameAndWait (tor, "Felidae/Pantherinae/Panthera/Tiger", "Snow Leopard"));
+  check_int_eq (0, libttest_torrentRenameAndWait (tor, "Felidae/Pantherinae/Panthera/Snow Leopard/Tony", "10.6"));
   strings[0] = "Felidae/Felinae/Acinonyx/Cheetah/Chester";
   strings[1] = "Felidae/Felinae/Felis/catus/Kyphi";
   strings[2] = "Felidae/Felinae/Felis/catus/Saffron";
@@ -459,7 +440,7 @@ test_multifile_torrent (void)
   files = tor->info.files;
 
   /* rename prefix of top */
-  check_int_eq (EINVAL, torrentRenameAndWait (tor, "Feli", "FelidaeX"));
+  check_int_eq (EINVAL, libttest_torrentRenameAndWait (tor, "Feli", "FelidaeX"));
   check_streq (tor->info.name, "Felidae");
   check (files[0].is_renamed == false);
   check (files[1].is_renamed == false);
@@ -467,7 +448,7 @@ test_multifile_torrent (void)
   check (files[3].is_renamed == false);
 
   /* rename false path */
-  check_int_eq (EINVAL, torrentRenameAndWait (tor, "Felidae/FelinaeX", "Genus Felinae"));
+  check_int_eq (EINVAL, libttest_torrentRenameAndWait (tor, "Felidae/FelinaeX", "Genus Felinae"));
   check_streq (tor->info.name, "Felidae");
   check (files[0].is_renamed == false);
   check (files[1].is_renamed == false);
@@ -527,8 +508,8 @@ test_partial_file (void)
   ****
   ***/
 
-  check_int_eq (0, torrentRenameAndWait (tor, "files-filled-with-zeroes", "foo"));
-  check_int_eq (0, torrentRenameAndWait (tor, "foo/1048576", "bar"));
+  check_int_eq (0, libttest_torrentRenameAndWait (tor, "files-filled-with-zeroes", "foo"));
+  check_int_eq (0, libttest_torrentRenameAndWait (tor, "foo/1048576", "bar"));
   strings[0] = "foo/bar";
   strings[1] = "foo/4096";
   strings[2] = "foo/512";
@@ -0,0 +1,276 @@
+/*
+ * This file Copyright (C) 2016 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ * $Id$
+ */
+
+#include <string.h> /* memset () */
+
+#ifndef _WIN32
+ #include <signal.h> /* signal (), SIGXFSZ */
+ #include <sys/resource.h> /* setrlimit () */
+#endif
+
+#include "transmission.h"
+#include "file.h"
+#include "resume-db.h"
+#include "utils.h"
+#include "variant.h"
+
+#include "libtransmission-test.h"
+
+static void
+makeHash (uint8_t * hash, int i)
+{
+  memset (hash, i, SHA_DIGEST_LENGTH);
+}
+
+static void
+makeState (tr_variant * state, int64_t downloaded)
+{
+  tr_variantInitDict (state, 2);
+  tr_variantDictAddInt (state, TR_KEY_downloaded, downloaded);
+  tr_variantDictAddStr (state, TR_KEY_destination, "/home/user/Downloads");
+}
+
+static bool
+getDownloaded (tr_resume_db * db, int i, int64_t * setme)
+{
+  bool ok;
+  tr_variant state;
+  uint8_t hash[SHA_DIGEST_LENGTH];
+
+  makeHash (hash, i);
+  if ((ok = tr_resumeDbGet (db, hash, &state)))
+    {
+      ok = tr_variantDictFindInt (&state, TR_KEY_downloaded, setme);
+      tr_variantFree (&state);
+    }
+
+  return ok;
+}
+
+static void
+put (tr_resume_db * db, int i, int64_t downloaded)
+{
+  tr_variant state;
+  uint8_t hash[SHA_DIGEST_LENGTH];
+
+  makeHash (hash, i);
+  makeState (&state, downloaded);
+  tr_resumeDbPut (db, hash, &state);
+  tr_variantFree (&state);
+}
+
+static int
+test_put_get_remove (void)
+{
+  int64_t i;
+  uint64_t size;
+  tr_resume_db * db;
+  uint8_t hash[SHA_DIGEST_LENGTH];
+  char * sandbox = libtest_sandbox_create ();
+  char * filename = tr_buildPath (sandbox, "resume.db", NULL);
+
+  db = tr_resumeDbOpen (filename, NULL);
+  check (db != NULL);
+  check_int_eq (0, tr_resumeDbCount (db));
+  check (!getDownloaded (db, 1, &i));
+
+  put (db, 1, 100);
+  put (db, 2, 200);
+  check_int_eq (2, tr_resumeDbCount (db));
+  check (getDownloaded (db, 1, &i));
+  check_int_eq (100, i);
+  check (getDownloaded (db, 2, &i));
+  check_int_eq (200, i);
+
+  /* newer saves replace older ones */
+  put (db, 1, 101);
+  check (getDownloaded (db, 1, &i));
+  check_int_eq (101, i);
+
+  /* saving the same state again doesn't write anything */
+  size = tr_resumeDbGetSize (db);
+  put (db, 1, 101);
+  check_uint_eq (size, tr_resumeDbGetSize (db));
+
+  makeHash (hash, 2);
+  tr_resumeDbRemove (db, hash);
+  check_int_eq (1, tr_resumeDbCount (db));
+  check (!getDownloaded (db, 2, &i));
+
+  /* the newest records, and the removal, are all there after reopening */
+  tr_resumeDbClose (db);
+  db = tr_resumeDbOpen (filename, NULL);
+  check (db != NULL);
+  check_int_eq (1, tr_resumeDbCount (db));
+  check (getDownloaded (db, 1, &i));
+  check_int_eq (101, i);
+  check (!getDownloaded (db, 2, &i));
+  tr_resumeDbClose (db);
+
+  tr_free (filename);
+  libtest_sandbox_destroy (sandbox);
+  tr_free (sandbox);
+  return 0;
+}
+
+static int
+test_torn_record (void)
+{
+  int64_t i;
+  uint64_t size;
+  tr_resume_db * db;
+  tr_sys_file_t fd;
+  char * sandbox = libtest_sandbox_create ();
+  char * filename = tr_buildPath (sandbox, "resume.db", NULL);
+
+  db = tr_resumeDbOpen (filename, NULL);
+  put (db, 1, 100);
+  put (db, 2, 200);
+  tr_resumeDbFlush (db);
+  size = tr_resumeDbGetSize (db);
+  tr_resumeDbClose (db);
+
+  /* pretend we crashed partway through writing the second record */
+  fd = tr_sys_file_open (filename, TR_SYS_FILE_WRITE, 0, NULL);
+  check (fd != TR_BAD_SYS_FILE);
+  check (tr_sys_file_truncate (fd, size - 5, NULL));
+  tr_sys_file_close (fd, NULL);
+
+  db = tr_resumeDbOpen (filename, NULL);
+  check (db != NULL);
+  check_int_eq (1, tr_resumeDbCount (db));
+  check (getDownloaded (db, 1, &i));
+  check_int_eq (100, i);
+  check (!getDownloaded (db, 2, &i));
+
+  /* new records go after the last good one */
+  put (db, 3, 300);
+  tr_resumeDbClose (db);
+  db = tr_resumeDbOpen (filename, NULL);
+  check_int_eq (2, tr_resumeDbCount (db));
+  check (getDownloaded (db, 3, &i));
+  check_int_eq (300, i);
+  tr_resumeDbClose (db);
+
+  /* files that aren't resume databases are left alone */
+  libtest_create_file_with_string_contents (filename, "d8:downloadedi1ee");
+  check (tr_resumeDbOpen (filename, NULL) == NULL);
+
+  tr_free (filename);
+  libtest_sandbox_destroy (sandbox);
+  tr_free (sandbox);
+  return 0;
+}
+
+#ifndef _WIN32
+
+static int
+test_failed_write (void)
+{
+  int64_t i;
+  uint64_t size;
+  tr_resume_db * db;
+  tr_variant state;
+  struct rlimit limit;
+  struct rlimit old_limit;
+  uint8_t hash[SHA_DIGEST_LENGTH];
+  char * sandbox = libtest_sandbox_create ();
+  char * filename = tr_buildPath (sandbox, "resume.db", NULL);
+
+  db = tr_resumeDbOpen (filename, NULL);
+  put (db, 1, 100);
+  size = tr_resumeDbGetSize (db);
+
+  /* a file size limit makes the next write stop partway through a record */
+  signal (SIGXFSZ, SIG_IGN);
+  getrlimit (RLIMIT_FSIZE, &old_limit);
+  limit = old_limit;
+  limit.rlim_cur = size + 10;
+  check (setrlimit (RLIMIT_FSIZE, &limit) == 0);
+  makeHash (hash, 2);
+  makeState (&state, 200);
+  check (!tr_resumeDbPut (db, hash, &state));
+  tr_variantFree (&state);
+  setrlimit (RLIMIT_FSIZE, &old_limit);
+  signal (SIGXFSZ, SIG_DFL);
+
+  /* the partial record was cut off, so later ones aren't lost behind it */
+  check_uint_eq (size, tr_resumeDbGetSize (db));
+  put (db, 3, 300);
+  tr_resumeDbClose (db);
+
+  db = tr_resumeDbOpen (filename, NULL);
+  check_int_eq (2, tr_resumeDbCount (db));
+  check (getDownloaded (db, 1, &i));
+  check_int_eq (100, i);
+  check (!getDownloaded (db, 2, &i));
+  check (getDownloaded (db, 3, &i));
+  check_int_eq (300, i);
+  tr_resumeDbClose (db);
+
+  tr_free (filename);
+  libtest_sandbox_destroy (sandbox);
+  tr_free (sandbox);
+  return 0;
+}
+
+#endif
+
+static int
+test_compact (void)
+{
+  int j;
+  int64_t i;
+  uint64_t size;
+  tr_resume_db * db;
+  char * sandbox = libtest_sandbox_create ();
+  char * filename = tr_buildPath (sandbox, "resume.db", NULL);
+
+  db = tr_resumeDbOpen (filename, NULL);
+  for (j=0; j<100; ++j)
+    put (db, j % 4, j);
+  size = tr_resumeDbGetSize (db);
+
+  check (tr_resumeDbCompact (db));
+  check (tr_resumeDbGetSize (db) < size);
+  check_int_eq (4, tr_resumeDbCount (db));
+  check (getDownloaded (db, 3, &i));
+  check_int_eq (99, i);
+
+  /* still appendable after being rewritten */
+  put (db, 0, 1000);
+  size = tr_resumeDbGetSize (db);
+  tr_resumeDbClose (db);
+
+  /* closing compacts away the old record for torrent 0 */
+  db = tr_resumeDbOpen (filename, NULL);
+  check (tr_resumeDbGetSize (db) < size);
+  check_int_eq (4, tr_resumeDbCount (db));
+  check (getDownloaded (db, 0, &i));
+  check_int_eq (1000, i);
+  tr_resumeDbClose (db);
+
+  tr_free (filename);
+  libtest_sandbox_destroy (sandbox);
+  tr_free (sandbox);
+  return 0;
+}
+
+int
+main (void)
+{
+  const testFunc tests[] = { test_put_get_remove,
+                             test_torn_record,
+#ifndef _WIN32
+                             test_failed_write,
+#endif
+                             test_compact };
+
+  return runTests (tests, NUM_TESTS (tests));
+}
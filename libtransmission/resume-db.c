@@ -0,0 +1,697 @@
+/*
+ * This file Copyright (C) 2016 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ * $Id$
+ */
+
+#include <string.h> /* memcmp (), memcpy () */
+
+#include <zlib.h> /* crc32 () */
+
+#include "transmission.h"
+#include "error.h"
+#include "error-types.h"
+#include "file.h"
+#include "log.h"
+#include "platform.h" /* tr_lock */
+#include "ptrarray.h"
+#include "resume-db.h"
+#include "utils.h"
+#include "variant.h"
+
+/***
+****  File format
+****
+****  The file starts with DB_MAGIC. After that come records, each one:
+****
+****    4 bytes   big-endian length of the hash and the state
+****    4 bytes   big-endian CRC-32 of the hash and the state
+****   20 bytes   the torrent's info hash
+****    ...       the torrent's state, in benc. empty if it was removed
+***/
+
+#define DB_MAGIC "TRRESUMEDB1\n"
+
+enum
+{
+  DB_MAGIC_LEN = sizeof (DB_MAGIC) - 1,
+  RECORD_HEADER_LEN = 4 + 4 + SHA_DIGEST_LENGTH,
+
+  /* don't bother compacting until at least this much could be saved */
+  COMPACT_MIN_GARBAGE = 1024 * 1024
+};
+
+#define MY_NAME "Resume DB"
+
+#define dbgmsg(...) \
+  do \
+    { \
+      if (tr_logGetDeepEnabled ()) \
+        tr_logAddDeep (__FILE__, __LINE__, MY_NAME, __VA_ARGS__); \
+    } \
+  while (0)
+
+struct db_entry
+{
+  /* must be first; see compareEntries () */
+  uint8_t hash[SHA_DIGEST_LENGTH];
+
+  char * state;
+  size_t state_len;
+};
+
+struct tr_resume_db
+{
+  char * filename;
+  tr_sys_file_t fd;
+  tr_lock * lock;
+
+  /* struct db_entry, sorted by hash */
+  tr_ptrArray entries;
+
+  /* bytes in the file, and how many of them are in current records */
+  uint64_t file_size;
+  uint64_t live_size;
+
+  /* are there writes that haven't been synced yet? */
+  bool is_dirty;
+
+  /* did a failed append leave a partial record that couldn't be cut off? */
+  bool is_torn;
+};
+
+static int
+compareEntries (const void * a, const void * b)
+{
+  return memcmp (a, b, SHA_DIGEST_LENGTH);
+}
+
+static void
+entryFree (void * ventry)
+{
+  struct db_entry * entry = ventry;
+
+  tr_free (entry->state);
+  tr_free (entry);
+}
+
+static uint64_t
+recordSize (const struct db_entry * entry)
+{
+  return RECORD_HEADER_LEN + entry->state_len;
+}
+
+static void
+writeUint32 (uint8_t * walk, uint32_t val)
+{
+  walk[0] = (uint8_t) (val >> 24);
+  walk[1] = (uint8_t) (val >> 16);
+  walk[2] = (uint8_t) (val >> 8);
+  walk[3] = (uint8_t) val;
+}
+
+static uint32_t
+readUint32 (const uint8_t * walk)
+{
+  return ((uint32_t) walk[0] << 24)
+       | ((uint32_t) walk[1] << 16)
+       | ((uint32_t) walk[2] << 8)
+       |  (uint32_t) walk[3];
+}
+
+static uint32_t
+recordChecksum (const uint8_t * hash, const void * state, size_t state_len)
+{
+  uLong crc = crc32 (0L, Z_NULL, 0);
+
+  crc = crc32 (crc, hash, SHA_DIGEST_LENGTH);
+  if (state_len > 0)
+    crc = crc32 (crc, state, state_len);
+
+  return (uint32_t) crc;
+}
+
+static bool
+writeAll (tr_sys_file_t fd, const void * buf, size_t len, tr_error ** error)
+{
+  const uint8_t * walk = buf;
+
+  while (len > 0)
+    {
+      uint64_t n;
+
+      if (!tr_sys_file_write (fd, walk, len, &n, error))
+        return false;
+
+      walk += n;
+      len -= n;
+    }
+
+  return true;
+}
+
+static bool
+writeRecord (tr_sys_file_t    fd,
+             const uint8_t  * hash,
+             const void     * state,
+             size_t           state_len,
+             tr_error      ** error)
+{
+  bool ok;
+  const size_t len = RECORD_HEADER_LEN + state_len;
+  uint8_t * buf = tr_new (uint8_t, len);
+
+  /* one write per record, so a crash can only tear the last one */
+  writeUint32 (buf, SHA_DIGEST_LENGTH + state_len);
+  writeUint32 (buf + 4, recordChecksum (hash, state, state_len));
+  memcpy (buf + 8, hash, SHA_DIGEST_LENGTH);
+  if (state_len > 0)
+    memcpy (buf + RECORD_HEADER_LEN, state, state_len);
+
+  ok = writeAll (fd, buf, len, error);
+
+  tr_free (buf);
+  return ok;
+}
+
+/***
+****
+***/
+
+static struct db_entry *
+findEntry (tr_resume_db * db, const uint8_t * hash)
+{
+  return tr_ptrArrayFindSorted (&db->entries, hash, compareEntries);
+}
+
+/* takes ownership of `state' */
+static void
+setEntry (tr_resume_db * db, const uint8_t * hash, char * state, size_t state_len)
+{
+  struct db_entry * entry = findEntry (db, hash);
+
+  if (entry != NULL)
+    {
+      db->live_size -= recordSize (entry);
+      tr_free (entry->state);
+    }
+  else
+    {
+      entry = tr_new0 (struct db_entry, 1);
+      memcpy (entry->hash, hash, SHA_DIGEST_LENGTH);
+      tr_ptrArrayInsertSorted (&db->entries, entry, compareEntries);
+    }
+
+  entry->state = state;
+  entry->state_len = state_len;
+  db->live_size += recordSize (entry);
+}
+
+static void
+removeEntry (tr_resume_db * db, const uint8_t * hash)
+{
+  struct db_entry * entry = findEntry (db, hash);
+
+  if (entry != NULL)
+    {
+      db->live_size -= recordSize (entry);
+      tr_ptrArrayRemoveSortedPointer (&db->entries, entry, compareEntries);
+      entryFree (entry);
+    }
+}
+
+/* reads every record in `buf' into db->entries.
+ * returns how many bytes were good; anything after that is torn or corrupt */
+static size_t
+parseRecords (tr_resume_db * db, const uint8_t * buf, size_t buflen)
+{
+  size_t pos = DB_MAGIC_LEN;
+
+  while (pos + RECORD_HEADER_LEN <= buflen)
+    {
+      const uint8_t * walk = buf + pos;
+      const uint32_t len = readUint32 (walk);
+      const uint32_t crc = readUint32 (walk + 4);
+      const uint8_t * hash = walk + 8;
+      size_t state_len;
+
+      if (len < SHA_DIGEST_LENGTH || len > buflen - pos - 8)
+        break;
+
+      state_len = len - SHA_DIGEST_LENGTH;
+      if (crc != recordChecksum (hash, walk + RECORD_HEADER_LEN, state_len))
+        break;
+
+      if (state_len == 0)
+        removeEntry (db, hash);
+      else
+        setEntry (db, hash, tr_memdup (walk + RECORD_HEADER_LEN, state_len), state_len);
+
+      pos += RECORD_HEADER_LEN + state_len;
+    }
+
+  return pos;
+}
+
+static bool
+openForAppend (tr_resume_db * db, tr_error ** error)
+{
+  db->fd = tr_sys_file_open (db->filename, TR_SYS_FILE_WRITE | TR_SYS_FILE_APPEND, 0, error);
+
+  return db->fd != TR_BAD_SYS_FILE;
+}
+
+static bool
+createFile (tr_resume_db * db, tr_error ** error)
+{
+  tr_sys_file_t fd;
+
+  fd = tr_sys_file_open (db->filename, TR_SYS_FILE_WRITE | TR_SYS_FILE_CREATE | TR_SYS_FILE_TRUNCATE, 0600, error);
+  if (fd == TR_BAD_SYS_FILE)
+    return false;
+
+  if (!writeAll (fd, DB_MAGIC, DB_MAGIC_LEN, error))
+    {
+      tr_sys_file_close (fd, NULL);
+      return false;
+    }
+
+  tr_sys_file_close (fd, NULL);
+  db->file_size = DB_MAGIC_LEN;
+  return true;
+}
+
+/* reads the whole file with one sequential read */
+static bool
+loadFile (tr_resume_db * db, tr_error ** error)
+{
+  size_t len;
+  size_t good_len;
+  uint8_t * buf;
+
+  if ((buf = tr_loadFile (db->filename, &len, error)) == NULL)
+    return false;
+
+  if (len < DB_MAGIC_LEN || memcmp (buf, DB_MAGIC, DB_MAGIC_LEN) != 0)
+    {
+      tr_error_set (error, TR_ERROR_EINVAL, _("\"%s\" isn't a resume database"), db->filename);
+      tr_free (buf);
+      return false;
+    }
+
+  good_len = parseRecords (db, buf, len);
+  tr_free (buf);
+
+  /* drop a record that was torn by a crash, so that new ones follow good ones */
+  if (good_len < len)
+    {
+      tr_sys_file_t fd;
+
+      tr_logAddNamedError (MY_NAME, _("Dropping %zu damaged bytes from the end of \"%s\""),
+                           len - good_len, db->filename);
+
+      fd = tr_sys_file_open (db->filename, TR_SYS_FILE_WRITE, 0, error);
+      if (fd == TR_BAD_SYS_FILE)
+        return false;
+
+      if (!tr_sys_file_truncate (fd, good_len, error))
+        {
+          tr_sys_file_close (fd, NULL);
+          return false;
+        }
+
+      tr_sys_file_close (fd, NULL);
+    }
+
+  db->file_size = good_len;
+  return true;
+}
+
+static bool
+shouldCompact (const tr_resume_db * db)
+{
+  const uint64_t garbage = db->file_size - DB_MAGIC_LEN - db->live_size;
+
+  return garbage >= COMPACT_MIN_GARBAGE && garbage > db->live_size;
+}
+
+/* a rename isn't on disk until the folder holding it is, so flush that too.
+ * Windows can't open a folder as a file, and journals renames anyway */
+static void
+syncParentDir (const char * filename)
+{
+#ifndef _WIN32
+  char * dir;
+  tr_sys_file_t fd;
+  tr_error * error = NULL;
+
+  if ((dir = tr_sys_path_dirname (filename, &error)) != NULL)
+    {
+      fd = tr_sys_file_open (dir, TR_SYS_FILE_READ, 0, &error);
+
+      if (fd != TR_BAD_SYS_FILE)
+        {
+          tr_sys_file_flush (fd, &error);
+          tr_sys_file_close (fd, NULL);
+        }
+    }
+
+  if (error != NULL)
+    {
+      tr_logAddNamedError (MY_NAME, _("Couldn't sync the folder of \"%s\": %s"), filename, error->message);
+      tr_error_free (error);
+    }
+
+  tr_free (dir);
+#else
+  (void) filename;
+#endif
+}
+
+static bool
+compactImpl (tr_resume_db * db, tr_error ** error)
+{
+  int i;
+  bool ok;
+  tr_sys_file_t fd;
+  char * tmp = tr_strdup_printf ("%s.tmp", db->filename);
+  const int n = tr_ptrArraySize (&db->entries);
+
+  fd = tr_sys_file_open (tmp, TR_SYS_FILE_WRITE | TR_SYS_FILE_CREATE | TR_SYS_FILE_TRUNCATE, 0600, error);
+  ok = fd != TR_BAD_SYS_FILE;
+
+  if (ok)
+    ok = writeAll (fd, DB_MAGIC, DB_MAGIC_LEN, error);
+
+  for (i=0; ok && i<n; ++i)
+    {
+      const struct db_entry * entry = tr_ptrArrayNth (&db->entries, i);
+      ok = writeRecord (fd, entry->hash, entry->state, entry->state_len, error);
+    }
+
+  /* the new file must be on disk before it replaces the old one */
+  if (ok)
+    ok = tr_sys_file_flush (fd, error);
+
+  if (fd != TR_BAD_SYS_FILE)
+    tr_sys_file_close (fd, NULL);
+
+  if (ok)
+    {
+      if (db->fd != TR_BAD_SYS_FILE)
+        {
+          tr_sys_file_close (db->fd, NULL);
+          db->fd = TR_BAD_SYS_FILE;
+        }
+
+      ok = tr_sys_path_rename (tmp, db->filename, error);
+
+      if (ok)
+        syncParentDir (db->filename);
+
+      ok = ok && openForAppend (db, error);
+    }
+
+  if (ok)
+    {
+      dbgmsg ("Compacted \"%s\" from %" PRIu64 " to %" PRIu64 " bytes",
+              db->filename, db->file_size, DB_MAGIC_LEN + db->live_size);
+      db->file_size = DB_MAGIC_LEN + db->live_size;
+      db->is_dirty = false;
+    }
+  else
+    {
+      tr_sys_path_remove (tmp, NULL);
+    }
+
+  tr_free (tmp);
+  return ok;
+}
+
+/* a failed write can leave part of a record at the end of the file.
+ * loadFile () stops at the first bad record and drops the rest, so
+ * nothing may be appended after one until it's been cut off */
+static bool
+appendRecord (tr_resume_db   * db,
+              const uint8_t  * hash,
+              const void     * state,
+              size_t           state_len,
+              tr_error      ** error)
+{
+  if (db->is_torn)
+    {
+      if (!compactImpl (db, error))
+        return false;
+
+      db->is_torn = false;
+    }
+
+  if (!writeRecord (db->fd, hash, state, state_len, error))
+    {
+      if (!tr_sys_file_truncate (db->fd, db->file_size, NULL))
+        db->is_torn = true;
+
+      return false;
+    }
+
+  db->file_size += RECORD_HEADER_LEN + state_len;
+  db->is_dirty = true;
+  return true;
+}
+
+/***
+****
+***/
+
+tr_resume_db *
+tr_resumeDbOpen (const char * filename, tr_error ** error)
+{
+  bool ok;
+  tr_resume_db * db = tr_new0 (tr_resume_db, 1);
+
+  db->filename = tr_strdup (filename);
+  db->fd = TR_BAD_SYS_FILE;
+  db->lock = tr_lockNew ();
+  db->entries = TR_PTR_ARRAY_INIT;
+
+  if (tr_sys_path_exists (filename, NULL))
+    ok = loadFile (db, error);
+  else
+    ok = createFile (db, error);
+
+  if (ok && shouldCompact (db))
+    ok = compactImpl (db, error);
+  else if (ok)
+    ok = openForAppend (db, error);
+
+  if (!ok)
+    {
+      tr_ptrArrayDestruct (&db->entries, entryFree);
+      tr_lockFree (db->lock);
+      tr_free (db->filename);
+      tr_free (db);
+      return NULL;
+    }
+
+  tr_logAddNamedInfo (MY_NAME, _("Loaded state for %d torrents from \"%s\""),
+                      tr_ptrArraySize (&db->entries), filename);
+  return db;
+}
+
+void
+tr_resumeDbClose (tr_resume_db * db)
+{
+  tr_error * error = NULL;
+
+  if (db == NULL)
+    return;
+
+  /* checkpoint on the way out, so the next startup reads only live records */
+  if (db->file_size > DB_MAGIC_LEN + db->live_size)
+    {
+      if (!compactImpl (db, &error))
+        {
+          tr_logAddNamedError (MY_NAME, _("Couldn't compact \"%s\": %s"), db->filename, error->message);
+          tr_error_clear (&error);
+        }
+    }
+
+  if (db->fd != TR_BAD_SYS_FILE)
+    {
+      if (db->is_dirty)
+        tr_sys_file_flush (db->fd, NULL);
+      tr_sys_file_close (db->fd, NULL);
+    }
+
+  tr_ptrArrayDestruct (&db->entries, entryFree);
+  tr_lockFree (db->lock);
+  tr_free (db->filename);
+  tr_free (db);
+}
+
+bool
+tr_resumeDbGet (tr_resume_db * db, const uint8_t * hash, tr_variant * setme)
+{
+  bool ok = false;
+  char * state = NULL;
+  size_t state_len = 0;
+  const struct db_entry * entry;
+
+  /* copy it so that the parsing can happen outside of the lock */
+  tr_lockLock (db->lock);
+  if ((entry = findEntry (db, hash)) != NULL)
+    {
+      state = tr_memdup (entry->state, entry->state_len);
+      state_len = entry->state_len;
+    }
+  tr_lockUnlock (db->lock);
+
+  if (state != NULL)
+    {
+      ok = tr_variantFromBenc (setme, state, state_len) == 0;
+      tr_free (state);
+    }
+
+  return ok;
+}
+
+bool
+tr_resumeDbPut (tr_resume_db * db, const uint8_t * hash, const tr_variant * state)
+{
+  size_t len;
+  bool ok = true;
+  tr_error * error = NULL;
+  char * benc = tr_variantToStr (state, TR_VARIANT_FMT_BENC, &len);
+  const struct db_entry * entry;
+
+  tr_lockLock (db->lock);
+
+  entry = findEntry (db, hash);
+
+  /* nothing to do if it hasn't changed since the last save */
+  if (entry != NULL && entry->state_len == len && memcmp (entry->state, benc, len) == 0)
+    {
+      tr_free (benc);
+    }
+  else if (db->fd == TR_BAD_SYS_FILE)
+    {
+      ok = false;
+      tr_free (benc);
+    }
+  else if (!appendRecord (db, hash, benc, len, &error))
+    {
+      tr_logAddNamedError (MY_NAME, _("Couldn't write to \"%s\": %s"), db->filename, error->message);
+      tr_error_free (error);
+      tr_free (benc);
+      ok = false;
+    }
+  else
+    {
+      setEntry (db, hash, benc, len);
+    }
+
+  tr_lockUnlock (db->lock);
+
+  return ok;
+}
+
+void
+tr_resumeDbRemove (tr_resume_db * db, const uint8_t * hash)
+{
+  tr_error * error = NULL;
+
+  tr_lockLock (db->lock);
+
+  if (findEntry (db, hash) != NULL && db->fd != TR_BAD_SYS_FILE)
+    {
+      if (!appendRecord (db, hash, NULL, 0, &error))
+        {
+          tr_logAddNamedError (MY_NAME, _("Couldn't write to \"%s\": %s"), db->filename, error->message);
+          tr_error_free (error);
+        }
+      else
+        {
+          removeEntry (db, hash);
+        }
+    }
+
+  tr_lockUnlock (db->lock);
+}
+
+void
+tr_resumeDbFlush (tr_resume_db * db)
+{
+  tr_error * error = NULL;
+
+  tr_lockLock (db->lock);
+
+  if (shouldCompact (db))
+    {
+      if (!compactImpl (db, &error))
+        {
+          tr_logAddNamedError (MY_NAME, _("Couldn't compact \"%s\": %s"), db->filename, error->message);
+          tr_error_clear (&error);
+        }
+    }
+
+  if (db->is_dirty && db->fd != TR_BAD_SYS_FILE)
+    {
+      if (tr_sys_file_flush (db->fd, &error))
+        {
+          db->is_dirty = false;
+        }
+      else
+        {
+          tr_logAddNamedError (MY_NAME, _("Couldn't save \"%s\": %s"), db->filename, error->message);
+          tr_error_clear (&error);
+        }
+    }
+
+  tr_lockUnlock (db->lock);
+}
+
+bool
+tr_resumeDbCompact (tr_resume_db * db)
+{
+  bool ok;
+  tr_error * error = NULL;
+
+  tr_lockLock (db->lock);
+
+  if (!(ok = compactImpl (db, &error)))
+    {
+      tr_logAddNamedError (MY_NAME, _("Couldn't compact \"%s\": %s"), db->filename, error->message);
+      tr_error_free (error);
+    }
+
+  tr_lockUnlock (db->lock);
+
+  return ok;
+}
+
+int
+tr_resumeDbCount (const tr_resume_db * db)
+{
+  int ret;
+
+  tr_lockLock (db->lock);
+  ret = tr_ptrArraySize (&db->entries);
+  tr_lockUnlock (db->lock);
+
+  return ret;
+}
+
+uint64_t
+tr_resumeDbGetSize (const tr_resume_db * db)
+{
+  uint64_t ret;
+
+  tr_lockLock (db->lock);
+  ret = db->file_size;
+  tr_lockUnlock (db->lock);
+
+  return ret;
+}
@@ -0,0 +1,65 @@
+/*
+ * This file Copyright (C) 2016 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ * $Id$
+ */
+
+#ifndef __TRANSMISSION__
+ #error only libtransmission should #include this header.
+#endif
+
+#pragma once
+
+/**
+ * A single file that holds every torrent's resume state, as an
+ * alternative to one .resume file per torrent.
+ *
+ * Saves are appended to the end of the file as checksummed records
+ * keyed by info hash. The whole file is read at once when it's opened,
+ * and the newest record for each torrent wins. If the last record was
+ * only partly written (say, because of a crash), it's dropped.
+ *
+ * Once enough of the file is outdated records, it's compacted: the
+ * live records are written to a temporary file, which is synced to disk
+ * and then renamed over the old one.
+ *
+ * All of these may be called from any thread.
+ */
+
+struct tr_error;
+struct tr_variant;
+
+typedef struct tr_resume_db tr_resume_db;
+
+tr_resume_db * tr_resumeDbOpen    (const char              * filename,
+                                   struct tr_error        ** error);
+
+/** @brief compacts the database if it's worth it, then frees it */
+void           tr_resumeDbClose   (tr_resume_db            * db);
+
+/** @brief gets a copy of the newest state saved for `hash' */
+bool           tr_resumeDbGet     (tr_resume_db            * db,
+                                   const uint8_t           * hash,
+                                   struct tr_variant       * setme);
+
+bool           tr_resumeDbPut     (tr_resume_db            * db,
+                                   const uint8_t           * hash,
+                                   const struct tr_variant * state);
+
+void           tr_resumeDbRemove  (tr_resume_db            * db,
+                                   const uint8_t           * hash);
+
+/** @brief syncs recent saves to disk, and compacts the file if needed */
+void           tr_resumeDbFlush   (tr_resume_db            * db);
+
+/** @brief rewrites the file with only the newest state of each torrent */
+bool           tr_resumeDbCompact (tr_resume_db            * db);
+
+/** @brief how many torrents have state in the database */
+int            tr_resumeDbCount   (const tr_resume_db      * db);
+
+/** @brief the database's size on disk, in bytes */
+uint64_t       tr_resumeDbGetSize (const tr_resume_db      * db);
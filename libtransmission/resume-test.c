@@ -0,0 +1,123 @@
+/*
+ * This file Copyright (C) 2016 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ * $Id$
+ */
+
+#include <string.h> /* strstr () */
+#include <time.h> /* time () */
+
+#include "transmission.h"
+#include "file.h"
+#include "metainfo.h" /* tr_metainfoGetBasename () */
+#include "platform.h" /* tr_getResumeDir () */
+#include "resume.h"
+#include "save-queue.h"
+#include "session.h" /* tr_resume_save_stats */
+#include "torrent.h"
+#include "utils.h"
+
+#include "libtransmission-test.h"
+
+static tr_session * session = NULL;
+
+/***
+****
+***/
+
+static int
+test_save_reuses_sections (void)
+{
+  uint64_t loaded;
+  tr_ctor * ctor;
+  tr_torrent * tor;
+  struct tr_resume_save_stats stats;
+
+  tor = libttest_zero_torrent_init (session);
+  libttest_zero_torrent_populate (tor, true);
+  ctor = tr_ctorNew (session);
+
+  /* saving again without any changes reuses the costly sections... */
+  tr_torrentSaveResume (tor);
+  stats = session->resumeSaveStats;
+  tr_torrentSaveResume (tor);
+  check_uint_eq (stats.sectionsRebuilt, session->resumeSaveStats.sectionsRebuilt);
+  check (stats.sectionsReused < session->resumeSaveStats.sectionsReused);
+  check_uint_eq (stats.mtimesRead, session->resumeSaveStats.mtimesRead);
+
+  /* ...but a rename since the last save still gets saved */
+  check_int_eq (0, libttest_torrentRenameAndWait (tor, "files-filled-with-zeroes/512", "foo"));
+  tr_torrentSaveResume (tor);
+  check (stats.sectionsRebuilt < session->resumeSaveStats.sectionsRebuilt);
+  tr_free (tor->info.files[2].name);
+  tor->info.files[2].name = tr_strdup ("gabba gabba hey");
+  loaded = tr_torrentLoadResume (tor, ~0, ctor);
+  check ((loaded & TR_FR_FILENAMES) != 0);
+  check_streq ("files-filled-with-zeroes/foo", tor->info.files[2].name);
+
+  tr_ctorFree (ctor);
+  tr_torrentRemove (tor, false, NULL);
+  return 0;
+}
+
+static int
+test_save_failure_sets_error (void)
+{
+  char * base;
+  char * filename;
+  char * child;
+  tr_torrent * tor;
+  const time_t deadline = time (NULL) + 10;
+
+  while (tr_sessionCountTorrents (session) > 0)
+    tr_wait_msec (10);
+
+  tor = libttest_zero_torrent_init (session);
+  libttest_zero_torrent_populate (tor, true);
+  check_int_eq (TR_STAT_OK, tor->error);
+
+  /* a file can't be renamed over a folder that isn't empty */
+  base = tr_metainfoGetBasename (&tor->info);
+  filename = tr_strdup_printf ("%s/%s.resume", tr_getResumeDir (session), base);
+  child = tr_buildPath (filename, "child", NULL);
+  tr_sys_path_remove (filename, NULL);
+  tr_sys_dir_create (filename, 0, 0700, NULL);
+  libtest_create_file_with_string_contents (child, "hello");
+
+  /* the background write fails, and the torrent hears about it */
+  tr_torrentSaveResume (tor);
+  tr_saveQueueFlush (session->saveQueue);
+  while (tor->error == TR_STAT_OK && time (NULL) < deadline)
+    tr_wait_msec (10);
+  check_int_eq (TR_STAT_LOCAL_ERROR, tor->error);
+  check (strstr (tor->errorString, "Unable to save resume file") != NULL);
+
+  tr_sys_path_remove (child, NULL);
+  tr_sys_path_remove (filename, NULL);
+  tr_free (child);
+  tr_free (filename);
+  tr_free (base);
+  tr_torrentRemove (tor, false, NULL);
+  return 0;
+}
+
+/***
+****
+***/
+
+int
+main (void)
+{
+  int ret;
+  const testFunc tests[] = { test_save_reuses_sections,
+                             test_save_failure_sets_error };
+
+  session = libttest_session_init (NULL);
+  ret = runTests (tests, NUM_TESTS (tests));
+  libttest_session_close (session);
+
+  return ret;
+}
@@ -13,13 +13,17 @@
 #include "completion.h"
 #include "error.h"
 #include "file.h"
+#include "list.h"
 #include "log.h"
 #include "metainfo.h" /* tr_metainfoGetBasename () */
 #include "peer-mgr.h" /* pex */
 #include "platform.h" /* tr_getResumeDir () */
 #include "resume.h"
+#include "resume-db.h"
+#include "save-queue.h"
 #include "session.h"
 #include "torrent.h"
+#include "trevent.h" /* tr_runInEventThread () */
 #include "utils.h" /* tr_buildPath */
 #include "variant.h"
 
@@ -29,15 +33,27 @@ enum
 };
 
 static char*
-getResumeFilename (const tr_torrent * tor)
+getResumeFilenameFromInfo (const tr_session * session, const tr_info * info)
 {
-  char * base = tr_metainfoGetBasename (tr_torrentInfo (tor));
+  char * base = tr_metainfoGetBasename (info);
   char * filename = tr_strdup_printf ("%s" TR_PATH_DELIMITER_STR "%s.resume",
-                                      tr_getResumeDir (tor->session), base);
+                                      tr_getResumeDir (session), base);
   tr_free (base);
   return filename;
 }
 
+static char*
+getResumeFilename (const tr_torrent * tor)
+{
+  return getResumeFilenameFromInfo (tor->session, &tor->info);
+}
+
+static bool
+useResumeDb (const tr_session * session)
+{
+  return session->isResumeDbEnabled && session->resumeDb != NULL;
+}
+
 /***
 ****
 ***/
@@ -110,14 +126,13 @@ loadPeers (tr_variant * dict, tr_torrent * tor)
 ***/
 
 static void
-saveDND (tr_variant * dict, const tr_torrent * tor)
+buildDND (tr_variant * list, const tr_torrent * tor)
 {
-  tr_variant * list;
   tr_file_index_t i;
-  const tr_info * const inf = tr_torrentInfo (tor);
+  const tr_info * const inf = &tor->info;
   const tr_file_index_t n = inf->fileCount;
 
-  list = tr_variantDictAddList (dict, TR_KEY_dnd, n);
+  tr_variantInitList (list, n);
   for (i=0; i<n; ++i)
     tr_variantListAddInt (list, inf->files[i].dnd ? 1 : 0);
 }
@@ -175,14 +190,13 @@ loadDND (tr_variant * dict, tr_torrent * tor)
 ***/
 
 static void
-saveFilePriorities (tr_variant * dict, const tr_torrent * tor)
+buildFilePriorities (tr_variant * list, const tr_torrent * tor)
 {
-  tr_variant * list;
   tr_file_index_t i;
-  const tr_info * const inf = tr_torrentInfo (tor);
+  const tr_info * const inf = &tor->info;
   const tr_file_index_t n = inf->fileCount;
 
-  list = tr_variantDictAddList (dict, TR_KEY_priority, n);
+  tr_variantInitList (list, n);
   for (i=0; i<n; ++i)
     tr_variantListAddInt (list, inf->files[i].priority);
 }
@@ -366,7 +380,76 @@ loadName (tr_variant * dict, tr_torrent * tor)
 ***/
 
 static void
-saveFilenames (tr_variant * dict, const tr_torrent * tor)
+saveBandwidthGroup (tr_variant * dict, const tr_torrent * tor)
+{
+  const char * group = tr_torrentGetBandwidthGroup (tor);
+
+  if (group != NULL)
+    tr_variantDictAddStr (dict, TR_KEY_group, group);
+}
+
+static uint64_t
+loadBandwidthGroup (tr_variant * dict, tr_torrent * tor)
+{
+  uint64_t ret = 0;
+  const char * group;
+
+  if (tr_variantDictFindStr (dict, TR_KEY_group, &group, NULL))
+    {
+      tr_torrentSetBandwidthGroup (tor, group);
+      ret = TR_FR_BANDWIDTH_GROUP;
+    }
+
+  return ret;
+}
+
+/***
+****
+***/
+
+static void
+saveDataFingerprint (tr_variant * dict, tr_torrent * tor)
+{
+  tr_variant * d;
+  tr_data_fingerprint fp;
+
+  if (tr_torrentGetDataFingerprint (tor, &fp))
+    {
+      d = tr_variantDictAddDict (dict, TR_KEY_data_fingerprint, 2);
+      tr_variantDictAddStr (d, TR_KEY_path, fp.dir);
+      tr_variantDictAddInt (d, TR_KEY_mtime, fp.mtime);
+      tr_free (fp.dir);
+    }
+}
+
+static uint64_t
+loadDataFingerprint (tr_variant * dict, tr_torrent * tor)
+{
+  uint64_t ret = 0;
+  tr_variant * d;
+  const char * dir;
+  int64_t mtime;
+
+  if (tr_variantDictFindDict (dict, TR_KEY_data_fingerprint, &d)
+      && tr_variantDictFindStr (d, TR_KEY_path, &dir, NULL)
+      && tr_variantDictFindInt (d, TR_KEY_mtime, &mtime))
+    {
+      tr_free (tor->dataFingerprint.dir);
+      tor->dataFingerprint.dir = tr_strdup (dir);
+      tor->dataFingerprint.mtime = mtime;
+      ret = TR_FR_DATA_FINGERPRINT;
+    }
+
+  return ret;
+}
+
+/***
+****
+***/
+
+/* leaves `list' empty if no files were renamed */
+static void
+buildFilenames (tr_variant * list, const tr_torrent * tor)
 {
   tr_file_index_t i;
   bool any_renamed;
@@ -377,13 +460,11 @@ saveFilenames (tr_variant * dict, const tr_torrent * tor)
   for (i=0; !any_renamed && i<n; ++i)
     any_renamed = files[i].is_renamed;
 
-  if (any_renamed)
-    {
-      tr_variant * list = tr_variantDictAddList (dict, TR_KEY_files, n);
+  tr_variantInitList (list, any_renamed ? n : 0);
 
-      for (i=0; i<n; ++i)
-        tr_variantListAddStr (list, files[i].is_renamed ? files[i].name : "");
-    }
+  if (any_renamed)
+    for (i=0; i<n; ++i)
+      tr_variantListAddStr (list, files[i].is_renamed ? files[i].name : "");
 }
 
 static uint64_t
@@ -442,73 +523,236 @@ bitfieldToBenc (const tr_bitfield * b, tr_variant * benc)
 
 
 static void
-saveProgress (tr_variant * dict, tr_torrent * tor)
+buildFileTimeChecked (tr_variant * setme, tr_torrent * tor, tr_file_index_t fi, time_t now)
 {
-  tr_variant * l;
-  tr_variant * prog;
-  tr_file_index_t fi;
-  const tr_info * inf = tr_torrentInfo (tor);
-  const time_t now = tr_time ();
-
-  prog = tr_variantDictAddDict (dict, TR_KEY_progress, 3);
-
-  /* add the file/piece check timestamps... */
-  l = tr_variantDictAddList (prog, TR_KEY_time_checked, inf->fileCount);
-  for (fi=0; fi<inf->fileCount; ++fi)
-    {
-      const tr_piece * p;
-      const tr_piece * pend;
-      time_t oldest_nonzero = now;
-      time_t newest = 0;
-      bool has_zero = false;
-      const time_t mtime = tr_torrentGetFileMTime (tor, fi);
-      const tr_file * f = &inf->files[fi];
-
-      /* get the oldest and newest nonzero timestamps for pieces in this file */
-      for (p=&inf->pieces[f->firstPiece], pend=&inf->pieces[f->lastPiece]; p!=pend; ++p)
-        {
-          if (!p->timeChecked)
-            has_zero = true;
-          else if (oldest_nonzero > p->timeChecked)
-            oldest_nonzero = p->timeChecked;
+  const time_t * p;
+  const time_t * pend;
+  time_t oldest_nonzero = now;
+  time_t newest = 0;
+  bool has_zero = false;
+  const tr_info * inf = &tor->info;
+  const time_t mtime = tr_torrentGetFileMTime (tor, fi);
+  const tr_file * f = &inf->files[fi];
+
+  /* get the oldest and newest nonzero timestamps for pieces in this file */
+  for (p=&tor->pieceTimeChecked[f->firstPiece], pend=&tor->pieceTimeChecked[f->lastPiece]; p!=pend; ++p)
+    {
+      if (!*p)
+        has_zero = true;
+      else if (oldest_nonzero > *p)
+        oldest_nonzero = *p;
 
-          if (newest < p->timeChecked)
-            newest = p->timeChecked;
-        }
+      if (newest < *p)
+        newest = *p;
+    }
 
-      /* If some of a file's pieces have been checked more recently than
-         the file's mtime, and some less recently, then that file will
-         have a list containing timestamps for each piece.
+  /* If some of a file's pieces have been checked more recently than
+     the file's mtime, and some less recently, then that file will
+     have a list containing timestamps for each piece.
 
-         However, the most common use case is that the file doesn't change
-         after it's downloaded. To reduce overhead in the .resume file,
-         only a single timestamp is saved for the file if *all* or *none*
-         of the pieces were tested more recently than the file's mtime. */
+     However, the most common use case is that the file doesn't change
+     after it's downloaded. To reduce overhead in the .resume file,
+     only a single timestamp is saved for the file if *all* or *none*
+     of the pieces were tested more recently than the file's mtime. */
 
-      if (!has_zero && (mtime <= oldest_nonzero)) /* all checked */
-        {
-          tr_variantListAddInt (l, oldest_nonzero);
-        }
-      else if (newest < mtime) /* none checked */
-        {
-          tr_variantListAddInt (l, newest);
-        }
-      else /* some are checked, some aren't... so list piece by piece */
+  if (!has_zero && (mtime <= oldest_nonzero)) /* all checked */
+    {
+      tr_variantInitInt (setme, oldest_nonzero);
+    }
+  else if (newest < mtime) /* none checked */
+    {
+      tr_variantInitInt (setme, newest);
+    }
+  else /* some are checked, some aren't... so list piece by piece */
+    {
+      const int offset = oldest_nonzero - 1;
+      tr_variantInitList (setme, 2 + f->lastPiece - f->firstPiece);
+      tr_variantListAddInt (setme, offset);
+      for (p=&tor->pieceTimeChecked[f->firstPiece], pend=&tor->pieceTimeChecked[f->lastPiece]+1; p!=pend; ++p)
+        tr_variantListAddInt (setme, *p ? *p - offset : 0);
+    }
+}
+
+/***
+****  The sections above that cost the most to build -- the blocks
+****  bitfield, the per-file check times (a stat () per file), and the
+****  per-file priorities, dnd flags and names -- are kept between saves
+****  and only rebuilt when tr_resumeSetDirty () or tr_resumeSetPieceChecked ()
+****  says they changed.
+****
+****  A file's check time is only rebuilt when one of its pieces is checked.
+****  Its mtime can change in between (say, as more blocks are written), but
+****  mtimes only move forward, so the saved time can only become more
+****  conservative: pieces checked before the new mtime get rechecked.
+***/
+
+enum
+{
+  CACHED_FIELDS = TR_FR_PROGRESS | TR_FR_DND | TR_FR_FILE_PRIORITIES | TR_FR_FILENAMES,
+
+  /* blocks, time_checked, dnd, priority, files */
+  CACHED_SECTION_COUNT = 5
+};
+
+struct tr_resume_cache
+{
+  /* which of CACHED_FIELDS changed since the last save */
+  uint64_t dirty;
+
+  /* pieces whose timeChecked changed since the last save */
+  tr_bitfield checkedPieces;
+
+  tr_variant blocks;
+  tr_variant timeChecked;
+  tr_variant dnd;
+  tr_variant priority;
+  tr_variant filenames;
+};
+
+void
+tr_resumeSetDirty (tr_torrent * tor, uint64_t fields)
+{
+  if (tor->resumeCache != NULL)
+    tor->resumeCache->dirty |= fields;
+}
+
+void
+tr_resumeSetPieceChecked (tr_torrent * tor, tr_piece_index_t piece)
+{
+  struct tr_resume_cache * cache = tor->resumeCache;
+
+  if (cache != NULL && piece < cache->checkedPieces.bit_count)
+    tr_bitfieldAdd (&cache->checkedPieces, piece);
+}
+
+void
+tr_resumeFreeCache (tr_torrent * tor)
+{
+  struct tr_resume_cache * cache = tor->resumeCache;
+
+  if (cache != NULL)
+    {
+      tr_bitfieldDestruct (&cache->checkedPieces);
+      tr_variantFree (&cache->blocks);
+      tr_variantFree (&cache->timeChecked);
+      tr_variantFree (&cache->dnd);
+      tr_variantFree (&cache->priority);
+      tr_variantFree (&cache->filenames);
+      tr_free (cache);
+      tor->resumeCache = NULL;
+    }
+}
+
+static struct tr_resume_cache *
+getResumeCache (tr_torrent * tor)
+{
+  struct tr_resume_cache * cache = tor->resumeCache;
+
+  if (cache == NULL)
+    {
+      tr_file_index_t fi;
+      const tr_file_index_t n = tor->info.fileCount;
+
+      cache = tr_new0 (struct tr_resume_cache, 1);
+      cache->dirty = CACHED_FIELDS;
+      tr_bitfieldConstruct (&cache->checkedPieces, tor->info.pieceCount);
+      tr_bitfieldSetHasAll (&cache->checkedPieces);
+      tr_variantInitBool (&cache->blocks, false);
+      tr_variantInitBool (&cache->dnd, false);
+      tr_variantInitBool (&cache->priority, false);
+      tr_variantInitBool (&cache->filenames, false);
+      tr_variantInitList (&cache->timeChecked, n);
+      for (fi=0; fi<n; ++fi)
+        tr_variantListAddInt (&cache->timeChecked, 0);
+
+      tor->resumeCache = cache;
+    }
+
+  return cache;
+}
+
+static void
+updateResumeCache (tr_torrent * tor, struct tr_resume_cache * cache)
+{
+  int rebuilt = 0;
+  struct tr_resume_save_stats * stats = &tor->session->resumeSaveStats;
+
+  if (cache->dirty & TR_FR_PROGRESS)
+    {
+      tr_variantFree (&cache->blocks);
+      bitfieldToBenc (&tor->completion.blockBitfield, &cache->blocks);
+      ++rebuilt;
+    }
+
+  if (!tr_bitfieldHasNone (&cache->checkedPieces))
+    {
+      tr_file_index_t fi;
+      const time_t now = tr_time ();
+      const tr_info * inf = &tor->info;
+
+      for (fi=0; fi<inf->fileCount; ++fi)
         {
-          const int offset = oldest_nonzero - 1;
-          tr_variant * ll = tr_variantListAddList (l, 2 + f->lastPiece - f->firstPiece);
-          tr_variantListAddInt (ll, offset);
-          for (p=&inf->pieces[f->firstPiece], pend=&inf->pieces[f->lastPiece]+1; p!=pend; ++p)
-            tr_variantListAddInt (ll, p->timeChecked ? p->timeChecked - offset : 0);
+          const tr_file * f = &inf->files[fi];
+
+          if (tr_bitfieldCountRange (&cache->checkedPieces, f->firstPiece, f->lastPiece + 1) > 0)
+            {
+              tr_variant * child = tr_variantListChild (&cache->timeChecked, fi);
+              tr_variantFree (child);
+              buildFileTimeChecked (child, tor, fi, now);
+              ++stats->mtimesRead;
+            }
         }
+
+      tr_bitfieldSetHasNone (&cache->checkedPieces);
+      ++rebuilt;
     }
 
-  /* add the progress */
-  if (tor->completeness == TR_SEED)
-    tr_variantDictAddStr (prog, TR_KEY_have, "all");
+  if (cache->dirty & TR_FR_DND)
+    {
+      tr_variantFree (&cache->dnd);
+      buildDND (&cache->dnd, tor);
+      ++rebuilt;
+    }
 
-  /* add the blocks bitfield */
-  bitfieldToBenc (&tor->completion.blockBitfield, tr_variantDictAdd (prog, TR_KEY_blocks));
+  if (cache->dirty & TR_FR_FILE_PRIORITIES)
+    {
+      tr_variantFree (&cache->priority);
+      buildFilePriorities (&cache->priority, tor);
+      ++rebuilt;
+    }
+
+  if (cache->dirty & TR_FR_FILENAMES)
+    {
+      tr_variantFree (&cache->filenames);
+      buildFilenames (&cache->filenames, tor);
+      ++rebuilt;
+    }
+
+  cache->dirty = 0;
+  stats->sectionsRebuilt += rebuilt;
+  stats->sectionsReused += CACHED_SECTION_COUNT - rebuilt;
+}
+
+/* lends a cached section to `dict' for as long as it takes to save it */
+static void
+lendSection (tr_variant * dict, tr_quark key, const tr_variant * section)
+{
+  tr_variant * child = tr_variantDictAdd (dict, key);
+
+  *child = *section;
+  child->key = key;
+}
+
+static void
+reclaimSection (tr_variant * dict, tr_quark key, tr_variant * section)
+{
+  tr_variant * child = tr_variantDictFind (dict, key);
+
+  if (child != NULL)
+    {
+      *section = *child;
+      tr_variantInitBool (child, false);
+    }
 }
 
 static uint64_t
@@ -517,10 +761,10 @@ loadProgress (tr_variant * dict, tr_torrent * tor)
   size_t i, n;
   uint64_t ret = 0;
   tr_variant * prog;
-  const tr_info * inf = tr_torrentInfo (tor);
+  const tr_info * inf = &tor->info;
 
   for (i=0, n=inf->pieceCount; i<n; ++i)
-    inf->pieces[i].timeChecked = 0;
+    tor->pieceTimeChecked[i] = 0;
 
   if (tr_variantDictFindDict (dict, TR_KEY_progress, &prog))
     {
@@ -551,15 +795,15 @@ loadProgress (tr_variant * dict, tr_torrent * tor)
             {
               tr_variant * b = tr_variantListChild (l, fi);
               const tr_file * f = &inf->files[fi];
-              tr_piece * p = &inf->pieces[f->firstPiece];
-              const tr_piece * pend = &inf->pieces[f->lastPiece]+1;
+              time_t * p = &tor->pieceTimeChecked[f->firstPiece];
+              const time_t * pend = &tor->pieceTimeChecked[f->lastPiece]+1;
 
               if (tr_variantIsInt (b))
                 {
                   int64_t t;
                   tr_variantGetInt (b, &t);
                   for (; p!=pend; ++p)
-                    p->timeChecked = (time_t)t;
+                    *p = (time_t)t;
                 }
               else if (tr_variantIsList (b))
                 {
@@ -573,7 +817,7 @@ loadProgress (tr_variant * dict, tr_torrent * tor)
                     {
                       int64_t t = 0;
                       tr_variantGetInt (tr_variantListChild (b, i+1), &t);
-                      inf->pieces[f->firstPiece+i].timeChecked = (time_t)(t ? t + offset : 0);
+                      tor->pieceTimeChecked[f->firstPiece+i] = (time_t)(t ? t + offset : 0);
                     }
                 }
             }
@@ -593,13 +837,13 @@ loadProgress (tr_variant * dict, tr_torrent * tor)
               if (tr_variantGetInt (tr_variantListChild (l, fi), &t))
                 {
                   const tr_file * f = &inf->files[fi];
-                  tr_piece * p = &inf->pieces[f->firstPiece];
-                  const tr_piece * pend = &inf->pieces[f->lastPiece];
+                  time_t * p = &tor->pieceTimeChecked[f->firstPiece];
+                  const time_t * pend = &tor->pieceTimeChecked[f->lastPiece];
                   const time_t mtime = tr_torrentGetFileMTime (tor, fi);
                   const time_t timeChecked = mtime==t ? mtime : 0;
 
                   for (; p!=pend; ++p)
-                    p->timeChecked = timeChecked;
+                    *p = timeChecked;
                 }
             }
         }
@@ -650,16 +894,80 @@ loadProgress (tr_variant * dict, tr_torrent * tor)
 ****
 ***/
 
+struct save_failure
+{
+  tr_session * session;
+  char * filename;
+  char * errmsg;
+};
+
+static void
+onSaveFailed (void * vfailure)
+{
+  tr_torrent * tor = NULL;
+  struct save_failure * failure = vfailure;
+
+  tr_sessionLock (failure->session);
+
+  while ((tor = tr_torrentNext (failure->session, tor)))
+    {
+      char * filename = getResumeFilename (tor);
+      const bool match = !strcmp (filename, failure->filename);
+
+      tr_free (filename);
+
+      if (match)
+        {
+          tr_torrentSetLocalError (tor, "Unable to save resume file: %s", failure->errmsg);
+          break;
+        }
+    }
+
+  tr_sessionUnlock (failure->session);
+
+  tr_free (failure->errmsg);
+  tr_free (failure->filename);
+  tr_free (failure);
+}
+
+void
+tr_resumeSaveFailed (const char * filename,
+                     const char * errmsg,
+                     void       * vsession)
+{
+  struct save_failure * failure;
+  tr_session * session = vsession;
+
+  /* the torrents are gone by the time the session's last saves are written */
+  if (session->isClosing)
+    return;
+
+  failure = tr_new (struct save_failure, 1);
+  failure->session = session;
+  failure->filename = tr_strdup (filename);
+  failure->errmsg = tr_strdup (errmsg);
+  tr_runInEventThread (session, onSaveFailed, failure);
+}
+
 void
 tr_torrentSaveResume (tr_torrent * tor)
 {
-  int err;
   tr_variant top;
   char * filename;
+  tr_variant * prog = NULL;
+  struct tr_resume_cache * cache = NULL;
+  struct timeval begin;
+  struct timeval end;
 
   if (!tr_isTorrent (tor))
     return;
 
+  /* the file and piece tables are part of what gets saved */
+  if (tr_torrentHasMetadata (tor) && !tr_torrentPageIn (tor))
+    return;
+
+  tr_gettimeofday (&begin);
+
   tr_variantInitDict (&top, 50); /* arbitrary "big enough" number */
   tr_variantDictAddInt (&top, TR_KEY_seeding_time_seconds, tor->secondsSeeding);
   tr_variantDictAddInt (&top, TR_KEY_downloading_time_seconds, tor->secondsDownloading);
@@ -678,61 +986,82 @@ tr_torrentSaveResume (tr_torrent * tor)
   savePeers (&top, tor);
   if (tr_torrentHasMetadata (tor))
     {
-      saveFilePriorities (&top, tor);
-      saveDND (&top, tor);
-      saveProgress (&top, tor);
+      cache = getResumeCache (tor);
+      updateResumeCache (tor, cache);
+
+      lendSection (&top, TR_KEY_priority, &cache->priority);
+      lendSection (&top, TR_KEY_dnd, &cache->dnd);
+      if (tr_variantListSize (&cache->filenames) > 0)
+        lendSection (&top, TR_KEY_files, &cache->filenames);
+
+      prog = tr_variantDictAddDict (&top, TR_KEY_progress, 3);
+      lendSection (prog, TR_KEY_time_checked, &cache->timeChecked);
+      if (tor->completeness == TR_SEED)
+        tr_variantDictAddStr (prog, TR_KEY_have, "all");
+      lendSection (prog, TR_KEY_blocks, &cache->blocks);
     }
   saveSpeedLimits (&top, tor);
   saveRatioLimits (&top, tor);
   saveIdleLimits (&top, tor);
-  saveFilenames (&top, tor);
   saveName (&top, tor);
+  saveBandwidthGroup (&top, tor);
+  saveDataFingerprint (&top, tor);
 
-  filename = getResumeFilename (tor);
-  if ((err = tr_variantToFile (&top, TR_VARIANT_FMT_BENC, filename)))
-    tr_torrentSetLocalError (tor, "Unable to save resume file: %s", tr_strerror (err));
-  tr_free (filename);
+  if (useResumeDb (tor->session))
+    {
+      if (!tr_resumeDbPut (tor->session->resumeDb, tor->info.hash, &top))
+        tr_torrentSetLocalError (tor, "Unable to save resume state to the database");
+    }
+  else
+    {
+      int err;
+
+      /* written in the background, along with other torrents' saves.
+       * if that fails, tr_resumeSaveFailed () sets the error instead */
+      filename = getResumeFilename (tor);
+      if ((err = tr_saveQueueAdd (tor->session->saveQueue, filename, &top, TR_VARIANT_FMT_BENC)))
+        tr_torrentSetLocalError (tor, "Unable to save resume file: %s", tr_strerror (err));
+      tr_free (filename);
+    }
+
+  if (cache != NULL)
+    {
+      reclaimSection (&top, TR_KEY_priority, &cache->priority);
+      reclaimSection (&top, TR_KEY_dnd, &cache->dnd);
+      reclaimSection (&top, TR_KEY_files, &cache->filenames);
+      reclaimSection (prog, TR_KEY_time_checked, &cache->timeChecked);
+      reclaimSection (prog, TR_KEY_blocks, &cache->blocks);
+    }
 
   tr_variantFree (&top);
+
+  tr_gettimeofday (&end);
+  tor->session->resumeSaveStats.saveCount++;
+  tor->session->resumeSaveStats.saveUsec += (end.tv_sec - begin.tv_sec) * 1000000
+                                          + (end.tv_usec - begin.tv_usec);
 }
 
 static uint64_t
-loadFromFile (tr_torrent * tor, uint64_t fieldsToLoad)
+loadFromVariant (tr_torrent * tor, uint64_t fieldsToLoad, tr_variant * top)
 {
   size_t len;
   int64_t  i;
   const char * str;
-  char * filename;
-  tr_variant top;
   bool boolVal;
   uint64_t fieldsLoaded = 0;
   const bool wasDirty = tor->isDirty;
-  tr_error * error = NULL;
 
   assert (tr_isTorrent (tor));
 
-  filename = getResumeFilename (tor);
-
-  if (!tr_variantFromFile (&top, TR_VARIANT_FMT_BENC, filename, &error))
-    {
-      tr_logAddTorDbg (tor, "Couldn't read \"%s\": %s", filename, error->message);
-      tr_error_free (error);
-
-      tr_free (filename);
-      return fieldsLoaded;
-    }
-
-  tr_logAddTorDbg (tor, "Read resume file \"%s\"", filename);
-
   if ((fieldsToLoad & TR_FR_CORRUPT)
-      && tr_variantDictFindInt (&top, TR_KEY_corrupt, &i))
+      && tr_variantDictFindInt (top, TR_KEY_corrupt, &i))
     {
       tor->corruptPrev = i;
       fieldsLoaded |= TR_FR_CORRUPT;
     }
 
   if ((fieldsToLoad & (TR_FR_PROGRESS | TR_FR_DOWNLOAD_DIR))
-      && (tr_variantDictFindStr (&top, TR_KEY_destination, &str, &len))
+      && (tr_variantDictFindStr (top, TR_KEY_destination, &str, &len))
       && (str && *str))
     {
       const bool is_current_dir = tor->currentDir == tor->downloadDir;
@@ -744,7 +1073,7 @@ loadFromFile (tr_torrent * tor, uint64_t fieldsToLoad)
     }
 
   if ((fieldsToLoad & (TR_FR_PROGRESS | TR_FR_INCOMPLETE_DIR))
-      && (tr_variantDictFindStr (&top, TR_KEY_incomplete_dir, &str, &len))
+      && (tr_variantDictFindStr (top, TR_KEY_incomplete_dir, &str, &len))
       && (str && *str))
     {
       const bool is_current_dir = tor->currentDir == tor->incompleteDir;
@@ -756,70 +1085,70 @@ loadFromFile (tr_torrent * tor, uint64_t fieldsToLoad)
     }
 
   if ((fieldsToLoad & TR_FR_DOWNLOADED)
-      && tr_variantDictFindInt (&top, TR_KEY_downloaded, &i))
+      && tr_variantDictFindInt (top, TR_KEY_downloaded, &i))
     {
       tor->downloadedPrev = i;
       fieldsLoaded |= TR_FR_DOWNLOADED;
     }
 
   if ((fieldsToLoad & TR_FR_UPLOADED)
-      && tr_variantDictFindInt (&top, TR_KEY_uploaded, &i))
+      && tr_variantDictFindInt (top, TR_KEY_uploaded, &i))
     {
       tor->uploadedPrev = i;
       fieldsLoaded |= TR_FR_UPLOADED;
     }
 
   if ((fieldsToLoad & TR_FR_MAX_PEERS)
-      && tr_variantDictFindInt (&top, TR_KEY_max_peers, &i))
+      && tr_variantDictFindInt (top, TR_KEY_max_peers, &i))
     {
       tor->maxConnectedPeers = i;
       fieldsLoaded |= TR_FR_MAX_PEERS;
     }
 
   if ((fieldsToLoad & TR_FR_RUN)
-      && tr_variantDictFindBool (&top, TR_KEY_paused, &boolVal))
+      && tr_variantDictFindBool (top, TR_KEY_paused, &boolVal))
     {
       tor->isRunning = !boolVal;
       fieldsLoaded |= TR_FR_RUN;
     }
 
   if ((fieldsToLoad & TR_FR_ADDED_DATE)
-      && tr_variantDictFindInt (&top, TR_KEY_added_date, &i))
+      && tr_variantDictFindInt (top, TR_KEY_added_date, &i))
     {
       tor->addedDate = i;
       fieldsLoaded |= TR_FR_ADDED_DATE;
     }
 
   if ((fieldsToLoad & TR_FR_DONE_DATE)
-      && tr_variantDictFindInt (&top, TR_KEY_done_date, &i))
+      && tr_variantDictFindInt (top, TR_KEY_done_date, &i))
     {
       tor->doneDate = i;
       fieldsLoaded |= TR_FR_DONE_DATE;
     }
 
   if ((fieldsToLoad & TR_FR_ACTIVITY_DATE)
-      && tr_variantDictFindInt (&top, TR_KEY_activity_date, &i))
+      && tr_variantDictFindInt (top, TR_KEY_activity_date, &i))
     {
       tr_torrentSetActivityDate (tor, i);
       fieldsLoaded |= TR_FR_ACTIVITY_DATE;
     }
 
   if ((fieldsToLoad & TR_FR_TIME_SEEDING)
-      && tr_variantDictFindInt (&top, TR_KEY_seeding_time_seconds, &i))
+      && tr_variantDictFindInt (top, TR_KEY_seeding_time_seconds, &i))
     {
       tor->secondsSeeding = i;
       fieldsLoaded |= TR_FR_TIME_SEEDING;
     }
 
   if ((fieldsToLoad & TR_FR_TIME_DOWNLOADING)
-      && tr_variantDictFindInt (&top, TR_KEY_downloading_time_seconds, &i))
+      && tr_variantDictFindInt (top, TR_KEY_downloading_time_seconds, &i))
     {
       tor->secondsDownloading = i;
       fieldsLoaded |= TR_FR_TIME_DOWNLOADING;
     }
 
   if ((fieldsToLoad & TR_FR_BANDWIDTH_PRIORITY)
-      && tr_variantDictFindInt (&top, TR_KEY_bandwidth_priority, &i)
+      && tr_variantDictFindInt (top, TR_KEY_bandwidth_priority, &i)
       && tr_isPriority (i))
     {
       tr_torrentSetPriority (tor, i);
@@ -827,39 +1156,86 @@ loadFromFile (tr_torrent * tor, uint64_t fieldsToLoad)
     }
 
   if (fieldsToLoad & TR_FR_PEERS)
-    fieldsLoaded |= loadPeers (&top, tor);
+    fieldsLoaded |= loadPeers (top, tor);
 
   if (fieldsToLoad & TR_FR_FILE_PRIORITIES)
-    fieldsLoaded |= loadFilePriorities (&top, tor);
+    fieldsLoaded |= loadFilePriorities (top, tor);
 
   if (fieldsToLoad & TR_FR_PROGRESS)
-    fieldsLoaded |= loadProgress (&top, tor);
+    fieldsLoaded |= loadProgress (top, tor);
 
   if (fieldsToLoad & TR_FR_DND)
-    fieldsLoaded |= loadDND (&top, tor);
+    fieldsLoaded |= loadDND (top, tor);
 
   if (fieldsToLoad & TR_FR_SPEEDLIMIT)
-    fieldsLoaded |= loadSpeedLimits (&top, tor);
+    fieldsLoaded |= loadSpeedLimits (top, tor);
 
   if (fieldsToLoad & TR_FR_RATIOLIMIT)
-    fieldsLoaded |= loadRatioLimits (&top, tor);
+    fieldsLoaded |= loadRatioLimits (top, tor);
 
   if (fieldsToLoad & TR_FR_IDLELIMIT)
-    fieldsLoaded |= loadIdleLimits (&top, tor);
+    fieldsLoaded |= loadIdleLimits (top, tor);
 
   if (fieldsToLoad & TR_FR_FILENAMES)
-    fieldsLoaded |= loadFilenames (&top, tor);
+    fieldsLoaded |= loadFilenames (top, tor);
 
   if (fieldsToLoad & TR_FR_NAME)
-    fieldsLoaded |= loadName (&top, tor);
+    fieldsLoaded |= loadName (top, tor);
+
+  if (fieldsToLoad & TR_FR_BANDWIDTH_GROUP)
+    fieldsLoaded |= loadBandwidthGroup (top, tor);
+
+  if (fieldsToLoad & TR_FR_DATA_FINGERPRINT)
+    fieldsLoaded |= loadDataFingerprint (top, tor);
 
   /* loading the resume file triggers of a lot of changes,
    * but none of them needs to trigger a re-saving of the
    * same resume information... */
   tor->isDirty = wasDirty;
 
-  tr_variantFree (&top);
+  return fieldsLoaded;
+}
+
+bool
+tr_torrentReadResume (const tr_session * session,
+                      const tr_info    * info,
+                      tr_variant       * setme)
+{
+  bool ok;
+  char * filename;
+  tr_resume_db * db = session->resumeDb;
+
+  if (useResumeDb (session) && tr_resumeDbGet (db, info->hash, setme))
+    return true;
+
+  /* the .resume file, then the database in case it's being migrated away from */
+  filename = getResumeFilenameFromInfo (session, info);
+  ok = tr_saveQueueReadFile (session->saveQueue, filename, TR_VARIANT_FMT_BENC, setme);
   tr_free (filename);
+
+  if (!ok && db != NULL && !useResumeDb (session))
+    ok = tr_resumeDbGet (db, info->hash, setme);
+
+  return ok;
+}
+
+static uint64_t
+loadFromFile (tr_torrent * tor, uint64_t fieldsToLoad)
+{
+  tr_variant top;
+  uint64_t fieldsLoaded = 0;
+
+  if (!tr_torrentReadResume (tor->session, &tor->info, &top))
+    {
+      tr_logAddTorDbg (tor, "Couldn't find resume state");
+    }
+  else
+    {
+      tr_logAddTorDbg (tor, "Read resume state");
+      fieldsLoaded = loadFromVariant (tor, fieldsToLoad, &top);
+      tr_variantFree (&top);
+    }
+
   return fieldsLoaded;
 }
 
@@ -910,10 +1286,12 @@ useFallbackFields (tr_torrent * tor, uint64_t fields, const tr_ctor * ctor)
   return setFromCtor (tor, fields, ctor, TR_FALLBACK);
 }
 
-uint64_t
-tr_torrentLoadResume (tr_torrent *    tor,
-                      uint64_t        fieldsToLoad,
-                      const tr_ctor * ctor)
+static uint64_t
+loadResume (tr_torrent    * tor,
+            uint64_t        fieldsToLoad,
+            const tr_ctor * ctor,
+            bool            isPreloaded,
+            tr_variant    * resume)
 {
   uint64_t ret = 0;
 
@@ -921,17 +1299,137 @@ tr_torrentLoadResume (tr_torrent *    tor,
 
   ret |= useManditoryFields (tor, fieldsToLoad, ctor);
   fieldsToLoad &= ~ret;
-  ret |= loadFromFile (tor, fieldsToLoad);
+  if (!isPreloaded)
+    ret |= loadFromFile (tor, fieldsToLoad);
+  else if (resume != NULL)
+    ret |= loadFromVariant (tor, fieldsToLoad, resume);
   fieldsToLoad &= ~ret;
   ret |= useFallbackFields (tor, fieldsToLoad, ctor);
 
+  /* whatever was saved before may have just been replaced */
+  tr_resumeFreeCache (tor);
+
   return ret;
 }
 
+uint64_t
+tr_torrentLoadResume (tr_torrent *    tor,
+                      uint64_t        fieldsToLoad,
+                      const tr_ctor * ctor)
+{
+  return loadResume (tor, fieldsToLoad, ctor, false, NULL);
+}
+
+uint64_t
+tr_torrentLoadPreloadedResume (tr_torrent    * tor,
+                               uint64_t        fieldsToLoad,
+                               const tr_ctor * ctor,
+                               tr_variant    * resume)
+{
+  return loadResume (tor, fieldsToLoad, ctor, true, resume);
+}
+
 void
 tr_torrentRemoveResume (const tr_torrent * tor)
 {
   char * filename = getResumeFilename (tor);
+  tr_saveQueueRemove (tor->session->saveQueue, filename);
   tr_sys_path_remove (filename, NULL);
   tr_free (filename);
+
+  if (tor->session->resumeDb != NULL)
+    tr_resumeDbRemove (tor->session->resumeDb, tor->info.hash);
+}
+
+/***
+****
+***/
+
+static void
+migrateToResumeDb (tr_session * session)
+{
+  int n = 0;
+  tr_list * l;
+  tr_list * moved = NULL;
+  tr_torrent * tor = NULL;
+
+  /* so the .resume files are all there, and none get rewritten after being removed */
+  tr_saveQueueFlush (session->saveQueue);
+
+  while ((tor = tr_torrentNext (session, tor)))
+    {
+      char * filename = getResumeFilename (tor);
+
+      if (tr_sys_path_exists (filename, NULL))
+        {
+          tr_torrentSaveResume (tor);
+          tr_list_prepend (&moved, filename);
+          ++n;
+        }
+      else
+        {
+          tr_free (filename);
+        }
+    }
+
+  /* the .resume files can go once the database has been checkpointed */
+  if (moved != NULL && tr_resumeDbCompact (session->resumeDb))
+    {
+      for (l=moved; l!=NULL; l=l->next)
+        tr_sys_path_remove (l->data, NULL);
+
+      tr_logAddInfo (_("Moved the resume state of %d torrents into the resume database"), n);
+    }
+
+  tr_list_free (&moved, tr_free);
+}
+
+static void
+migrateFromResumeDb (tr_session * session)
+{
+  int n_left;
+  tr_torrent * tor = NULL;
+  const int n = tr_resumeDbCount (session->resumeDb);
+  char * filename = tr_buildPath (session->configDir, "resume.db", NULL);
+
+  while ((tor = tr_torrentNext (session, tor)))
+    tr_torrentSaveResume (tor);
+  tr_saveQueueFlush (session->saveQueue);
+
+  /* only drop a torrent from the database once its .resume file is on disk */
+  while ((tor = tr_torrentNext (session, tor)))
+    {
+      char * resume = getResumeFilename (tor);
+      if (tr_sys_path_exists (resume, NULL))
+        tr_resumeDbRemove (session->resumeDb, tor->info.hash);
+      tr_free (resume);
+    }
+
+  n_left = tr_resumeDbCount (session->resumeDb);
+  if (n > n_left)
+    tr_logAddInfo (_("Moved the resume state of %d torrents into .resume files"), n - n_left);
+
+  tr_resumeDbClose (session->resumeDb);
+  session->resumeDb = NULL;
+
+  /* whatever's left is for torrents that weren't loaded or couldn't be
+   * saved. keep it so that a later start can try again */
+  if (n_left > 0)
+    tr_logAddInfo (_("Keeping \"%s\" for the resume state of %d other torrents"), filename, n_left);
+  else
+    tr_sys_path_remove (filename, NULL);
+
+  tr_free (filename);
+}
+
+void
+tr_resumeMigrate (tr_session * session)
+{
+  if (session->resumeDb == NULL)
+    return;
+
+  if (session->isResumeDbEnabled)
+    migrateToResumeDb (session);
+  else
+    migrateFromResumeDb (session);
 }
@@ -36,7 +36,9 @@ enum
   TR_FR_TIME_SEEDING        = (1 << 18),
   TR_FR_TIME_DOWNLOADING    = (1 << 19),
   TR_FR_FILENAMES           = (1 << 20),
-  TR_FR_NAME                = (1 << 21)
+  TR_FR_NAME                = (1 << 21),
+  TR_FR_BANDWIDTH_GROUP     = (1 << 22),
+  TR_FR_DATA_FINGERPRINT    = (1 << 23)
 };
 
 /**
@@ -46,10 +48,58 @@ uint64_t tr_torrentLoadResume   (tr_torrent        * tor,
                                  uint64_t            fieldsToLoad,
                                  const tr_ctor     * ctor);
 
+/**
+ * Reads the .resume file for the torrent described by `info'.
+ * This doesn't touch any torrent, so it's safe to call from any thread.
+ */
+bool     tr_torrentReadResume   (const tr_session  * session,
+                                 const tr_info     * info,
+                                 struct tr_variant * setme);
+
+/**
+ * Like tr_torrentLoadResume (), but uses a file that was already read
+ * by tr_torrentReadResume (). `resume' is NULL if there wasn't one.
+ */
+uint64_t tr_torrentLoadPreloadedResume (tr_torrent    * tor,
+                                        uint64_t        fieldsToLoad,
+                                        const tr_ctor * ctor,
+                                        struct tr_variant * resume);
+
 void     tr_torrentSaveResume   (tr_torrent        * tor);
 
+/**
+ * The session's tr_save_failed_func. If `filename' is a torrent's
+ * .resume file, that torrent's local error is set.
+ */
+void     tr_resumeSaveFailed    (const char        * filename,
+                                 const char        * errmsg,
+                                 void              * vsession);
+
+/**
+ * tr_torrentSaveResume () reuses the sections that are costly to build
+ * (TR_FR_PROGRESS's blocks, TR_FR_DND, TR_FR_FILE_PRIORITIES and
+ * TR_FR_FILENAMES) from its last save until they're marked as changed.
+ * The torrent must still be marked with tr_torrentSetDirty () too.
+ */
+void     tr_resumeSetDirty      (tr_torrent        * tor,
+                                 uint64_t            fields);
+
+/** @brief like tr_resumeSetDirty (), for a piece's timeChecked */
+void     tr_resumeSetPieceChecked (tr_torrent      * tor,
+                                   tr_piece_index_t  piece);
+
+/** @brief frees the reused sections, e.g. when the torrent's metainfo changes */
+void     tr_resumeFreeCache     (tr_torrent        * tor);
+
 void     tr_torrentRemoveResume (const tr_torrent  * tor);
 
+/**
+ * Moves resume state between .resume files and the resume database,
+ * depending on whether the database is enabled.
+ * Call this once the torrents have been loaded at startup.
+ */
+void     tr_resumeMigrate       (tr_session        * session);
+
 int      tr_torrentRenameResume (const tr_torrent  * tor,
                                  const char        * newname);
 
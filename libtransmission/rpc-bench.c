@@ -0,0 +1,148 @@
+/*
+ * This file Copyright (C) 2016 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ * $Id$
+ */
+
+/* Compares torrent-get's serialization paths:
+ * building a tr_variant and then walking it to JSON, and
+ * streaming JSON or benc straight into an evbuffer.
+ *
+ * usage: rpc-bench [torrent-count] [iterations] */
+
+#include <stdio.h>
+#include <stdlib.h> /* atoi () */
+
+#include <event2/buffer.h>
+
+#include "transmission.h"
+#include "rpcimpl.h"
+#include "utils.h"
+#include "variant.h"
+
+#include "libtransmission-test.h"
+
+static void
+rpc_response_func (tr_session * session    UNUSED,
+                   tr_variant * response,
+                   void       * setme)
+{
+  *(tr_variant *) setme = *response;
+  tr_variantInitBool (response, false);
+}
+
+/* how many tr_variant nodes the old path had to allocate and free */
+static size_t
+count_nodes (tr_variant * v)
+{
+  size_t i;
+  size_t n = 1;
+  tr_quark key;
+  tr_variant * child;
+
+  if (tr_variantIsDict (v))
+    for (i=0; tr_variantDictChild (v, i, &key, &child); ++i)
+      n += count_nodes (child);
+  else if (tr_variantIsList (v))
+    for (i=0; (child = tr_variantListChild (v, i)); ++i)
+      n += count_nodes (child);
+
+  return n;
+}
+
+int
+main (int argc, char ** argv)
+{
+  int i;
+  tr_session * session;
+  tr_torrent * tor;
+  tr_variant request;
+  tr_variant * args;
+  tr_variant * ids;
+  tr_variant * fields;
+  uint64_t begin;
+  uint64_t variant_msec;
+  uint64_t stream_msec;
+  uint64_t benc_msec;
+  size_t nodes = 0;
+  size_t bytes = 0;
+  size_t benc_bytes = 0;
+  const int torrent_count = argc > 1 ? atoi (argv[1]) : 10000;
+  const int iterations = argc > 2 ? atoi (argv[2]) : 10;
+  const char * field_names[] = { "id", "name", "status", "error", "errorString",
+                                 "eta", "isFinished", "leftUntilDone", "percentDone",
+                                 "rateDownload", "rateUpload", "sizeWhenDone",
+                                 "uploadRatio", "peersConnected", "queuePosition",
+                                 "files", "fileStats", "priorities", "wanted" };
+  const size_t n_fields = sizeof (field_names) / sizeof (*field_names);
+
+  session = libttest_session_init (NULL);
+  tor = libttest_zero_torrent_init (session);
+
+  /* torrents can't be added twice, so ask for the same one over and over.
+   * the serialization cost is the same as for that many different ones. */
+  tr_variantInitDict (&request, 2);
+  tr_variantDictAddStr (&request, TR_KEY_method, "torrent-get");
+  args = tr_variantDictAddDict (&request, TR_KEY_arguments, 2);
+  ids = tr_variantDictAddList (args, TR_KEY_ids, torrent_count);
+  for (i=0; i<torrent_count; ++i)
+    tr_variantListAddInt (ids, tr_torrentId (tor));
+  fields = tr_variantDictAddList (args, TR_KEY_fields, n_fields);
+  for (i=0; i<(int)n_fields; ++i)
+    tr_variantListAddStr (fields, field_names[i]);
+
+  /* the old path: tr_variant tree -> JSON */
+  begin = tr_time_msec ();
+  for (i=0; i<iterations; ++i)
+    {
+      tr_variant response;
+      struct evbuffer * buf;
+
+      tr_rpc_request_exec_json (session, &request, rpc_response_func, &response);
+      buf = tr_variantToBuf (&response, TR_VARIANT_FMT_JSON_LEAN);
+      if (i == 0)
+        nodes = count_nodes (&response);
+      evbuffer_free (buf);
+      tr_variantFree (&response);
+    }
+  variant_msec = tr_time_msec () - begin;
+
+  /* the new path: straight to JSON */
+  begin = tr_time_msec ();
+  for (i=0; i<iterations; ++i)
+    {
+      struct evbuffer * buf = evbuffer_new ();
+      tr_rpc_request_exec_json_stream (session, &request, TR_VARIANT_FMT_JSON_LEAN, buf);
+      bytes = evbuffer_get_length (buf);
+      evbuffer_free (buf);
+    }
+  stream_msec = tr_time_msec () - begin;
+
+  /* what clients that ask for benc get */
+  begin = tr_time_msec ();
+  for (i=0; i<iterations; ++i)
+    {
+      struct evbuffer * buf = evbuffer_new ();
+      tr_rpc_request_exec_json_stream (session, &request, TR_VARIANT_FMT_BENC, buf);
+      benc_bytes = evbuffer_get_length (buf);
+      evbuffer_free (buf);
+    }
+  benc_msec = tr_time_msec () - begin;
+
+  printf ("torrent-get: %d torrents, %zu fields, %zu byte response, %d iterations\n",
+          torrent_count, n_fields, bytes, iterations);
+  printf ("  tr_variant: %8.2f ms/request, %zu nodes allocated per request\n",
+          (double)variant_msec / iterations, nodes);
+  printf ("  streamed:   %8.2f ms/request\n",
+          (double)stream_msec / iterations);
+  printf ("  streamed benc: %5.2f ms/request, %zu byte response\n",
+          (double)benc_msec / iterations, benc_bytes);
+
+  tr_variantFree (&request);
+  tr_torrentRemove (tor, false, NULL);
+  libttest_session_close (session);
+  return 0;
+}
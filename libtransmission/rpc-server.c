@@ -9,11 +9,12 @@
 
 #include <assert.h>
 #include <errno.h>
-#include <string.h> /* memcpy */
+#include <string.h> /* memset (), strcmp () */
 
 #include <zlib.h>
 
 #include <event2/buffer.h>
+#include <event2/bufferevent.h>
 #include <event2/event.h>
 #include <event2/http.h>
 #include <event2/http_struct.h> /* TODO: eventually remove this */
@@ -23,6 +24,7 @@
 #include "crypto-utils.h" /* tr_rand_buffer () */
 #include "error.h"
 #include "fdlimit.h"
+#include "file.h" /* tr_sys_path_get_info () */
 #include "list.h"
 #include "log.h"
 #include "net.h"
@@ -47,6 +49,27 @@
 #define MY_REALM "Transmission"
 #define TR_N_ELEMENTS(ary) (sizeof (ary) / sizeof (*ary))
 
+enum
+{
+  /* how many gzip levels add_response () chooses between */
+  DEFLATE_LEVEL_COUNT = 3,
+
+  /* how many of the web client's files to keep gzipped */
+  GZIP_CACHE_SIZE = 32,
+  GZIP_CACHE_MAX_FILE_SIZE = 4 * 1024 * 1024
+};
+
+struct gzip_cache_entry
+{
+    char             * filename;
+    uint64_t           size;
+    time_t             mtime;
+
+    /* NULL if gzip didn't make the file any smaller */
+    void             * zipped;
+    size_t             zipped_len;
+};
+
 struct tr_rpc_server
 {
     bool               isEnabled;
@@ -69,6 +92,15 @@ struct tr_rpc_server
 
     bool               isStreamInitialized;
     z_stream           stream;
+    int                streamLevel;
+
+    /* bytes per msec that each gzip level has been managing */
+    size_t             deflateSpeed[DEFLATE_LEVEL_COUNT];
+
+    struct gzip_cache_entry gzipCache[GZIP_CACHE_SIZE];
+    int                gzipCacheNext;
+
+    tr_list          * monitors;
 };
 
 #define dbgmsg(...) \
@@ -316,78 +348,271 @@ mimetype_guess (const char * path)
   return "application/octet-stream";
 }
 
+/***
+****  gzip
+****
+****  Big torrent-get responses can be many megabytes, and compressing
+****  them ties up the event thread. So deflate () reads straight from
+****  the evbuffer's segments instead of a pulled-up copy, and the level
+****  is picked from the body's size and how fast each level has been
+****  going, so that no response takes much longer than a budget.
+***/
+
+enum
+{
+  /* how long we'd like to spend compressing any one response */
+  DEFLATE_BUDGET_MSEC = 25,
+
+  /* how much output space to ask deflate () to fill at a time */
+  DEFLATE_CHUNK_SIZE = 64 * 1024,
+
+  /* bodies smaller than this don't take long enough to time */
+  DEFLATE_MIN_TIMED_SIZE = 64 * 1024
+};
+
+/* from slowest to fastest. initial speeds are rough guesses in
+ * bytes per msec for JSON; they're refined as responses are sent */
+static const int deflate_levels[DEFLATE_LEVEL_COUNT] = { Z_BEST_COMPRESSION, 6, Z_BEST_SPEED };
+static const size_t deflate_initial_speeds[DEFLATE_LEVEL_COUNT] = { 8000, 25000, 80000 };
+
+static bool
+accepts_gzip (struct evhttp_request * req)
+{
+  const char * encoding = evhttp_find_header (req->input_headers, "Accept-Encoding");
+
+  return encoding != NULL && strstr (encoding, "gzip") != NULL;
+}
+
+/* gzips all of `content' into `out' without copying it into one piece.
+ * returns false if that didn't make it smaller, in which case `out'
+ * has garbage in it */
+bool
+tr_rpcDeflateEvbuffer (z_stream * stream, struct evbuffer * content, struct evbuffer * out)
+{
+  int i;
+  bool ok = true;
+  const size_t content_len = evbuffer_get_length (content);
+  const int n = evbuffer_peek (content, -1, NULL, NULL, 0);
+  struct evbuffer_iovec * segments = tr_new (struct evbuffer_iovec, n);
+
+  evbuffer_peek (content, -1, NULL, segments, n);
+
+  for (i=0; ok && i<n; ++i)
+    {
+      int state;
+      const int flush = i == n - 1 ? Z_FINISH : Z_NO_FLUSH;
+
+      stream->next_in = segments[i].iov_base;
+      stream->avail_in = segments[i].iov_len;
+
+      do
+        {
+          struct evbuffer_iovec space[1];
+
+          evbuffer_reserve_space (out, DEFLATE_CHUNK_SIZE, space, 1);
+          stream->next_out = space[0].iov_base;
+          stream->avail_out = space[0].iov_len;
+          state = deflate (stream, flush);
+          space[0].iov_len -= stream->avail_out;
+          evbuffer_commit_space (out, space, 1);
+
+          /* we won't use the deflated data if it's no shorter than the raw data */
+          if (state == Z_STREAM_ERROR || evbuffer_get_length (out) >= content_len)
+            ok = false;
+        }
+      while (ok && (stream->avail_out == 0 || (flush == Z_FINISH && state != Z_STREAM_END)));
+    }
+
+  tr_free (segments);
+  return ok && n > 0;
+}
+
+int
+tr_rpcPickDeflateLevel (const tr_rpc_server * server, size_t content_len)
+{
+  int i;
+#ifdef TR_LIGHTWEIGHT
+  const int first = 1;
+#else
+  const int first = 0;
+#endif
+
+  for (i=first; i<DEFLATE_LEVEL_COUNT-1; ++i)
+    if (content_len / server->deflateSpeed[i] <= DEFLATE_BUDGET_MSEC)
+      break;
+
+  return i;
+}
+
 static void
 add_response (struct evhttp_request * req,
               struct tr_rpc_server  * server,
               struct evbuffer       * out,
               struct evbuffer       * content)
 {
-  const char * key = "Accept-Encoding";
-  const char * encoding = evhttp_find_header (req->input_headers, key);
-  const int do_compress = encoding && strstr (encoding, "gzip");
-
-  if (!do_compress)
+  if (!accepts_gzip (req))
     {
       evbuffer_add_buffer (out, content);
     }
   else
     {
-      int state;
-      struct evbuffer_iovec iovec[1];
-      void * content_ptr = evbuffer_pullup (content, -1);
+      int level;
+      uint64_t msec;
       const size_t content_len = evbuffer_get_length (content);
+      struct evbuffer * zipped = evbuffer_new ();
 
-      if (!server->isStreamInitialized)
+      level = tr_rpcPickDeflateLevel (server, content_len);
+
+      /* deflateParams () has version-specific quirks on a stream that was
+       * just reset, so simply start a new stream when the level changes */
+      if (server->isStreamInitialized && server->streamLevel != level)
         {
-          int compressionLevel;
+          deflateEnd (&server->stream);
+          server->isStreamInitialized = false;
+        }
 
+      if (!server->isStreamInitialized)
+        {
           server->isStreamInitialized = true;
+          server->streamLevel = level;
           server->stream.zalloc = (alloc_func) Z_NULL;
           server->stream.zfree = (free_func) Z_NULL;
           server->stream.opaque = (voidpf) Z_NULL;
 
           /* zlib's manual says: "Add 16 to windowBits to write a simple gzip header
            * and trailer around the compressed data instead of a zlib wrapper." */
-#ifdef TR_LIGHTWEIGHT
-          compressionLevel = Z_DEFAULT_COMPRESSION;
-#else
-          compressionLevel = Z_BEST_COMPRESSION;
-#endif
-          deflateInit2 (&server->stream, compressionLevel, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY);
+          deflateInit2 (&server->stream, deflate_levels[level], Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY);
         }
 
-      server->stream.next_in = content_ptr;
-      server->stream.avail_in = content_len;
+      msec = tr_time_msec ();
 
-      /* allocate space for the raw data and call deflate () just once --
-       * we won't use the deflated data if it's longer than the raw data,
-       * so it's okay to let deflate () run out of output buffer space */
-      evbuffer_reserve_space (out, content_len, iovec, 1);
-      server->stream.next_out = iovec[0].iov_base;
-      server->stream.avail_out = iovec[0].iov_len;
-      state = deflate (&server->stream, Z_FINISH);
-
-      if (state == Z_STREAM_END)
+      if (tr_rpcDeflateEvbuffer (&server->stream, content, zipped))
         {
-          iovec[0].iov_len -= server->stream.avail_out;
-
-#if 0
-          fprintf (stderr, "compressed response is %.2f of original (raw==%zu bytes; compressed==%zu)\n",
-                   (double)evbuffer_get_length (out)/content_len,
-                   content_len, evbuffer_get_length (out));
-#endif
-          evhttp_add_header (req->output_headers,
-                             "Content-Encoding", "gzip");
+          evhttp_add_header (req->output_headers, "Content-Encoding", "gzip");
+          evbuffer_add_buffer (out, zipped);
         }
       else
         {
-          memcpy (iovec[0].iov_base, content_ptr, content_len);
-          iovec[0].iov_len = content_len;
+          evbuffer_add_buffer (out, content);
+        }
+
+      /* keep a running average of how fast this level is */
+      msec = tr_time_msec () - msec;
+      if (content_len >= DEFLATE_MIN_TIMED_SIZE && msec > 0)
+        {
+          size_t * speed = &server->deflateSpeed[level];
+          *speed = MAX (1, (*speed * 3 + content_len / msec) / 4);
         }
 
-      evbuffer_commit_space (out, iovec, 1);
+      evbuffer_free (zipped);
       deflateReset (&server->stream);
     }
+
+  evhttp_add_header (req->output_headers, "Vary", "Accept-Encoding");
+}
+
+/* the web client's files don't change, so keep them compressed
+ * rather than compressing them again for every page load */
+bool
+tr_rpcGzipCacheGet (tr_rpc_server  * server,
+                    const char     * filename,
+                    const void    ** setme_zipped,
+                    size_t         * setme_zipped_len,
+                    void          ** setme_file,
+                    size_t         * setme_file_len)
+{
+  int i;
+  z_stream stream;
+  void * file;
+  size_t file_len;
+  tr_sys_path_info info;
+  struct evbuffer * content;
+  struct evbuffer * zipped;
+  struct gzip_cache_entry * entry;
+
+  *setme_file = NULL;
+  *setme_file_len = 0;
+
+  if (!tr_sys_path_get_info (filename, 0, &info, NULL) || info.size > GZIP_CACHE_MAX_FILE_SIZE)
+    return false;
+
+  for (i=0; i<GZIP_CACHE_SIZE; ++i)
+    {
+      entry = &server->gzipCache[i];
+
+      if (entry->filename != NULL && strcmp (entry->filename, filename) == 0)
+        {
+          if (entry->size == info.size && entry->mtime == info.last_modified_at)
+            {
+              *setme_zipped = entry->zipped;
+              *setme_zipped_len = entry->zipped_len;
+              return true;
+            }
+
+          break; /* stale */
+        }
+    }
+
+  if ((file = tr_loadFile (filename, &file_len, NULL)) == NULL)
+    return false;
+
+  /* reuse the stale slot if there was one; otherwise take the next in turn */
+  if (i == GZIP_CACHE_SIZE)
+    {
+      i = server->gzipCacheNext;
+      server->gzipCacheNext = (i + 1) % GZIP_CACHE_SIZE;
+    }
+
+  entry = &server->gzipCache[i];
+  tr_free (entry->filename);
+  tr_free (entry->zipped);
+  entry->filename = tr_strdup (filename);
+  entry->size = info.size;
+  entry->mtime = info.last_modified_at;
+  entry->zipped = NULL;
+  entry->zipped_len = 0;
+
+  /* this only happens once per file, so take the time to squeeze it */
+  memset (&stream, 0, sizeof (stream));
+  deflateInit2 (&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY);
+  content = evbuffer_new ();
+  zipped = evbuffer_new ();
+  evbuffer_add_reference (content, file, file_len, NULL, NULL);
+  if (tr_rpcDeflateEvbuffer (&stream, content, zipped))
+    {
+      entry->zipped_len = evbuffer_get_length (zipped);
+      entry->zipped = tr_memdup (evbuffer_pullup (zipped, -1), entry->zipped_len);
+    }
+  evbuffer_free (zipped);
+  evbuffer_free (content);
+  deflateEnd (&stream);
+
+  /* if it's going to be sent as it is, don't make the caller read it again */
+  if (entry->zipped == NULL)
+    {
+      *setme_file = file;
+      *setme_file_len = file_len;
+    }
+  else
+    {
+      tr_free (file);
+    }
+
+  *setme_zipped = entry->zipped;
+  *setme_zipped_len = entry->zipped_len;
+  return true;
+}
+
+static void
+gzip_cache_free (struct tr_rpc_server * server)
+{
+  int i;
+
+  for (i=0; i<GZIP_CACHE_SIZE; ++i)
+    {
+      tr_free (server->gzipCache[i].filename);
+      tr_free (server->gzipCache[i].zipped);
+    }
 }
 
 static void
@@ -416,19 +641,42 @@ serve_file (struct evhttp_request  * req,
             struct tr_rpc_server   * server,
             const char             * filename)
 {
+  bool cached = false;
+  void * file = NULL;
+  size_t file_len = 0;
+  const void * zipped = NULL;
+  size_t zipped_len = 0;
+
   if (req->type != EVHTTP_REQ_GET)
     {
       evhttp_add_header (req->output_headers, "Allow", "GET");
       send_simple_response (req, 405, NULL);
     }
+  else if (accepts_gzip (req)
+           && (cached = tr_rpcGzipCacheGet (server, filename, &zipped, &zipped_len, &file, &file_len))
+           && zipped != NULL)
+    {
+      struct evbuffer * out = evbuffer_new ();
+      const time_t now = tr_time ();
+
+      /* copy it, since the entry could be evicted before `out' is sent */
+      evbuffer_add (out, zipped, zipped_len);
+      evhttp_add_header (req->output_headers, "Content-Type", mimetype_guess (filename));
+      evhttp_add_header (req->output_headers, "Content-Encoding", "gzip");
+      evhttp_add_header (req->output_headers, "Vary", "Accept-Encoding");
+      add_time_header (req->output_headers, "Date", now);
+      add_time_header (req->output_headers, "Expires", now+ (24*60*60));
+      evhttp_send_reply (req, HTTP_OK, "OK", out);
+
+      evbuffer_free (out);
+    }
   else
     {
-      void * file;
-      size_t file_len;
       tr_error * error = NULL;
 
-      file_len = 0;
-      file = tr_loadFile (filename, &file_len, &error);
+      /* the cache may have read it already */
+      if (file == NULL)
+        file = tr_loadFile (filename, &file_len, &error);
 
       if (file == NULL)
         {
@@ -450,7 +698,15 @@ serve_file (struct evhttp_request  * req,
           evhttp_add_header (req->output_headers, "Content-Type", mimetype_guess (filename));
           add_time_header (req->output_headers, "Date", now);
           add_time_header (req->output_headers, "Expires", now+ (24*60*60));
-          add_response (req, server, out, content);
+          if (cached) /* we already know gzip won't help */
+            {
+              evhttp_add_header (req->output_headers, "Vary", "Accept-Encoding");
+              evbuffer_add_buffer (out, content);
+            }
+          else
+            {
+              add_response (req, server, out, content);
+            }
           evhttp_send_reply (req, HTTP_OK, "OK", out);
 
           evbuffer_free (out);
@@ -508,43 +764,93 @@ struct rpc_response_data
 {
   struct evhttp_request * req;
   struct tr_rpc_server  * server;
+  tr_variant_fmt          fmt;
 };
 
+static bool
+is_benc_content_type (const char * content_type)
+{
+  return content_type != NULL
+      && strncmp (content_type, TR_RPC_BENC_CONTENT_TYPE, strlen (TR_RPC_BENC_CONTENT_TYPE)) == 0;
+}
+
+/* answer in benc if the client asked for it or if it spoke benc to us */
+static tr_variant_fmt
+get_response_format (struct evhttp_request * req)
+{
+  const char * accept = evhttp_find_header (req->input_headers, "Accept");
+
+  if ((accept != NULL) && (strstr (accept, TR_RPC_BENC_CONTENT_TYPE) != NULL))
+    return TR_VARIANT_FMT_BENC;
+
+  if (is_benc_content_type (evhttp_find_header (req->input_headers, "Content-Type")))
+    return TR_VARIANT_FMT_BENC;
+
+  return TR_VARIANT_FMT_JSON_LEAN;
+}
+
+static void
+send_rpc_response (struct evhttp_request * req,
+                   struct tr_rpc_server  * server,
+                   tr_variant_fmt          fmt,
+                   struct evbuffer       * response_buf)
+{
+  struct evbuffer * buf = evbuffer_new ();
+
+  add_response (req, server, buf, response_buf);
+  evhttp_add_header (req->output_headers, "Content-Type",
+                     fmt == TR_VARIANT_FMT_BENC ? TR_RPC_BENC_CONTENT_TYPE
+                                                : "application/json; charset=UTF-8");
+  evhttp_send_reply (req, HTTP_OK, "OK", buf);
+
+  evbuffer_free (buf);
+}
+
 static void
 rpc_response_func (tr_session * session UNUSED,
                    tr_variant * response,
                    void       * user_data)
 {
   struct rpc_response_data * data = user_data;
-  struct evbuffer * response_buf = tr_variantToBuf (response, TR_VARIANT_FMT_JSON_LEAN);
-  struct evbuffer * buf = evbuffer_new ();
+  struct evbuffer * response_buf = tr_variantToBuf (response, data->fmt);
 
-  add_response (data->req, data->server, buf, response_buf);
-  evhttp_add_header (data->req->output_headers,
-                     "Content-Type", "application/json; charset=UTF-8");
-  evhttp_send_reply (data->req, HTTP_OK, "OK", buf);
+  send_rpc_response (data->req, data->server, data->fmt, response_buf);
 
-  evbuffer_free (buf);
   evbuffer_free (response_buf);
   tr_free (data);
 }
 
 static void
-handle_rpc_from_json (struct evhttp_request * req,
-                      struct tr_rpc_server  * server,
-                      const char            * json,
-                      size_t                  json_len)
+handle_rpc_from_buf (struct evhttp_request * req,
+                     struct tr_rpc_server  * server,
+                     const char            * text,
+                     size_t                  text_len)
 {
   tr_variant top;
-  bool have_content = tr_variantFromJson (&top, json, json_len) == 0;
-  struct rpc_response_data * data;
-
-  data = tr_new0 (struct rpc_response_data, 1);
-  data->req = req;
-  data->server = server;
-
-  tr_rpc_request_exec_json (server->session, have_content ? &top : NULL, rpc_response_func, data);
+  const tr_variant_fmt response_fmt = get_response_format (req);
+  const tr_variant_fmt request_fmt =
+    is_benc_content_type (evhttp_find_header (req->input_headers, "Content-Type"))
+      ? TR_VARIANT_FMT_BENC
+      : TR_VARIANT_FMT_JSON;
+  bool have_content = tr_variantFromBuf (&top, request_fmt, text, text_len,
+                                         NULL, NULL, TR_VARIANT_PARSE_ARENA) == 0;
+  struct evbuffer * response_buf = evbuffer_new ();
+
+  /* big responses like torrent-get can skip the tr_variant round trip */
+  if (have_content && tr_rpc_request_exec_json_stream (server->session, &top, response_fmt, response_buf))
+    {
+      send_rpc_response (req, server, response_fmt, response_buf);
+    }
+  else
+    {
+      struct rpc_response_data * data = tr_new0 (struct rpc_response_data, 1);
+      data->req = req;
+      data->server = server;
+      data->fmt = response_fmt;
+      tr_rpc_request_exec_json (server->session, have_content ? &top : NULL, rpc_response_func, data);
+    }
 
+  evbuffer_free (response_buf);
   if (have_content)
     tr_variantFree (&top);
 }
@@ -556,15 +862,16 @@ handle_rpc (struct evhttp_request * req, struct tr_rpc_server  * server)
 
   if (req->type == EVHTTP_REQ_POST)
     {
-      handle_rpc_from_json (req, server,
-                            (const char *) evbuffer_pullup (req->input_buffer, -1),
-                            evbuffer_get_length (req->input_buffer));
+      handle_rpc_from_buf (req, server,
+                           (const char *) evbuffer_pullup (req->input_buffer, -1),
+                           evbuffer_get_length (req->input_buffer));
     }
   else if ((req->type == EVHTTP_REQ_GET) && ((q = strchr (req->uri, '?'))))
     {
       struct rpc_response_data * data = tr_new0 (struct rpc_response_data, 1);
       data->req = req;
       data->server = server;
+      data->fmt = get_response_format (req);
       tr_rpc_request_exec_uri (server->session, q + 1, TR_BAD_SIZE, rpc_response_func, data);
     }
   else
@@ -573,6 +880,330 @@ handle_rpc (struct evhttp_request * req, struct tr_rpc_server  * server)
     }
 }
 
+/***
+****  Monitors
+****
+****  A monitor is a long-lived chunked response that reruns a few
+****  read-only RPC requests on a timer and pushes their results to the
+****  client whenever they change, so that clients don't have to poll.
+****  torrent-get is rerun with "since" so that only the torrents that
+****  changed are sent, and only when the session's torrent revision
+****  has moved; the other requests are pushed when their response differs
+****  from the one last sent.
+***/
+
+/* these are all immediate, so their responses are ready when exec returns */
+static const char * const monitor_methods[] =
+{
+  "group-get",
+  "session-get",
+  "session-stats",
+  "torrent-get"
+};
+
+enum
+{
+  MONITOR_DEFAULT_INTERVAL_MSEC = 1000,
+  MONITOR_MIN_INTERVAL_MSEC = 100,
+  MONITOR_MAX_INTERVAL_MSEC = 3600 * 1000,
+
+  /* skip ticks while a client has this much unsent output, so one
+   * that stops reading can't make us buffer without bound */
+  MONITOR_MAX_PENDING_BYTES = 1024 * 1024
+};
+
+struct rpc_monitor_request
+{
+  tr_variant      * request;
+
+  /* torrent-get: the session's torrent revision when it was last sent */
+  bool              is_torrent_get;
+  bool              sent;
+  uint64_t          revision;
+
+  /* everything else: the response that was last sent */
+  struct evbuffer * last;
+};
+
+struct rpc_monitor
+{
+  struct tr_rpc_server       * server;
+  struct evhttp_request      * req;
+  struct event               * timer;
+  tr_variant_fmt               fmt;
+  int                          interval_msec;
+  tr_variant                   top;
+  int                          request_count;
+  struct rpc_monitor_request * requests;
+};
+
+static void
+monitor_free (struct rpc_monitor * monitor)
+{
+  int i;
+
+  for (i=0; i<monitor->request_count; ++i)
+    if (monitor->requests[i].last != NULL)
+      evbuffer_free (monitor->requests[i].last);
+
+  event_free (monitor->timer);
+  tr_variantFree (&monitor->top);
+  tr_free (monitor->requests);
+  tr_free (monitor);
+}
+
+struct monitor_response_data
+{
+  tr_variant_fmt    fmt;
+  struct evbuffer * out;
+};
+
+static void
+monitor_response_func (tr_session * session UNUSED,
+                       tr_variant * response,
+                       void       * user_data)
+{
+  struct monitor_response_data * data = user_data;
+  struct evbuffer * buf = tr_variantToBuf (response, data->fmt);
+
+  evbuffer_add_buffer (data->out, buf);
+  evbuffer_free (buf);
+}
+
+static bool
+evbuffers_equal (struct evbuffer * a, struct evbuffer * b)
+{
+  const size_t len = evbuffer_get_length (a);
+
+  return len == evbuffer_get_length (b)
+      && memcmp (evbuffer_pullup (a, -1), evbuffer_pullup (b, -1), len) == 0;
+}
+
+static size_t
+monitor_get_pending_bytes (const struct rpc_monitor * monitor)
+{
+  struct evhttp_connection * evcon = evhttp_request_get_connection (monitor->req);
+  struct bufferevent * bev = evhttp_connection_get_bufferevent (evcon);
+
+  return bev != NULL ? evbuffer_get_length (bufferevent_get_output (bev)) : 0;
+}
+
+/* rerun the monitor's requests and push whichever ones have changed.
+ * Skipping a tick loses nothing: torrent-get's "since" and the other
+ * requests' last-sent responses still describe what the client has */
+static void
+monitor_run (struct rpc_monitor * monitor)
+{
+  int i;
+  tr_session * session = monitor->server->session;
+  struct evbuffer * out;
+
+  if (monitor_get_pending_bytes (monitor) > MONITOR_MAX_PENDING_BYTES)
+    return;
+
+  out = evbuffer_new ();
+
+  for (i=0; i<monitor->request_count; ++i)
+    {
+      struct rpc_monitor_request * r = &monitor->requests[i];
+      struct evbuffer * buf;
+
+      if (r->is_torrent_get && r->sent && (r->revision == session->torrentRevision))
+        continue;
+
+      buf = evbuffer_new ();
+
+      if (r->is_torrent_get)
+        {
+          tr_variant * args;
+
+          if (!tr_variantDictFindDict (r->request, TR_KEY_arguments, &args))
+            args = tr_variantDictAddDict (r->request, TR_KEY_arguments, 1);
+          if (r->sent)
+            tr_variantDictAddInt (args, TR_KEY_since, r->revision);
+
+          r->revision = session->torrentRevision;
+          tr_rpc_request_exec_json_stream (session, r->request, monitor->fmt, buf);
+        }
+      else
+        {
+          struct monitor_response_data data;
+
+          data.fmt = monitor->fmt;
+          data.out = buf;
+          tr_rpc_request_exec_json (session, r->request, monitor_response_func, &data);
+
+          if (r->sent && evbuffers_equal (buf, r->last))
+            {
+              evbuffer_free (buf);
+              continue;
+            }
+
+          if (r->last == NULL)
+            r->last = evbuffer_new ();
+          evbuffer_drain (r->last, evbuffer_get_length (r->last));
+          evbuffer_add (r->last, evbuffer_pullup (buf, -1), evbuffer_get_length (buf));
+        }
+
+      /* lean JSON has no raw newlines, so one message per line
+       * lets clients split the stream. benc delimits itself. */
+      if (monitor->fmt != TR_VARIANT_FMT_BENC)
+        {
+          const size_t len = evbuffer_get_length (buf);
+          if (len == 0 || evbuffer_pullup (buf, -1)[len - 1] != '\n')
+            evbuffer_add (buf, "\n", 1);
+        }
+
+      r->sent = true;
+      evbuffer_add_buffer (out, buf);
+      evbuffer_free (buf);
+    }
+
+  if (evbuffer_get_length (out) > 0)
+    evhttp_send_reply_chunk (monitor->req, out);
+
+  evbuffer_free (out);
+}
+
+static void
+monitor_timer_func (evutil_socket_t   fd UNUSED,
+                    short             what UNUSED,
+                    void            * vmonitor)
+{
+  struct rpc_monitor * monitor = vmonitor;
+
+  monitor_run (monitor);
+  tr_timerAddMsec (monitor->timer, monitor->interval_msec);
+}
+
+/* the client went away */
+static void
+monitor_closed (struct evhttp_connection * evcon UNUSED, void * vmonitor)
+{
+  struct rpc_monitor * monitor = vmonitor;
+
+  /* libevent leaves the unfinished reply to us; ending it frees it */
+  evhttp_send_reply_end (monitor->req);
+
+  tr_list_remove_data (&monitor->server->monitors, monitor);
+  monitor_free (monitor);
+}
+
+static void
+monitors_close (struct tr_rpc_server * server)
+{
+  struct rpc_monitor * monitor;
+
+  while ((monitor = tr_list_pop_front (&server->monitors)))
+    {
+      evhttp_connection_set_closecb (evhttp_request_get_connection (monitor->req), NULL, NULL);
+      evhttp_send_reply_end (monitor->req);
+      monitor_free (monitor);
+    }
+}
+
+static bool
+is_monitor_method (const char * method)
+{
+  size_t i;
+
+  for (i=0; i<TR_N_ELEMENTS (monitor_methods); ++i)
+    if (strcmp (method, monitor_methods[i]) == 0)
+      return true;
+
+  return false;
+}
+
+/* the request body is a dict with a "requests" list of ordinary,
+ * read-only RPC requests and an optional "interval" in seconds */
+static void
+handle_monitor (struct evhttp_request * req, struct tr_rpc_server * server)
+{
+  int i;
+  double interval;
+  tr_variant * requests;
+  const char * error = NULL;
+  struct rpc_monitor * monitor;
+  const tr_variant_fmt request_fmt =
+    is_benc_content_type (evhttp_find_header (req->input_headers, "Content-Type"))
+      ? TR_VARIANT_FMT_BENC
+      : TR_VARIANT_FMT_JSON;
+
+  if (req->type != EVHTTP_REQ_POST)
+    {
+      send_simple_response (req, 405, NULL);
+      return;
+    }
+
+  monitor = tr_new0 (struct rpc_monitor, 1);
+  monitor->server = server;
+  monitor->req = req;
+  monitor->fmt = get_response_format (req);
+  monitor->interval_msec = MONITOR_DEFAULT_INTERVAL_MSEC;
+
+  if (tr_variantFromBuf (&monitor->top, request_fmt,
+                         evbuffer_pullup (req->input_buffer, -1),
+                         evbuffer_get_length (req->input_buffer),
+                         NULL, NULL, TR_VARIANT_PARSE_DEFAULT) != 0)
+    {
+      tr_free (monitor);
+      send_simple_response (req, HTTP_BADREQUEST, "Unable to parse request");
+      return;
+    }
+
+  if (!tr_variantDictFindList (&monitor->top, TR_KEY_requests, &requests)
+      || tr_variantListSize (requests) == 0)
+    error = "No requests to monitor";
+
+  if (tr_variantDictFindReal (&monitor->top, TR_KEY_interval, &interval))
+    monitor->interval_msec = MIN (MAX ((int)(interval * 1000), MONITOR_MIN_INTERVAL_MSEC),
+                                  MONITOR_MAX_INTERVAL_MSEC);
+
+  if (error == NULL)
+    {
+      monitor->request_count = tr_variantListSize (requests);
+      monitor->requests = tr_new0 (struct rpc_monitor_request, monitor->request_count);
+    }
+
+  for (i=0; error == NULL && i<monitor->request_count; ++i)
+    {
+      const char * method;
+      tr_variant * request = tr_variantListChild (requests, i);
+
+      if (!tr_variantDictFindStr (request, TR_KEY_method, &method, NULL) || !is_monitor_method (method))
+        error = "Only read-only requests can be monitored";
+
+      monitor->requests[i].request = request;
+      monitor->requests[i].is_torrent_get = (error == NULL) && (strcmp (method, "torrent-get") == 0);
+    }
+
+  if (error != NULL)
+    {
+      tr_variantFree (&monitor->top);
+      tr_free (monitor->requests);
+      tr_free (monitor);
+      send_simple_response (req, HTTP_BADREQUEST, error);
+      return;
+    }
+
+  monitor->timer = evtimer_new (server->session->event_base, monitor_timer_func, monitor);
+  tr_list_append (&server->monitors, monitor);
+  evhttp_connection_set_closecb (evhttp_request_get_connection (req), monitor_closed, monitor);
+
+  evhttp_add_header (req->output_headers, "Content-Type",
+                     monitor->fmt == TR_VARIANT_FMT_BENC ? TR_RPC_BENC_CONTENT_TYPE
+                                                         : "application/json; charset=UTF-8");
+  evhttp_add_header (req->output_headers, "Cache-Control", "no-cache");
+  evhttp_send_reply_start (req, HTTP_OK, "OK");
+
+  monitor_run (monitor);
+  tr_timerAddMsec (monitor->timer, monitor->interval_msec);
+}
+
+/***
+****
+***/
+
 static bool
 isAddressAllowed (const tr_rpc_server * server, const char * address)
 {
@@ -683,6 +1314,10 @@ handle_request (struct evhttp_request * req, void * arg)
           tr_free (tmp);
         }
 #endif
+      else if (strcmp (req->uri + strlen (server->url), "rpc/monitor") == 0)
+        {
+          handle_monitor (req, server);
+        }
       else if (strncmp (req->uri + strlen (server->url), "rpc", 3) == 0)
         {
           handle_rpc (req, server);
@@ -795,6 +1430,7 @@ stopServer (tr_rpc_server * server)
   const char * address = tr_rpcGetBindAddress (server);
   const int port = server->port;
 
+  monitors_close (server);
   server->httpd = NULL;
   evhttp_free (httpd);
 
@@ -1004,6 +1640,7 @@ closeServer (void * vserver)
     tr_free (tmp);
   if (s->isStreamInitialized)
     deflateEnd (&s->stream);
+  gzip_cache_free (s);
   tr_free (s->url);
   tr_free (s->sessionId);
   tr_free (s->whitelistStr);
@@ -1039,6 +1676,9 @@ tr_rpcInit (tr_session  * session, tr_variant * settings)
   s = tr_new0 (tr_rpc_server, 1);
   s->session = session;
 
+  for (i=0; i<DEFLATE_LEVEL_COUNT; ++i)
+    s->deflateSpeed[i] = deflate_initial_speeds[i];
+
   key = TR_KEY_rpc_enabled;
   if (!tr_variantDictFindBool (settings, key, &boolVal))
     missing_settings_key (key);
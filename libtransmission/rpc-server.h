@@ -64,3 +64,32 @@ bool            tr_rpcIsPasswordEnabled (const tr_rpc_server * session);
 
 const char*     tr_rpcGetBindAddress (const tr_rpc_server * server);
 
+/***
+****  Private functions that are exposed here only for unit tests
+***/
+
+struct evbuffer;
+struct z_stream_s;
+
+/** @brief gzips `content' into `out'. Returns false if that didn't make it smaller */
+bool            tr_rpcDeflateEvbuffer (struct z_stream_s * stream,
+                                       struct evbuffer   * content,
+                                       struct evbuffer   * out);
+
+/** @brief picks a gzip level for a response, from 0 (the slowest) on up */
+int             tr_rpcPickDeflateLevel (const tr_rpc_server * server,
+                                        size_t                content_len);
+
+/**
+ * @brief looks up a web client file's gzipped contents, gzipping it if needed.
+ * @return false if the file can't be cached. Otherwise `setme_zipped' is
+ *         NULL if gzip doesn't make the file smaller. If that was just found
+ *         out, `setme_file' is the file's contents, to be freed by the caller.
+ */
+bool            tr_rpcGzipCacheGet (tr_rpc_server  * server,
+                                    const char     * filename,
+                                    const void    ** setme_zipped,
+                                    size_t         * setme_zipped_len,
+                                    void          ** setme_file,
+                                    size_t         * setme_file_len);
+
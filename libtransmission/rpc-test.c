@@ -7,8 +7,23 @@
  * $Id$
  */
 
+#include <math.h> /* fabs () */
+#include <string.h> /* memcmp (), memset () */
+
+#include <zlib.h>
+
+#include <event2/buffer.h>
+#include <event2/event.h>
+#include <event2/http.h>
+
 #include "transmission.h"
+#include "bandwidth-group.h"
+#include "crypto-utils.h" /* tr_rand_int_weak () */
 #include "rpcimpl.h"
+#include "rpc-server.h"
+#include "save-queue.h"
+#include "session.h"
+#include "torrent.h"
 #include "utils.h"
 #include "variant.h"
 
@@ -156,6 +171,682 @@ test_session_get_and_set (void)
   return 0;
 }
 
+static int
+test_bandwidth_groups (void)
+{
+  tr_session * session;
+  tr_variant request;
+  tr_variant response;
+  tr_variant * args;
+  tr_variant * list;
+  tr_variant * d;
+  tr_torrent * tor;
+  const char * str;
+  char * filename;
+  tr_variant top;
+  int64_t i;
+  bool b;
+
+  session = libttest_session_init (NULL);
+  tor = libttest_zero_torrent_init (session);
+  check (tor != NULL);
+  check (tr_bandwidthGroupFind (session, "slow") == NULL);
+
+  /* create a group */
+  tr_variantInitDict (&request, 2);
+  tr_variantDictAddStr (&request, TR_KEY_method, "group-set");
+  args = tr_variantDictAddDict (&request, TR_KEY_arguments, 3);
+  tr_variantDictAddStr (args, TR_KEY_name, "slow");
+  tr_variantDictAddInt (args, TR_KEY_uploadLimit, 10);
+  tr_variantDictAddBool (args, TR_KEY_uploadLimited, true);
+  tr_rpc_request_exec_json (session, &request, rpc_response_func, &response);
+  tr_variantFree (&request);
+  check (tr_variantDictFindStr (&response, TR_KEY_result, &str, NULL));
+  check_streq ("success", str);
+  tr_variantFree (&response);
+  check (tr_bandwidthGroupFind (session, "slow") != NULL);
+
+  /* put the torrent in it */
+  tr_variantInitDict (&request, 2);
+  tr_variantDictAddStr (&request, TR_KEY_method, "torrent-set");
+  args = tr_variantDictAddDict (&request, TR_KEY_arguments, 2);
+  tr_variantDictAddInt (args, TR_KEY_ids, tr_torrentId (tor));
+  tr_variantDictAddStr (args, TR_KEY_group, "slow");
+  tr_rpc_request_exec_json (session, &request, rpc_response_func, &response);
+  tr_variantFree (&request);
+  tr_variantFree (&response);
+  check_streq ("slow", tr_torrentGetBandwidthGroup (tor));
+  check (tor->bandwidth.parent == &tr_bandwidthGroupFind (session, "slow")->bandwidth);
+
+  /* read it back */
+  tr_variantInitDict (&request, 1);
+  tr_variantDictAddStr (&request, TR_KEY_method, "group-get");
+  tr_rpc_request_exec_json (session, &request, rpc_response_func, &response);
+  tr_variantFree (&request);
+  check (tr_variantDictFindDict (&response, TR_KEY_arguments, &args));
+  check (tr_variantDictFindList (args, TR_KEY_group, &list));
+  check_int_eq (1, tr_variantListSize (list));
+  d = tr_variantListChild (list, 0);
+  check (tr_variantDictFindStr (d, TR_KEY_name, &str, NULL));
+  check_streq ("slow", str);
+  check (tr_variantDictFindInt (d, TR_KEY_uploadLimit, &i));
+  check_int_eq (10, i);
+  check (tr_variantDictFindBool (d, TR_KEY_uploadLimited, &b));
+  check (b);
+  check (tr_variantDictFindBool (d, TR_KEY_downloadLimited, &b));
+  check (!b);
+  tr_variantFree (&response);
+
+  /* leaving the group reparents to the session */
+  tr_torrentSetBandwidthGroup (tor, "");
+  check (tr_torrentGetBandwidthGroup (tor) == NULL);
+  check (tor->bandwidth.parent == &session->bandwidth);
+
+  /* removing a group reparents its torrents too */
+  tr_torrentSetBandwidthGroup (tor, "slow");
+  tr_variantInitDict (&request, 2);
+  tr_variantDictAddStr (&request, TR_KEY_method, "group-remove");
+  args = tr_variantDictAddDict (&request, TR_KEY_arguments, 1);
+  tr_variantDictAddStr (args, TR_KEY_name, "slow");
+  tr_rpc_request_exec_json (session, &request, rpc_response_func, &response);
+  tr_variantFree (&request);
+  check (tr_variantDictFindStr (&response, TR_KEY_result, &str, NULL));
+  check_streq ("success", str);
+  tr_variantFree (&response);
+  check (tr_bandwidthGroupFind (session, "slow") == NULL);
+  check (tr_torrentGetBandwidthGroup (tor) == NULL);
+  check (tor->bandwidth.parent == &session->bandwidth);
+
+  /* groups named only by torrent-set are saved right away */
+  tr_torrentSetBandwidthGroup (tor, "implicit");
+  tr_saveQueueFlush (session->saveQueue);
+  filename = tr_buildPath (tr_sessionGetConfigDir (session), "bandwidth-groups.json", NULL);
+  check (tr_variantFromFile (&top, TR_VARIANT_FMT_JSON, filename, NULL));
+  check (tr_variantDictFind (&top, tr_quark_new ("implicit", TR_BAD_SIZE)) != NULL);
+  tr_variantFree (&top);
+  tr_free (filename);
+
+  /* cleanup */
+  tr_torrentRemove (tor, false, NULL);
+  libttest_session_close (session);
+  return 0;
+}
+
+static void
+torrent_get (tr_session * session, int64_t since, tr_variant * response)
+{
+  tr_variant request;
+  tr_variant * args;
+  tr_variant * fields;
+
+  tr_variantInitDict (&request, 2);
+  tr_variantDictAddStr (&request, TR_KEY_method, "torrent-get");
+  args = tr_variantDictAddDict (&request, TR_KEY_arguments, 2);
+  if (since)
+    tr_variantDictAddInt (args, TR_KEY_since, since);
+  fields = tr_variantDictAddList (args, TR_KEY_fields, 3);
+  tr_variantListAddStr (fields, "id");
+  tr_variantListAddStr (fields, "name");
+  tr_variantListAddStr (fields, "seedRatioLimit");
+  tr_rpc_request_exec_json (session, &request, rpc_response_func, response);
+  tr_variantFree (&request);
+}
+
+static int
+test_torrent_get_since (void)
+{
+  tr_session * session;
+  tr_variant response;
+  tr_variant * args;
+  tr_variant * list;
+  tr_variant * d;
+  tr_torrent * tor;
+  int64_t revision;
+  int64_t i;
+
+  session = libttest_session_init (NULL);
+  tor = libttest_zero_torrent_init (session);
+  check (tor != NULL);
+
+  /* a full query hands out a cursor */
+  torrent_get (session, 0, &response);
+  check (tr_variantDictFindDict (&response, TR_KEY_arguments, &args));
+  check (tr_variantDictFindInt (args, TR_KEY_revision, &revision));
+  check (revision > 0);
+  check (tr_variantDictFind (args, TR_KEY_removed) == NULL);
+  check (tr_variantDictFindList (args, TR_KEY_torrents, &list));
+  check_int_eq (1, tr_variantListSize (list));
+  d = tr_variantListChild (list, 0);
+  check (tr_variantDictFind (d, TR_KEY_name) != NULL);
+  check (tr_variantDictFind (d, TR_KEY_seedRatioLimit) != NULL);
+  tr_variantFree (&response);
+
+  /* changing a setting resends that setting, but not the metainfo */
+  tr_torrentSetRatioLimit (tor, 4.5);
+  torrent_get (session, revision, &response);
+  check (tr_variantDictFindDict (&response, TR_KEY_arguments, &args));
+  check (tr_variantDictFindInt (args, TR_KEY_revision, &i));
+  check (i > revision);
+  check (tr_variantDictFindList (args, TR_KEY_removed, &list));
+  check_int_eq (0, tr_variantListSize (list));
+  check (tr_variantDictFindList (args, TR_KEY_torrents, &list));
+  check_int_eq (1, tr_variantListSize (list));
+  d = tr_variantListChild (list, 0);
+  check (tr_variantDictFindInt (d, TR_KEY_id, &i));
+  check_int_eq (tr_torrentId (tor), i);
+  check (tr_variantDictFind (d, TR_KEY_name) == NULL);
+  check (tr_variantDictFind (d, TR_KEY_seedRatioLimit) != NULL);
+  tr_variantFree (&response);
+
+  /* a cursor from the future is ignored */
+  torrent_get (session, revision + 1000000, &response);
+  check (tr_variantDictFindDict (&response, TR_KEY_arguments, &args));
+  check (tr_variantDictFind (args, TR_KEY_removed) == NULL);
+  check (tr_variantDictFindList (args, TR_KEY_torrents, &list));
+  check_int_eq (1, tr_variantListSize (list));
+  check (tr_variantDictFind (tr_variantListChild (list, 0), TR_KEY_name) != NULL);
+  tr_variantFree (&response);
+
+  /* so is one from an earlier run, even though it's a small number */
+  check (revision > 1000);
+  torrent_get (session, 1000, &response);
+  check (tr_variantDictFindDict (&response, TR_KEY_arguments, &args));
+  check (tr_variantDictFind (args, TR_KEY_removed) == NULL);
+  check (tr_variantDictFindList (args, TR_KEY_torrents, &list));
+  check_int_eq (1, tr_variantListSize (list));
+  check (tr_variantDictFind (tr_variantListChild (list, 0), TR_KEY_name) != NULL);
+  tr_variantFree (&response);
+
+  /* cleanup */
+  tr_torrentRemove (tor, false, NULL);
+  libttest_session_close (session);
+  return 0;
+}
+
+/* the revision counter can move between two requests,
+ * since stats for recently-busy torrents change with the clock */
+static void
+copy_revision (tr_variant * to, tr_variant * from)
+{
+  int64_t revision;
+  tr_variant * args;
+
+  if (tr_variantDictFindDict (from, TR_KEY_arguments, &args)
+      && tr_variantDictFindInt (args, TR_KEY_revision, &revision)
+      && tr_variantDictFindDict (to, TR_KEY_arguments, &args))
+    tr_variantDictAddInt (args, TR_KEY_revision, revision);
+}
+
+static int
+test_torrent_get_stream (void)
+{
+  size_t i;
+  tr_session * session;
+  tr_variant request;
+  tr_variant response;
+  tr_variant streamed;
+  tr_variant * args;
+  tr_variant * fields;
+  tr_torrent * tor;
+  struct evbuffer * buf;
+  char * expected;
+  char * actual;
+  const char * str;
+  tr_quark key;
+  const char * field_names[] = { "id", "name", "hashString", "rateDownload",
+                                 "percentDone", "isFinished", "files", "fileStats",
+                                 "priorities", "wanted", "peersFrom", "trackers",
+                                 "noSuchField" };
+  const size_t n_fields = sizeof (field_names) / sizeof (*field_names);
+
+  session = libttest_session_init (NULL);
+  tor = libttest_zero_torrent_init (session);
+  check (tor != NULL);
+
+  tr_variantInitDict (&request, 3);
+  tr_variantDictAddStr (&request, TR_KEY_method, "torrent-get");
+  tr_variantDictAddInt (&request, TR_KEY_tag, 42);
+  args = tr_variantDictAddDict (&request, TR_KEY_arguments, 1);
+  fields = tr_variantDictAddList (args, TR_KEY_fields, n_fields);
+  for (i=0; i<n_fields; ++i)
+    tr_variantListAddStr (fields, field_names[i]);
+
+  /* the streamed response should say the same thing as the tr_variant one,
+   * even if the upkeep timer moves the revision between the two requests */
+  tr_rpc_request_exec_json (session, &request, rpc_response_func, &response);
+  tr_torrentMarkChanged (tor, TR_FIELDS_STATS);
+  buf = evbuffer_new ();
+  check (tr_rpc_request_exec_json_stream (session, &request, TR_VARIANT_FMT_JSON_LEAN, buf));
+  check (tr_variantFromJson (&streamed, evbuffer_pullup (buf, -1), evbuffer_get_length (buf)) == 0);
+  copy_revision (&response, &streamed);
+  expected = tr_variantToStr (&response, TR_VARIANT_FMT_JSON_LEAN, NULL);
+  actual = tr_variantToStr (&streamed, TR_VARIANT_FMT_JSON_LEAN, NULL);
+  check_streq (expected, actual);
+  tr_free (actual);
+  tr_free (expected);
+  tr_variantFree (&streamed);
+  evbuffer_free (buf);
+
+  /* streamed benc should be byte-for-byte what tr_variantToBuf () makes,
+   * sorted keys and all */
+  buf = evbuffer_new ();
+  check (tr_rpc_request_exec_json_stream (session, &request, TR_VARIANT_FMT_BENC, buf));
+  check (tr_variantFromBenc (&streamed, evbuffer_pullup (buf, -1), evbuffer_get_length (buf)) == 0);
+  copy_revision (&response, &streamed);
+  tr_variantFree (&streamed);
+  expected = tr_variantToStr (&response, TR_VARIANT_FMT_BENC, &i);
+  check_uint_eq (i, evbuffer_get_length (buf));
+  check (memcmp (expected, evbuffer_pullup (buf, -1), i) == 0);
+  tr_free (expected);
+  tr_variantFree (&response);
+  evbuffer_free (buf);
+
+  /* field names from clients shouldn't grow the quark table */
+  check (!tr_quark_lookup ("noSuchField", strlen ("noSuchField"), &key));
+
+  /* methods without a streaming writer are left to tr_rpc_request_exec_json () */
+  tr_variantDictAddStr (&request, TR_KEY_method, "session-get");
+  buf = evbuffer_new ();
+  check (!tr_rpc_request_exec_json_stream (session, &request, TR_VARIANT_FMT_JSON_LEAN, buf));
+  check_int_eq (0, evbuffer_get_length (buf));
+  evbuffer_free (buf);
+
+  /* nor are method names */
+  tr_variantDictAddStr (&request, TR_KEY_method, "no-such-method");
+  tr_rpc_request_exec_json (session, &request, rpc_response_func, &response);
+  check (tr_variantDictFindStr (&response, TR_KEY_result, &str, NULL));
+  check_streq ("method name not recognized", str);
+  check (!tr_quark_lookup ("no-such-method", strlen ("no-such-method"), &key));
+  tr_variantFree (&response);
+  tr_variantFree (&request);
+
+  /* cleanup */
+  tr_torrentRemove (tor, false, NULL);
+  libttest_session_close (session);
+  return 0;
+}
+
+/* benc has no bool or real types, so check they survive a round trip */
+static int
+test_benc_messages (void)
+{
+  size_t len;
+  char * benc;
+  bool b;
+  double d;
+  tr_session * session;
+  tr_variant request;
+  tr_variant response;
+  tr_variant * args;
+
+  session = libttest_session_init (NULL);
+
+  tr_variantInitDict (&request, 2);
+  tr_variantDictAddStr (&request, TR_KEY_method, "session-set");
+  args = tr_variantDictAddDict (&request, TR_KEY_arguments, 2);
+  tr_variantDictAddReal (args, TR_KEY_seedRatioLimit, 2.5);
+  tr_variantDictAddBool (args, TR_KEY_seedRatioLimited, true);
+  benc = tr_variantToStr (&request, TR_VARIANT_FMT_BENC, &len);
+  tr_variantFree (&request);
+  check_int_eq (0, tr_variantFromBenc (&request, benc, len));
+  tr_free (benc);
+  tr_rpc_request_exec_json (session, &request, rpc_response_func, &response);
+  tr_variantFree (&request);
+  tr_variantFree (&response);
+
+  check (fabs (tr_sessionGetRatioLimit (session) - 2.5) < 0.001);
+  check (tr_sessionIsRatioLimited (session));
+
+  tr_variantInitDict (&request, 1);
+  tr_variantDictAddStr (&request, TR_KEY_method, "session-get");
+  tr_rpc_request_exec_json (session, &request, rpc_response_func, &response);
+  tr_variantFree (&request);
+  benc = tr_variantToStr (&response, TR_VARIANT_FMT_BENC, &len);
+  tr_variantFree (&response);
+  check_int_eq (0, tr_variantFromBenc (&response, benc, len));
+  tr_free (benc);
+
+  check (tr_variantDictFindDict (&response, TR_KEY_arguments, &args));
+  check (tr_variantDictFindReal (args, TR_KEY_seedRatioLimit, &d));
+  check (fabs (d - 2.5) < 0.001);
+  check (tr_variantDictFindBool (args, TR_KEY_seedRatioLimited, &b));
+  check (b);
+  tr_variantFree (&response);
+
+  libttest_session_close (session);
+  return 0;
+}
+
+/***
+****
+***/
+
+struct monitor_client
+{
+  struct event_base * base;
+  struct evbuffer   * body;
+  char              * session_id;
+  int                 status;
+  int                 lines;
+};
+
+static void
+monitor_chunk_func (struct evhttp_request * req, void * vclient)
+{
+  struct monitor_client * client = vclient;
+  struct evbuffer * in = evhttp_request_get_input_buffer (req);
+  const size_t len = evbuffer_get_length (in);
+  const char * walk = (const char *) evbuffer_pullup (in, -1);
+  size_t i;
+
+  for (i=0; i<len; ++i)
+    if (walk[i] == '\n')
+      ++client->lines;
+
+  client->status = evhttp_request_get_response_code (req);
+  evbuffer_add_buffer (client->body, in);
+  event_base_loopbreak (client->base);
+}
+
+static void
+monitor_done_func (struct evhttp_request * req, void * vclient)
+{
+  struct monitor_client * client = vclient;
+
+  if (req != NULL)
+    {
+      const char * id = evhttp_find_header (evhttp_request_get_input_headers (req), TR_RPC_SESSION_ID_HEADER);
+
+      client->status = evhttp_request_get_response_code (req);
+      if (id != NULL)
+        {
+          tr_free (client->session_id);
+          client->session_id = tr_strdup (id);
+        }
+    }
+
+  event_base_loopbreak (client->base);
+}
+
+/* POSTs `body' to the monitor URL and runs until the first response
+ * or chunk arrives. The caller frees the returned connection */
+static struct evhttp_connection *
+monitor_post (struct monitor_client * client, int port, const char * body)
+{
+  struct timeval tv = { 10, 0 };
+  struct evhttp_request * req;
+  struct evhttp_connection * evcon;
+
+  client->status = 0;
+  evcon = evhttp_connection_base_new (client->base, NULL, "127.0.0.1", port);
+  req = evhttp_request_new (monitor_done_func, client);
+  evhttp_request_set_chunked_cb (req, monitor_chunk_func);
+  evhttp_add_header (evhttp_request_get_output_headers (req), "Host", "127.0.0.1");
+  if (client->session_id != NULL)
+    evhttp_add_header (evhttp_request_get_output_headers (req), TR_RPC_SESSION_ID_HEADER, client->session_id);
+  evbuffer_add (evhttp_request_get_output_buffer (req), body, strlen (body));
+  evhttp_make_request (evcon, req, EVHTTP_REQ_POST, "/transmission/rpc/monitor");
+
+  event_base_loopexit (client->base, &tv);
+  event_base_dispatch (client->base);
+  return evcon;
+}
+
+static int
+test_monitor (void)
+{
+  int i;
+  tr_variant settings;
+  tr_session * session;
+  struct evhttp_connection * evcon;
+  struct monitor_client client;
+  struct timeval tv = { 10, 0 };
+  const int port = 40000 + tr_rand_int_weak (10000);
+  const char * body = "{ \"interval\": 0.1, \"requests\": "
+                      "[ { \"method\": \"session-stats\", \"tag\": 7 } ] }";
+
+  tr_variantInitDict (&settings, 5);
+  tr_variantDictAddBool (&settings, TR_KEY_rpc_enabled, true);
+  tr_variantDictAddInt (&settings, TR_KEY_rpc_port, port);
+  tr_variantDictAddStr (&settings, TR_KEY_rpc_bind_address, "127.0.0.1");
+  tr_variantDictAddBool (&settings, TR_KEY_rpc_authentication_required, false);
+  tr_variantDictAddBool (&settings, TR_KEY_rpc_whitelist_enabled, false);
+  session = libttest_session_init (&settings);
+
+  memset (&client, 0, sizeof (client));
+  client.base = event_base_new ();
+  client.body = evbuffer_new ();
+
+  /* the first try is turned away, but hands out a session id.
+   * retry until the server's listening */
+  for (i=0; i<100 && client.session_id == NULL; ++i)
+    {
+      evcon = monitor_post (&client, port, body);
+      evhttp_connection_free (evcon);
+      if (client.session_id == NULL)
+        tr_wait_msec (100);
+    }
+  check_int_eq (409, client.status);
+  check (client.session_id != NULL);
+
+  /* each request is answered right away... */
+  evbuffer_drain (client.body, evbuffer_get_length (client.body));
+  evcon = monitor_post (&client, port, body);
+  check_int_eq (200, client.status);
+  check (client.lines >= 1);
+  check (evbuffer_search (client.body, "\"tag\":7", 7, NULL).pos != -1);
+  check (evbuffer_search (client.body, "success", 7, NULL).pos != -1);
+
+  /* ...and pushed again when it changes, which session-stats'
+   * "secondsActive" does every second */
+  for (i=0; i<3 && client.lines<2; ++i)
+    {
+      event_base_loopexit (client.base, &tv);
+      event_base_dispatch (client.base);
+    }
+  check_int_eq (2, client.lines);
+
+  /* cleanup */
+  evhttp_connection_free (evcon);
+  evbuffer_free (client.body);
+  event_base_free (client.base);
+  tr_free (client.session_id);
+  libttest_session_close (session);
+  tr_variantFree (&settings);
+  return 0;
+}
+
+/***
+****
+***/
+
+/* returns the inflated contents of `zipped', or NULL if it isn't valid gzip */
+static char *
+gunzip (const void * zipped, size_t zipped_len, size_t * setme_len)
+{
+  int state = Z_OK;
+  z_stream stream;
+  struct evbuffer * out = evbuffer_new ();
+
+  memset (&stream, 0, sizeof (stream));
+  inflateInit2 (&stream, 15+16);
+  stream.next_in = (Bytef*) zipped;
+  stream.avail_in = zipped_len;
+
+  while (state == Z_OK)
+    {
+      struct evbuffer_iovec space[1];
+
+      evbuffer_reserve_space (out, 4096, space, 1);
+      stream.next_out = space[0].iov_base;
+      stream.avail_out = space[0].iov_len;
+      state = inflate (&stream, Z_NO_FLUSH);
+      space[0].iov_len -= stream.avail_out;
+      evbuffer_commit_space (out, space, 1);
+    }
+
+  inflateEnd (&stream);
+
+  if (state != Z_STREAM_END)
+    {
+      evbuffer_free (out);
+      return NULL;
+    }
+
+  return evbuffer_free_to_str (out, setme_len);
+}
+
+static int
+test_deflate_evbuffer (void)
+{
+  int i;
+  size_t len;
+  char * str;
+  z_stream stream;
+  char segments[3][4096];
+  char random[65536];
+  struct evbuffer * content = evbuffer_new ();
+  struct evbuffer * zipped = evbuffer_new ();
+  struct evbuffer * expected = evbuffer_new ();
+
+  memset (&stream, 0, sizeof (stream));
+  deflateInit2 (&stream, 6, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY);
+
+  /* content in several pieces is gzipped as a whole */
+  for (i=0; i<3; ++i)
+    {
+      memset (segments[i], 'a' + i, sizeof (segments[i]));
+      evbuffer_add_reference (content, segments[i], sizeof (segments[i]), NULL, NULL);
+      evbuffer_add (expected, segments[i], sizeof (segments[i]));
+    }
+  check_int_eq (3, evbuffer_peek (content, -1, NULL, NULL, 0));
+  check (tr_rpcDeflateEvbuffer (&stream, content, zipped));
+  check (evbuffer_get_length (zipped) < evbuffer_get_length (content));
+  str = gunzip (evbuffer_pullup (zipped, -1), evbuffer_get_length (zipped), &len);
+  check (str != NULL);
+  check_uint_eq (evbuffer_get_length (expected), len);
+  check (memcmp (evbuffer_pullup (expected, -1), str, len) == 0);
+  tr_free (str);
+
+  /* content that gzip can't shrink isn't used */
+  deflateReset (&stream);
+  evbuffer_drain (content, evbuffer_get_length (content));
+  evbuffer_drain (zipped, evbuffer_get_length (zipped));
+  tr_rand_buffer (random, sizeof (random));
+  evbuffer_add_reference (content, random, sizeof (random), NULL, NULL);
+  check (!tr_rpcDeflateEvbuffer (&stream, content, zipped));
+
+  deflateEnd (&stream);
+  evbuffer_free (expected);
+  evbuffer_free (zipped);
+  evbuffer_free (content);
+  return 0;
+}
+
+static int
+test_pick_deflate_level (void)
+{
+  tr_session * session;
+  int small_level;
+
+  session = libttest_session_init (NULL);
+
+  /* small responses get the best compression there is time for... */
+  small_level = tr_rpcPickDeflateLevel (session->rpcServer, 1024);
+#ifdef TR_LIGHTWEIGHT
+  check_int_eq (1, small_level);
+#else
+  check_int_eq (0, small_level);
+#endif
+
+  /* ...and huge ones get the fastest */
+  check_int_eq (2, tr_rpcPickDeflateLevel (session->rpcServer, 100 * 1024 * 1024));
+  check (small_level <= tr_rpcPickDeflateLevel (session->rpcServer, 1024 * 1024));
+
+  libttest_session_close (session);
+  return 0;
+}
+
+/* looks up `filename' in the gzip cache, and checks its gzipped contents */
+static int
+check_gzip_cache_get (tr_session * session, const char * filename, const char * expected, const void ** setme_zipped)
+{
+  char * str;
+  size_t len;
+  void * file;
+  size_t file_len;
+  size_t zipped_len;
+
+  check (tr_rpcGzipCacheGet (session->rpcServer, filename, setme_zipped, &zipped_len, &file, &file_len));
+  check (*setme_zipped != NULL);
+  check (file == NULL);
+  str = gunzip (*setme_zipped, zipped_len, &len);
+  check_streq (expected, str);
+  tr_free (str);
+  return 0;
+}
+
+static int
+test_gzip_cache (void)
+{
+  void * file;
+  size_t file_len;
+  const void * zipped;
+  const void * first;
+  size_t zipped_len;
+  char random[4096];
+  char * filename;
+  char * filename2;
+  tr_session * session;
+  const char * text1 = "hello hello hello hello hello hello hello hello hello hello";
+  const char * text2 = "hello hello hello hello hello hello hello hello hello hello world";
+  const char * text3 = "jello jello jello jello jello jello jello jello jello jello world";
+
+  session = libttest_session_init (NULL);
+  filename = tr_buildPath (tr_sessionGetConfigDir (session), "index.html", NULL);
+  filename2 = tr_buildPath (tr_sessionGetConfigDir (session), "random.png", NULL);
+
+  /* a file is gzipped once, then served from the cache... */
+  libtest_create_file_with_string_contents (filename, text1);
+  if (check_gzip_cache_get (session, filename, text1, &first))
+    return 1;
+  if (check_gzip_cache_get (session, filename, text1, &zipped))
+    return 1;
+  check (zipped == first);
+
+  /* ...until its size changes... */
+  libtest_create_file_with_string_contents (filename, text2);
+  if (check_gzip_cache_get (session, filename, text2, &zipped))
+    return 1;
+
+  /* ...or its mtime does */
+  tr_wait_msec (1100);
+  libtest_create_file_with_string_contents (filename, text3);
+  if (check_gzip_cache_get (session, filename, text3, &zipped))
+    return 1;
+
+  /* a file that gzip can't shrink is handed back as it was read,
+   * so that it needn't be read again to be sent */
+  tr_rand_buffer (random, sizeof (random));
+  libtest_create_file_with_contents (filename2, random, sizeof (random));
+  check (tr_rpcGzipCacheGet (session->rpcServer, filename2, &zipped, &zipped_len, &file, &file_len));
+  check (zipped == NULL);
+  check (file != NULL);
+  check_uint_eq (sizeof (random), file_len);
+  check (memcmp (random, file, file_len) == 0);
+  tr_free (file);
+
+  /* ...and after that, the cache remembers not to bother */
+  check (tr_rpcGzipCacheGet (session->rpcServer, filename2, &zipped, &zipped_len, &file, &file_len));
+  check (zipped == NULL);
+  check (file == NULL);
+
+  tr_free (filename2);
+  tr_free (filename);
+  libttest_session_close (session);
+  return 0;
+}
+
 /***
 ****
 ***/
@@ -164,7 +855,14 @@ int
 main (void)
 {
   const testFunc tests[] = { test_list,
-                             test_session_get_and_set };
-
+                             test_session_get_and_set,
+                             test_bandwidth_groups,
+                             test_torrent_get_since,
+                             test_torrent_get_stream,
+                             test_benc_messages,
+                             test_monitor,
+                             test_deflate_evbuffer,
+                             test_pick_deflate_level,
+                             test_gzip_cache };
   return runTests (tests, NUM_TESTS (tests));
 }
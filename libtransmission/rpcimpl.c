@@ -18,6 +18,7 @@
 #include <event2/buffer.h>
 
 #include "transmission.h"
+#include "bandwidth-group.h"
 #include "completion.h"
 #include "crypto-utils.h"
 #include "error.h"
@@ -33,7 +34,7 @@
 #include "version.h"
 #include "web.h"
 
-#define RPC_VERSION     15
+#define RPC_VERSION     16
 #define RPC_VERSION_MIN 1
 
 #define RECENTLY_ACTIVE_SECONDS 60
@@ -435,10 +436,10 @@ addFileStats (const tr_torrent * tor, tr_variant * list)
 {
   tr_file_index_t i;
   tr_file_index_t n;
-  const tr_info * info = tr_torrentInfo (tor);
-  tr_file_stat * files = tr_torrentFiles (tor, &n);
+  tr_file_stat * files = tr_torrentFiles (tor, &n); /* pages in the file table */
+  const tr_info * info = &tor->info;
 
-  for (i=0; i<info->fileCount; ++i)
+  for (i=0; i<n; ++i)
     {
       const tr_file * file = &info->files[i];
       tr_variant * d = tr_variantListAddDict (list, 3);
@@ -455,10 +456,10 @@ addFiles (const tr_torrent * tor, tr_variant * list)
 {
   tr_file_index_t i;
   tr_file_index_t n;
-  const tr_info * info = tr_torrentInfo (tor);
-  tr_file_stat *  files = tr_torrentFiles (tor, &n);
+  tr_file_stat *  files = tr_torrentFiles (tor, &n); /* pages in the file table */
+  const tr_info * info = &tor->info;
 
-  for (i=0; i<info->fileCount; ++i)
+  for (i=0; i<n; ++i)
     {
       const tr_file * file = &info->files[i];
       tr_variant * d = tr_variantListAddDict (list, 3);
@@ -652,6 +653,10 @@ addField (tr_torrent       * const tor,
         addFileStats (tor, tr_variantDictAddList (d, key, inf->fileCount));
         break;
 
+      case TR_KEY_group:
+        tr_variantDictAddStr (d, key, tor->bandwidthGroup ? tor->bandwidthGroup : "");
+        break;
+
       case TR_KEY_hashString:
         tr_variantDictAddStr (d, key, tor->info.hashString);
         break;
@@ -775,8 +780,9 @@ addField (tr_torrent       * const tor,
       case TR_KEY_priorities:
         {
           tr_file_index_t i;
-          tr_variant * p = tr_variantDictAddList (d, key, inf->fileCount);
-          for (i=0; i<inf->fileCount; ++i)
+          const tr_file_index_t n = tr_torrentPageIn (tor) ? inf->fileCount : 0;
+          tr_variant * p = tr_variantDictAddList (d, key, n);
+          for (i=0; i<n; ++i)
             tr_variantListAddInt (p, inf->files[i].priority);
           break;
         }
@@ -877,8 +883,9 @@ addField (tr_torrent       * const tor,
       case TR_KEY_wanted:
         {
           tr_file_index_t i;
-          tr_variant * w = tr_variantDictAddList (d, key, inf->fileCount);
-          for (i=0; i<inf->fileCount; ++i)
+          const tr_file_index_t n = tr_torrentPageIn (tor) ? inf->fileCount : 0;
+          tr_variant * w = tr_variantDictAddList (d, key, n);
+          for (i=0; i<n; ++i)
             tr_variantListAddInt (w, inf->files[i].dnd ? 0 : 1);
           break;
         }
@@ -896,46 +903,196 @@ addField (tr_torrent       * const tor,
     }
 }
 
-static void
-addInfo (tr_torrent * tor, tr_variant * d, tr_variant * fields)
+/* which tr_field_group a torrent-get field belongs to */
+static tr_field_group
+getFieldGroup (const tr_quark key)
+{
+  switch (key)
+    {
+      case TR_KEY_addedDate:
+      case TR_KEY_comment:
+      case TR_KEY_creator:
+      case TR_KEY_dateCreated:
+      case TR_KEY_hashString:
+      case TR_KEY_id:
+      case TR_KEY_isPrivate:
+      case TR_KEY_magnetLink:
+      case TR_KEY_name:
+      case TR_KEY_pieceCount:
+      case TR_KEY_pieceSize:
+      case TR_KEY_torrentFile:
+      case TR_KEY_totalSize:
+        return TR_FIELDS_INFO;
+
+      case TR_KEY_bandwidthPriority:
+      case TR_KEY_downloadDir:
+      case TR_KEY_downloadLimit:
+      case TR_KEY_downloadLimited:
+      case TR_KEY_group:
+      case TR_KEY_honorsSessionLimits:
+      case TR_KEY_maxConnectedPeers:
+      case TR_KEY_peer_limit:
+      case TR_KEY_priorities:
+      case TR_KEY_queuePosition:
+      case TR_KEY_seedIdleLimit:
+      case TR_KEY_seedIdleMode:
+      case TR_KEY_seedRatioLimit:
+      case TR_KEY_seedRatioMode:
+      case TR_KEY_trackers:
+      case TR_KEY_uploadLimit:
+      case TR_KEY_uploadLimited:
+      case TR_KEY_wanted:
+      case TR_KEY_webseeds:
+        return TR_FIELDS_CONFIG;
+
+      default:
+        return TR_FIELDS_STATS;
+    }
+}
+
+static uint64_t
+getTorrentRevision (const tr_torrent * tor)
+{
+  int i;
+  uint64_t ret = 0;
+
+  for (i=0; i<TR_FIELDS_COUNT; ++i)
+    ret = MAX (ret, tor->revision[i]);
+
+  return ret;
+}
+
+/* a requested torrent-get field and the tr_field_group it's in */
+struct field_key
+{
+  tr_quark key;
+  tr_field_group group;
+};
+
+static int
+compareFieldKeys (const void * va, const void * vb)
+{
+  size_t alen;
+  size_t blen;
+  const char * a = tr_quark_get_string (((const struct field_key *) va)->key, &alen);
+  const char * b = tr_quark_get_string (((const struct field_key *) vb)->key, &blen);
+  const int ret = memcmp (a, b, MIN (alen, blen));
+
+  if (ret != 0)
+    return ret;
+
+  return alen < blen ? -1 : (alen > blen ? 1 : 0);
+}
+
+/* look up the requested fields' quarks and groups once per request
+ * rather than once per torrent. names we don't know are dropped
+ * instead of being added to the quark table. benc dicts must have
+ * sorted, unique keys, so sort and dedupe them if needed. */
+static struct field_key *
+getFieldKeys (tr_variant * fields, bool sorted, int * setme_n)
 {
-  const int n = tr_variantListSize (fields);
+  int i;
+  int n = 0;
+  const int field_count = tr_variantListSize (fields);
+  struct field_key * keys = tr_new (struct field_key, field_count);
+
+  for (i=0; i<field_count; ++i)
+    {
+      size_t len;
+      const char * str;
+      tr_quark key;
+
+      if (tr_variantGetStr (tr_variantListChild (fields, i), &str, &len)
+          && tr_quark_lookup (str, len, &key))
+        {
+          keys[n].key = key;
+          keys[n].group = getFieldGroup (key);
+          ++n;
+        }
+    }
+
+  if (sorted && n > 1)
+    {
+      int j = 0;
 
-  tr_variantInitDict (d, n);
+      qsort (keys, n, sizeof (struct field_key), compareFieldKeys);
+      for (i=1; i<n; ++i)
+        if (keys[i].key != keys[j].key)
+          keys[++j] = keys[i];
+      n = j + 1;
+    }
+
+  *setme_n = n;
+  return keys;
+}
+
+/* if `since' is nonzero, only the fields that changed after that
+ * revision are added. `id' is always added so clients can merge. */
+static void
+addInfo (tr_torrent * tor, tr_variant * d, const struct field_key * keys, int n_keys, uint64_t since)
+{
+  tr_variantInitDict (d, n_keys);
 
-  if (n > 0)
+  if (n_keys > 0)
     {
       int i;
-      const tr_info * const inf = tr_torrentInfo (tor);
+      const tr_info * const inf = &tor->info;
       const tr_stat * const st = tr_torrentStat ((tr_torrent*)tor);
 
-      for (i=0; i<n; ++i)
+      for (i=0; i<n_keys; ++i)
         {
-          size_t len;
-          const char * str;
-          if (tr_variantGetStr (tr_variantListChild (fields, i), &str, &len))
-            addField (tor, inf, st, d, tr_quark_new (str, len));
+          const tr_quark key = keys[i].key;
+
+          if (since && (key != TR_KEY_id) && (tor->revision[keys[i].group] <= since))
+            continue;
+
+          addField (tor, inf, st, d, key);
         }
     }
 }
 
-static const char*
-torrentGet (tr_session               * session,
-            tr_variant               * args_in,
-            tr_variant               * args_out,
-            struct tr_rpc_idle_data  * idle_data UNUSED)
+/* parse torrent-get's "since" cursor. 0 means "everything" */
+static int64_t
+getTorrentGetSince (const tr_session * session, tr_variant * args_in)
 {
-  int i;
-  int torrentCount;
-  tr_torrent ** torrents = getTorrents (session, args_in, &torrentCount);
-  tr_variant * list = tr_variantDictAddList (args_out, TR_KEY_torrents, torrentCount);
-  tr_variant * fields;
-  const char * strVal;
-  const char * errmsg = NULL;
+  int64_t since = 0;
 
-  assert (idle_data == NULL);
+  /* a cursor from another run can't be trusted: the torrent ids
+   * have been reassigned and the removals weren't recorded */
+  if (tr_variantDictFindInt (args_in, TR_KEY_since, &since))
+    if ((since < 0)
+        || ((uint64_t)since < session->torrentRevisionBase)
+        || ((uint64_t)since > session->torrentRevision))
+      since = 0;
+
+  return since;
+}
+
+/* add everything in a torrent-get response except the "torrents" list */
+static void
+addTorrentGetHeader (tr_session * session,
+                     tr_variant * args_in,
+                     int64_t      since,
+                     tr_variant * args_out)
+{
+  const char * strVal;
 
-  if (tr_variantDictFindStr (args_in, TR_KEY_ids, &strVal, NULL) && strcmp (strVal, "recently-active") == 0)
+  if (since > 0)
+    {
+      int n = 0;
+      tr_variant * d;
+      tr_variant * removed_out = tr_variantDictAddList (args_out, TR_KEY_removed, 0);
+      while ((d = tr_variantListChild (&session->removedTorrents, n++)))
+        {
+          int64_t intVal;
+          if (tr_variantDictFindInt (d, TR_KEY_revision, &intVal) && (intVal > since))
+            {
+              tr_variantDictFindInt (d, TR_KEY_id, &intVal);
+              tr_variantListAddInt (removed_out, intVal);
+            }
+        }
+    }
+  else if (tr_variantDictFindStr (args_in, TR_KEY_ids, &strVal, NULL) && strcmp (strVal, "recently-active") == 0)
     {
       int n = 0;
       tr_variant * d;
@@ -953,15 +1110,263 @@ torrentGet (tr_session               * session,
         }
     }
 
+  tr_variantDictAddInt (args_out, TR_KEY_revision, session->torrentRevision);
+}
+
+static const char*
+torrentGet (tr_session               * session,
+            tr_variant               * args_in,
+            tr_variant               * args_out,
+            struct tr_rpc_idle_data  * idle_data UNUSED)
+{
+  int i;
+  int torrentCount;
+  tr_torrent ** torrents = getTorrents (session, args_in, &torrentCount);
+  const int64_t since = getTorrentGetSince (session, args_in);
+  tr_variant * list;
+  tr_variant * fields;
+  const char * errmsg = NULL;
+
+  assert (idle_data == NULL);
+
+  addTorrentGetHeader (session, args_in, since, args_out);
+
+  list = tr_variantDictAddList (args_out, TR_KEY_torrents, torrentCount);
+
   if (!tr_variantDictFindList (args_in, TR_KEY_fields, &fields))
-    errmsg = "no fields specified";
-  else for (i=0; i<torrentCount; ++i)
-    addInfo (torrents[i], tr_variantListAdd (list), fields);
+    {
+      errmsg = "no fields specified";
+    }
+  else
+    {
+      int n_keys;
+      struct field_key * keys = getFieldKeys (fields, false, &n_keys);
+
+      for (i=0; i<torrentCount; ++i)
+        if (!since || (getTorrentRevision (torrents[i]) > (uint64_t)since))
+          addInfo (torrents[i], tr_variantListAdd (list), keys, n_keys, since);
+
+      tr_free (keys);
+    }
 
   tr_free (torrents);
   return errmsg;
 }
 
+/***
+****  Streaming torrent-get
+****
+****  For big sessions, building a tr_variant tree for every torrent,
+****  file, and field and then walking it is most of torrent-get's cost.
+****  These write the common fields straight into the response instead
+****  and fall back to addField () for the rest.
+***/
+
+static void
+streamFiles (const tr_torrent * tor, tr_jsonWriter * w, bool withStats)
+{
+  tr_file_index_t i;
+  tr_file_index_t n;
+  tr_file_stat * files = tr_torrentFiles (tor, &n); /* pages in the file table */
+  const tr_info * info = &tor->info;
+
+  tr_jsonWriteListBegin (w);
+
+  for (i=0; i<n; ++i)
+    {
+      const tr_file * file = &info->files[i];
+
+      tr_jsonWriteDictBegin (w);
+      tr_jsonWriteKey (w, TR_KEY_bytesCompleted);
+      tr_jsonWriteInt (w, files[i].bytesCompleted);
+      if (withStats)
+        {
+          tr_jsonWriteKey (w, TR_KEY_priority);
+          tr_jsonWriteInt (w, file->priority);
+          tr_jsonWriteKey (w, TR_KEY_wanted);
+          tr_jsonWriteBool (w, !file->dnd);
+        }
+      else
+        {
+          tr_jsonWriteKey (w, TR_KEY_length);
+          tr_jsonWriteInt (w, file->length);
+          tr_jsonWriteKey (w, TR_KEY_name);
+          tr_jsonWriteStr (w, file->name, TR_BAD_SIZE);
+        }
+      tr_jsonWriteDictEnd (w);
+    }
+
+  tr_jsonWriteListEnd (w);
+
+  tr_torrentFilesFree (files, n);
+}
+
+static void
+streamField (tr_torrent       * const tor,
+             const tr_info    * const inf,
+             const tr_stat    * const st,
+             tr_jsonWriter    * const w,
+             const tr_quark           key)
+{
+  tr_file_index_t i;
+  tr_file_index_t n;
+
+  switch (key)
+    {
+      case TR_KEY_activityDate:     tr_jsonWriteKey (w, key); tr_jsonWriteInt (w, st->activityDate); break;
+      case TR_KEY_addedDate:        tr_jsonWriteKey (w, key); tr_jsonWriteInt (w, st->addedDate); break;
+      case TR_KEY_corruptEver:      tr_jsonWriteKey (w, key); tr_jsonWriteInt (w, st->corruptEver); break;
+      case TR_KEY_desiredAvailable: tr_jsonWriteKey (w, key); tr_jsonWriteInt (w, st->desiredAvailable); break;
+      case TR_KEY_doneDate:         tr_jsonWriteKey (w, key); tr_jsonWriteInt (w, st->doneDate); break;
+      case TR_KEY_downloadDir:      tr_jsonWriteKey (w, key); tr_jsonWriteStr (w, tr_torrentGetDownloadDir (tor), TR_BAD_SIZE); break;
+      case TR_KEY_downloadedEver:   tr_jsonWriteKey (w, key); tr_jsonWriteInt (w, st->downloadedEver); break;
+      case TR_KEY_error:            tr_jsonWriteKey (w, key); tr_jsonWriteInt (w, st->error); break;
+      case TR_KEY_errorString:      tr_jsonWriteKey (w, key); tr_jsonWriteStr (w, st->errorString, TR_BAD_SIZE); break;
+      case TR_KEY_eta:              tr_jsonWriteKey (w, key); tr_jsonWriteInt (w, st->eta); break;
+      case TR_KEY_etaIdle:          tr_jsonWriteKey (w, key); tr_jsonWriteInt (w, st->etaIdle); break;
+      case TR_KEY_hashString:       tr_jsonWriteKey (w, key); tr_jsonWriteStr (w, inf->hashString, TR_BAD_SIZE); break;
+      case TR_KEY_haveUnchecked:    tr_jsonWriteKey (w, key); tr_jsonWriteInt (w, st->haveUnchecked); break;
+      case TR_KEY_haveValid:        tr_jsonWriteKey (w, key); tr_jsonWriteInt (w, st->haveValid); break;
+      case TR_KEY_id:               tr_jsonWriteKey (w, key); tr_jsonWriteInt (w, st->id); break;
+      case TR_KEY_isFinished:       tr_jsonWriteKey (w, key); tr_jsonWriteBool (w, st->finished); break;
+      case TR_KEY_isStalled:        tr_jsonWriteKey (w, key); tr_jsonWriteBool (w, st->isStalled); break;
+      case TR_KEY_leftUntilDone:    tr_jsonWriteKey (w, key); tr_jsonWriteInt (w, st->leftUntilDone); break;
+      case TR_KEY_metadataPercentComplete: tr_jsonWriteKey (w, key); tr_jsonWriteReal (w, st->metadataPercentComplete); break;
+      case TR_KEY_name:             tr_jsonWriteKey (w, key); tr_jsonWriteStr (w, tr_torrentName (tor), TR_BAD_SIZE); break;
+      case TR_KEY_percentDone:      tr_jsonWriteKey (w, key); tr_jsonWriteReal (w, st->percentDone); break;
+      case TR_KEY_peersConnected:   tr_jsonWriteKey (w, key); tr_jsonWriteInt (w, st->peersConnected); break;
+      case TR_KEY_peersGettingFromUs: tr_jsonWriteKey (w, key); tr_jsonWriteInt (w, st->peersGettingFromUs); break;
+      case TR_KEY_peersSendingToUs: tr_jsonWriteKey (w, key); tr_jsonWriteInt (w, st->peersSendingToUs); break;
+      case TR_KEY_queuePosition:    tr_jsonWriteKey (w, key); tr_jsonWriteInt (w, st->queuePosition); break;
+      case TR_KEY_rateDownload:     tr_jsonWriteKey (w, key); tr_jsonWriteInt (w, toSpeedBytes (st->pieceDownloadSpeed_KBps)); break;
+      case TR_KEY_rateUpload:       tr_jsonWriteKey (w, key); tr_jsonWriteInt (w, toSpeedBytes (st->pieceUploadSpeed_KBps)); break;
+      case TR_KEY_recheckProgress:  tr_jsonWriteKey (w, key); tr_jsonWriteReal (w, st->recheckProgress); break;
+      case TR_KEY_sizeWhenDone:     tr_jsonWriteKey (w, key); tr_jsonWriteInt (w, st->sizeWhenDone); break;
+      case TR_KEY_startDate:        tr_jsonWriteKey (w, key); tr_jsonWriteInt (w, st->startDate); break;
+      case TR_KEY_status:           tr_jsonWriteKey (w, key); tr_jsonWriteInt (w, st->activity); break;
+      case TR_KEY_totalSize:        tr_jsonWriteKey (w, key); tr_jsonWriteInt (w, inf->totalSize); break;
+      case TR_KEY_uploadedEver:     tr_jsonWriteKey (w, key); tr_jsonWriteInt (w, st->uploadedEver); break;
+      case TR_KEY_uploadRatio:      tr_jsonWriteKey (w, key); tr_jsonWriteReal (w, st->ratio); break;
+      case TR_KEY_webseedsSendingToUs: tr_jsonWriteKey (w, key); tr_jsonWriteInt (w, st->webseedsSendingToUs); break;
+
+      case TR_KEY_files:
+        tr_jsonWriteKey (w, key);
+        streamFiles (tor, w, false);
+        break;
+
+      case TR_KEY_fileStats:
+        tr_jsonWriteKey (w, key);
+        streamFiles (tor, w, true);
+        break;
+
+      case TR_KEY_priorities:
+        n = tr_torrentPageIn (tor) ? inf->fileCount : 0;
+        tr_jsonWriteKey (w, key);
+        tr_jsonWriteListBegin (w);
+        for (i=0; i<n; ++i)
+          tr_jsonWriteInt (w, inf->files[i].priority);
+        tr_jsonWriteListEnd (w);
+        break;
+
+      case TR_KEY_wanted:
+        n = tr_torrentPageIn (tor) ? inf->fileCount : 0;
+        tr_jsonWriteKey (w, key);
+        tr_jsonWriteListBegin (w);
+        for (i=0; i<n; ++i)
+          tr_jsonWriteInt (w, inf->files[i].dnd ? 0 : 1);
+        tr_jsonWriteListEnd (w);
+        break;
+
+      default:
+        {
+          tr_variant tmp;
+          tr_variant * child;
+
+          tr_variantInitDict (&tmp, 1);
+          addField (tor, inf, st, &tmp, key);
+          if ((child = tr_variantDictFind (&tmp, key)))
+            {
+              tr_jsonWriteKey (w, key);
+              tr_jsonWriteVariant (w, child);
+            }
+          tr_variantFree (&tmp);
+          break;
+        }
+    }
+}
+
+/* the streaming counterpart of addInfo () */
+static void
+streamInfo (tr_torrent * tor, tr_jsonWriter * w, const struct field_key * keys, int n_keys, uint64_t since)
+{
+  int i;
+  const tr_info * const inf = &tor->info;
+  const tr_stat * const st = tr_torrentStat (tor);
+
+  tr_jsonWriteDictBegin (w);
+
+  for (i=0; i<n_keys; ++i)
+    {
+      const tr_quark key = keys[i].key;
+
+      if (since && (key != TR_KEY_id) && (tor->revision[keys[i].group] <= since))
+        continue;
+
+      streamField (tor, inf, st, w, key);
+    }
+
+  tr_jsonWriteDictEnd (w);
+}
+
+/* writes the value of torrent-get's "arguments" */
+static const char*
+torrentGetStreamed (tr_session    * session,
+                    tr_variant    * args_in,
+                    tr_jsonWriter * w)
+{
+  int i;
+  int torrentCount;
+  tr_torrent ** torrents;
+  tr_variant * fields;
+  tr_variant header;
+  tr_quark key;
+  struct field_key * keys;
+  int n_keys;
+  tr_variant * child;
+  const int64_t since = getTorrentGetSince (session, args_in);
+
+  if (!tr_variantDictFindList (args_in, TR_KEY_fields, &fields))
+    return "no fields specified";
+
+  torrents = getTorrents (session, args_in, &torrentCount);
+  keys = getFieldKeys (fields, w->benc, &n_keys);
+
+  tr_jsonWriteDictBegin (w);
+
+  /* the small stuff goes through a tr_variant as usual */
+  tr_variantInitDict (&header, 2);
+  addTorrentGetHeader (session, args_in, since, &header);
+  for (i=0; tr_variantDictChild (&header, i, &key, &child); ++i)
+    {
+      tr_jsonWriteKey (w, key);
+      tr_jsonWriteVariant (w, child);
+    }
+  tr_variantFree (&header);
+
+  tr_jsonWriteKey (w, TR_KEY_torrents);
+  tr_jsonWriteListBegin (w);
+  for (i=0; i<torrentCount; ++i)
+    if (!since || (getTorrentRevision (torrents[i]) > (uint64_t)since))
+      streamInfo (torrents[i], w, keys, n_keys, since);
+  tr_jsonWriteListEnd (w);
+
+  tr_jsonWriteDictEnd (w);
+
+  tr_free (keys);
+  tr_free (torrents);
+  return NULL;
+}
+
 /***
 ****
 ***/
@@ -1103,7 +1508,7 @@ addTrackerUrls (tr_torrent * tor, tr_variant * urls)
   tr_variant * val;
   tr_tracker_info * trackers;
   bool changed = false;
-  const tr_info * inf = tr_torrentInfo (tor);
+  const tr_info * inf = &tor->info;
   const char * errmsg = NULL;
 
   /* make a working copy of the existing announce list */
@@ -1144,7 +1549,7 @@ replaceTrackers (tr_torrent * tor, tr_variant * urls)
   tr_variant * pair[2];
   tr_tracker_info * trackers;
   bool changed = false;
-  const tr_info * inf = tr_torrentInfo (tor);
+  const tr_info * inf = &tor->info;
   const int n = inf->trackerCount;
   const char * errmsg = NULL;
 
@@ -1195,7 +1600,7 @@ removeTrackers (tr_torrent * tor, tr_variant * ids)
   tr_variant * val;
   tr_tracker_info * trackers;
   bool changed = false;
-  const tr_info * inf = tr_torrentInfo (tor);
+  const tr_info * inf = &tor->info;
   const char * errmsg = NULL;
 
   /* make a working copy of the existing announce list */
@@ -1258,6 +1663,7 @@ torrentSet (tr_session               * session,
       tr_variant * files;
       tr_variant * trackers;
       bool boolVal;
+      const char * str;
       tr_torrent * tor;
 
       tor = torrents[i];
@@ -1266,6 +1672,9 @@ torrentSet (tr_session               * session,
         if (tr_isPriority (tmp))
           tr_torrentSetPriority (tor, tmp);
 
+      if (tr_variantDictFindStr (args_in, TR_KEY_group, &str, NULL))
+        tr_torrentSetBandwidthGroup (tor, str);
+
       if (!errmsg && tr_variantDictFindList (args_in, TR_KEY_files_unwanted, &files))
         errmsg = setFileDLs (tor, false, files);
 
@@ -1616,15 +2025,12 @@ addTorrentImpl (struct tr_rpc_idle_data * data, tr_ctor * ctor)
 
   if (tor && key)
     {
-      tr_variant fields;
-      tr_variantInitList (&fields, 3);
-      tr_variantListAddStr (&fields, "id");
-      tr_variantListAddStr (&fields, "name");
-      tr_variantListAddStr (&fields, "hashString");
-      addInfo (tor, tr_variantDictAdd (data->args_out, key), &fields);
+      const struct field_key fields[] = { { TR_KEY_id, TR_FIELDS_INFO },
+                                          { TR_KEY_name, TR_FIELDS_INFO },
+                                          { TR_KEY_hashString, TR_FIELDS_INFO } };
+      addInfo (tor, tr_variantDictAdd (data->args_out, key), fields, TR_N_ELEMENTS (fields), 0);
       if (result == NULL)
         notify (data->session, TR_RPC_TORRENT_ADDED, tor);
-      tr_variantFree (&fields);
       result = NULL;
     }
 
@@ -1991,6 +2397,139 @@ sessionSet (tr_session               * session,
   return NULL;
 }
 
+/***
+****
+***/
+
+static void
+addGroupInfo (tr_variant * list, tr_bandwidth_group * group)
+{
+  const uint64_t now = tr_time_msec ();
+  const tr_bandwidth * b = &group->bandwidth;
+  tr_variant * d = tr_variantListAddDict (list, 8);
+
+  tr_variantDictAddInt  (d, TR_KEY_downloadLimit, toSpeedKBps (tr_bandwidthGetDesiredSpeed_Bps (b, TR_DOWN)));
+  tr_variantDictAddBool (d, TR_KEY_downloadLimited, tr_bandwidthIsLimited (b, TR_DOWN));
+  tr_variantDictAddBool (d, TR_KEY_honorsSessionLimits, tr_bandwidthAreParentLimitsHonored (b, TR_UP));
+  tr_variantDictAddStr  (d, TR_KEY_name, group->name);
+  tr_variantDictAddInt  (d, TR_KEY_rateDownload, tr_bandwidthGetPieceSpeed_Bps (b, now, TR_DOWN));
+  tr_variantDictAddInt  (d, TR_KEY_rateUpload, tr_bandwidthGetPieceSpeed_Bps (b, now, TR_UP));
+  tr_variantDictAddInt  (d, TR_KEY_uploadLimit, toSpeedKBps (tr_bandwidthGetDesiredSpeed_Bps (b, TR_UP)));
+  tr_variantDictAddBool (d, TR_KEY_uploadLimited, tr_bandwidthIsLimited (b, TR_UP));
+}
+
+static const char*
+groupGet (tr_session               * session,
+          tr_variant               * args_in,
+          tr_variant               * args_out,
+          struct tr_rpc_idle_data  * idle_data UNUSED)
+{
+  tr_variant * names;
+  tr_variant * list;
+  const char * str;
+
+  assert (idle_data == NULL);
+
+  list = tr_variantDictAddList (args_out, TR_KEY_group, 0);
+
+  if (tr_variantDictFindStr (args_in, TR_KEY_group, &str, NULL))
+    {
+      tr_bandwidth_group * group = tr_bandwidthGroupFind (session, str);
+      if (group != NULL)
+        addGroupInfo (list, group);
+    }
+  else if (tr_variantDictFindList (args_in, TR_KEY_group, &names))
+    {
+      int i;
+      const int n = tr_variantListSize (names);
+
+      for (i=0; i<n; ++i)
+        {
+          tr_bandwidth_group * group;
+
+          if (tr_variantGetStr (tr_variantListChild (names, i), &str, NULL))
+            if ((group = tr_bandwidthGroupFind (session, str)))
+              addGroupInfo (list, group);
+        }
+    }
+  else
+    {
+      int i, n;
+      tr_bandwidth_group ** groups = tr_bandwidthGroupList (session, &n);
+
+      for (i=0; i<n; ++i)
+        addGroupInfo (list, groups[i]);
+
+      tr_free (groups);
+    }
+
+  return NULL;
+}
+
+static const char*
+groupSet (tr_session               * session,
+          tr_variant               * args_in,
+          tr_variant               * args_out UNUSED,
+          struct tr_rpc_idle_data  * idle_data UNUSED)
+{
+  int64_t tmp;
+  bool boolVal;
+  const char * name;
+  tr_bandwidth * b;
+
+  assert (idle_data == NULL);
+
+  if (!tr_variantDictFindStr (args_in, TR_KEY_name, &name, NULL) || *name == '\0')
+    return "missing group name";
+
+  b = &tr_bandwidthGroupGet (session, name)->bandwidth;
+
+  if (tr_variantDictFindInt (args_in, TR_KEY_downloadLimit, &tmp))
+    tr_bandwidthSetDesiredSpeed_Bps (b, TR_DOWN, toSpeedBytes (tmp));
+
+  if (tr_variantDictFindBool (args_in, TR_KEY_downloadLimited, &boolVal))
+    tr_bandwidthSetLimited (b, TR_DOWN, boolVal);
+
+  if (tr_variantDictFindBool (args_in, TR_KEY_honorsSessionLimits, &boolVal))
+    {
+      tr_bandwidthHonorParentLimits (b, TR_UP, boolVal);
+      tr_bandwidthHonorParentLimits (b, TR_DOWN, boolVal);
+    }
+
+  if (tr_variantDictFindInt (args_in, TR_KEY_uploadLimit, &tmp))
+    tr_bandwidthSetDesiredSpeed_Bps (b, TR_UP, toSpeedBytes (tmp));
+
+  if (tr_variantDictFindBool (args_in, TR_KEY_uploadLimited, &boolVal))
+    tr_bandwidthSetLimited (b, TR_UP, boolVal);
+
+  tr_bandwidthGroupsSave (session);
+
+  return NULL;
+}
+
+static const char*
+groupRemove (tr_session               * session,
+             tr_variant               * args_in,
+             tr_variant               * args_out UNUSED,
+             struct tr_rpc_idle_data  * idle_data UNUSED)
+{
+  const char * name;
+
+  assert (idle_data == NULL);
+
+  if (!tr_variantDictFindStr (args_in, TR_KEY_name, &name, NULL) || *name == '\0')
+    return "missing group name";
+
+  if (!tr_bandwidthGroupRemove (session, name))
+    return "no such group";
+
+  return NULL;
+}
+
+/***
+****
+***/
+
 static const char*
 sessionStats (tr_session               * session,
               tr_variant               * args_in UNUSED,
@@ -2037,6 +2576,13 @@ sessionStats (tr_session               * session,
   tr_variantDictAddInt (d, TR_KEY_sessionCount, currentStats.sessionCount);
   tr_variantDictAddInt (d, TR_KEY_uploadedBytes, currentStats.uploadedBytes);
 
+  d = tr_variantDictAddDict (args_out, TR_KEY_resume_save_stats, 5);
+  tr_variantDictAddInt (d, TR_KEY_mtimesRead, session->resumeSaveStats.mtimesRead);
+  tr_variantDictAddInt (d, TR_KEY_saveCount, session->resumeSaveStats.saveCount);
+  tr_variantDictAddInt (d, TR_KEY_saveMicroseconds, session->resumeSaveStats.saveUsec);
+  tr_variantDictAddInt (d, TR_KEY_sectionsRebuilt, session->resumeSaveStats.sectionsRebuilt);
+  tr_variantDictAddInt (d, TR_KEY_sectionsReused, session->resumeSaveStats.sectionsReused);
+
   return NULL;
 }
 
@@ -2163,36 +2709,62 @@ typedef const char* (*handler)(tr_session*, tr_variant*, tr_variant*, struct tr_
 
 static struct method
 {
-  const char *  name;
+  tr_quark      name;
   bool          immediate;
   handler       func;
 }
 methods[] =
 {
-  { "port-test",             false, portTest            },
-  { "blocklist-update",      false, blocklistUpdate     },
-  { "free-space",            true,  freeSpace           },
-  { "session-close",         true,  sessionClose        },
-  { "session-get",           true,  sessionGet          },
-  { "session-set",           true,  sessionSet          },
-  { "session-stats",         true,  sessionStats        },
-  { "torrent-add",           false, torrentAdd          },
-  { "torrent-get",           true,  torrentGet          },
-  { "torrent-remove",        true,  torrentRemove       },
-  { "torrent-rename-path",   false, torrentRenamePath   },
-  { "torrent-set",           true,  torrentSet          },
-  { "torrent-set-location",  true,  torrentSetLocation  },
-  { "torrent-start",         true,  torrentStart        },
-  { "torrent-start-now",     true,  torrentStartNow     },
-  { "torrent-stop",          true,  torrentStop         },
-  { "torrent-verify",        true,  torrentVerify       },
-  { "torrent-reannounce",    true,  torrentReannounce   },
-  { "queue-move-top",        true,  queueMoveTop        },
-  { "queue-move-up",         true,  queueMoveUp         },
-  { "queue-move-down",       true,  queueMoveDown       },
-  { "queue-move-bottom",     true,  queueMoveBottom     }
+  { TR_KEY_port_test,             false, portTest            },
+  { TR_KEY_blocklist_update,      false, blocklistUpdate     },
+  { TR_KEY_free_space,            true,  freeSpace           },
+  { TR_KEY_group_get,             true,  groupGet            },
+  { TR_KEY_group_remove,          true,  groupRemove         },
+  { TR_KEY_group_set,             true,  groupSet            },
+  { TR_KEY_session_close,         true,  sessionClose        },
+  { TR_KEY_session_get,           true,  sessionGet          },
+  { TR_KEY_session_set,           true,  sessionSet          },
+  { TR_KEY_session_stats,         true,  sessionStats        },
+  { TR_KEY_torrent_add,           false, torrentAdd          },
+  { TR_KEY_torrent_get,           true,  torrentGet          },
+  { TR_KEY_torrent_remove,        true,  torrentRemove       },
+  { TR_KEY_torrent_rename_path,   false, torrentRenamePath   },
+  { TR_KEY_torrent_set,           true,  torrentSet          },
+  { TR_KEY_torrent_set_location,  true,  torrentSetLocation  },
+  { TR_KEY_torrent_start,         true,  torrentStart        },
+  { TR_KEY_torrent_start_now,     true,  torrentStartNow     },
+  { TR_KEY_torrent_stop,          true,  torrentStop         },
+  { TR_KEY_torrent_verify,        true,  torrentVerify       },
+  { TR_KEY_torrent_reannounce,    true,  torrentReannounce   },
+  { TR_KEY_queue_move_top,        true,  queueMoveTop        },
+  { TR_KEY_queue_move_up,         true,  queueMoveUp         },
+  { TR_KEY_queue_move_down,       true,  queueMoveDown       },
+  { TR_KEY_queue_move_bottom,     true,  queueMoveBottom     }
 };
 
+/* every method name is in the quark table, so a single lookup there
+ * turns the request's method into an integer for the tables above */
+static bool
+findMethodQuark (tr_variant * request, tr_quark * setme, const char ** setme_errmsg)
+{
+  size_t len;
+  const char * str;
+
+  if (!tr_variantDictFindStr (request, TR_KEY_method, &str, &len))
+    {
+      *setme_errmsg = "no method name";
+      return false;
+    }
+
+  if (!tr_quark_lookup (str, len, setme))
+    {
+      *setme_errmsg = "method name not recognized";
+      return false;
+    }
+
+  return true;
+}
+
 static void
 noop_response_callback (tr_session * session UNUSED,
                         tr_variant * response UNUSED,
@@ -2207,7 +2779,7 @@ tr_rpc_request_exec_json (tr_session            * session,
                           void                  * callback_user_data)
 {
   int i;
-  const char * str;
+  tr_quark method;
   tr_variant * const mutable_request = (tr_variant *) request;
   tr_variant * args_in = tr_variantDictFind (mutable_request, TR_KEY_arguments);
   const char * result = NULL;
@@ -2216,16 +2788,12 @@ tr_rpc_request_exec_json (tr_session            * session,
     callback = noop_response_callback;
 
   /* parse the request */
-  if (!tr_variantDictFindStr (mutable_request, TR_KEY_method, &str, NULL))
-    {
-      result = "no method name";
-    }
-  else
+  if (findMethodQuark (mutable_request, &method, &result))
     {
       const int n = TR_N_ELEMENTS (methods);
 
       for (i=0; i<n; ++i)
-        if (strcmp (str, methods[i].name) == 0)
+        if (method == methods[i].name)
           break;
 
       if (i ==n)
@@ -2287,6 +2855,73 @@ tr_rpc_request_exec_json (tr_session            * session,
     }
 }
 
+typedef const char* (*stream_handler)(tr_session    * session,
+                                      tr_variant    * args_in,
+                                      tr_jsonWriter * args_out);
+
+static struct stream_method
+{
+  tr_quark        name;
+  stream_handler  func;
+}
+stream_methods[] =
+{
+  { TR_KEY_torrent_get, torrentGetStreamed }
+};
+
+bool
+tr_rpc_request_exec_json_stream (tr_session       * session,
+                                 const tr_variant * request,
+                                 tr_variant_fmt     fmt,
+                                 struct evbuffer  * out)
+{
+  int i;
+  int64_t tag;
+  tr_quark method;
+  const char * result;
+  tr_jsonWriter w;
+  size_t old_len;
+  tr_variant * const mutable_request = (tr_variant *) request;
+  tr_variant * args_in = tr_variantDictFind (mutable_request, TR_KEY_arguments);
+  const int n = TR_N_ELEMENTS (stream_methods);
+
+  if (!findMethodQuark (mutable_request, &method, &result))
+    return false;
+
+  for (i=0; i<n; ++i)
+    if (method == stream_methods[i].name)
+      break;
+
+  if (i == n)
+    return false;
+
+  tr_jsonWriterInit (&w, out, fmt);
+  tr_jsonWriteDictBegin (&w);
+  tr_jsonWriteKey (&w, TR_KEY_arguments);
+
+  old_len = evbuffer_get_length (out);
+  result = (*stream_methods[i].func)(session, args_in, &w);
+  if (evbuffer_get_length (out) == old_len)
+    {
+      /* the handler bailed before writing anything */
+      tr_jsonWriteDictBegin (&w);
+      tr_jsonWriteDictEnd (&w);
+    }
+
+  if (result == NULL)
+    result = "success";
+  tr_jsonWriteKey (&w, TR_KEY_result);
+  tr_jsonWriteStr (&w, result, TR_BAD_SIZE);
+  if (tr_variantDictFindInt (mutable_request, TR_KEY_tag, &tag))
+    {
+      tr_jsonWriteKey (&w, TR_KEY_tag);
+      tr_jsonWriteInt (&w, tag);
+    }
+  tr_jsonWriteDictEnd (&w);
+
+  return true;
+}
+
 /**
  * Munge the URI into a usable form.
  *
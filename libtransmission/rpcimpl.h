@@ -30,6 +30,16 @@ void tr_rpc_request_exec_json (tr_session            * session,
                                tr_rpc_response_func    callback,
                                void                  * callback_user_data);
 
+/* Like tr_rpc_request_exec_json (), but writes the response as lean JSON
+ * (or benc, if fmt is TR_VARIANT_FMT_BENC) straight into `out' without
+ * building a tr_variant for it first.
+ * Only some methods support this; for the others, nothing is written
+ * and false is returned so the caller can use tr_rpc_request_exec_json (). */
+bool tr_rpc_request_exec_json_stream (tr_session       * session,
+                                      const tr_variant * request,
+                                      tr_variant_fmt     fmt,
+                                      struct evbuffer  * out);
+
 /* see the RPC spec's "Request URI Notation" section */
 void tr_rpc_request_exec_uri (tr_session           * session,
                               const void           * request_uri,
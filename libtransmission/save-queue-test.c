@@ -0,0 +1,189 @@
+/*
+ * This file Copyright (C) 2016 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ * $Id$
+ */
+
+#include <time.h> /* time () */
+
+#include "transmission.h"
+#include "file.h"
+#include "save-queue.h"
+#include "utils.h"
+#include "variant.h"
+
+#include "libtransmission-test.h"
+
+static void
+queueSave (tr_save_queue * queue, const char * filename, int64_t downloaded)
+{
+  tr_variant v;
+
+  tr_variantInitDict (&v, 1);
+  tr_variantDictAddInt (&v, TR_KEY_downloaded, downloaded);
+  tr_saveQueueAdd (queue, filename, &v, TR_VARIANT_FMT_BENC);
+  tr_variantFree (&v);
+}
+
+static bool
+readDownloaded (tr_save_queue * queue, const char * filename, int64_t * setme)
+{
+  bool ok;
+  tr_variant v;
+
+  if ((ok = tr_saveQueueReadFile (queue, filename, TR_VARIANT_FMT_BENC, &v)))
+    {
+      ok = tr_variantDictFindInt (&v, TR_KEY_downloaded, setme);
+      tr_variantFree (&v);
+    }
+
+  return ok;
+}
+
+static int
+test_coalesce (void)
+{
+  int64_t i;
+  uint64_t files;
+  uint64_t batches;
+  tr_save_queue * queue;
+  char * sandbox = libtest_sandbox_create ();
+  char * a = tr_buildPath (sandbox, "a.resume", NULL);
+  char * b = tr_buildPath (sandbox, "b.resume", NULL);
+  char * c = tr_buildPath (sandbox, "c.resume", NULL);
+
+  /* long enough that nothing's written until the flush */
+  queue = tr_saveQueueNew (600, NULL, NULL);
+
+  queueSave (queue, a, 1);
+  queueSave (queue, a, 2);
+  queueSave (queue, b, 10);
+  queueSave (queue, a, 3);
+  queueSave (queue, c, 100);
+
+  /* reads see the newest save, even before it's written */
+  check (!tr_sys_path_exists (a, NULL));
+  check (readDownloaded (queue, a, &i));
+  check_int_eq (3, i);
+
+  /* removed saves never get written */
+  tr_saveQueueRemove (queue, c);
+  check (!readDownloaded (queue, c, &i));
+
+  /* one write per file, all in one batch */
+  tr_saveQueueFlush (queue);
+  tr_saveQueueGetStats (queue, &files, &batches);
+  check_uint_eq (2, files);
+  check_uint_eq (1, batches);
+  check (!tr_sys_path_exists (c, NULL));
+  check (readDownloaded (NULL, a, &i));
+  check_int_eq (3, i);
+  check (readDownloaded (NULL, b, &i));
+  check_int_eq (10, i);
+
+  /* freeing the queue writes what's left */
+  queueSave (queue, b, 11);
+  tr_saveQueueFree (queue);
+  check (readDownloaded (NULL, b, &i));
+  check_int_eq (11, i);
+
+  tr_free (c);
+  tr_free (b);
+  tr_free (a);
+  libtest_sandbox_destroy (sandbox);
+  tr_free (sandbox);
+  return 0;
+}
+
+static int
+test_delay (void)
+{
+  int64_t i;
+  tr_save_queue * queue;
+  char * sandbox = libtest_sandbox_create ();
+  char * a = tr_buildPath (sandbox, "a.resume", NULL);
+  const time_t deadline = time (NULL) + 10;
+
+  /* with no delay, saves are written on their own */
+  queue = tr_saveQueueNew (0, NULL, NULL);
+  queueSave (queue, a, 1);
+  while (!tr_sys_path_exists (a, NULL) && time (NULL) < deadline)
+    tr_wait_msec (10);
+  check (tr_sys_path_exists (a, NULL));
+
+  /* with a delay, they're still written without a flush */
+  tr_saveQueueSetDelay (queue, 1);
+  queueSave (queue, a, 2);
+  while (readDownloaded (NULL, a, &i) && i == 1 && time (NULL) < deadline)
+    tr_wait_msec (10);
+  check_int_eq (2, i);
+
+  tr_saveQueueFree (queue);
+  tr_free (a);
+  libtest_sandbox_destroy (sandbox);
+  tr_free (sandbox);
+  return 0;
+}
+
+/* failed[0] is the filename, failed[1] is the error message */
+static void
+onSaveFailed (const char * filename, const char * errmsg, void * vfailed)
+{
+  char ** failed = vfailed;
+
+  tr_free (failed[0]);
+  tr_free (failed[1]);
+  failed[0] = tr_strdup (filename);
+  failed[1] = tr_strdup (errmsg);
+}
+
+static int
+test_failed (void)
+{
+  int64_t i;
+  char * failed[2] = { NULL, NULL };
+  tr_save_queue * queue;
+  char * sandbox = libtest_sandbox_create ();
+  char * a = tr_buildPath (sandbox, "a.resume", NULL);
+  char * b = tr_buildPath (sandbox, "b.resume", NULL);
+  char * b_child = tr_buildPath (b, "child", NULL);
+
+  /* a file can't be renamed over a folder that isn't empty */
+  tr_sys_dir_create (b, 0, 0700, NULL);
+  libtest_create_file_with_string_contents (b_child, "hello");
+
+  queue = tr_saveQueueNew (600, onSaveFailed, failed);
+  queueSave (queue, a, 1);
+  queueSave (queue, b, 2);
+  tr_saveQueueFlush (queue);
+
+  /* the file that couldn't be written is reported, and only that one */
+  check_streq (b, failed[0]);
+  check (failed[1] != NULL && *failed[1] != '\0');
+  check (readDownloaded (NULL, a, &i));
+  check_int_eq (1, i);
+  check (tr_sys_path_exists (b_child, NULL));
+
+  tr_saveQueueFree (queue);
+  tr_free (failed[1]);
+  tr_free (failed[0]);
+  tr_free (b_child);
+  tr_free (b);
+  tr_free (a);
+  libtest_sandbox_destroy (sandbox);
+  tr_free (sandbox);
+  return 0;
+}
+
+int
+main (void)
+{
+  const testFunc tests[] = { test_coalesce,
+                             test_delay,
+                             test_failed };
+
+  return runTests (tests, NUM_TESTS (tests));
+}
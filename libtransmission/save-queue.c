@@ -0,0 +1,509 @@
+/*
+ * This file Copyright (C) 2016 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ * $Id$
+ */
+
+#ifdef HAVE_SYNCFS
+ #define _GNU_SOURCE /* glibc's unistd.h needs this to pick up syncfs () */
+#endif
+
+#include <errno.h>
+#include <string.h> /* strcmp () */
+#include <time.h> /* time () */
+
+#ifdef HAVE_SYNCFS
+ #include <fcntl.h> /* open () */
+ #include <unistd.h> /* syncfs (), close () */
+#endif
+
+#include "transmission.h"
+#include "error.h"
+#include "file.h"
+#include "log.h"
+#include "platform.h" /* tr_lock, tr_threadNew () */
+#include "ptrarray.h"
+#include "save-queue.h"
+#include "utils.h"
+#include "variant.h"
+
+#define MY_NAME "Save Queue"
+
+struct save_item
+{
+  char * filename;
+  char * contents;
+  size_t len;
+};
+
+struct tr_save_queue
+{
+  tr_lock * lock;
+
+  /* struct save_item, sorted by filename. `queued' is waiting to be
+   * written; `writing' is the batch the worker thread has taken */
+  tr_ptrArray queued;
+  tr_ptrArray writing;
+
+  /* when the oldest save in `queued' was added */
+  time_t queuedAt;
+  int delay_seconds;
+
+  /* callers waiting in tr_saveQueueFlush () */
+  int flushers;
+  bool threadRunning;
+
+  tr_save_failed_func failed_func;
+  void * failed_func_user_data;
+
+  uint64_t filesWritten;
+  uint64_t batchesWritten;
+};
+
+static int
+compareItems (const void * va, const void * vb)
+{
+  const struct save_item * a = va;
+  const struct save_item * b = vb;
+
+  return strcmp (a->filename, b->filename);
+}
+
+static void
+itemFree (void * vitem)
+{
+  struct save_item * item = vitem;
+
+  tr_free (item->contents);
+  tr_free (item->filename);
+  tr_free (item);
+}
+
+static struct save_item *
+findItem (tr_ptrArray * items, const char * filename)
+{
+  struct save_item key;
+
+  key.filename = (char *) filename;
+
+  return tr_ptrArrayFindSorted (items, &key, compareItems);
+}
+
+/***
+****  Writing
+***/
+
+static bool
+writeAll (tr_sys_file_t fd, const char * buf, size_t len, tr_error ** error)
+{
+  while (len > 0)
+    {
+      uint64_t n;
+
+      if (!tr_sys_file_write (fd, buf, len, &n, error))
+        return false;
+
+      buf += n;
+      len -= n;
+    }
+
+  return true;
+}
+
+/* writes the item to a new temporary file next to its real one.
+ * returns the temporary file's name, or NULL on error */
+static char *
+writeTemporaryFile (const struct save_item  * item,
+                    char                   ** setme_real_filename,
+                    tr_error               ** error)
+{
+  bool ok;
+  tr_sys_file_t fd;
+  char * tmp;
+  char * filename;
+
+  /* follow symlinks to find the "real" file, to make sure the temporary
+   * we build with tr_sys_file_open_temp() is created on the right partition */
+  if ((filename = tr_sys_path_resolve (item->filename, NULL)) == NULL)
+    filename = tr_strdup (item->filename);
+
+  tmp = tr_strdup_printf ("%s.tmp.XXXXXX", filename);
+  fd = tr_sys_file_open_temp (tmp, error);
+  if (fd == TR_BAD_SYS_FILE)
+    {
+      tr_logAddError (_("Couldn't save temporary file \"%1$s\": %2$s"), tmp, (*error)->message);
+      tr_free (tmp);
+      tr_free (filename);
+      return NULL;
+    }
+
+  ok = writeAll (fd, item->contents, item->len, error);
+
+#ifndef HAVE_SYNCFS
+  /* no way to sync the whole batch at once, so sync each file */
+  if (ok)
+    ok = tr_sys_file_flush (fd, error);
+#endif
+
+  tr_sys_file_close (fd, NULL);
+
+  if (!ok)
+    {
+      tr_logAddError (_("Couldn't save temporary file \"%1$s\": %2$s"), tmp, (*error)->message);
+      tr_sys_path_remove (tmp, NULL);
+      tr_free (tmp);
+      tr_free (filename);
+      return NULL;
+    }
+
+  *setme_real_filename = filename;
+  return tmp;
+}
+
+/* gets the temporary files onto the disk before they replace the old ones,
+ * so that a crash leaves each file either old or new, but never empty */
+static void
+syncTemporaryFiles (char ** tmps, int n)
+{
+#ifdef HAVE_SYNCFS
+  int i;
+  char * lastdir = NULL;
+
+  /* the batch is sorted by filename, so files in the same folder
+   * are next to each other. That's one syncfs () per folder,
+   * and in practice just one or two per batch */
+  for (i=0; i<n; ++i)
+    {
+      char * dir;
+
+      if (tmps[i] == NULL || (dir = tr_sys_path_dirname (tmps[i], NULL)) == NULL)
+        continue;
+
+      if (lastdir == NULL || strcmp (dir, lastdir) != 0)
+        {
+          const int fd = open (dir, O_RDONLY);
+
+          if (fd == -1 || syncfs (fd) == -1)
+            tr_logAddNamedError (MY_NAME, "Couldn't sync \"%s\": %s", dir, tr_strerror (errno));
+
+          if (fd != -1)
+            close (fd);
+
+          tr_free (lastdir);
+          lastdir = dir;
+        }
+      else
+        {
+          tr_free (dir);
+        }
+    }
+
+  tr_free (lastdir);
+#else
+  (void) tmps;
+  (void) n;
+#endif
+}
+
+static void
+writeBatch (tr_save_queue * queue, tr_ptrArray * batch)
+{
+  int i;
+  const int n = tr_ptrArraySize (batch);
+  char ** tmps = tr_new0 (char *, n);
+  char ** filenames = tr_new0 (char *, n);
+  tr_error ** errors = tr_new0 (tr_error *, n);
+
+  for (i=0; i<n; ++i)
+    tmps[i] = writeTemporaryFile (tr_ptrArrayNth (batch, i), &filenames[i], &errors[i]);
+
+  syncTemporaryFiles (tmps, n);
+
+  for (i=0; i<n; ++i)
+    {
+      if (tmps[i] == NULL)
+        continue;
+
+      if (tr_sys_path_rename (tmps[i], filenames[i], &errors[i]))
+        {
+          tr_logAddInfo (_("Saved \"%s\""), filenames[i]);
+        }
+      else
+        {
+          tr_logAddError (_("Couldn't save file \"%1$s\": %2$s"), filenames[i], errors[i]->message);
+          tr_sys_path_remove (tmps[i], NULL);
+        }
+
+      tr_free (filenames[i]);
+      tr_free (tmps[i]);
+    }
+
+  /* let the owner know which files weren't saved */
+  for (i=0; i<n; ++i)
+    {
+      if (errors[i] == NULL)
+        continue;
+
+      if (queue->failed_func != NULL)
+        {
+          const struct save_item * item = tr_ptrArrayNth (batch, i);
+          queue->failed_func (item->filename, errors[i]->message, queue->failed_func_user_data);
+        }
+
+      tr_error_free (errors[i]);
+    }
+
+  tr_free (errors);
+  tr_free (filenames);
+  tr_free (tmps);
+}
+
+static void
+saveThreadFunc (void * vqueue)
+{
+  tr_save_queue * queue = vqueue;
+
+  for (;;)
+    {
+      tr_lockLock (queue->lock);
+
+      if (tr_ptrArrayEmpty (&queue->queued))
+        {
+          queue->threadRunning = false;
+          tr_lockUnlock (queue->lock);
+          break;
+        }
+
+      /* give later saves a chance to join the batch */
+      if (queue->flushers == 0 && time (NULL) < queue->queuedAt + queue->delay_seconds)
+        {
+          tr_lockUnlock (queue->lock);
+          tr_wait_msec (100);
+          continue;
+        }
+
+      queue->writing = queue->queued;
+      queue->queued = TR_PTR_ARRAY_INIT;
+      tr_lockUnlock (queue->lock);
+
+      tr_logAddNamedDbg (MY_NAME, "Writing %d files", tr_ptrArraySize (&queue->writing));
+      writeBatch (queue, &queue->writing);
+
+      tr_lockLock (queue->lock);
+      queue->filesWritten += tr_ptrArraySize (&queue->writing);
+      queue->batchesWritten++;
+      tr_ptrArrayDestruct (&queue->writing, itemFree);
+      queue->writing = TR_PTR_ARRAY_INIT;
+      tr_lockUnlock (queue->lock);
+    }
+}
+
+/***
+****
+***/
+
+tr_save_queue *
+tr_saveQueueNew (int                   delay_seconds,
+                 tr_save_failed_func   failed_func,
+                 void                * failed_func_user_data)
+{
+  tr_save_queue * queue = tr_new0 (tr_save_queue, 1);
+
+  queue->lock = tr_lockNew ();
+  queue->queued = TR_PTR_ARRAY_INIT;
+  queue->writing = TR_PTR_ARRAY_INIT;
+  queue->delay_seconds = MAX (0, delay_seconds);
+  queue->failed_func = failed_func;
+  queue->failed_func_user_data = failed_func_user_data;
+
+  return queue;
+}
+
+void
+tr_saveQueueFree (tr_save_queue * queue)
+{
+  bool running;
+
+  if (queue == NULL)
+    return;
+
+  tr_saveQueueFlush (queue);
+
+  /* wait for the worker thread to notice there's nothing left */
+  for (;;)
+    {
+      tr_lockLock (queue->lock);
+      running = queue->threadRunning;
+      tr_lockUnlock (queue->lock);
+
+      if (!running)
+        break;
+
+      tr_wait_msec (10);
+    }
+
+  tr_ptrArrayDestruct (&queue->queued, itemFree);
+  tr_lockFree (queue->lock);
+  tr_free (queue);
+}
+
+void
+tr_saveQueueSetDelay (tr_save_queue * queue, int delay_seconds)
+{
+  tr_lockLock (queue->lock);
+  queue->delay_seconds = MAX (0, delay_seconds);
+  tr_lockUnlock (queue->lock);
+}
+
+int
+tr_saveQueueAdd (tr_save_queue     * queue,
+                 const char        * filename,
+                 const tr_variant  * v,
+                 tr_variant_fmt      fmt)
+{
+  size_t len;
+  char * contents;
+  struct save_item * item;
+
+  if (queue == NULL)
+    return tr_variantToFile (v, fmt, filename);
+
+  contents = tr_variantToStr (v, fmt, &len);
+
+  tr_lockLock (queue->lock);
+
+  if ((item = findItem (&queue->queued, filename)) != NULL)
+    {
+      /* the newer save replaces the older one, but keeps its place
+       * in line so that saving a file often doesn't keep delaying it */
+      tr_free (item->contents);
+    }
+  else
+    {
+      if (tr_ptrArrayEmpty (&queue->queued))
+        queue->queuedAt = time (NULL);
+
+      item = tr_new0 (struct save_item, 1);
+      item->filename = tr_strdup (filename);
+      tr_ptrArrayInsertSorted (&queue->queued, item, compareItems);
+    }
+
+  item->contents = contents;
+  item->len = len;
+
+  if (!queue->threadRunning)
+    {
+      queue->threadRunning = true;
+      tr_threadNew (saveThreadFunc, queue);
+    }
+
+  tr_lockUnlock (queue->lock);
+  return 0;
+}
+
+bool
+tr_saveQueueReadFile (tr_save_queue   * queue,
+                      const char      * filename,
+                      tr_variant_fmt    fmt,
+                      tr_variant      * setme)
+{
+  if (queue != NULL)
+    {
+      bool found;
+      bool ok = false;
+      struct save_item * item;
+
+      tr_lockLock (queue->lock);
+
+      /* the queued save is newer than the one being written,
+       * which is newer than the one on disk */
+      if ((item = findItem (&queue->queued, filename)) == NULL)
+        item = findItem (&queue->writing, filename);
+
+      if ((found = item != NULL))
+        ok = !tr_variantFromBuf (setme, fmt, item->contents, item->len,
+                                 filename, NULL, TR_VARIANT_PARSE_DEFAULT);
+
+      tr_lockUnlock (queue->lock);
+
+      if (found)
+        return ok;
+    }
+
+  return tr_variantFromFile (setme, fmt, filename, NULL);
+}
+
+void
+tr_saveQueueRemove (tr_save_queue * queue, const char * filename)
+{
+  bool writing;
+  struct save_item * item;
+
+  if (queue == NULL)
+    return;
+
+  tr_lockLock (queue->lock);
+  if ((item = findItem (&queue->queued, filename)) != NULL)
+    {
+      tr_ptrArrayRemoveSortedPointer (&queue->queued, item, compareItems);
+      itemFree (item);
+    }
+  tr_lockUnlock (queue->lock);
+
+  /* if it's in the batch being written, wait until that's done
+   * so that the caller's next step, such as deleting the file, comes after */
+  for (;;)
+    {
+      tr_lockLock (queue->lock);
+      writing = findItem (&queue->writing, filename) != NULL;
+      tr_lockUnlock (queue->lock);
+
+      if (!writing)
+        break;
+
+      tr_wait_msec (10);
+    }
+}
+
+void
+tr_saveQueueFlush (tr_save_queue * queue)
+{
+  bool done;
+
+  if (queue == NULL)
+    return;
+
+  tr_lockLock (queue->lock);
+  ++queue->flushers;
+  tr_lockUnlock (queue->lock);
+
+  for (;;)
+    {
+      tr_lockLock (queue->lock);
+      done = tr_ptrArrayEmpty (&queue->queued) && tr_ptrArrayEmpty (&queue->writing);
+      tr_lockUnlock (queue->lock);
+
+      if (done)
+        break;
+
+      tr_wait_msec (10);
+    }
+
+  tr_lockLock (queue->lock);
+  --queue->flushers;
+  tr_lockUnlock (queue->lock);
+}
+
+void
+tr_saveQueueGetStats (tr_save_queue * queue,
+                      uint64_t      * setme_files,
+                      uint64_t      * setme_batches)
+{
+  tr_lockLock (queue->lock);
+  *setme_files = queue->filesWritten;
+  *setme_batches = queue->batchesWritten;
+  tr_lockUnlock (queue->lock);
+}
@@ -0,0 +1,78 @@
+/*
+ * This file Copyright (C) 2016 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ * $Id$
+ */
+
+#ifndef __TRANSMISSION__
+ #error only libtransmission should #include this header.
+#endif
+
+#pragma once
+
+#include "variant.h" /* tr_variant_fmt */
+
+/**
+ * Writes .resume files and settings.json in the background.
+ *
+ * Saves are serialized right away but written later, by a worker
+ * thread, in batches. Saving a file again before it's been written
+ * replaces the earlier save, so each file is written once per batch.
+ *
+ * A batch is written once its first save has waited for the queue's
+ * delay. Each file goes to a temporary file first. Then all of the
+ * batch's temporary files are synced to disk together, and only after
+ * that are they renamed over the old files.
+ *
+ * All of these may be called from any thread. If `queue' is NULL,
+ * tr_saveQueueAdd () and tr_saveQueueReadFile () use the file directly.
+ */
+
+typedef struct tr_save_queue tr_save_queue;
+
+/** @brief called by the worker thread for each file it couldn't write */
+typedef void (*tr_save_failed_func) (const char * filename,
+                                     const char * errmsg,
+                                     void       * user_data);
+
+tr_save_queue * tr_saveQueueNew         (int                       delay_seconds,
+                                         tr_save_failed_func       failed_func,
+                                         void                    * failed_func_user_data);
+
+/** @brief writes whatever's still queued, then frees the queue */
+void            tr_saveQueueFree        (tr_save_queue           * queue);
+
+/** @brief sets how long a save can wait before it's written */
+void            tr_saveQueueSetDelay    (tr_save_queue           * queue,
+                                         int                       delay_seconds);
+
+/**
+ * @brief queues `v' to be written to `filename'
+ * @return 0 on success, or an errno if `queue' is NULL and the write failed.
+ *         Queued writes that fail are reported to the queue's failed_func
+ */
+int             tr_saveQueueAdd         (tr_save_queue           * queue,
+                                         const char              * filename,
+                                         const struct tr_variant * v,
+                                         tr_variant_fmt            fmt);
+
+/** @brief reads `filename', or what's been queued for it if it's newer */
+bool            tr_saveQueueReadFile    (tr_save_queue           * queue,
+                                         const char              * filename,
+                                         tr_variant_fmt            fmt,
+                                         struct tr_variant       * setme);
+
+/** @brief drops any queued saves of `filename', e.g. before deleting it */
+void            tr_saveQueueRemove      (tr_save_queue           * queue,
+                                         const char              * filename);
+
+/** @brief blocks until everything queued so far has been written */
+void            tr_saveQueueFlush       (tr_save_queue           * queue);
+
+/** @brief how many files and batches have been written */
+void            tr_saveQueueGetStats    (tr_save_queue           * queue,
+                                         uint64_t                * setme_files,
+                                         uint64_t                * setme_batches);
@@ -7,12 +7,16 @@
  * $Id$
  */
 
+#include <math.h> /* fabs () */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "transmission.h"
+#include "save-queue.h"
 #include "session.h"
+#include "torrent.h"
 #include "utils.h"
+#include "variant.h"
 #include "version.h"
 
 #undef VERBOSE
@@ -46,4 +50,139 @@ testPeerId (void)
     return 0;
 }
 
-MAIN_SINGLE_TEST (testPeerId)
+/***
+****
+***/
+
+#define LOAD_COUNT 6
+
+struct loaded_torrent
+{
+    int id;
+    char hashString[2*SHA_DIGEST_LENGTH+1];
+    char name[32];
+    tr_ratiolimit ratioMode;
+    double ratioLimit;
+    uint16_t peerLimit;
+};
+
+/* loads the session's torrents with up to `max_threads' threads,
+ * notes what they looked like, and closes them again */
+static int
+loadAndClose (tr_session * session, int max_threads, struct loaded_torrent * loaded)
+{
+    int i;
+    int n;
+    tr_torrent ** torrents;
+    tr_ctor * ctor = tr_ctorNew (session);
+
+    tr_ctorSetPaused (ctor, TR_FORCE, true);
+    torrents = tr_sessionLoadTorrentsWithThreads (session, ctor, max_threads, &n);
+    check_int_eq (LOAD_COUNT, n);
+
+    for (i = 0; i < n; ++i)
+    {
+        tr_torrent * tor = torrents[i];
+
+        loaded[i].id = tr_torrentId (tor);
+        tr_strlcpy (loaded[i].hashString, tor->info.hashString, sizeof (loaded[i].hashString));
+        tr_strlcpy (loaded[i].name, tr_torrentName (tor), sizeof (loaded[i].name));
+        loaded[i].ratioMode = tr_torrentGetRatioMode (tor);
+        loaded[i].ratioLimit = tr_torrentGetRatioLimit (tor);
+        loaded[i].peerLimit = tr_torrentGetPeerLimit (tor);
+        tr_torrentFree (tor);
+    }
+
+    while (tr_sessionCountTorrents (session) > 0)
+        tr_wait_msec (10);
+
+    tr_free (torrents);
+    tr_ctorFree (ctor);
+    return 0;
+}
+
+static int
+testLoadTorrentsInParallel (void)
+{
+    int i;
+    tr_torrent * tor;
+    tr_variant metainfo;
+    tr_variant * info;
+    tr_session * session;
+    struct loaded_torrent serial[LOAD_COUNT];
+    struct loaded_torrent parallel[LOAD_COUNT];
+
+    /* make some torrents that differ in their .torrent and .resume files */
+    session = libttest_session_init (NULL);
+    tor = libttest_zero_torrent_init (session);
+    check (tr_variantFromFile (&metainfo, TR_VARIANT_FMT_BENC, tor->info.torrent, NULL));
+    check (tr_variantDictFindDict (&metainfo, TR_KEY_info, &info));
+    tr_torrentRemove (tor, false, NULL);
+    while (tr_sessionCountTorrents (session) > 0)
+        tr_wait_msec (10);
+
+    for (i = 0; i < LOAD_COUNT; ++i)
+    {
+        int err;
+        char name[32];
+        size_t len;
+        char * benc;
+        tr_ctor * ctor = tr_ctorNew (session);
+
+        tr_snprintf (name, sizeof (name), "torrent-%d", i);
+        tr_variantDictAddStr (info, TR_KEY_name, name);
+        benc = tr_variantToStr (&metainfo, TR_VARIANT_FMT_BENC, &len);
+        tr_ctorSetMetainfo (ctor, (const uint8_t *) benc, len);
+        tr_ctorSetPaused (ctor, TR_FORCE, true);
+        tor = tr_torrentNew (ctor, &err, NULL);
+        check (tor != NULL);
+
+        tr_torrentSetRatioMode (tor, TR_RATIOLIMIT_SINGLE);
+        tr_torrentSetRatioLimit (tor, 1.5 + i);
+        tr_torrentSetPeerLimit (tor, 10 + i);
+        tr_torrentSave (tor);
+        tr_torrentFree (tor);
+
+        tr_ctorFree (ctor);
+        tr_free (benc);
+    }
+
+    tr_variantFree (&metainfo);
+    while (tr_sessionCountTorrents (session) > 0)
+        tr_wait_msec (10);
+    tr_saveQueueFlush (session->saveQueue);
+
+    /* loading them with one thread or with several gives the same results */
+    if (loadAndClose (session, 1, serial) || loadAndClose (session, 4, parallel))
+        return current_test;
+
+    for (i = 0; i < LOAD_COUNT; ++i)
+    {
+        int k;
+
+        check_streq (serial[i].hashString, parallel[i].hashString);
+        check_streq (serial[i].name, parallel[i].name);
+        check_int_eq (serial[i].id - serial[0].id, parallel[i].id - parallel[0].id);
+        check_int_eq (serial[i].ratioMode, parallel[i].ratioMode);
+        check (fabs (serial[i].ratioLimit - parallel[i].ratioLimit) < 0.001);
+        check_int_eq (serial[i].peerLimit, parallel[i].peerLimit);
+
+        /* ...and the .resume files were read */
+        check (sscanf (parallel[i].name, "torrent-%d", &k) == 1);
+        check_int_eq (TR_RATIOLIMIT_SINGLE, parallel[i].ratioMode);
+        check (fabs (1.5 + k - parallel[i].ratioLimit) < 0.001);
+        check_int_eq (10 + k, parallel[i].peerLimit);
+    }
+
+    libttest_session_close (session);
+    return 0;
+}
+
+int
+main (void)
+{
+    const testFunc tests[] = { testPeerId,
+                               testLoadTorrentsInParallel };
+
+    return runTests (tests, NUM_TESTS (tests));
+}
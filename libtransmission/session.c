@@ -15,9 +15,12 @@
 
 #include <signal.h>
 
-#ifndef _WIN32
+#ifdef _WIN32
+ #include <windows.h> /* GetSystemInfo () */
+#else
  #include <sys/types.h> /* umask () */
  #include <sys/stat.h> /* umask () */
+ #include <unistd.h> /* sysconf () */
 #endif
 
 #include <event2/dns.h> /* evdns_base_free () */
@@ -29,6 +32,7 @@
 #include "transmission.h"
 #include "announcer.h"
 #include "bandwidth.h"
+#include "bandwidth-group.h"
 #include "blocklist.h"
 #include "cache.h"
 #include "crypto-utils.h"
@@ -44,6 +48,9 @@
 #include "platform.h" /* tr_lock, tr_getTorrentDir () */
 #include "platform-quota.h" /* tr_device_info_free() */
 #include "port-forwarding.h"
+#include "resume.h" /* tr_torrentReadResume () */
+#include "save-queue.h"
+#include "resume-db.h"
 #include "rpc-server.h"
 #include "session.h"
 #include "stats.h"
@@ -328,6 +335,7 @@ tr_sessionGetDefaultSettings (tr_variant * d)
   tr_variantDictAddInt  (d, TR_KEY_speed_limit_down,                100);
   tr_variantDictAddBool (d, TR_KEY_speed_limit_down_enabled,        false);
   tr_variantDictAddInt  (d, TR_KEY_encryption,                      TR_DEFAULT_ENCRYPTION);
+  tr_variantDictAddInt  (d, TR_KEY_idle_metainfo_unload_minutes,    0);
   tr_variantDictAddInt  (d, TR_KEY_idle_seeding_limit,              30);
   tr_variantDictAddBool (d, TR_KEY_idle_seeding_limit_enabled,      false);
   tr_variantDictAddStr  (d, TR_KEY_incomplete_dir,                  tr_getDefaultDownloadDir ());
@@ -352,6 +360,7 @@ tr_sessionGetDefaultSettings (tr_variant * d)
   tr_variantDictAddReal (d, TR_KEY_ratio_limit,                     2.0);
   tr_variantDictAddBool (d, TR_KEY_ratio_limit_enabled,             false);
   tr_variantDictAddBool (d, TR_KEY_rename_partial_files,            true);
+  tr_variantDictAddBool (d, TR_KEY_resume_database_enabled,         false);
   tr_variantDictAddBool (d, TR_KEY_rpc_authentication_required,     false);
   tr_variantDictAddStr  (d, TR_KEY_rpc_bind_address,                "0.0.0.0");
   tr_variantDictAddBool (d, TR_KEY_rpc_enabled,                     false);
@@ -361,6 +370,7 @@ tr_sessionGetDefaultSettings (tr_variant * d)
   tr_variantDictAddBool (d, TR_KEY_rpc_whitelist_enabled,           true);
   tr_variantDictAddInt  (d, TR_KEY_rpc_port,                        atoi (TR_DEFAULT_RPC_PORT_STR));
   tr_variantDictAddStr  (d, TR_KEY_rpc_url,                         TR_DEFAULT_RPC_URL_STR);
+  tr_variantDictAddInt  (d, TR_KEY_save_delay_seconds,              10);
   tr_variantDictAddBool (d, TR_KEY_scrape_paused_torrents_enabled,  true);
   tr_variantDictAddStr  (d, TR_KEY_script_torrent_done_filename,    "");
   tr_variantDictAddBool (d, TR_KEY_script_torrent_done_enabled,     false);
@@ -401,6 +411,7 @@ tr_sessionGetSettings (tr_session * s, tr_variant * d)
   tr_variantDictAddInt  (d, TR_KEY_speed_limit_down,             tr_sessionGetSpeedLimit_KBps (s, TR_DOWN));
   tr_variantDictAddBool (d, TR_KEY_speed_limit_down_enabled,     tr_sessionIsSpeedLimited (s, TR_DOWN));
   tr_variantDictAddInt  (d, TR_KEY_encryption,                   s->encryptionMode);
+  tr_variantDictAddInt  (d, TR_KEY_idle_metainfo_unload_minutes, s->idleMetainfoUnloadMinutes);
   tr_variantDictAddInt  (d, TR_KEY_idle_seeding_limit,           tr_sessionGetIdleLimit (s));
   tr_variantDictAddBool (d, TR_KEY_idle_seeding_limit_enabled,   tr_sessionIsIdleLimited (s));
   tr_variantDictAddStr  (d, TR_KEY_incomplete_dir,               tr_sessionGetIncompleteDir (s));
@@ -424,6 +435,7 @@ tr_sessionGetSettings (tr_session * s, tr_variant * d)
   tr_variantDictAddReal (d, TR_KEY_ratio_limit,                  s->desiredRatio);
   tr_variantDictAddBool (d, TR_KEY_ratio_limit_enabled,          s->isRatioLimited);
   tr_variantDictAddBool (d, TR_KEY_rename_partial_files,         tr_sessionIsIncompleteFileNamingEnabled (s));
+  tr_variantDictAddBool (d, TR_KEY_resume_database_enabled,      s->isResumeDbEnabled);
   tr_variantDictAddBool (d, TR_KEY_rpc_authentication_required,  tr_sessionIsRPCPasswordEnabled (s));
   tr_variantDictAddStr  (d, TR_KEY_rpc_bind_address,             tr_sessionGetRPCBindAddress (s));
   tr_variantDictAddBool (d, TR_KEY_rpc_enabled,                  tr_sessionIsRPCEnabled (s));
@@ -433,6 +445,7 @@ tr_sessionGetSettings (tr_session * s, tr_variant * d)
   tr_variantDictAddStr  (d, TR_KEY_rpc_username,                 tr_sessionGetRPCUsername (s));
   tr_variantDictAddStr  (d, TR_KEY_rpc_whitelist,                tr_sessionGetRPCWhitelist (s));
   tr_variantDictAddBool (d, TR_KEY_rpc_whitelist_enabled,        tr_sessionGetRPCWhitelistEnabled (s));
+  tr_variantDictAddInt  (d, TR_KEY_save_delay_seconds,           s->saveDelaySeconds);
   tr_variantDictAddBool (d, TR_KEY_scrape_paused_torrents_enabled, s->scrapePausedTorrents);
   tr_variantDictAddBool (d, TR_KEY_script_torrent_done_enabled,  tr_sessionIsTorrentDoneScriptEnabled (s));
   tr_variantDictAddStr  (d, TR_KEY_script_torrent_done_filename, tr_sessionGetTorrentDoneScript (s));
@@ -512,7 +525,7 @@ tr_sessionSaveSettings (tr_session       * session,
   /* the existing file settings are the fallback values */
   {
     tr_variant fileSettings;
-    if (tr_variantFromFile (&fileSettings, TR_VARIANT_FMT_JSON, filename, NULL))
+    if (tr_saveQueueReadFile (session->saveQueue, filename, TR_VARIANT_FMT_JSON, &fileSettings))
       {
         tr_variantMergeDicts (&settings, &fileSettings);
         tr_variantFree (&fileSettings);
@@ -532,7 +545,7 @@ tr_sessionSaveSettings (tr_session       * session,
   }
 
   /* save the result */
-  tr_variantToFile (&settings, TR_VARIANT_FMT_JSON, filename);
+  tr_saveQueueAdd (session->saveQueue, filename, &settings, TR_VARIANT_FMT_JSON);
 
   /* cleanup */
   tr_free (filename);
@@ -558,7 +571,15 @@ onSaveTimer (evutil_socket_t foo UNUSED, short bar UNUSED, void * vsession)
     tr_logAddError ("Error while flushing completed pieces from cache");
 
   while ((tor = tr_torrentNext (session, tor)))
-    tr_torrentSave (tor);
+    {
+      tr_torrentSave (tor);
+
+      if (session->idleMetainfoUnloadMinutes > 0)
+        tr_torrentPageOutIfIdle (tor, session->idleMetainfoUnloadMinutes);
+    }
+
+  if (session->resumeDb != NULL)
+    tr_resumeDbFlush (session->resumeDb);
 
   tr_statsSaveDirty (session);
 
@@ -603,6 +624,12 @@ tr_sessionInit (const char * configDir,
   tr_bandwidthConstruct (&session->bandwidth, session, NULL);
   tr_variantInitList (&session->removedTorrents, 0);
 
+  /* start past every revision an earlier run could have handed out,
+   * assuming it averaged under 1024 changes per millisecond. The
+   * result still fits in a double's 53 bits, so JavaScript is fine */
+  session->torrentRevisionBase = tr_time_msec () << 10;
+  session->torrentRevision = session->torrentRevisionBase;
+
   /* nice to start logging at the very beginning */
   if (tr_variantDictFindInt (clientSettings, TR_KEY_message_level, &i))
     tr_logSetLevel (i);
@@ -627,6 +654,12 @@ tr_sessionInit (const char * configDir,
 
 static void turtleCheckClock (tr_session * s, struct tr_turtle_info * t);
 
+enum
+{
+  /* how often a running-but-idle torrent's stats are considered changed */
+  STATS_HEARTBEAT_SEC = 10
+};
+
 static void
 onNowTimer (evutil_socket_t foo UNUSED, short bar UNUSED, void * vsession)
 {
@@ -661,6 +694,19 @@ onNowTimer (evutil_socket_t foo UNUSED, short bar UNUSED, void * vsession)
           else
             ++tor->secondsDownloading;
         }
+
+      /* speeds, eta and tracker stats drift with the clock rather
+       * than with any one event, so flag torrents that were busy
+       * recently, plus a staggered heartbeat for the running ones */
+      if ((tor->anyDate + HISTORY_MSEC / 1000 + 1 >= now)
+          || (tor->isRunning && ((now + tor->uniqueId) % STATS_HEARTBEAT_SEC == 0)))
+        tr_torrentMarkChanged (tor, TR_FIELDS_STATS);
+    }
+
+  if (session->peerPollChanges > 0)
+    {
+      tr_logAddDeep (__FILE__, __LINE__, NULL, "%u peer poll changes (epoll_ctl calls) in the last second", session->peerPollChanges);
+      session->peerPollChanges = 0;
     }
 
   /**
@@ -711,6 +757,8 @@ tr_sessionInitImpl (void * vdata)
 
   tr_setConfigDir (session, data->configDir);
 
+  session->saveQueue = tr_saveQueueNew (session->saveDelaySeconds, tr_resumeSaveFailed, session);
+
   session->peerMgr = tr_peerMgrNew (session);
 
   session->shared = tr_sharedInit (session);
@@ -739,8 +787,30 @@ tr_sessionInitImpl (void * vdata)
 
   tr_statsInit (session);
 
+  tr_bandwidthGroupsInit (session);
+
   tr_sessionSet (session, &settings);
 
+  /* open the resume database if it's wanted, or if there's one left over
+   * whose state needs to be moved back to .resume files. see tr_resumeMigrate () */
+  {
+    char * filename = tr_buildPath (session->configDir, "resume.db", NULL);
+
+    if (session->isResumeDbEnabled || tr_sys_path_exists (filename, NULL))
+      {
+        tr_error * error = NULL;
+
+        session->resumeDb = tr_resumeDbOpen (filename, &error);
+        if (session->resumeDb == NULL)
+          {
+            tr_logAddError (_("Couldn't open \"%s\": %s"), filename, error->message);
+            tr_error_free (error);
+          }
+      }
+
+    tr_free (filename);
+  }
+
   tr_udpInit (session);
 
   if (session->isLPDEnabled)
@@ -841,6 +911,10 @@ sessionSetImpl (void * vdata)
     tr_sessionSetIncompleteDirEnabled (session, boolVal);
   if (tr_variantDictFindBool (settings, TR_KEY_rename_partial_files, &boolVal))
     tr_sessionSetIncompleteFileNamingEnabled (session, boolVal);
+  if (tr_variantDictFindBool (settings, TR_KEY_resume_database_enabled, &boolVal))
+    session->isResumeDbEnabled = boolVal;
+  if (tr_variantDictFindInt (settings, TR_KEY_idle_metainfo_unload_minutes, &i))
+    session->idleMetainfoUnloadMinutes = (int) MAX (0, i);
 
   /* rpc server */
   if (session->rpcServer != NULL) /* close the old one */
@@ -939,6 +1013,12 @@ sessionSetImpl (void * vdata)
   if (tr_variantDictFindBool (settings, TR_KEY_scrape_paused_torrents_enabled, &boolVal))
     session->scrapePausedTorrents = boolVal;
 
+  if (tr_variantDictFindInt (settings, TR_KEY_save_delay_seconds, &i))
+    {
+      session->saveDelaySeconds = (int) MAX (0, i);
+      tr_saveQueueSetDelay (session->saveQueue, session->saveDelaySeconds);
+    }
+
   data->done = true;
 }
 
@@ -1170,12 +1250,24 @@ tr_sessionGetPortForwarding (const tr_session * session)
 ****
 ***/
 
+/* torrents that follow the session's seed limits
+ * need to recalculate their seed progress and eta */
+static void
+invalidateSeedLimitStats (tr_session * session)
+{
+  tr_torrent * tor = NULL;
+
+  while ((tor = tr_torrentNext (session, tor)))
+    tr_torrentInvalidateStats (tor, TR_STAT_RATES);
+}
+
 void
 tr_sessionSetRatioLimited (tr_session * session, bool isLimited)
 {
   assert (tr_isSession (session));
 
   session->isRatioLimited = isLimited;
+  invalidateSeedLimitStats (session);
 }
 
 void
@@ -1184,6 +1276,7 @@ tr_sessionSetRatioLimit (tr_session * session, double desiredRatio)
   assert (tr_isSession (session));
 
   session->desiredRatio = desiredRatio;
+  invalidateSeedLimitStats (session);
 }
 
 bool
@@ -1212,6 +1305,7 @@ tr_sessionSetIdleLimited (tr_session * session, bool isLimited)
   assert (tr_isSession (session));
 
   session->isIdleLimited = isLimited;
+  invalidateSeedLimitStats (session);
 }
 
 void
@@ -1220,6 +1314,7 @@ tr_sessionSetIdleLimit (tr_session * session, uint16_t idleMinutes)
   assert (tr_isSession (session));
 
   session->idleLimitMinutes = idleMinutes;
+  invalidateSeedLimitStats (session);
 }
 
 bool
@@ -1819,6 +1914,13 @@ sessionCloseImplStart (tr_session * session)
   for (i=0; i<n; ++i)
     tr_torrentFree (torrents[i]);
   tr_free (torrents);
+  tr_locationMoverFree (session);
+
+  /* the torrents saved their state while being freed */
+  tr_resumeDbClose (session->resumeDb);
+  session->resumeDb = NULL;
+  tr_saveQueueFree (session->saveQueue);
+  session->saveQueue = NULL;
 
   /* Close the announcer *after* closing the torrents
      so that all the &event=stopped messages will be
@@ -1872,6 +1974,7 @@ sessionCloseImplFinish (tr_session * session)
   tr_udpUninit (session);
 
   tr_statsClose (session);
+  tr_bandwidthGroupsClose (session);
   tr_peerMgrFree (session->peerMgr);
 
   closeBlocklists (session);
@@ -1973,6 +2076,36 @@ tr_sessionClose (tr_session * session)
   tr_free (session);
 }
 
+/***
+****  Loading torrents at startup
+****
+****  Reading and parsing thousands of .torrent and .resume files one by
+****  one in the event thread could keep a big session from answering RPC
+****  for minutes. So the caller's thread and a few helpers do the parsing,
+****  and the event thread only has to register the results.
+***/
+
+enum
+{
+  /* how many threads to parse .torrent and .resume files with.
+   * reading the files blocks, so use a couple even on one core */
+  MIN_LOADER_THREADS = 2,
+  MAX_LOADER_THREADS = 8
+};
+
+struct loadTorrentsItem
+{
+  char * filename;
+
+  tr_parse_result result;
+  tr_info info;
+  bool hasInfo;
+  size_t infoDictLength;
+
+  bool hasResume;
+  tr_variant resume;
+};
+
 struct sessionLoadTorrentsData
 {
   tr_session * session;
@@ -1980,24 +2113,81 @@ struct sessionLoadTorrentsData
   int * setmeCount;
   tr_torrent ** torrents;
   bool done;
+
+  struct loadTorrentsItem * items;
+  int itemCount;
+
+  /* guards nextItem */
+  tr_lock * lock;
+  int nextItem;
 };
 
+struct loadTorrentsThread
+{
+  struct sessionLoadTorrentsData * data;
+  tr_ctor * ctor;
+  tr_thread * thread;
+};
+
+static int
+getLoaderThreadCount (void)
+{
+  long n = 1;
+
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo (&info);
+  n = info.dwNumberOfProcessors;
+#elif defined (_SC_NPROCESSORS_ONLN)
+  n = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+
+  return (int) MAX (MIN_LOADER_THREADS, MIN (n, MAX_LOADER_THREADS));
+}
+
+/* parse items until there are none left. each thread needs its own ctor */
 static void
-sessionLoadTorrents (void * vdata)
+parseTorrentFiles (struct sessionLoadTorrentsData * data, tr_ctor * ctor)
+{
+  for (;;)
+    {
+      struct loadTorrentsItem * item = NULL;
+
+      tr_lockLock (data->lock);
+      if (data->nextItem < data->itemCount)
+        item = &data->items[data->nextItem++];
+      tr_lockUnlock (data->lock);
+
+      if (item == NULL)
+        break;
+
+      item->result = TR_PARSE_ERR;
+      if (tr_ctorSetMetainfoFromFile (ctor, item->filename) == 0)
+        item->result = tr_torrentParseMetainfo (ctor, &item->info, &item->hasInfo, &item->infoDictLength);
+
+      if (item->result == TR_PARSE_OK)
+        item->hasResume = tr_torrentReadResume (data->session, &item->info, &item->resume);
+    }
+}
+
+static void
+loadTorrentsThreadFunc (void * vthread)
+{
+  struct loadTorrentsThread * thread = vthread;
+
+  /* the caller frees our ctor once it's joined us */
+  parseTorrentFiles (thread->data, thread->ctor);
+}
+
+static void
+findTorrentFiles (struct sessionLoadTorrentsData * data)
 {
-  int i;
   int n = 0;
   tr_sys_path_info info;
   tr_sys_dir_t odir = NULL;
-  tr_list * l = NULL;
   tr_list * list = NULL;
-  struct sessionLoadTorrentsData * data = vdata;
   const char * dirname = tr_getTorrentDir (data->session);
 
-  assert (tr_isSession (data->session));
-
-  tr_ctorSetSave (data->ctor, false); /* since we already have them */
-
   if (tr_sys_path_get_info (dirname, 0, &info, NULL) &&
       info.type == TR_SYS_PATH_IS_DIRECTORY &&
       (odir = tr_sys_dir_open (dirname, NULL)) != TR_BAD_SYS_DIR)
@@ -2007,32 +2197,92 @@ sessionLoadTorrents (void * vdata)
         {
           if (tr_str_has_suffix (name, ".torrent"))
             {
-              tr_torrent * tor;
-              char * path = tr_buildPath (dirname, name, NULL);
-              tr_ctorSetMetainfoFromFile (data->ctor, path);
-              if ((tor = tr_torrentNew (data->ctor, NULL, NULL)))
-                {
-                  tr_list_prepend (&list, tor);
-                  ++n;
-                }
-              tr_free (path);
+              tr_list_append (&list, tr_buildPath (dirname, name, NULL));
+              ++n;
             }
         }
       tr_sys_dir_close (odir, NULL);
     }
 
+  data->itemCount = n;
+  data->items = tr_new0 (struct loadTorrentsItem, n);
+  for (n=0; list!=NULL; ++n)
+    data->items[n].filename = tr_list_pop_front (&list);
+}
+
+/* parses data->items with up to `max_threads' threads, counting this one */
+static void
+parseTorrentFilesInParallel (struct sessionLoadTorrentsData * data, int max_threads)
+{
+  int i;
+  const int n_threads = MAX (1, MIN (max_threads, data->itemCount));
+  struct loadTorrentsThread * threads = tr_new0 (struct loadTorrentsThread, n_threads);
+
+  data->lock = tr_lockNew ();
+  data->nextItem = 0;
+
+  for (i=0; i<n_threads; ++i)
+    {
+      threads[i].data = data;
+      threads[i].ctor = tr_ctorNew (data->session);
+    }
+
+  for (i=1; i<n_threads; ++i)
+    threads[i].thread = tr_threadNewJoinable (loadTorrentsThreadFunc, &threads[i]);
+
+  parseTorrentFiles (data, threads[0].ctor);
+
+  for (i=1; i<n_threads; ++i)
+    tr_threadJoin (threads[i].thread);
+
+  for (i=0; i<n_threads; ++i)
+    tr_ctorFree (threads[i].ctor);
+  tr_free (threads);
+  tr_lockFree (data->lock);
+  data->lock = NULL;
+}
+
+static void
+sessionLoadTorrents (void * vdata)
+{
+  int i;
+  int n = 0;
+  tr_list * l = NULL;
+  tr_list * list = NULL;
+  struct sessionLoadTorrentsData * data = vdata;
+
+  assert (tr_isSession (data->session));
+
+  tr_ctorSetSave (data->ctor, false); /* since we already have them */
+
+  for (i=0; i<data->itemCount; ++i)
+    {
+      tr_torrent * tor;
+      struct loadTorrentsItem * item = &data->items[i];
+
+      if (item->result != TR_PARSE_OK)
+        continue;
+
+      /* this takes ownership of item->info */
+      tor = tr_torrentNewParsed (data->ctor, &item->info, item->hasInfo, item->infoDictLength,
+                                 item->hasResume ? &item->resume : NULL, NULL);
+      if (tor != NULL)
+        {
+          tr_list_prepend (&list, tor);
+          ++n;
+        }
+    }
+
   data->torrents = tr_new (tr_torrent *, n);
   for (i=0, l=list; l!=NULL; l=l->next)
     data->torrents[i++] = (tr_torrent*) l->data;
   assert (i == n);
 
-    tr_list_free (&list, NULL);
+  tr_list_free (&list, NULL);
 
-  if (n)
-    tr_logAddInfo (_("Loaded %d torrents"), n);
+  tr_resumeMigrate (data->session);
 
-  if (data->setmeCount)
-    *data->setmeCount = n;
+  *data->setmeCount = n;
 
   data->done = true;
 }
@@ -2042,17 +2292,60 @@ tr_sessionLoadTorrents (tr_session * session,
                         tr_ctor    * ctor,
                         int        * setmeCount)
 {
+  return tr_sessionLoadTorrentsWithThreads (session, ctor, getLoaderThreadCount (), setmeCount);
+}
+
+tr_torrent **
+tr_sessionLoadTorrentsWithThreads (tr_session * session,
+                                   tr_ctor    * ctor,
+                                   int          max_threads,
+                                   int        * setmeCount)
+{
+  int i;
+  int n_loaded = 0;
+  uint64_t begin;
+  uint64_t find_msec;
+  uint64_t parse_msec;
+  uint64_t register_msec;
   struct sessionLoadTorrentsData data;
 
+  memset (&data, 0, sizeof (data));
   data.session = session;
   data.ctor = ctor;
-  data.setmeCount = setmeCount;
+  data.setmeCount = &n_loaded;
   data.torrents = NULL;
   data.done = false;
 
+  begin = tr_time_msec ();
+  findTorrentFiles (&data);
+  find_msec = tr_time_msec () - begin;
+
+  begin = tr_time_msec ();
+  parseTorrentFilesInParallel (&data, max_threads);
+  parse_msec = tr_time_msec () - begin;
+
+  begin = tr_time_msec ();
   tr_runInEventThread (session, sessionLoadTorrents, &data);
   while (!data.done)
-    tr_wait_msec (100);
+    tr_wait_msec (10);
+  register_msec = tr_time_msec () - begin;
+
+  for (i=0; i<data.itemCount; ++i)
+    {
+      if (data.items[i].hasResume)
+        tr_variantFree (&data.items[i].resume);
+      tr_free (data.items[i].filename);
+    }
+  tr_free (data.items);
+
+  if (data.itemCount > 0)
+    tr_logAddInfo (_("Loaded %d torrents in %"PRIu64" ms "
+                     "(finding files: %"PRIu64" ms; parsing with %d threads: %"PRIu64" ms; adding: %"PRIu64" ms)"),
+                   n_loaded, find_msec + parse_msec + register_msec,
+                   find_msec, MAX (1, MIN (max_threads, data.itemCount)), parse_msec, register_msec);
+
+  if (setmeCount != NULL)
+    *setmeCount = n_loaded;
 
   return data.torrents;
 }
@@ -55,6 +55,20 @@ struct tr_cache;
 struct tr_fdInfo;
 struct tr_device_info;
 
+/* how much work saving .resume files has taken. see tr_torrentSaveResume () */
+struct tr_resume_save_stats
+{
+    uint64_t saveCount;
+    uint64_t saveUsec;
+
+    /* how many costly sections were rebuilt, or reused from the last save */
+    uint64_t sectionsRebuilt;
+    uint64_t sectionsReused;
+
+    /* how many times a file's mtime was looked up for its check time */
+    uint64_t mtimesRead;
+};
+
 struct tr_turtle_info
 {
     /* TR_UP and TR_DOWN speed limits */
@@ -114,11 +128,20 @@ struct tr_session
     bool                         pauseAddedTorrent;
     bool                         deleteSourceTorrent;
     bool                         scrapePausedTorrents;
+    bool                         isResumeDbEnabled;
 
     uint8_t                      peer_id_ttl_hours;
 
     tr_variant                   removedTorrents;
 
+    /* bumped whenever a torrent's RPC-visible fields change.
+     * see tr_torrentMarkChanged () */
+    uint64_t                     torrentRevision;
+
+    /* where this run's torrentRevision started. Cursors below it
+     * come from an earlier run. see getTorrentGetSince () */
+    uint64_t                     torrentRevisionBase;
+
     bool                         stalledEnabled;
     bool                         queueEnabled[2];
     int                          queueSize[2];
@@ -126,6 +149,10 @@ struct tr_session
 
     int                          umask;
 
+    /* how long a stopped torrent has to go unused before its file and
+     * piece tables are freed, or 0 to keep them. see tr_torrentPageIn () */
+    int                          idleMetainfoUnloadMinutes;
+
     unsigned int                 speedLimit_Bps[2];
     bool                         speedLimitEnabled[2];
 
@@ -176,6 +203,12 @@ struct tr_session
     int                          torrentCount;
     tr_torrent *                 torrentList;
 
+    /* finds torrents by id, info hash, or obfuscated hash. see torrent.c */
+    struct tr_torrent_lookup   * torrentLookup;
+
+    /* copies files for torrents being moved to another filesystem. see torrent.c */
+    struct tr_location_mover   * locationMover;
+
     char *                       torrentDoneScript;
 
     char *                       configDir;
@@ -183,6 +216,14 @@ struct tr_session
     char *                       torrentDir;
     char *                       incompleteDir;
 
+    /* every torrent's resume state in a single file, if enabled. see resume-db.h */
+    struct tr_resume_db        * resumeDb;
+
+    /* writes .resume files and settings.json in the background.
+     * see save-queue.h */
+    struct tr_save_queue       * saveQueue;
+    int                          saveDelaySeconds;
+
     char *                       blocklist_url;
 
     struct tr_device_info *      downloadDir;
@@ -203,17 +244,26 @@ struct tr_session
 
     struct tr_stats_handle     * sessionStats;
 
+    struct tr_resume_save_stats  resumeSaveStats;
+
     struct tr_announcer        * announcer;
     struct tr_announcer_udp    * announcer_udp;
 
     tr_variant                 * metainfoLookup;
 
+    /* how many times peer sockets were added to or removed from
+     * the event loop's poll set since the last onNowTimer () */
+    unsigned int                 peerPollChanges;
+
     struct event               * nowTimer;
     struct event               * saveTimer;
 
     /* monitors the "global pool" speeds */
     struct tr_bandwidth          bandwidth;
 
+    /* named bandwidths shared by groups of torrents, sorted by name */
+    tr_ptrArray                  bandwidthGroups;
+
     float                        desiredRatio;
 
     uint16_t                     idleLimitMinutes;
@@ -259,6 +309,13 @@ int tr_sessionCountTorrents (const tr_session * session);
 
 tr_torrent ** tr_sessionGetTorrents (tr_session * session, int * setme_n);
 
+/** @brief Private function that's exposed here only for unit tests.
+    Like tr_sessionLoadTorrents (), with up to `max_threads' parsing threads */
+tr_torrent ** tr_sessionLoadTorrentsWithThreads (tr_session * session,
+                                                 tr_ctor    * ctor,
+                                                 int          max_threads,
+                                                 int        * setmeCount);
+
 enum
 {
     SESSION_MAGIC_NUMBER = 3845,
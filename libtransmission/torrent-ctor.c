@@ -91,7 +91,8 @@ tr_ctorSetMetainfo (tr_ctor *       ctor,
     int err;
 
     clearMetainfo (ctor);
-    err = tr_variantFromBenc (&ctor->metainfo, metainfo, len);
+    err = tr_variantFromBuf (&ctor->metainfo, TR_VARIANT_FMT_BENC, metainfo, len,
+                             NULL, NULL, TR_VARIANT_PARSE_ARENA);
     ctor->isSet_metainfo = !err;
     return err;
 }
@@ -0,0 +1,351 @@
+/*
+ * This file Copyright (C) 2016 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ * $Id$
+ */
+
+#include <ctype.h> /* toupper () */
+#include <string.h> /* memcmp (), memcpy () */
+
+#include "transmission.h"
+#include "completion.h"
+#include "session.h" /* tr_sessionCountTorrents () */
+#include "torrent.h"
+#include "trevent.h" /* tr_runInEventThread () */
+#include "utils.h"
+#include "variant.h"
+
+#include "libtransmission-test.h"
+
+static tr_session * session = NULL;
+
+/***
+****
+***/
+
+static int
+test_page_out_and_in (void)
+{
+  tr_file_index_t i;
+  tr_piece_index_t p;
+  tr_torrent * tor;
+  const tr_stat * st;
+  tr_file_stat * fst;
+  tr_file_index_t n;
+  int8_t piecePriorities[33];
+  time_t timeChecked[33];
+  uint64_t sizeWhenDone;
+  uint64_t leftUntilDone;
+  uint8_t hash[SHA_DIGEST_LENGTH];
+  const tr_file_index_t dnd[] = { 1 };
+  const tr_file_index_t high[] = { 2 };
+  const char * strings[3];
+
+  tor = libttest_zero_torrent_init (session);
+  libttest_zero_torrent_populate (tor, false);
+  check_int_eq (0, libttest_torrentRenameAndWait (tor, "files-filled-with-zeroes/1048576", "bar"));
+  tr_torrentSetFileDLs (tor, dnd, 1, false);
+  tr_torrentSetFilePriorities (tor, high, 1, TR_PRI_HIGH);
+  memcpy (hash, tr_infoPieceHash (&tor->info, 32), SHA_DIGEST_LENGTH);
+  check_uint_eq (33, tor->info.pieceCount);
+  for (p=0; p<33; ++p)
+    {
+      piecePriorities[p] = tor->piecePriority[p];
+      timeChecked[p] = tor->pieceTimeChecked[p];
+    }
+  st = tr_torrentStat (tor);
+  sizeWhenDone = st->sizeWhenDone;
+  leftUntilDone = st->leftUntilDone;
+
+  /* the tables aren't freed while there are unsaved changes... */
+  tr_torrentPageOutIfIdle (tor, 0);
+  check (tor->info.files != NULL);
+
+  /* ...but they are once it's been saved */
+  tr_torrentSave (tor);
+  tr_torrentPageOutIfIdle (tor, 0);
+  check (tor->info.files == NULL);
+  check (tor->info.pieceHashes == NULL);
+  check (tor->metainfoMap == NULL);
+  check (tr_torrentHasMetadata (tor));
+  check_uint_eq (3, tor->info.fileCount);
+
+  /* the stats don't need them */
+  st = tr_torrentStat (tor);
+  check_uint_eq (sizeWhenDone, st->sizeWhenDone);
+  check_uint_eq (leftUntilDone, st->leftUntilDone);
+  check (tor->info.files == NULL);
+
+  /* asking for the files brings them back, changes and all */
+  fst = tr_torrentFiles (tor, &n);
+  check_uint_eq (3, n);
+  check (tor->info.files != NULL);
+  check (tor->info.pieceHashes != NULL);
+  check_uint_eq (4096, fst[1].bytesCompleted);
+  tr_torrentFilesFree (fst, n);
+
+  strings[0] = "files-filled-with-zeroes/bar";
+  strings[1] = "files-filled-with-zeroes/4096";
+  strings[2] = "files-filled-with-zeroes/512";
+  for (i=0; i<3; ++i)
+    check_streq (strings[i], tor->info.files[i].name);
+  check (tor->info.files[0].is_renamed);
+  check (!tor->info.files[1].is_renamed);
+  check (tor->info.files[1].dnd);
+  check (!tor->info.files[2].dnd);
+  check_int_eq (TR_PRI_HIGH, tor->info.files[2].priority);
+  for (p=0; p<33; ++p)
+    {
+      check_int_eq (piecePriorities[p], tor->piecePriority[p]);
+      check_int_eq (timeChecked[p], tor->pieceTimeChecked[p]);
+    }
+  check (memcmp (hash, tr_infoPieceHash (&tor->info, 32), SHA_DIGEST_LENGTH) == 0);
+
+  /* the hashes are read straight from the .torrent file */
+  check (tor->metainfoMap != NULL);
+  check ((const uint8_t*)tor->info.pieceHashes > (const uint8_t*)tor->metainfoMap);
+  check ((const uint8_t*)tor->info.pieceHashes + 33 * SHA_DIGEST_LENGTH <= (const uint8_t*)tor->metainfoMap + tor->metainfoMapSize);
+  check_uint_eq (sizeWhenDone, tr_torrentStat (tor)->sizeWhenDone);
+
+  /* once a client has been handed the info, it's never freed */
+  check (tr_torrentInfo (tor) == &tor->info);
+  tr_torrentPageOutIfIdle (tor, 0);
+  check (tor->info.files != NULL);
+
+  tr_torrentRemove (tor, false, NULL);
+  return 0;
+}
+
+static int
+test_stat_invalidation (void)
+{
+  tr_torrent * tor;
+  const tr_stat * st;
+  const tr_file_index_t first[] = { 0 };
+
+  while (tr_sessionCountTorrents (session) > 0)
+    tr_wait_msec (10);
+
+  tor = libttest_zero_torrent_init (session);
+  libttest_zero_torrent_populate (tor, false);
+  st = tr_torrentStat (tor);
+  check_uint_eq (tor->info.pieceSize, st->leftUntilDone);
+  check_int_eq (0, tor->staleStats);
+
+  /* a stopped torrent that nothing has happened to has nothing to refresh */
+  tr_torrentStat (tor);
+  check_int_eq (0, tor->staleStats);
+
+  /* changing which files are wanted changes the progress... */
+  tr_torrentSetFileDLs (tor, first, 1, false);
+  check (tor->staleStats & TR_STAT_PROGRESS);
+  check_uint_eq (0, tr_torrentStat (tor)->leftUntilDone);
+  check_int_eq (0, tor->staleStats);
+  tr_torrentSetFileDLs (tor, first, 1, true);
+  check_uint_eq (tor->info.pieceSize, tr_torrentStat (tor)->leftUntilDone);
+
+  /* ...and so does gaining or losing pieces, even without a save */
+  tr_cpPieceAdd (&tor->completion, 0);
+  check (tor->staleStats & TR_STAT_PROGRESS);
+  check_uint_eq (0, tr_torrentStat (tor)->leftUntilDone);
+  tr_cpPieceRem (&tor->completion, 0);
+  check_uint_eq (tor->info.pieceSize, tr_torrentStat (tor)->leftUntilDone);
+
+  /* session-wide seed limits apply to this torrent too */
+  tr_sessionSetRatioLimit (session, tr_sessionGetRatioLimit (session));
+  check (tor->staleStats & TR_STAT_RATES);
+  tr_torrentStat (tor);
+  check_int_eq (0, tor->staleStats);
+
+  tr_torrentRemove (tor, false, NULL);
+  return 0;
+}
+
+static int
+test_announce_list_while_verifying (void)
+{
+  tr_torrent * tor;
+  tr_variant metainfo;
+  const char * str;
+  const void * map;
+  tr_tracker_info tracker;
+
+  while (tr_sessionCountTorrents (session) > 0)
+    tr_wait_msec (10);
+
+  tor = libttest_zero_torrent_init (session);
+  libttest_zero_torrent_populate (tor, true);
+  map = tor->metainfoMap;
+  check (map != NULL);
+
+  tracker.tier = 0;
+  tracker.announce = (char*) "http://tracker.example.com/announce";
+  tracker.scrape = NULL;
+  tracker.id = 0;
+
+  /* the hashes aren't moved while the verify thread might be reading them... */
+  tr_torrentSetVerifyState (tor, TR_VERIFY_NOW);
+  check (tr_torrentSetAnnounceList (tor, &tracker, 1));
+  check (tor->metainfoMap == map);
+  check (tor->pendingMetainfo != NULL);
+  check_int_eq (1, tor->info.trackerCount);
+  tr_torrentSetVerifyState (tor, TR_VERIFY_NONE);
+
+  /* ...and the .torrent file is saved once it's done */
+  libttest_blockingTorrentVerify (tor);
+  check (tor->pendingMetainfo == NULL);
+  check (tor->metainfoMap != NULL);
+  check (tr_variantFromFile (&metainfo, TR_VARIANT_FMT_BENC, tor->info.torrent, NULL));
+  check (tr_variantDictFindStr (&metainfo, TR_KEY_announce, &str, NULL));
+  check_streq (tracker.announce, str);
+  tr_variantFree (&metainfo);
+
+  tr_torrentRemove (tor, false, NULL);
+  return 0;
+}
+
+static int
+test_torrent_lookup (void)
+{
+  int i;
+  int ids[100];
+  char upper[SHA_DIGEST_LENGTH*2 + 1];
+  tr_torrent * tors[100];
+  const int n = sizeof (tors) / sizeof (*tors);
+
+  while (tr_sessionCountTorrents (session) > 0)
+    tr_wait_msec (10);
+
+  for (i=0; i<n; ++i)
+    {
+      int err;
+      char link[128];
+      tr_ctor * ctor = tr_ctorNew (session);
+
+      tr_snprintf (link, sizeof (link), "magnet:?xt=urn:btih:%040x", i + 1);
+      check_int_eq (0, tr_ctorSetMetainfoFromMagnetLink (ctor, link));
+      tr_ctorSetPaused (ctor, TR_FORCE, true);
+      tors[i] = tr_torrentNew (ctor, &err, NULL);
+      check (tors[i] != NULL);
+      ids[i] = tr_torrentId (tors[i]);
+      tr_ctorFree (ctor);
+    }
+
+  for (i=0; i<n; ++i)
+    {
+      check (tr_torrentFindFromId (session, ids[i]) == tors[i]);
+      check (tr_torrentFindFromHash (session, tors[i]->info.hash) == tors[i]);
+      check (tr_torrentFindFromHashString (session, tors[i]->info.hashString) == tors[i]);
+      check (tr_torrentFindFromObfuscatedHash (session, tors[i]->obfuscatedHash) == tors[i]);
+    }
+  check (tr_torrentFindFromId (session, -1) == NULL);
+  check (tr_torrentFindFromHashString (session, "recently-active") == NULL);
+
+  /* hash strings are matched case-insensitively */
+  tr_strlcpy (upper, tors[1]->info.hashString, sizeof (upper));
+  for (i=0; upper[i]; ++i)
+    upper[i] = toupper (upper[i]);
+  check (tr_torrentFindFromHashString (session, upper) == tors[1]);
+
+  /* remove every other torrent; the rest must still be found */
+  for (i=0; i<n; i+=2)
+    tr_torrentRemove (tors[i], false, NULL);
+  while (tr_sessionCountTorrents (session) > n/2)
+    tr_wait_msec (10);
+  for (i=0; i<n; ++i)
+    {
+      if (i % 2)
+        {
+          check (tr_torrentFindFromId (session, ids[i]) == tors[i]);
+          check (tr_torrentFindFromHash (session, tors[i]->info.hash) == tors[i]);
+          check (tr_torrentFindFromObfuscatedHash (session, tors[i]->obfuscatedHash) == tors[i]);
+        }
+      else
+        {
+          check (tr_torrentFindFromId (session, ids[i]) == NULL);
+        }
+    }
+
+  /* cleanup */
+  for (i=1; i<n; i+=2)
+    tr_torrentRemove (tors[i], false, NULL);
+  return 0;
+}
+
+static void
+onVerifyDone (tr_torrent * tor UNUSED, bool aborted UNUSED, void * vcalled)
+{
+  *(bool*)vcalled = true;
+}
+
+static void
+onEventThreadSynced (void * vdone)
+{
+  *(bool*)vdone = true;
+}
+
+/* holds up the libtransmission thread until the verify thread has the torrent */
+static void
+waitForVerifyToStart (void * vtor)
+{
+  tr_torrent * tor = vtor;
+
+  while (tor->verifyState == TR_VERIFY_WAIT)
+    tr_wait_msec (1);
+}
+
+static int
+test_remove_while_verifying (void)
+{
+  tr_torrent * tor;
+  volatile bool called = false;
+  volatile bool synced = false;
+
+  while (tr_sessionCountTorrents (session) > 0)
+    tr_wait_msec (10);
+
+  tor = libttest_zero_torrent_init (session);
+  libttest_zero_torrent_populate (tor, true);
+
+  /* the removal is queued behind the verify, so the verify thread's
+   * done callback is queued behind the removal... */
+  tr_sessionLock (session);
+  tr_torrentVerify (tor, onVerifyDone, (void*)&called);
+  tr_runInEventThread (session, waitForVerifyToStart, tor);
+  tr_torrentRemove (tor, false, NULL);
+  tr_sessionUnlock (session);
+  while (tr_sessionCountTorrents (session) > 0)
+    tr_wait_msec (10);
+
+  /* ...and mustn't touch the freed torrent */
+  tr_runInEventThread (session, onEventThreadSynced, (void*)&synced);
+  while (!synced)
+    tr_wait_msec (10);
+  check (!called);
+
+  return 0;
+}
+
+/***
+****
+***/
+
+int
+main (void)
+{
+  int ret;
+  const testFunc tests[] = { test_page_out_and_in,
+                             test_stat_invalidation,
+                             test_announce_list_while_verifying,
+                             test_torrent_lookup,
+                             test_remove_while_verifying };
+
+  session = libttest_session_init (NULL);
+  ret = runTests (tests, NUM_TESTS (tests));
+  libttest_session_close (session);
+
+  return ret;
+}
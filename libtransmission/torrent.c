@@ -18,6 +18,7 @@
 #endif
 
 #include <assert.h>
+#include <ctype.h> /* isxdigit () */
 #include <math.h>
 #include <stdarg.h>
 #include <string.h> /* memcmp */
@@ -29,6 +30,7 @@
 #include "transmission.h"
 #include "announcer.h"
 #include "bandwidth.h"
+#include "bandwidth-group.h"
 #include "cache.h"
 #include "completion.h"
 #include "crypto-utils.h" /* for tr_sha1 */
@@ -36,6 +38,7 @@
 #include "fdlimit.h" /* tr_fdTorrentClose */
 #include "file.h"
 #include "inout.h" /* tr_ioTestPiece () */
+#include "list.h"
 #include "log.h"
 #include "magnet.h"
 #include "metainfo.h"
@@ -81,14 +84,183 @@ tr_torrentId (const tr_torrent * tor)
   return tor ? tor->uniqueId : -1;
 }
 
+/***
+****  Lookup tables
+****
+****  Every torrent in the session is in three open-addressed hash tables,
+****  keyed by id, by info hash, and by obfuscated hash, so that RPC and
+****  incoming handshakes don't have to walk the whole torrent list.
+****  The tables share one size since they all hold the same torrents.
+***/
+
+enum
+{
+  LOOKUP_BY_ID,
+  LOOKUP_BY_HASH,
+  LOOKUP_BY_OBFUSCATED_HASH,
+
+  LOOKUP_COUNT,
+
+  LOOKUP_MIN_SLOTS = 64
+};
+
+struct tr_torrent_lookup
+{
+  size_t count;
+  size_t mask; /* slot count - 1; slot count is a power of two */
+  tr_torrent ** slots[LOOKUP_COUNT];
+};
+
+static inline size_t
+lookupHashId (int id)
+{
+  return (size_t)((unsigned int)id * 2654435761u);
+}
+
+/* SHA1 digests are already uniformly distributed */
+static inline size_t
+lookupHashDigest (const uint8_t * digest)
+{
+  size_t h;
+  memcpy (&h, digest, sizeof (h));
+  return h;
+}
+
+static size_t
+lookupHome (const struct tr_torrent_lookup * lookup, int table, const tr_torrent * tor)
+{
+  size_t h;
+
+  switch (table)
+    {
+      case LOOKUP_BY_ID: h = lookupHashId (tor->uniqueId); break;
+      case LOOKUP_BY_HASH: h = lookupHashDigest (tor->info.hash); break;
+      default: h = lookupHashDigest (tor->obfuscatedHash); break;
+    }
+
+  return h & lookup->mask;
+}
+
+static void
+lookupInsert (struct tr_torrent_lookup * lookup, tr_torrent * tor)
+{
+  int t;
+
+  for (t=0; t<LOOKUP_COUNT; ++t)
+    {
+      tr_torrent ** slots = lookup->slots[t];
+      size_t i = lookupHome (lookup, t, tor);
+
+      while (slots[i] != NULL)
+        i = (i + 1) & lookup->mask;
+
+      slots[i] = tor;
+    }
+
+  ++lookup->count;
+}
+
+static void
+torrentLookupAdd (tr_session * session, tr_torrent * tor)
+{
+  struct tr_torrent_lookup * lookup = session->torrentLookup;
+
+  if (lookup == NULL)
+    {
+      lookup = session->torrentLookup = tr_new0 (struct tr_torrent_lookup, 1);
+    }
+
+  /* keep the tables at most half full */
+  if ((lookup->count + 1) * 2 > lookup->mask + 1)
+    {
+      int t;
+      size_t i;
+      size_t n = LOOKUP_MIN_SLOTS;
+      const size_t old_n = lookup->slots[0] ? lookup->mask + 1 : 0;
+      tr_torrent ** old_slots[LOOKUP_COUNT];
+
+      while (n < (lookup->count + 1) * 2)
+        n *= 2u;
+
+      for (t=0; t<LOOKUP_COUNT; ++t)
+        {
+          old_slots[t] = lookup->slots[t];
+          lookup->slots[t] = tr_new0 (tr_torrent*, n);
+        }
+      lookup->mask = n - 1;
+      lookup->count = 0;
+
+      for (i=0; i<old_n; ++i)
+        if (old_slots[0][i] != NULL)
+          lookupInsert (lookup, old_slots[0][i]);
+
+      for (t=0; t<LOOKUP_COUNT; ++t)
+        tr_free (old_slots[t]);
+    }
+
+  lookupInsert (lookup, tor);
+}
+
+static void
+torrentLookupRemove (tr_session * session, tr_torrent * tor)
+{
+  int t;
+  struct tr_torrent_lookup * lookup = session->torrentLookup;
+
+  assert (lookup != NULL);
+
+  for (t=0; t<LOOKUP_COUNT; ++t)
+    {
+      size_t i;
+      size_t j;
+      tr_torrent ** slots = lookup->slots[t];
+
+      for (i=lookupHome (lookup, t, tor); slots[i]!=tor; i=(i+1)&lookup->mask)
+        assert (slots[i] != NULL);
+
+      /* empty tor's slot, then backward-shift the rest of its probe run
+       * so that no later torrent is cut off from its home slot */
+      slots[i] = NULL;
+      for (j=(i+1)&lookup->mask; slots[j]!=NULL; j=(j+1)&lookup->mask)
+        {
+          const size_t home = lookupHome (lookup, t, slots[j]);
+
+          /* can the entry at j move back to i? only if its home isn't in (i, j] */
+          if (((j - home) & lookup->mask) >= ((j - i) & lookup->mask))
+            {
+              slots[i] = slots[j];
+              slots[j] = NULL;
+              i = j;
+            }
+        }
+    }
+
+  /* the session closes its torrents before it goes away,
+   * so freeing the tables when they're empty keeps them from leaking */
+  if (--lookup->count == 0)
+    {
+      for (t=0; t<LOOKUP_COUNT; ++t)
+        tr_free (lookup->slots[t]);
+      tr_free (lookup);
+      session->torrentLookup = NULL;
+    }
+}
+
 tr_torrent*
 tr_torrentFindFromId (tr_session * session, int id)
 {
-  tr_torrent * tor = NULL;
+  size_t i;
+  tr_torrent * tor;
+  const struct tr_torrent_lookup * lookup = session->torrentLookup;
+
+  if (lookup != NULL)
+    {
+      tr_torrent ** slots = lookup->slots[LOOKUP_BY_ID];
 
-  while ((tor = tr_torrentNext (session, tor)))
-    if (tor->uniqueId == id)
-      return tor;
+      for (i=lookupHashId (id) & lookup->mask; (tor = slots[i]); i=(i+1)&lookup->mask)
+        if (tor->uniqueId == id)
+          return tor;
+    }
 
   return NULL;
 }
@@ -96,24 +268,35 @@ tr_torrentFindFromId (tr_session * session, int id)
 tr_torrent*
 tr_torrentFindFromHashString (tr_session *  session, const char * str)
 {
-  tr_torrent * tor = NULL;
+  size_t i;
+  uint8_t hash[SHA_DIGEST_LENGTH];
 
-  while ((tor = tr_torrentNext (session, tor)))
-    if (!evutil_ascii_strcasecmp (str, tor->info.hashString))
-      return tor;
+  for (i=0; i<SHA_DIGEST_LENGTH*2; ++i)
+    if (!isxdigit ((unsigned char) str[i]))
+      return NULL;
 
-  return NULL;
+  if (str[i] != '\0')
+    return NULL;
+
+  tr_hex_to_sha1 (hash, str);
+  return tr_torrentFindFromHash (session, hash);
 }
 
 tr_torrent*
 tr_torrentFindFromHash (tr_session * session, const uint8_t * torrentHash)
 {
-  tr_torrent * tor = NULL;
+  size_t i;
+  tr_torrent * tor;
+  const struct tr_torrent_lookup * lookup = session->torrentLookup;
+
+  if (lookup != NULL)
+    {
+      tr_torrent ** slots = lookup->slots[LOOKUP_BY_HASH];
 
-  while ((tor = tr_torrentNext (session, tor)))
-    if (*tor->info.hash == *torrentHash)
-      if (memcmp (tor->info.hash, torrentHash, SHA_DIGEST_LENGTH) == 0)
-        return tor;
+      for (i=lookupHashDigest (torrentHash) & lookup->mask; (tor = slots[i]); i=(i+1)&lookup->mask)
+        if (memcmp (tor->info.hash, torrentHash, SHA_DIGEST_LENGTH) == 0)
+          return tor;
+    }
 
   return NULL;
 }
@@ -137,11 +320,18 @@ tr_torrent*
 tr_torrentFindFromObfuscatedHash (tr_session * session,
                                   const uint8_t * obfuscatedTorrentHash)
 {
-  tr_torrent * tor = NULL;
+  size_t i;
+  tr_torrent * tor;
+  const struct tr_torrent_lookup * lookup = session->torrentLookup;
+
+  if (lookup != NULL)
+    {
+      tr_torrent ** slots = lookup->slots[LOOKUP_BY_OBFUSCATED_HASH];
 
-  while ((tor = tr_torrentNext (session, tor)))
-    if (memcmp (tor->obfuscatedHash, obfuscatedTorrentHash, SHA_DIGEST_LENGTH) == 0)
-      return tor;
+      for (i=lookupHashDigest (obfuscatedTorrentHash) & lookup->mask; (tor = slots[i]); i=(i+1)&lookup->mask)
+        if (memcmp (tor->obfuscatedHash, obfuscatedTorrentHash, SHA_DIGEST_LENGTH) == 0)
+          return tor;
+    }
 
   return NULL;
 }
@@ -289,6 +479,40 @@ tr_torrentUsesSessionLimits (const tr_torrent * tor)
   return tr_bandwidthAreParentLimitsHonored (&tor->bandwidth, TR_UP);
 }
 
+void
+tr_torrentSetBandwidthGroup (tr_torrent * tor, const char * group)
+{
+  tr_bandwidth * parent;
+
+  assert (tr_isTorrent (tor));
+
+  if (group != NULL && *group == '\0')
+    group = NULL;
+
+  if (!tr_strcmp0 (group, tor->bandwidthGroup))
+    return;
+
+  if (group == NULL)
+    parent = &tor->session->bandwidth;
+  else
+    parent = &tr_bandwidthGroupGet (tor->session, group)->bandwidth;
+
+  tr_bandwidthSetParent (&tor->bandwidth, parent);
+
+  tr_free (tor->bandwidthGroup);
+  tor->bandwidthGroup = tr_strdup (group);
+
+  tr_torrentSetDirty (tor);
+}
+
+const char *
+tr_torrentGetBandwidthGroup (const tr_torrent * tor)
+{
+  assert (tr_isTorrent (tor));
+
+  return tor->bandwidthGroup;
+}
+
 /***
 ****
 ***/
@@ -533,6 +757,7 @@ tr_torrentSetLocalError (tr_torrent * tor, const char * fmt, ...)
   tor->errorTracker[0] = '\0';
   evutil_vsnprintf (tor->errorString, sizeof (tor->errorString), fmt, ap);
   va_end (ap);
+  tr_torrentMarkChanged (tor, TR_FIELDS_STATS);
 
   tr_logAddTorErr (tor, "%s", tor->errorString);
 
@@ -727,7 +952,7 @@ tr_torrentInitFilePieces (tr_torrent * tor)
 #endif
 
   for (p=0; p<inf->pieceCount; ++p)
-    inf->pieces[p].priority = calculatePiecePriority (tor, p, firstFiles[p]);
+    tor->piecePriority[p] = calculatePiecePriority (tor, p, firstFiles[p]);
 
   tr_free (firstFiles);
 }
@@ -754,6 +979,9 @@ tr_getBlockSize (uint32_t pieceSize)
 }
 
 static void refreshCurrentDir (tr_torrent * tor);
+static void mapPieceHashes (tr_torrent * tor);
+static void unmapPieceHashes (tr_torrent * tor, bool keepHashes);
+static void savePendingMetainfo (tr_torrent * tor);
 
 static void
 torrentInitFromInfo (tr_torrent * tor)
@@ -761,6 +989,9 @@ torrentInitFromInfo (tr_torrent * tor)
   uint64_t t;
   tr_info * info = &tor->info;
 
+  /* the sections saved for the old metainfo don't fit the new one */
+  tr_resumeFreeCache (tor);
+
   tor->blockSize = tr_getBlockSize (info->pieceSize);
 
   if (info->pieceSize)
@@ -805,6 +1036,14 @@ torrentInitFromInfo (tr_torrent * tor)
 
   tr_cpConstruct (&tor->completion, tor);
 
+  /* pieces start out unchecked, wanted, and at normal priority */
+  tr_free (tor->pieceTimeChecked);
+  tr_free (tor->piecePriority);
+  tr_free (tor->pieceDND);
+  tor->pieceTimeChecked = tr_new0 (time_t, info->pieceCount);
+  tor->piecePriority = tr_new0 (int8_t, info->pieceCount);
+  tor->pieceDND = tr_new0 (int8_t, info->pieceCount);
+
   tr_torrentInitFilePieces (tor);
 
   tor->completeness = tr_cpGetStatus (&tor->completion);
@@ -816,6 +1055,9 @@ void
 tr_torrentGotNewInfoDict (tr_torrent * tor)
 {
   torrentInitFromInfo (tor);
+  mapPieceHashes (tor);
+
+  tr_torrentMarkChanged (tor, TR_FIELDS_INFO);
 
   tr_peerMgrOnTorrentGotMetainfo (tor);
 
@@ -834,11 +1076,22 @@ hasAnyLocalData (const tr_torrent * tor)
   return false;
 }
 
+static void
+forgetDataFingerprint (tr_torrent * tor)
+{
+  tor->localDataUnchecked = false;
+  tr_free (tor->dataFingerprint.dir);
+  memset (&tor->dataFingerprint, 0, sizeof (tr_data_fingerprint));
+}
+
 static bool
 setLocalErrorIfFilesDisappeared (tr_torrent * tor)
 {
   const bool disappeared = (tr_torrentHaveTotal (tor) > 0) && !hasAnyLocalData (tor);
 
+  /* once the files have been checked, the startup fingerprint is moot */
+  forgetDataFingerprint (tor);
+
   if (disappeared)
     {
       tr_deeplog_tor (tor, "%s", "[LAZY] uh oh, the files disappeared");
@@ -848,13 +1101,104 @@ setLocalErrorIfFilesDisappeared (tr_torrent * tor)
   return disappeared;
 }
 
+bool
+tr_torrentCheckLocalData (tr_torrent * tor)
+{
+  assert (tr_isTorrent (tor));
+
+  return !tor->localDataUnchecked || !setLocalErrorIfFilesDisappeared (tor);
+}
+
+/* gets the mtime of the torrent's top-level file or folder in `dir' */
+static bool
+getTopMtime (const tr_torrent * tor, const char * dir, time_t * setme)
+{
+  bool ok;
+  char * top;
+  char * path;
+  tr_sys_path_info info;
+  const char * name = tor->info.files[0].name;
+  const char * slash = strchr (name, '/');
+
+  top = slash != NULL ? tr_strndup (name, slash - name) : tr_strdup (name);
+  path = tr_buildPath (dir, top, NULL);
+
+  if ((ok = tr_sys_path_get_info (path, 0, &info, NULL)))
+    *setme = info.last_modified_at;
+
+  tr_free (path);
+  tr_free (top);
+  return ok;
+}
+
+bool
+tr_torrentGetDataFingerprint (tr_torrent * tor, tr_data_fingerprint * setme)
+{
+  assert (tr_isTorrent (tor));
+
+  /* still unchecked, so the loaded fingerprint is as good as it gets */
+  if (tor->localDataUnchecked)
+    {
+      if (tr_strcmp0 (tor->dataFingerprint.dir, tor->currentDir) != 0)
+        return false;
+
+      *setme = tor->dataFingerprint;
+      setme->dir = tr_strdup (tor->dataFingerprint.dir);
+      return true;
+    }
+
+  if ((tor->error == TR_STAT_LOCAL_ERROR)
+      || (tor->currentDir == NULL)
+      || !tr_torrentHasMetadata (tor)
+      || (tor->info.fileCount == 0)
+      || (tr_torrentHaveTotal (tor) == 0)
+      || !getTopMtime (tor, tor->currentDir, &setme->mtime))
+    return false;
+
+  setme->dir = tr_strdup (tor->currentDir);
+  return true;
+}
+
+/* Skips the per-file search for local data at startup if the torrent's
+ * top-level file or folder hasn't changed since the fingerprint was saved.
+ * The search is done later, when the data's first read or written or when
+ * it's verified. With huge torrents, that's a lot of stat () calls saved. */
+static bool
+useDataFingerprint (tr_torrent * tor)
+{
+  time_t mtime;
+  const char * dir = NULL;
+  const tr_data_fingerprint * fp = &tor->dataFingerprint;
+
+  if (fp->dir == NULL)
+    return false;
+
+  if (!tr_strcmp0 (fp->dir, tor->downloadDir))
+    dir = tor->downloadDir;
+  else if (!tr_strcmp0 (fp->dir, tor->incompleteDir))
+    dir = tor->incompleteDir;
+
+  if ((dir == NULL) || !getTopMtime (tor, dir, &mtime) || (mtime != fp->mtime))
+    return false;
+
+  tr_deeplog_tor (tor, "%s", "local data fingerprint matches; skipping the check for missing files");
+  tor->currentDir = dir;
+  tor->localDataUnchecked = true;
+  return true;
+}
+
+/* if isResumePreloaded is true, `resume' is the already-read .resume
+ * file, or NULL if there wasn't one. see tr_torrentReadResume () */
 static void
-torrentInit (tr_torrent * tor, const tr_ctor * ctor)
+torrentInit (tr_torrent * tor, const tr_ctor * ctor, bool isResumePreloaded, tr_variant * resume)
 {
+  int i;
   bool doStart;
+  bool searched;
   uint64_t loaded;
   const char * dir;
   bool isNewTorrent;
+  tr_data_fingerprint fingerprint;
   tr_session * session = tr_ctorGetSession (ctor);
   static int nextUniqueId = 1;
 
@@ -866,11 +1210,15 @@ torrentInit (tr_torrent * tor, const tr_ctor * ctor)
   tor->uniqueId = nextUniqueId++;
   tor->magicNumber = TORRENT_MAGIC_NUMBER;
   tor->queuePosition = session->torrentCount;
+  tor->infoUsedAt = tr_time ();
 
   tr_sha1 (tor->obfuscatedHash, "req2", 4,
            tor->info.hash, SHA_DIGEST_LENGTH,
            NULL);
 
+  for (i=0; i<TR_FIELDS_COUNT; ++i)
+    tr_torrentMarkChanged (tor, i);
+
   if (tr_ctorGetDownloadDir (ctor, TR_FORCE, &dir) ||
       tr_ctorGetDownloadDir (ctor, TR_FALLBACK, &dir))
     tor->downloadDir = tr_strdup (dir);
@@ -897,14 +1245,27 @@ torrentInit (tr_torrent * tor, const tr_ctor * ctor)
                                                overwritten by the resume file */
 
   torrentInitFromInfo (tor);
-  loaded = tr_torrentLoadResume (tor, ~0, ctor);
+  if (isResumePreloaded)
+    loaded = tr_torrentLoadPreloadedResume (tor, ~0, ctor, resume);
+  else
+    loaded = tr_torrentLoadResume (tor, ~0, ctor);
   tor->completeness = tr_cpGetStatus (&tor->completion);
-  setLocalErrorIfFilesDisappeared (tor);
+
+  searched = !useDataFingerprint (tor) && !setLocalErrorIfFilesDisappeared (tor);
 
   tr_ctorInitTorrentPriorities (ctor, tor);
   tr_ctorInitTorrentWanted (ctor, tor);
 
-  refreshCurrentDir (tor);
+  if (!tor->localDataUnchecked)
+    refreshCurrentDir (tor);
+
+  /* if the files had to be searched for, save a fingerprint for next time.
+   * some torrents can't have one, e.g. a single file still named .part */
+  if (searched && tr_torrentGetDataFingerprint (tor, &fingerprint))
+    {
+      tr_free (fingerprint.dir);
+      tr_torrentSetDirty (tor);
+    }
 
   doStart = tor->isRunning;
   tor->isRunning = false;
@@ -943,6 +1304,7 @@ torrentInit (tr_torrent * tor, const tr_ctor * ctor)
         it = it->next;
       it->next = tor;
     }
+  torrentLookupAdd (session, tor);
 
   /* if we don't have a local .torrent file already, assume the torrent is new */
   isNewTorrent = !tr_sys_path_exists (tor->info.torrent, NULL);
@@ -961,6 +1323,8 @@ torrentInit (tr_torrent * tor, const tr_ctor * ctor)
         }
     }
 
+  mapPieceHashes (tor);
+
   tor->tiers = tr_announcerAddTorrent (tor, onTrackerResponse, NULL);
 
   if (isNewTorrent)
@@ -977,56 +1341,84 @@ torrentInit (tr_torrent * tor, const tr_ctor * ctor)
 }
 
 static tr_parse_result
-torrentParseImpl (const tr_ctor  * ctor,
-                  tr_info        * setmeInfo,
-                  bool           * setmeHasInfo,
-                  size_t         * dictLength,
-                  int            * setme_duplicate_id)
+parseMetainfo (const tr_ctor  * ctor,
+               tr_info        * setmeInfo,
+               bool           * setmeHasInfo,
+               size_t         * dictLength)
 {
-  bool doFree;
   bool didParse;
-  bool hasInfo = false;
-  tr_info tmp;
   const tr_variant * metainfo;
   tr_session * session = tr_ctorGetSession (ctor);
-  tr_parse_result result = TR_PARSE_OK;
 
-  if (setmeInfo == NULL)
-    setmeInfo = &tmp;
   memset (setmeInfo, 0, sizeof (tr_info));
+  *setmeHasInfo = false;
 
   if (!tr_ctorGetMetainfo (ctor, &metainfo))
     return TR_PARSE_ERR;
 
   didParse = tr_metainfoParse (session, metainfo, setmeInfo,
-                               &hasInfo, dictLength);
-  doFree = didParse && (setmeInfo == &tmp);
+                               setmeHasInfo, dictLength);
 
   if (!didParse)
-    result = TR_PARSE_ERR;
-
-  if (didParse && hasInfo && !tr_getBlockSize (setmeInfo->pieceSize))
-    result = TR_PARSE_ERR;
+    return TR_PARSE_ERR;
 
-  if (didParse && session && (result == TR_PARSE_OK))
+  if (*setmeHasInfo && !tr_getBlockSize (setmeInfo->pieceSize))
     {
-      const tr_torrent * const tor = tr_torrentFindFromHash (session, setmeInfo->hash);
+      tr_metainfoFree (setmeInfo);
+      return TR_PARSE_ERR;
+    }
 
-      if (tor != NULL)
-        {
-          result = TR_PARSE_DUPLICATE;
+  return TR_PARSE_OK;
+}
 
-          if (setme_duplicate_id != NULL)
-            *setme_duplicate_id = tr_torrentId (tor);
-        }
-    }
+static tr_parse_result
+checkDuplicate (const tr_session * session,
+                const tr_info    * info,
+                int              * setme_duplicate_id)
+{
+  const tr_torrent * tor;
+
+  if (session == NULL)
+    return TR_PARSE_OK;
+
+  if ((tor = tr_torrentFindFromHash ((tr_session *) session, info->hash)) == NULL)
+    return TR_PARSE_OK;
+
+  if (setme_duplicate_id != NULL)
+    *setme_duplicate_id = tr_torrentId (tor);
+
+  return TR_PARSE_DUPLICATE;
+}
+
+static tr_parse_result
+torrentParseImpl (const tr_ctor  * ctor,
+                  tr_info        * setmeInfo,
+                  bool           * setmeHasInfo,
+                  size_t         * dictLength,
+                  int            * setme_duplicate_id)
+{
+  tr_info tmp;
+  bool hasInfo;
+  size_t len = 0;
+  tr_parse_result result;
+
+  if (setmeInfo == NULL)
+    setmeInfo = &tmp;
+
+  result = parseMetainfo (ctor, setmeInfo, &hasInfo, &len);
+
+  if (result == TR_PARSE_OK)
+    result = checkDuplicate (tr_ctorGetSession (ctor), setmeInfo, setme_duplicate_id);
 
-  if (doFree)
+  if (result != TR_PARSE_ERR && setmeInfo == &tmp)
     tr_metainfoFree (setmeInfo);
 
   if (setmeHasInfo != NULL)
     *setmeHasInfo = hasInfo;
 
+  if (dictLength != NULL)
+    *dictLength = len;
+
   return result;
 }
 
@@ -1036,6 +1428,25 @@ tr_torrentParse (const tr_ctor * ctor, tr_info * setmeInfo)
   return torrentParseImpl (ctor, setmeInfo, NULL, NULL, NULL);
 }
 
+static tr_torrent *
+torrentNewImpl (const tr_ctor * ctor,
+                tr_info       * info,
+                bool            hasInfo,
+                size_t          infoDictLength,
+                bool            isResumePreloaded,
+                tr_variant    * resume)
+{
+  tr_torrent * tor = tr_new0 (tr_torrent, 1);
+
+  tor->info = *info;
+
+  if (hasInfo)
+    tor->infoDictLength = infoDictLength;
+
+  torrentInit (tor, ctor, isResumePreloaded, resume);
+  return tor;
+}
+
 tr_torrent *
 tr_torrentNew (const tr_ctor * ctor, int * setme_error, int * setme_duplicate_id)
 {
@@ -1051,13 +1462,7 @@ tr_torrentNew (const tr_ctor * ctor, int * setme_error, int * setme_duplicate_id
   r = torrentParseImpl (ctor, &tmpInfo, &hasInfo, &len, setme_duplicate_id);
   if (r == TR_PARSE_OK)
     {
-      tor = tr_new0 (tr_torrent, 1);
-      tor->info = tmpInfo;
-
-      if (hasInfo)
-        tor->infoDictLength = len;
-
-      torrentInit (tor, ctor);
+      tor = torrentNewImpl (ctor, &tmpInfo, hasInfo, len, false, NULL);
     }
   else
     {
@@ -1071,6 +1476,39 @@ tr_torrentNew (const tr_ctor * ctor, int * setme_error, int * setme_duplicate_id
   return tor;
 }
 
+tr_parse_result
+tr_torrentParseMetainfo (const tr_ctor * ctor,
+                         tr_info       * setmeInfo,
+                         bool          * setmeHasInfo,
+                         size_t        * setmeInfoDictLength)
+{
+  return parseMetainfo (ctor, setmeInfo, setmeHasInfo, setmeInfoDictLength);
+}
+
+tr_torrent *
+tr_torrentNewParsed (const tr_ctor * ctor,
+                     tr_info       * info,
+                     bool            hasInfo,
+                     size_t          infoDictLength,
+                     tr_variant    * resume,
+                     int           * setme_error)
+{
+  tr_parse_result r;
+  tr_session * session = tr_ctorGetSession (ctor);
+
+  assert (tr_isSession (session));
+  assert (tr_amInEventThread (session));
+
+  r = checkDuplicate (session, info, NULL);
+  if (r == TR_PARSE_OK)
+    return torrentNewImpl (ctor, info, hasInfo, infoDictLength, true, resume);
+
+  tr_metainfoFree (info);
+  if (setme_error != NULL)
+    *setme_error = r;
+  return NULL;
+}
+
 /**
 ***
 **/
@@ -1146,7 +1584,30 @@ tr_torrentCanManualUpdate (const tr_torrent * tor)
 const tr_info *
 tr_torrentInfo (const tr_torrent * tor)
 {
-  return tr_isTorrent (tor) ? &tor->info : NULL;
+  if (!tr_isTorrent (tor))
+    return NULL;
+
+  /* callers can look at any part of it, so the tables need to be there,
+   * and since they can keep the pointer, they need to stay there */
+  tr_torrentPageIn ((tr_torrent*)tor);
+  ((tr_torrent*)tor)->infoIsShared = true;
+  return &tor->info;
+}
+
+char *
+tr_torrentGetMagnetLink (const tr_torrent * tor)
+{
+  if (!tr_isTorrent (tor) || !tr_torrentPageIn ((tr_torrent*)tor))
+    return NULL;
+
+  return tr_torrentInfoGetMagnetLink (&tor->info);
+}
+
+bool
+tr_torrentHasMetadata (const tr_torrent * tor)
+{
+  /* fileCount is kept when the file table is paged out */
+  return tor->info.fileCount > 0;
 }
 
 const tr_stat *
@@ -1154,7 +1615,7 @@ tr_torrentStatCached (tr_torrent * tor)
 {
   const time_t now = tr_time ();
 
-  return tr_isTorrent (tor) && (now == tor->lastStatTime)
+  return tr_isTorrent (tor) && (now == tor->lastStatTime) && !tor->staleStats
        ? &tor->stats
        : tr_torrentStat (tor);
 }
@@ -1167,6 +1628,7 @@ tr_torrentSetVerifyState (tr_torrent * tor, tr_verify_state state)
 
   tor->verifyState = state;
   tor->anyDate = tr_time ();
+  tr_torrentMarkChanged (tor, TR_FIELDS_STATS);
 }
 
 tr_torrent_activity
@@ -1232,7 +1694,7 @@ getVerifyProgress (const tr_torrent * tor)
       tr_piece_index_t checked = 0;
 
       for (i=0, n=tor->info.pieceCount; i!=n; ++i)
-        if (tor->info.pieces[i].timeChecked)
+        if (tor->pieceTimeChecked[i])
           ++checked;
 
       d = checked / (double)tor->info.pieceCount;
@@ -1245,11 +1707,14 @@ const tr_stat *
 tr_torrentStat (tr_torrent * tor)
 {
   tr_stat * s;
+  int stale;
+  tr_torrent_activity activity;
   uint64_t seedRatioBytesLeft;
   uint64_t seedRatioBytesGoal;
   bool seedRatioApplies;
   uint16_t seedIdleMinutes;
   const uint64_t now = tr_time_msec ();
+  const time_t now_sec = tr_time ();
   unsigned int pieceUploadSpeed_Bps;
   unsigned int pieceDownloadSpeed_Bps;
   struct tr_swarm_stats swarm_stats;
@@ -1257,42 +1722,42 @@ tr_torrentStat (tr_torrent * tor)
 
   assert (tr_isTorrent (tor));
 
-  tor->lastStatTime = tr_time ();
+  s = &tor->stats;
+  stale = tor->staleStats;
+  tor->staleStats = 0;
 
-  if (tor->swarm != NULL)
-    tr_swarmGetStats (tor->swarm, &swarm_stats);
-  else
-    swarm_stats = TR_SWARM_STATS_INIT;
+  /* peers and speeds drift with the clock rather than with any one event,
+   * so refresh them once a second while they might be changing */
+  if (now_sec != tor->lastStatTime)
+    {
+      if (tor->isRunning)
+        stale |= TR_STAT_SWARM | TR_STAT_RATES;
+      else if (tor->anyDate + HISTORY_MSEC / 1000 + 1 >= now_sec)
+        stale |= TR_STAT_RATES;
+    }
 
-  s = &tor->stats;
+  activity = tr_torrentGetActivity (tor);
+  if (activity != s->activity)
+    stale = TR_STAT_ALL;
+
+  /* each group uses some of the ones before it */
+  if (stale & TR_STAT_PROGRESS)
+    stale |= TR_STAT_SWARM;
+  if (stale & TR_STAT_SWARM)
+    stale |= TR_STAT_RATES;
+
+  tor->lastStatTime = now_sec;
+
+  /* these are cheap enough to copy every time */
   s->id = tor->uniqueId;
-  s->activity = tr_torrentGetActivity (tor);
+  s->activity = activity;
   s->error = tor->error;
   s->queuePosition = tor->queuePosition;
   s->isStalled = tr_torrentIsStalled (tor);
-  tr_strlcpy (s->errorString, tor->errorString, sizeof (s->errorString));
-
-  s->manualAnnounceTime = tr_announcerNextManualAnnounce (tor);
-  s->peersConnected      = swarm_stats.peerCount;
-  s->peersSendingToUs    = swarm_stats.activePeerCount[TR_DOWN];
-  s->peersGettingFromUs  = swarm_stats.activePeerCount[TR_UP];
-  s->webseedsSendingToUs = swarm_stats.activeWebseedCount;
-  for (i=0; i<TR_PEER_FROM__MAX; i++)
-    s->peersFrom[i] = swarm_stats.peerFromCount[i];
+  if ((s->error != TR_STAT_OK) || (*s->errorString != '\0'))
+    tr_strlcpy (s->errorString, tor->errorString, sizeof (s->errorString));
 
-  s->rawUploadSpeed_KBps     = toSpeedKBps (tr_bandwidthGetRawSpeed_Bps (&tor->bandwidth, now, TR_UP));
-  s->rawDownloadSpeed_KBps   = toSpeedKBps (tr_bandwidthGetRawSpeed_Bps (&tor->bandwidth, now, TR_DOWN));
-  pieceUploadSpeed_Bps       = tr_bandwidthGetPieceSpeed_Bps (&tor->bandwidth, now, TR_UP);
-  pieceDownloadSpeed_Bps     = tr_bandwidthGetPieceSpeed_Bps (&tor->bandwidth, now, TR_DOWN);
-  s->pieceUploadSpeed_KBps   = toSpeedKBps (pieceUploadSpeed_Bps);
-  s->pieceDownloadSpeed_KBps = toSpeedKBps (pieceDownloadSpeed_Bps);
-
-  s->percentComplete = tr_cpPercentComplete (&tor->completion);
   s->metadataPercentComplete = tr_torrentGetMetadataPercent (tor);
-
-  s->percentDone         = tr_cpPercentDone (&tor->completion);
-  s->leftUntilDone       = tr_torrentGetLeftUntilDone (tor);
-  s->sizeWhenDone        = tr_cpSizeWhenDone (&tor->completion);
   s->recheckProgress     = s->activity == TR_STATUS_CHECK ? getVerifyProgress (tor) : 0;
   s->activityDate        = tor->activityDate;
   s->addedDate           = tor->addedDate;
@@ -1305,13 +1770,54 @@ tr_torrentStat (tr_torrent * tor)
   s->corruptEver      = tor->corruptCur    + tor->corruptPrev;
   s->downloadedEver   = tor->downloadedCur + tor->downloadedPrev;
   s->uploadedEver     = tor->uploadedCur   + tor->uploadedPrev;
-  s->haveValid        = tr_cpHaveValid (&tor->completion);
-  s->haveUnchecked    = tr_torrentHaveTotal (tor) - s->haveValid;
-  s->desiredAvailable = tr_peerMgrGetDesiredAvailable (tor);
+
+  if (stale & TR_STAT_PROGRESS)
+    {
+      s->percentComplete = tr_cpPercentComplete (&tor->completion);
+      s->percentDone     = tr_cpPercentDone (&tor->completion);
+      s->leftUntilDone   = tr_torrentGetLeftUntilDone (tor);
+      s->sizeWhenDone    = tr_cpSizeWhenDone (&tor->completion);
+      s->haveValid       = tr_cpHaveValid (&tor->completion);
+      s->haveUnchecked   = tr_torrentHaveTotal (tor) - s->haveValid;
+    }
 
   s->ratio = tr_getRatio (s->uploadedEver,
                           s->downloadedEver ? s->downloadedEver : s->haveValid);
 
+  if (stale & TR_STAT_SWARM)
+    {
+      if (tor->swarm != NULL)
+        tr_swarmGetStats (tor->swarm, &swarm_stats);
+      else
+        swarm_stats = TR_SWARM_STATS_INIT;
+
+      s->peersConnected      = swarm_stats.peerCount;
+      s->peersSendingToUs    = swarm_stats.activePeerCount[TR_DOWN];
+      s->peersGettingFromUs  = swarm_stats.activePeerCount[TR_UP];
+      s->webseedsSendingToUs = swarm_stats.activeWebseedCount;
+      for (i=0; i<TR_PEER_FROM__MAX; i++)
+        s->peersFrom[i] = swarm_stats.peerFromCount[i];
+
+      s->desiredAvailable = tr_peerMgrGetDesiredAvailable (tor);
+    }
+
+  /* test some of the constraints */
+  assert (s->sizeWhenDone <= tor->info.totalSize);
+  assert (s->leftUntilDone <= s->sizeWhenDone);
+  assert (s->desiredAvailable <= s->leftUntilDone);
+
+  if (!(stale & TR_STAT_RATES))
+    return s;
+
+  s->manualAnnounceTime = tr_announcerNextManualAnnounce (tor);
+
+  s->rawUploadSpeed_KBps     = toSpeedKBps (tr_bandwidthGetRawSpeed_Bps (&tor->bandwidth, now, TR_UP));
+  s->rawDownloadSpeed_KBps   = toSpeedKBps (tr_bandwidthGetRawSpeed_Bps (&tor->bandwidth, now, TR_DOWN));
+  pieceUploadSpeed_Bps       = tr_bandwidthGetPieceSpeed_Bps (&tor->bandwidth, now, TR_UP);
+  pieceDownloadSpeed_Bps     = tr_bandwidthGetPieceSpeed_Bps (&tor->bandwidth, now, TR_DOWN);
+  s->pieceUploadSpeed_KBps   = toSpeedKBps (pieceUploadSpeed_Bps);
+  s->pieceDownloadSpeed_KBps = toSpeedKBps (pieceDownloadSpeed_Bps);
+
   seedRatioApplies = tr_torrentGetSeedRatioBytes (tor, &seedRatioBytesLeft,
                                                        &seedRatioBytesGoal);
 
@@ -1384,11 +1890,6 @@ tr_torrentStat (tr_torrent * tor)
   else
     s->seedRatioPercentDone = (double)(seedRatioBytesGoal - seedRatioBytesLeft) / seedRatioBytesGoal;
 
-  /* test some of the constraints */
-  assert (s->sizeWhenDone <= tor->info.totalSize);
-  assert (s->leftUntilDone <= s->sizeWhenDone);
-  assert (s->desiredAvailable <= s->leftUntilDone);
-
   return s;
 }
 
@@ -1441,13 +1942,17 @@ tr_torrentFiles (const tr_torrent * tor,
                  tr_file_index_t  * fileCount)
 {
   tr_file_index_t i;
-  const tr_file_index_t n = tor->info.fileCount;
-  tr_file_stat * files = tr_new0 (tr_file_stat, n);
-  tr_file_stat * walk = files;
+  tr_file_index_t n;
+  tr_file_stat * files;
+  tr_file_stat * walk;
   const bool isSeed = tor->completeness == TR_SEED;
 
   assert (tr_isTorrent (tor));
 
+  n = tr_torrentPageIn ((tr_torrent*)tor) ? tor->info.fileCount : 0;
+  files = tr_new0 (tr_file_stat, n);
+  walk = files;
+
   for (i=0; i<n; ++i, ++walk)
     {
       const uint64_t b = isSeed ? tor->info.files[i].length : countFileBytesCompleted (tor, i);
@@ -1552,6 +2057,8 @@ tr_torrentSetHasPiece (tr_torrent *     tor,
     tr_cpPieceAdd (&tor->completion, pieceIndex);
   else
     tr_cpPieceRem (&tor->completion, pieceIndex);
+
+  tr_resumeSetDirty (tor, TR_FR_PROGRESS);
 }
 
 /***
@@ -1562,6 +2069,8 @@ tr_torrentSetHasPiece (tr_torrent *     tor,
 static bool queueIsSequenced (tr_session *);
 #endif
 
+static void freePagedInfo (struct tr_paged_info *);
+
 static void
 freeTorrent (tr_torrent * tor)
 {
@@ -1579,9 +2088,16 @@ freeTorrent (tr_torrent * tor)
   tr_announcerRemoveTorrent (session->announcer, tor);
 
   tr_cpDestruct (&tor->completion);
+  tr_resumeFreeCache (tor);
+  if (tor->pagedInfo != NULL)
+    freePagedInfo (tor->pagedInfo);
+  tr_free (tor->pieceTimeChecked);
+  tr_free (tor->piecePriority);
+  tr_free (tor->pieceDND);
 
   tr_free (tor->downloadDir);
   tr_free (tor->incompleteDir);
+  tr_free (tor->dataFingerprint.dir);
 
   if (tor == session->torrentList)
     {
@@ -1595,6 +2111,7 @@ freeTorrent (tr_torrent * tor)
           break;
         }
     }
+  torrentLookupRemove (session, tor);
 
   /* decrement the torrent count */
   assert (session->torrentCount >= 1);
@@ -1613,7 +2130,10 @@ freeTorrent (tr_torrent * tor)
   assert (queueIsSequenced (session));
 
   tr_bandwidthDestruct (&tor->bandwidth);
+  tr_free (tor->bandwidthGroup);
 
+  savePendingMetainfo (tor);
+  unmapPieceHashes (tor, false);
   tr_metainfoFree (inf);
   memset (tor, ~0, sizeof (tr_torrent));
   tr_free (tor);
@@ -1689,6 +2209,9 @@ torrentShouldQueue (const tr_torrent * tor)
 static void
 torrentStart (tr_torrent * tor, bool bypass_queue)
 {
+  if (!tr_torrentPageIn (tor))
+    return;
+
   switch (tr_torrentGetActivity (tor))
     {
       case TR_STATUS_SEED:
@@ -1719,8 +2242,9 @@ torrentStart (tr_torrent * tor, bool bypass_queue)
         break;
     }
 
-  /* don't allow the torrent to be started if the files disappeared */
-  if (setLocalErrorIfFilesDisappeared (tor))
+  /* don't allow the torrent to be started if the files disappeared.
+   * if startup skipped that check, it's done on the first I/O instead */
+  if (!tor->localDataUnchecked && setLocalErrorIfFilesDisappeared (tor))
     return;
 
   /* otherwise, start it now... */
@@ -1760,10 +2284,13 @@ tr_torrentStartNow (tr_torrent * tor)
     torrentStart (tor, true);
 }
 
+/* torrents are looked up by id when these run, rather than kept by
+ * pointer, in case they were removed while this was in the queue */
 struct verify_data
 {
   bool aborted;
-  tr_torrent * tor;
+  tr_session * session;
+  int torrentId;
   tr_verify_done_func callback_func;
   void * callback_data;
 };
@@ -1772,7 +2299,18 @@ static void
 onVerifyDoneThreadFunc (void * vdata)
 {
   struct verify_data * data = vdata;
-  tr_torrent * tor = data->tor;
+  tr_torrent * tor = tr_torrentFindFromId (data->session, data->torrentId);
+
+  if (tor == NULL)
+    {
+      tr_free (data);
+      return;
+    }
+
+  tr_torrentLock (tor);
+  if (tor->verifyState == TR_VERIFY_NONE)
+    savePendingMetainfo (tor);
+  tr_torrentUnlock (tor);
 
   if (!data->aborted)
     tr_torrentRecheckCompleteness (tor);
@@ -1793,7 +2331,7 @@ static void
 onVerifyDone (tr_torrent * tor, bool aborted, void * vdata)
 {
   struct verify_data * data = vdata;
-  assert (data->tor == tor);
+  assert (data->torrentId == tor->uniqueId);
   data->aborted = aborted;
   tr_runInEventThread (tor->session, onVerifyDoneThreadFunc, data);
 }
@@ -1803,7 +2341,14 @@ verifyTorrent (void * vdata)
 {
   bool startAfter;
   struct verify_data * data = vdata;
-  tr_torrent * tor = data->tor;
+  tr_torrent * tor = tr_torrentFindFromId (data->session, data->torrentId);
+
+  if (tor == NULL)
+    {
+      tr_free (data);
+      return;
+    }
+
   tr_sessionLock (tor->session);
 
   /* if the torrent's already being verified, stop it */
@@ -1814,8 +2359,11 @@ verifyTorrent (void * vdata)
     tr_torrentStop (tor);
   tor->startAfterVerify = startAfter;
 
-  if (setLocalErrorIfFilesDisappeared (tor))
-    tor->startAfterVerify = false;
+  if (!tr_torrentPageIn (tor) || setLocalErrorIfFilesDisappeared (tor))
+    {
+      tor->startAfterVerify = false;
+      tr_free (data);
+    }
   else
     tr_verifyAdd (tor, onVerifyDone, data);
 
@@ -1830,7 +2378,8 @@ tr_torrentVerify (tr_torrent           * tor,
   struct verify_data * data;
 
   data = tr_new (struct verify_data, 1);
-  data->tor = tor;
+  data->session = tor->session;
+  data->torrentId = tor->uniqueId;
   data->aborted = false;
   data->callback_func = callback_func;
   data->callback_data = callback_data;
@@ -1849,6 +2398,345 @@ tr_torrentSave (tr_torrent * tor)
     }
 }
 
+/***
+****  Piece hashes
+***/
+
+/* Points info.pieceHashes into a read-only mapping of the .torrent file,
+ * and frees the parser's heap copy. The pages are then shared with the
+ * page cache, and the kernel can drop them when memory is tight. */
+static void
+mapPieceHashes (tr_torrent * tor)
+{
+  tr_sys_file_t fd;
+  tr_sys_path_info info;
+  tr_info * inf = &tor->info;
+  const size_t len = (size_t)inf->pieceCount * SHA_DIGEST_LENGTH;
+
+  if (tor->metainfoMap != NULL || inf->pieceHashes == NULL || inf->torrent == NULL)
+    return;
+
+  fd = tr_sys_file_open (inf->torrent, TR_SYS_FILE_READ, 0, NULL);
+  if (fd == TR_BAD_SYS_FILE)
+    return;
+
+  if (tr_sys_file_get_info (fd, &info, NULL) && info.size > len)
+    {
+      const char * map = tr_sys_file_map_for_reading (fd, 0, info.size, NULL);
+
+      if (map != NULL)
+        {
+          char key[32];
+          const char * walk = map;
+          const char * end = map + info.size;
+          const uint8_t * found = NULL;
+          const size_t keylen = tr_snprintf (key, sizeof (key), "6:pieces%zu:", len);
+
+          /* find the pieces string, and make sure it's the one we parsed */
+          while (found == NULL && (walk = tr_memmem (walk, end - walk, key, keylen)) != NULL)
+            {
+              walk += keylen;
+              if ((size_t)(end - walk) >= len && memcmp (walk, inf->pieceHashes, len) == 0)
+                found = (const uint8_t *) walk;
+            }
+
+          if (found != NULL)
+            {
+              tr_free ((void*)inf->pieceHashes);
+              inf->pieceHashes = found;
+              tor->metainfoMap = map;
+              tor->metainfoMapSize = info.size;
+            }
+          else
+            {
+              tr_sys_file_unmap (map, info.size, NULL);
+            }
+        }
+    }
+
+  tr_sys_file_close (fd, NULL);
+}
+
+/* Unmaps the .torrent file so that it can be replaced or removed.
+ * If keepHashes is true, info.pieceHashes is moved back to the heap. */
+static void
+unmapPieceHashes (tr_torrent * tor, bool keepHashes)
+{
+  if (tor->metainfoMap != NULL)
+    {
+      tr_info * inf = &tor->info;
+      const size_t len = (size_t)inf->pieceCount * SHA_DIGEST_LENGTH;
+
+      inf->pieceHashes = keepHashes ? tr_memdup (inf->pieceHashes, len) : NULL;
+      tr_sys_file_unmap (tor->metainfoMap, tor->metainfoMapSize, NULL);
+      tor->metainfoMap = NULL;
+      tor->metainfoMapSize = 0;
+    }
+}
+
+/* Writes a .torrent file that tr_torrentSetAnnounceList () changed.
+ * The caller must make sure the torrent isn't being verified. */
+static void
+savePendingMetainfo (tr_torrent * tor)
+{
+  if (tor->pendingMetainfo != NULL)
+    {
+      /* some platforms can't replace a file that's mapped */
+      unmapPieceHashes (tor, true);
+      tr_variantToFile (tor->pendingMetainfo, TR_VARIANT_FMT_BENC, tor->info.torrent);
+      mapPieceHashes (tor);
+
+      tr_variantFree (tor->pendingMetainfo);
+      tr_free (tor->pendingMetainfo);
+      tor->pendingMetainfo = NULL;
+    }
+}
+
+/***
+****  Paging idle torrents' file and piece tables
+***/
+
+/* the parts of info.files and the per-piece state that can't be
+ * rebuilt from the .torrent, kept while the tables are freed */
+struct tr_paged_info
+{
+  int8_t * filePriorities;
+  tr_bitfield fileDND;
+  tr_bitfield pieceDND;
+
+  /* files that the user has renamed, and their new names */
+  tr_file_index_t renamedCount;
+  tr_file_index_t * renamedFiles;
+  char ** renamedNames;
+
+  /* usually every piece was checked at the same time, so this is
+   * NULL and timeChecked holds that time. piece priorities are
+   * rebuilt from the file priorities */
+  time_t * pieceTimeChecked;
+  time_t timeChecked;
+};
+
+static void
+freePagedInfo (struct tr_paged_info * paged)
+{
+  tr_file_index_t i;
+
+  for (i=0; i<paged->renamedCount; ++i)
+    tr_free (paged->renamedNames[i]);
+
+  tr_free (paged->renamedNames);
+  tr_free (paged->renamedFiles);
+  tr_free (paged->pieceTimeChecked);
+  tr_bitfieldDestruct (&paged->pieceDND);
+  tr_bitfieldDestruct (&paged->fileDND);
+  tr_free (paged->filePriorities);
+  tr_free (paged);
+}
+
+/* parse the torrent's .torrent file again, making sure it's the same torrent */
+static bool
+reparseMetainfo (const tr_torrent * tor, tr_info * setme)
+{
+  bool ok = false;
+  tr_variant metainfo;
+  const tr_info * inf = &tor->info;
+
+  memset (setme, 0, sizeof (tr_info));
+
+  if (inf->torrent != NULL && tr_variantFromFile (&metainfo, TR_VARIANT_FMT_BENC, inf->torrent, NULL))
+    {
+      ok = tr_metainfoParse (NULL, &metainfo, setme, NULL, NULL);
+      tr_variantFree (&metainfo);
+    }
+
+  if (ok && ((memcmp (setme->hash, inf->hash, SHA_DIGEST_LENGTH) != 0)
+             || (setme->fileCount != inf->fileCount)
+             || (setme->pieceCount != inf->pieceCount)
+             || (setme->pieceSize != inf->pieceSize)))
+    {
+      tr_metainfoFree (setme);
+      ok = false;
+    }
+
+  return ok;
+}
+
+bool
+tr_torrentPageIn (tr_torrent * tor)
+{
+  bool ok = true;
+
+  assert (tr_isTorrent (tor));
+
+  tor->infoUsedAt = tr_time ();
+
+  if (tor->pagedInfo == NULL)
+    return true;
+
+  tr_torrentLock (tor);
+
+  if (tor->pagedInfo != NULL)
+    {
+      tr_info tmp;
+      tr_file_index_t i;
+      tr_piece_index_t p;
+      tr_info * inf = &tor->info;
+      struct tr_paged_info * paged = tor->pagedInfo;
+
+      if (!reparseMetainfo (tor, &tmp))
+        {
+          tr_torrentSetLocalError (tor, _("Couldn't reread \"%s\""), inf->torrent);
+          ok = false;
+        }
+      else
+        {
+          /* take the tables and throw away the rest */
+          inf->files = tmp.files;
+          inf->pieceHashes = tmp.pieceHashes;
+          tmp.files = NULL;
+          tmp.fileCount = 0;
+          tmp.pieceHashes = NULL;
+          tr_metainfoFree (&tmp);
+          mapPieceHashes (tor);
+
+          for (i=0; i<inf->fileCount; ++i)
+            {
+              inf->files[i].priority = paged->filePriorities[i];
+              inf->files[i].dnd = tr_bitfieldHas (&paged->fileDND, i);
+            }
+
+          for (i=0; i<paged->renamedCount; ++i)
+            {
+              tr_file * file = &inf->files[paged->renamedFiles[i]];
+              tr_free (file->name);
+              file->name = paged->renamedNames[i];
+              file->is_renamed = true;
+              paged->renamedNames[i] = NULL;
+            }
+
+          tor->piecePriority = tr_new (int8_t, inf->pieceCount);
+          tor->pieceDND = tr_new (int8_t, inf->pieceCount);
+          for (p=0; p<inf->pieceCount; ++p)
+            tor->pieceDND[p] = tr_bitfieldHas (&paged->pieceDND, p);
+
+          if (paged->pieceTimeChecked != NULL)
+            {
+              tor->pieceTimeChecked = paged->pieceTimeChecked;
+              paged->pieceTimeChecked = NULL;
+            }
+          else
+            {
+              tor->pieceTimeChecked = tr_new (time_t, inf->pieceCount);
+              for (p=0; p<inf->pieceCount; ++p)
+                tor->pieceTimeChecked[p] = paged->timeChecked;
+            }
+
+          tr_torrentInitFilePieces (tor);
+
+          freePagedInfo (paged);
+          tor->pagedInfo = NULL;
+        }
+    }
+
+  tr_torrentUnlock (tor);
+  return ok;
+}
+
+void
+tr_torrentPageOutIfIdle (tr_torrent * tor, int idleMinutes)
+{
+  tr_info tmp;
+  tr_file_index_t i;
+  tr_piece_index_t p;
+  struct tr_paged_info * paged;
+  tr_info * inf = &tor->info;
+  const time_t now = tr_time ();
+
+  assert (tr_isTorrent (tor));
+
+  if (tor->pagedInfo != NULL || tor->infoIsShared || !tr_torrentHasMetadata (tor))
+    return;
+
+  if (tor->isRunning || tor->isStopping || tor->isDeleting || tor->isDirty
+                     || tr_torrentGetActivity (tor) != TR_STATUS_STOPPED)
+    {
+      tor->infoUsedAt = now;
+      return;
+    }
+
+  if (tor->infoUsedAt + (idleMinutes * 60) > now)
+    return;
+
+  /* don't free anything that we can't get back */
+  if (!reparseMetainfo (tor, &tmp))
+    {
+      tor->infoUsedAt = now;
+      return;
+    }
+  tr_metainfoFree (&tmp);
+
+  tr_torrentLock (tor);
+
+  /* these are cached from the tables, so make sure they're up to date */
+  tr_cpSizeWhenDone (&tor->completion);
+  tr_cpHaveValid (&tor->completion);
+  tr_resumeFreeCache (tor);
+
+  paged = tr_new0 (struct tr_paged_info, 1);
+  paged->filePriorities = tr_new (int8_t, inf->fileCount);
+  tr_bitfieldConstruct (&paged->fileDND, inf->fileCount);
+  tr_bitfieldConstruct (&paged->pieceDND, inf->pieceCount);
+
+  for (i=0; i<inf->fileCount; ++i)
+    {
+      tr_file * file = &inf->files[i];
+
+      paged->filePriorities[i] = file->priority;
+      if (file->dnd)
+        tr_bitfieldAdd (&paged->fileDND, i);
+
+      if (file->is_renamed)
+        {
+          paged->renamedFiles = tr_renew (tr_file_index_t, paged->renamedFiles, paged->renamedCount + 1);
+          paged->renamedNames = tr_renew (char*, paged->renamedNames, paged->renamedCount + 1);
+          paged->renamedFiles[paged->renamedCount] = i;
+          paged->renamedNames[paged->renamedCount] = file->name;
+          ++paged->renamedCount;
+        }
+      else
+        {
+          tr_free (file->name);
+        }
+    }
+
+  for (p=0; p<inf->pieceCount; ++p)
+    if (tor->pieceDND[p])
+      tr_bitfieldAdd (&paged->pieceDND, p);
+
+  paged->timeChecked = tor->pieceTimeChecked[0];
+  for (p=1; p<inf->pieceCount; ++p)
+    if (tor->pieceTimeChecked[p] != paged->timeChecked)
+      break;
+  if (p < inf->pieceCount)
+    paged->pieceTimeChecked = tor->pieceTimeChecked;
+  else
+    tr_free (tor->pieceTimeChecked);
+
+  tr_free (inf->files);
+  inf->files = NULL;
+  unmapPieceHashes (tor, false);
+  tr_free ((void*)inf->pieceHashes);
+  inf->pieceHashes = NULL;
+  tr_free (tor->piecePriority);
+  tr_free (tor->pieceDND);
+  tor->pieceTimeChecked = NULL;
+  tor->piecePriority = NULL;
+  tor->pieceDND = NULL;
+  tor->pagedInfo = paged;
+
+  tr_torrentUnlock (tor);
+}
+
 static void
 stopTorrent (void * vtor)
 {
@@ -1900,6 +2788,8 @@ tr_torrentStop (tr_torrent * tor)
     }
 }
 
+static void cancelLocationMove (tr_torrent *);
+
 static void
 closeTorrent (void * vtor)
 {
@@ -1908,17 +2798,27 @@ closeTorrent (void * vtor)
 
   assert (tr_isTorrent (tor));
 
-  d = tr_variantListAddDict (&tor->session->removedTorrents, 2);
+  d = tr_variantListAddDict (&tor->session->removedTorrents, 3);
   tr_variantDictAddInt (d, TR_KEY_id, tor->uniqueId);
   tr_variantDictAddInt (d, TR_KEY_date, tr_time ());
+  tr_variantDictAddInt (d, TR_KEY_revision, ++tor->session->torrentRevision);
 
   tr_logAddTorInfo (tor, "%s", _("Removing torrent"));
 
   tor->magnetVerify = false;
   stopTorrent (tor);
+  cancelLocationMove (tor);
 
   if (tor->isDeleting)
     {
+      if (tor->pendingMetainfo != NULL)
+        {
+          tr_variantFree (tor->pendingMetainfo);
+          tr_free (tor->pendingMetainfo);
+          tor->pendingMetainfo = NULL;
+        }
+
+      unmapPieceHashes (tor, false);
       tr_metainfoRemoveSaved (tor->session, &tor->info);
       tr_torrentRemoveResume (tor);
     }
@@ -2302,7 +3202,9 @@ tr_torrentInitFilePriority (tr_torrent *    tor,
   file = &tor->info.files[fileIndex];
   file->priority = priority;
   for (i=file->firstPiece; i<=file->lastPiece; ++i)
-    tor->info.pieces[i].priority = calculatePiecePriority (tor, i, fileIndex);
+    tor->piecePriority[i] = calculatePiecePriority (tor, i, fileIndex);
+
+  tr_resumeSetDirty (tor, TR_FR_FILE_PRIORITIES);
 }
 
 void
@@ -2315,11 +3217,14 @@ tr_torrentSetFilePriorities (tr_torrent             * tor,
   assert (tr_isTorrent (tor));
   tr_torrentLock (tor);
 
-  for (i=0; i<fileCount; ++i)
-    if (files[i] < tor->info.fileCount)
-      tr_torrentInitFilePriority (tor, files[i], priority);
-  tr_torrentSetDirty (tor);
-  tr_peerMgrRebuildRequests (tor);
+  if (tr_torrentPageIn (tor))
+    {
+      for (i=0; i<fileCount; ++i)
+        if (files[i] < tor->info.fileCount)
+          tr_torrentInitFilePriority (tor, files[i], priority);
+      tr_torrentSetDirty (tor);
+      tr_peerMgrRebuildRequests (tor);
+    }
 
   tr_torrentUnlock (tor);
 }
@@ -2334,8 +3239,9 @@ tr_torrentGetFilePriorities (const tr_torrent * tor)
 
   p = tr_new0 (tr_priority_t, tor->info.fileCount);
 
-  for (i=0; i<tor->info.fileCount; ++i)
-    p[i] = tor->info.files[i].priority;
+  if (tr_torrentPageIn ((tr_torrent*)tor))
+    for (i=0; i<tor->info.fileCount; ++i)
+      p[i] = tor->info.files[i].priority;
 
   return p;
 }
@@ -2344,6 +3250,16 @@ tr_torrentGetFilePriorities (const tr_torrent * tor)
 ***  File DND
 **/
 
+static void
+setPieceDND (tr_torrent * tor, tr_piece_index_t piece, int8_t dnd)
+{
+  if (tor->pieceDND[piece] != dnd)
+    {
+      tor->pieceDND[piece] = dnd;
+      tr_cpPieceDNDChanged (&tor->completion, piece);
+    }
+}
+
 static void
 setFileDND (tr_torrent * tor, tr_file_index_t fileIndex, int doDownload)
 {
@@ -2356,6 +3272,7 @@ setFileDND (tr_torrent * tor, tr_file_index_t fileIndex, int doDownload)
   tr_file * file = &tor->info.files[fileIndex];
 
   file->dnd = dnd;
+  tr_resumeSetDirty (tor, TR_FR_DND);
   firstPiece = file->firstPiece;
   lastPiece = file->lastPiece;
 
@@ -2387,15 +3304,15 @@ setFileDND (tr_torrent * tor, tr_file_index_t fileIndex, int doDownload)
 
   if (firstPiece == lastPiece)
     {
-      tor->info.pieces[firstPiece].dnd = firstPieceDND && lastPieceDND;
+      setPieceDND (tor, firstPiece, firstPieceDND && lastPieceDND);
     }
   else
     {
       tr_piece_index_t pp;
-      tor->info.pieces[firstPiece].dnd = firstPieceDND;
-      tor->info.pieces[lastPiece].dnd = lastPieceDND;
+      setPieceDND (tor, firstPiece, firstPieceDND);
+      setPieceDND (tor, lastPiece, lastPieceDND);
       for (pp=firstPiece+1; pp<lastPiece; ++pp)
-        tor->info.pieces[pp].dnd = dnd;
+        setPieceDND (tor, pp, dnd);
     }
 }
 
@@ -2415,8 +3332,6 @@ tr_torrentInitFileDLs (tr_torrent             * tor,
     if (files[i] < tor->info.fileCount)
       setFileDND (tor, files[i], doDownload);
 
-  tr_cpInvalidateDND (&tor->completion);
-
   tr_torrentUnlock (tor);
 }
 
@@ -2429,10 +3344,13 @@ tr_torrentSetFileDLs (tr_torrent             * tor,
   assert (tr_isTorrent (tor));
   tr_torrentLock (tor);
 
-  tr_torrentInitFileDLs (tor, files, fileCount, doDownload);
-  tr_torrentSetDirty (tor);
-  tr_torrentRecheckCompleteness (tor);
-  tr_peerMgrRebuildRequests (tor);
+  if (tr_torrentPageIn (tor))
+    {
+      tr_torrentInitFileDLs (tor, files, fileCount, doDownload);
+      tr_torrentSetDirty (tor);
+      tr_torrentRecheckCompleteness (tor);
+      tr_peerMgrRebuildRequests (tor);
+    }
 
   tr_torrentUnlock (tor);
 }
@@ -2617,7 +3535,8 @@ tr_torrentSetPieceChecked (tr_torrent * tor, tr_piece_index_t pieceIndex)
   assert (tr_isTorrent (tor));
   assert (pieceIndex < tor->info.pieceCount);
 
-  tor->info.pieces[pieceIndex].timeChecked = tr_time ();
+  tor->pieceTimeChecked[pieceIndex] = tr_time ();
+  tr_resumeSetPieceChecked (tor, pieceIndex);
 }
 
 void
@@ -2628,7 +3547,10 @@ tr_torrentSetChecked (tr_torrent * tor, time_t when)
   assert (tr_isTorrent (tor));
 
   for (i=0, n=tor->info.pieceCount; i!=n; ++i)
-    tor->info.pieces[i].timeChecked = when;
+    {
+      tor->pieceTimeChecked[i] = when;
+      tr_resumeSetPieceChecked (tor, i);
+    }
 }
 
 bool
@@ -2661,10 +3583,10 @@ tr_torrentPieceNeedsCheck (const tr_torrent * tor, tr_piece_index_t p)
 {
   uint64_t unused;
   tr_file_index_t f;
-  const tr_info * inf = tr_torrentInfo (tor);
+  const tr_info * inf = &tor->info;
 
   /* if we've never checked this piece, then it needs to be checked */
-  if (!inf->pieces[p].timeChecked)
+  if (!tor->pieceTimeChecked[p])
     return true;
 
   /* If we think we've completed one of the files in this piece,
@@ -2673,7 +3595,7 @@ tr_torrentPieceNeedsCheck (const tr_torrent * tor, tr_piece_index_t p)
   tr_ioFindFileLocation (tor, p, 0, &f, &unused);
   for (; f < inf->fileCount && pieceHasFile (p, &inf->files[f]); ++f)
     if (tr_cpFileIsComplete (&tor->completion, f))
-      if (tr_torrentGetFileMTime (tor, f) > inf->pieces[p].timeChecked)
+      if (tr_torrentGetFileMTime (tor, f) > tor->pieceTimeChecked[p])
         return true;
 
   return false;
@@ -2770,7 +3692,18 @@ tr_torrentSetAnnounceList (tr_torrent             * tor,
           tmpInfo.trackerCount = swap.trackerCount;
 
           tr_metainfoFree (&tmpInfo);
-          tr_variantToFile (&metainfo, TR_VARIANT_FMT_BENC, tor->info.torrent);
+
+          /* the verify thread reads the hashes without a lock,
+           * so don't swap them out from under it */
+          if (tor->pendingMetainfo == NULL)
+            tor->pendingMetainfo = tr_new (tr_variant, 1);
+          else
+            tr_variantFree (tor->pendingMetainfo);
+          *tor->pendingMetainfo = metainfo;
+          tr_variantInitBool (&metainfo, false);
+
+          if (tor->verifyState == TR_VERIFY_NONE)
+            savePendingMetainfo (tor);
         }
 
       /* cleanup */
@@ -2847,6 +3780,9 @@ tr_torrentGetBytesLeftToAllocate (const tr_torrent * tor)
 
   assert (tr_isTorrent (tor));
 
+  if (!tr_torrentPageIn ((tr_torrent*)tor))
+    return 0;
+
   for (i=0; i<tor->info.fileCount; ++i)
     {
       if (!tor->info.files[i].dnd)
@@ -3092,71 +4028,533 @@ tr_torrentDeleteLocalData (tr_torrent * tor, tr_fileFunc func)
   if (func == NULL)
     func = tr_sys_path_remove;
 
+  /* don't leave copies behind in the new location */
+  cancelLocationMove (tor);
+
   /* close all the files because we're about to delete them */
   tr_cacheFlushTorrent (tor->session->cache, tor);
   tr_fdTorrentClose (tor->session, tor->uniqueId);
 
-  deleteLocalData (tor, func);
+  if (tr_torrentPageIn (tor))
+    deleteLocalData (tor, func);
 }
 
 /***
 ****
 ***/
 
-struct LocationData
+/* The longest part of moving a torrent to another filesystem is copying
+ * its files. That's done by worker threads shared by all of the session's
+ * torrents, while the torrent keeps seeding from the old files; then the
+ * event thread swaps in the copies, taking the slow path again for any
+ * file that changed while it was copied. */
+
+enum
 {
-  bool move_from_old_location;
-  volatile int * setme_state;
-  volatile double * setme_progress;
-  char * location;
-  tr_torrent * tor;
+  /* how many files a session copies at once */
+  LOCATION_MOVE_MAX_THREADS = 4
 };
 
-static void
-setLocation (void * vdata)
+/* the worker threads shared by all of a session's moves */
+struct tr_location_mover
 {
-  bool err = false;
-  struct LocationData * data = vdata;
-  tr_torrent * tor = data->tor;
-  const bool do_move = data->move_from_old_location;
-  const char * location = data->location;
-  double bytesHandled = 0;
-  tr_torrentLock (tor);
+  tr_lock * lock;
 
-  assert (tr_isTorrent (tor));
+  /* the moves with files left to copy. they take turns, a file at a time */
+  tr_list * queue;
 
-  tr_logAddDebug ("Moving \"%s\" location from currentDir \"%s\" to \"%s\"",
-                  tr_torrentName (tor), tor->currentDir, location);
+  int threadCount;
+  int maxThreads;
+  bool alwaysCopy;
+};
 
-  tr_sys_dir_create (location, TR_SYS_DIR_CREATE_PARENTS, 0777, NULL);
+struct location_move_file
+{
+  tr_file_index_t index;
+  char * oldpath;
+  char * newpath;
+  bool copied;
+
+  /* what the old file looked like when it was copied */
+  uint64_t size;
+  time_t mtime;
+  time_t checkedAt;
+};
+
+struct tr_location_move
+{
+  tr_session * session;
+  int torrentId;
+  int id;
+
+  char * location;
+  volatile double * setme_progress;
+  volatile int * setme_state;
+
+  /* sorted by index */
+  struct location_move_file * files;
+  size_t fileCount;
+
+  /* the fields below are guarded by mover->lock */
+  struct tr_location_mover * mover;
+  bool queued;
+  size_t nextFile;
+  int busyFiles;
+  bool cancelled;
+  char * errorMessage;
+  uint64_t bytesDone;
+  uint64_t bytesTotal;
+};
+
+struct location_move_done
+{
+  tr_session * session;
+  int torrentId;
+  int moveId;
+};
+
+static void onLocationMoveDone (void *);
+
+static struct tr_location_mover *
+getLocationMover (tr_session * session)
+{
+  struct tr_location_mover * mover;
+
+  tr_sessionLock (session);
 
-  if (!tr_sys_path_is_same (location, tor->currentDir, NULL))
+  if ((mover = session->locationMover) == NULL)
     {
-      tr_file_index_t i;
+      mover = session->locationMover = tr_new0 (struct tr_location_mover, 1);
+      mover->lock = tr_lockNew ();
+      mover->maxThreads = LOCATION_MOVE_MAX_THREADS;
+    }
 
-      /* bad idea to move files while they're being verified... */
-      tr_verifyRemove (tor);
+  tr_sessionUnlock (session);
+  return mover;
+}
+
+static void
+dequeueLocationMove (struct tr_location_move * move)
+{
+  if (move->queued)
+    {
+      tr_list_remove_data (&move->mover->queue, move);
+      move->queued = false;
+    }
+}
+
+static bool
+onLocationMoveProgress (uint64_t bytes, void * vmove)
+{
+  bool keep_going;
+  struct tr_location_move * move = vmove;
+
+  tr_lockLock (move->mover->lock);
+
+  move->bytesDone += bytes;
+  if (move->setme_progress != NULL && move->bytesTotal > 0)
+    *move->setme_progress = (double)move->bytesDone / move->bytesTotal;
+
+  keep_going = !move->cancelled && move->errorMessage == NULL;
+
+  tr_lockUnlock (move->mover->lock);
+  return keep_going;
+}
+
+static void
+locationMoveThreadFunc (void * vmover)
+{
+  struct tr_location_mover * mover = vmover;
+
+  tr_lockLock (mover->lock);
+
+  while (mover->threadCount <= mover->maxThreads && mover->queue != NULL)
+    {
+      bool ok;
+      tr_sys_path_info info;
+      tr_error * error = NULL;
+      struct location_move_file * f;
+      struct tr_location_move * move = tr_list_pop_front (&mover->queue);
+
+      /* take the move's next file, then send it to the back of the line */
+      f = &move->files[move->nextFile++];
+      ++move->busyFiles;
+      if (move->nextFile < move->fileCount)
+        tr_list_append (&mover->queue, move);
+      else
+        move->queued = false;
+
+      tr_lockUnlock (mover->lock);
+
+      /* note what the old file looks like before copying it,
+       * so that finishLocationMove () can tell if it's changed since */
+      f->checkedAt = tr_time ();
+      ok = tr_sys_path_get_info (f->oldpath, 0, &info, &error)
+        && tr_copyFile (f->oldpath, f->newpath, onLocationMoveProgress, move, &error);
+
+      tr_lockLock (mover->lock);
+
+      --move->busyFiles;
+      if (ok)
+        {
+          f->copied = true;
+          f->size = info.size;
+          f->mtime = info.last_modified_at;
+        }
+      else if (!move->cancelled && move->errorMessage == NULL)
+        {
+          move->errorMessage = tr_strdup_printf ("error copying \"%s\" to \"%s\": %s",
+                                                 f->oldpath, f->newpath, error->message);
+          dequeueLocationMove (move);
+        }
+
+      tr_error_clear (&error);
+
+      /* the thread copying the move's last file hands it back to
+       * the libtransmission thread. a cancelled move is already gone */
+      if (!move->queued && move->busyFiles == 0 && !move->cancelled)
+        {
+          struct location_move_done * data = tr_new (struct location_move_done, 1);
+          data->session = move->session;
+          data->torrentId = move->torrentId;
+          data->moveId = move->id;
+          tr_runInEventThread (data->session, onLocationMoveDone, data);
+        }
+    }
+
+  --mover->threadCount;
+  tr_lockUnlock (mover->lock);
+}
+
+/* starts a thread for each queued file, up to the limit.
+ * the caller holds mover->lock */
+static void
+startLocationMoveThreads (struct tr_location_mover * mover)
+{
+  tr_list * l;
+  size_t fileCount = 0;
+
+  for (l=mover->queue; l!=NULL; l=l->next)
+    {
+      const struct tr_location_move * move = l->data;
+      fileCount += move->fileCount - move->nextFile;
+    }
+
+  while (fileCount-- > 0 && mover->threadCount < mover->maxThreads)
+    {
+      ++mover->threadCount;
+      tr_threadNew (locationMoveThreadFunc, mover);
+    }
+}
 
-      /* try to move the files.
-       * FIXME: there are still all kinds of nasty cases, like what
-       * if the target directory runs out of space halfway through... */
-      for (i=0; !err && i<tor->info.fileCount; ++i)
+/* removes the copies that weren't used, and the folders made for them */
+static void
+freeLocationMove (struct tr_location_move * move)
+{
+  size_t i;
+
+  for (i=0; i<move->fileCount; ++i)
+    {
+      struct location_move_file * f = &move->files[i];
+
+      if (f->copied && tr_sys_path_remove (f->newpath, NULL))
         {
-          char * sub;
-          const char * oldbase;
-          const tr_file * f = &tor->info.files[i];
+          char * dir = tr_sys_path_dirname (f->newpath, NULL);
 
-          if (tr_torrentFindFile2 (tor, i, &oldbase, &sub, NULL))
+          while (dir != NULL && !tr_sys_path_is_same (dir, move->location, NULL)
+                             && tr_sys_path_remove (dir, NULL))
             {
-              char * oldpath = tr_buildPath (oldbase, sub, NULL);
-              char * newpath = tr_buildPath (location, sub, NULL);
+              char * parent = tr_sys_path_dirname (dir, NULL);
+              tr_free (dir);
+              dir = parent;
+            }
 
-              tr_logAddDebug ("Found file #%d: %s", (int)i, oldpath);
+          tr_free (dir);
+        }
 
-              if (do_move && !tr_sys_path_is_same (oldpath, newpath, NULL))
-                {
-                  tr_error * error = NULL;
+      tr_free (f->newpath);
+      tr_free (f->oldpath);
+    }
+
+  tr_free (move->errorMessage);
+  tr_free (move->files);
+  tr_free (move->location);
+  tr_free (move);
+}
+
+static void
+cancelLocationMove (tr_torrent * tor)
+{
+  struct tr_location_move * move = tor->locationMove;
+  struct tr_location_mover * mover;
+
+  if (move == NULL)
+    return;
+
+  tor->locationMove = NULL;
+  mover = move->mover;
+
+  tr_lockLock (mover->lock);
+  move->cancelled = true;
+  dequeueLocationMove (move);
+  tr_lockUnlock (mover->lock);
+
+  /* the threads notice within one tr_copyFile () chunk */
+  for (;;)
+    {
+      bool done;
+
+      tr_lockLock (mover->lock);
+      done = move->busyFiles == 0;
+      tr_lockUnlock (mover->lock);
+
+      if (done)
+        break;
+
+      tr_wait_msec (10);
+    }
+
+  tr_logAddTorInfo (tor, "cancelled moving to \"%s\"", move->location);
+
+  if (move->setme_state != NULL)
+    *move->setme_state = TR_LOC_ERROR;
+
+  freeLocationMove (move);
+}
+
+void
+tr_locationMoverFree (tr_session * session)
+{
+  struct tr_location_mover * mover = session->locationMover;
+
+  if (mover == NULL)
+    return;
+
+  session->locationMover = NULL;
+
+  /* the torrents cancelled their moves when they were closed,
+   * so the threads are only waiting to exit */
+  assert (mover->queue == NULL);
+  for (;;)
+    {
+      bool done;
+
+      tr_lockLock (mover->lock);
+      done = mover->threadCount == 0;
+      tr_lockUnlock (mover->lock);
+
+      if (done)
+        break;
+
+      tr_wait_msec (10);
+    }
+
+  tr_lockFree (mover->lock);
+  tr_free (mover);
+}
+
+void
+tr_locationMoverSetLimits (tr_session * session, int maxThreads, bool alwaysCopy)
+{
+  struct tr_location_mover * mover = getLocationMover (session);
+
+  tr_lockLock (mover->lock);
+  mover->maxThreads = maxThreads;
+  mover->alwaysCopy = alwaysCopy;
+  startLocationMoveThreads (mover);
+  tr_lockUnlock (mover->lock);
+}
+
+int
+tr_locationMoverCountThreads (tr_session * session)
+{
+  int n;
+  struct tr_location_mover * mover = getLocationMover (session);
+
+  tr_lockLock (mover->lock);
+  n = mover->threadCount;
+  tr_lockUnlock (mover->lock);
+
+  return n;
+}
+
+/* true if files in `olddir' can be renamed into `newdir' */
+static bool
+canRenameBetween (const char * olddir, const char * newdir)
+{
+  bool ok = false;
+  char * oldpath = tr_buildPath (olddir, "transmission-move-XXXXXX", NULL);
+  const tr_sys_file_t fd = tr_sys_file_open_temp (oldpath, NULL);
+
+  if (fd != TR_BAD_SYS_FILE)
+    {
+      char * name = tr_sys_path_basename (oldpath, NULL);
+      char * newpath = tr_buildPath (newdir, name, NULL);
+
+      tr_sys_file_close (fd, NULL);
+      ok = tr_sys_path_rename (oldpath, newpath, NULL);
+      tr_sys_path_remove (ok ? newpath : oldpath, NULL);
+
+      tr_free (newpath);
+      tr_free (name);
+    }
+
+  tr_free (oldpath);
+  return ok;
+}
+
+/* queues the files that can't be renamed into `location' to be copied.
+ * returns false if there aren't any, so the move can be done right away */
+static bool
+startLocationMove (tr_torrent       * tor,
+                   const char       * location,
+                   volatile double  * setme_progress,
+                   volatile int     * setme_state)
+{
+  tr_file_index_t fi;
+  struct tr_location_move * move;
+  static int nextMoveId = 0;
+  int canRename[2] = { -1, -1 }; /* from downloadDir, incompleteDir */
+  struct tr_location_mover * mover = getLocationMover (tor->session);
+
+  move = tr_new0 (struct tr_location_move, 1);
+  move->files = tr_new0 (struct location_move_file, tor->info.fileCount);
 
+  for (fi=0; fi<tor->info.fileCount; ++fi)
+    {
+      char * sub;
+      const char * oldbase;
+
+      if (tr_torrentFindFile2 (tor, fi, &oldbase, &sub, NULL))
+        {
+          char * oldpath = tr_buildPath (oldbase, sub, NULL);
+          char * newpath = tr_buildPath (location, sub, NULL);
+          const int which = oldbase == tor->downloadDir ? 0 : 1;
+
+          if (canRename[which] < 0)
+            canRename[which] = !mover->alwaysCopy && canRenameBetween (oldbase, location);
+
+          if (!canRename[which] && !tr_sys_path_is_same (oldpath, newpath, NULL))
+            {
+              struct location_move_file * f = &move->files[move->fileCount++];
+              f->index = fi;
+              f->oldpath = oldpath;
+              f->newpath = newpath;
+              move->bytesTotal += tor->info.files[fi].length;
+              oldpath = newpath = NULL;
+            }
+
+          tr_free (newpath);
+          tr_free (oldpath);
+          tr_free (sub);
+        }
+    }
+
+  if (move->fileCount == 0)
+    {
+      freeLocationMove (move);
+      return false;
+    }
+
+  /* make sure the copies get everything that's been written so far */
+  tr_cacheFlushTorrent (tor->session->cache, tor);
+
+  move->session = tor->session;
+  move->torrentId = tor->uniqueId;
+  move->id = ++nextMoveId;
+  move->location = tr_strdup (location);
+  move->setme_progress = setme_progress;
+  move->setme_state = setme_state;
+  move->mover = mover;
+  tor->locationMove = move;
+
+  tr_logAddTorInfo (tor, "copying %zu files to \"%s\"", move->fileCount, location);
+
+  tr_lockLock (mover->lock);
+  move->queued = true;
+  tr_list_append (&mover->queue, move);
+  startLocationMoveThreads (mover);
+  tr_lockUnlock (mover->lock);
+
+  return true;
+}
+
+/* true if `f' is a copy of the file now at `oldpath' */
+static bool
+isCopyCurrent (const struct location_move_file * f,
+               const char                      * oldpath,
+               const char                      * newpath)
+{
+  tr_sys_path_info info;
+
+  /* files written to within the second they were checked
+   * may have changed without their mtime changing too */
+  return f->copied
+      && f->mtime < f->checkedAt
+      && !strcmp (f->oldpath, oldpath)
+      && !strcmp (f->newpath, newpath)
+      && tr_sys_path_get_info (oldpath, 0, &info, NULL)
+      && info.size == f->size
+      && info.last_modified_at == f->mtime;
+}
+
+static void
+forgetIncompleteDir (tr_torrent * tor)
+{
+  tr_free (tor->incompleteDir);
+  tor->incompleteDir = NULL;
+  tor->currentDir = tor->downloadDir;
+}
+
+/* moves the torrent's files into `location'. If `move' is non-NULL,
+ * its copies are used in place of the files that haven't changed since */
+static bool
+relocateFiles (tr_torrent               * tor,
+               const char               * location,
+               bool                       do_move,
+               struct tr_location_move  * move,
+               volatile double          * setme_progress)
+{
+  bool err = false;
+  tr_file_index_t i;
+  size_t next_copy = 0;
+  double bytesHandled = 0;
+
+  /* try to move the files.
+   * FIXME: there are still all kinds of nasty cases, like what
+   * if the target directory runs out of space halfway through... */
+  for (i=0; !err && i<tor->info.fileCount; ++i)
+    {
+      char * sub;
+      const char * oldbase;
+      const tr_file * f = &tor->info.files[i];
+      struct location_move_file * copy = NULL;
+
+      if (move != NULL && next_copy < move->fileCount && move->files[next_copy].index == i)
+        copy = &move->files[next_copy++];
+
+      if (tr_torrentFindFile2 (tor, i, &oldbase, &sub, NULL))
+        {
+          char * oldpath = tr_buildPath (oldbase, sub, NULL);
+          char * newpath = tr_buildPath (location, sub, NULL);
+
+          tr_logAddDebug ("Found file #%d: %s", (int)i, oldpath);
+
+          if (do_move && !tr_sys_path_is_same (oldpath, newpath, NULL))
+            {
+              tr_error * error = NULL;
+
+              if (copy != NULL && isCopyCurrent (copy, oldpath, newpath))
+                {
+                  tr_logAddTorDbg (tor, "removing \"%s\", copied to \"%s\"", oldpath, newpath);
+                  if (!tr_sys_path_remove (oldpath, &error))
+                    {
+                      tr_logAddTorErr (tor, "Unable to remove file at old path: %s", error->message);
+                      tr_error_free (error);
+                    }
+                }
+              else
+                {
                   tr_logAddTorInfo (tor, "moving \"%s\" to \"%s\"", oldpath, newpath);
                   if (!tr_moveFile (oldpath, newpath, &error))
                     {
@@ -3167,38 +4565,147 @@ setLocation (void * vdata)
                     }
                 }
 
-              tr_free (newpath);
-              tr_free (oldpath);
-              tr_free (sub);
+              /* either way, the copy is the torrent's file now */
+              if (copy != NULL && !err && !strcmp (copy->newpath, newpath))
+                copy->copied = false;
             }
 
-          if (data->setme_progress != NULL)
-            {
-              bytesHandled += f->length;
-              *data->setme_progress = bytesHandled / tor->info.totalSize;
-            }
+          tr_free (newpath);
+          tr_free (oldpath);
+          tr_free (sub);
         }
 
-      if (!err)
+      if (setme_progress != NULL)
         {
-          /* blow away the leftover subdirectories in the old location */
-          if (do_move)
-            tr_torrentDeleteLocalData (tor, tr_sys_path_remove);
-
-          /* set the new location and reverify */
-          tr_torrentSetDownloadDir (tor, location);
+          bytesHandled += f->length;
+          *setme_progress = bytesHandled / tor->info.totalSize;
         }
     }
 
-  if (!err && do_move)
+  if (!err)
+    {
+      /* blow away the leftover subdirectories in the old location */
+      if (do_move)
+        tr_torrentDeleteLocalData (tor, tr_sys_path_remove);
+
+      /* set the new location and reverify */
+      tr_torrentSetDownloadDir (tor, location);
+    }
+
+  return !err;
+}
+
+/* called in the libtransmission thread when the copies are done */
+static void
+finishLocationMove (tr_torrent * tor)
+{
+  bool err;
+  struct tr_location_move * move = tor->locationMove;
+
+  tor->locationMove = NULL;
+
+  if (move->errorMessage != NULL)
+    {
+      err = true;
+      tr_logAddTorErr (tor, "%s", move->errorMessage);
+    }
+  else if (!tr_torrentPageIn (tor))
+    {
+      err = true;
+    }
+  else
+    {
+      /* nothing can be written to the old files while they're moved */
+      tr_cacheFlushTorrent (tor->session->cache, tor);
+      tr_fdTorrentClose (tor->session, tor->uniqueId);
+      tr_verifyRemove (tor);
+
+      err = !relocateFiles (tor, move->location, true, move, NULL);
+      if (!err)
+        forgetIncompleteDir (tor);
+    }
+
+  if (!err && move->setme_progress != NULL)
+    *move->setme_progress = 1.0;
+
+  if (move->setme_state != NULL)
+    *move->setme_state = err ? TR_LOC_ERROR : TR_LOC_DONE;
+
+  freeLocationMove (move);
+}
+
+static void
+onLocationMoveDone (void * vdata)
+{
+  struct location_move_done * data = vdata;
+  tr_torrent * tor = tr_torrentFindFromId (data->session, data->torrentId);
+
+  /* the move may have been cancelled while this was queued */
+  if (tor != NULL && tor->locationMove != NULL && tor->locationMove->id == data->moveId)
     {
-      tr_free (tor->incompleteDir);
-      tor->incompleteDir = NULL;
-      tor->currentDir = tor->downloadDir;
+      tr_torrentLock (tor);
+      finishLocationMove (tor);
+      tr_torrentUnlock (tor);
     }
 
-  if (data->setme_state != NULL)
-    *data->setme_state = err ? TR_LOC_ERROR : TR_LOC_DONE;
+  tr_free (data);
+}
+
+struct LocationData
+{
+  bool move_from_old_location;
+  volatile int * setme_state;
+  volatile double * setme_progress;
+  char * location;
+  tr_torrent * tor;
+};
+
+static void
+setLocation (void * vdata)
+{
+  bool err = false;
+  bool started = false;
+  struct LocationData * data = vdata;
+  tr_torrent * tor = data->tor;
+  const bool do_move = data->move_from_old_location;
+  const char * location = data->location;
+  tr_torrentLock (tor);
+
+  assert (tr_isTorrent (tor));
+
+  /* the newest location wins */
+  cancelLocationMove (tor);
+
+  tr_logAddDebug ("Moving \"%s\" location from currentDir \"%s\" to \"%s\"",
+                  tr_torrentName (tor), tor->currentDir, location);
+
+  tr_sys_dir_create (location, TR_SYS_DIR_CREATE_PARENTS, 0777, NULL);
+
+  if (!tr_torrentPageIn (tor))
+    {
+      err = true;
+    }
+  else if (!tr_sys_path_is_same (location, tor->currentDir, NULL))
+    {
+      /* bad idea to move files while they're being verified... */
+      tr_verifyRemove (tor);
+
+      if (do_move)
+        started = startLocationMove (tor, location, data->setme_progress, data->setme_state);
+
+      if (!started)
+        err = !relocateFiles (tor, location, do_move, NULL, data->setme_progress);
+    }
+
+  /* if the files are being copied, finishLocationMove () does the rest */
+  if (!started)
+    {
+      if (!err && do_move)
+        forgetIncompleteDir (tor);
+
+      if (data->setme_state != NULL)
+        *data->setme_state = err ? TR_LOC_ERROR : TR_LOC_DONE;
+    }
 
   /* cleanup */
   tr_torrentUnlock (tor);
@@ -3233,6 +4740,24 @@ tr_torrentSetLocation (tr_torrent       * tor,
   tr_runInEventThread (tor->session, setLocation, data);
 }
 
+static void
+cancelSetLocation (void * vtor)
+{
+  tr_torrent * tor = vtor;
+
+  tr_torrentLock (tor);
+  cancelLocationMove (tor);
+  tr_torrentUnlock (tor);
+}
+
+void
+tr_torrentCancelSetLocation (tr_torrent * tor)
+{
+  assert (tr_isTorrent (tor));
+
+  tr_runInEventThread (tor->session, cancelSetLocation, tor);
+}
+
 /***
 ****
 ***/
@@ -3244,8 +4769,7 @@ tr_torrentFileCompleted (tr_torrent * tor, tr_file_index_t fileIndex)
   const char * base;
   const tr_info * inf = &tor->info;
   const tr_file * f = &inf->files[fileIndex];
-  tr_piece * p;
-  const tr_piece * pend;
+  tr_piece_index_t p;
   const time_t now = tr_time ();
 
   /* close the file so that we can reopen in read-only mode as needed */
@@ -3254,8 +4778,11 @@ tr_torrentFileCompleted (tr_torrent * tor, tr_file_index_t fileIndex)
 
   /* now that the file is complete and closed, we can start watching its
    * mtime timestamp for changes to know if we need to reverify pieces */
-  for (p=&inf->pieces[f->firstPiece], pend=&inf->pieces[f->lastPiece]; p!=pend; ++p)
-    p->timeChecked = now;
+  for (p=f->firstPiece; p!=f->lastPiece; ++p)
+    {
+      tor->pieceTimeChecked[p] = now;
+      tr_resumeSetPieceChecked (tor, p);
+    }
 
   /* if the torrent's current filename isn't the same as the one in the
    * metadata -- for example, if it had the ".part" suffix appended to
@@ -3313,6 +4840,7 @@ tr_torrentGotBlock (tr_torrent * tor, tr_block_index_t block)
       tr_piece_index_t p;
 
       tr_cpBlockAdd (&tor->completion, block);
+      tr_resumeSetDirty (tor, TR_FR_PROGRESS);
       tr_torrentSetDirty (tor);
 
       p = tr_torBlockPiece (tor, block);
@@ -3433,7 +4961,8 @@ tr_torrentFindFile (const tr_torrent * tor, tr_file_index_t fileNum)
   char * ret = NULL;
   const char * base;
 
-  if (tr_torrentFindFile2 (tor, fileNum, &base, &subpath, NULL))
+  if (tr_torrentPageIn ((tr_torrent*)tor)
+      && tr_torrentFindFile2 (tor, fileNum, &base, &subpath, NULL))
     {
       ret = tr_buildPath (base, subpath, NULL);
       tr_free (subpath);
@@ -3450,7 +4979,7 @@ refreshCurrentDir (tr_torrent * tor)
 
   if (tor->incompleteDir == NULL)
     dir = tor->downloadDir;
-  else if (!tr_torrentHasMetadata (tor)) /* no files to find */
+  else if (!tr_torrentHasMetadata (tor) || !tr_torrentPageIn (tor)) /* no files to find */
     dir = tor->incompleteDir;
   else if (!tr_torrentFindFile2 (tor, 0, &dir, NULL, NULL))
     dir = tor->incompleteDir;
@@ -3777,6 +5306,7 @@ renameTorrentFileString (tr_torrent       * tor,
       tr_free (file->name);
       file->name = name;
       file->is_renamed = true;
+      tr_resumeSetDirty (tor, TR_FR_FILENAMES);
     }
 }
 
@@ -3808,6 +5338,10 @@ torrentRenamePath (void * vdata)
     {
       error = EINVAL;
     }
+  else if (!tr_torrentPageIn (tor))
+    {
+      error = EIO;
+    }
   else
     {
       size_t n;
@@ -3837,6 +5371,7 @@ torrentRenamePath (void * vdata)
                   tor->info.name = tr_strdup (newname);
                 }
 
+              tr_torrentMarkChanged (tor, TR_FIELDS_INFO);
               tr_torrentSetDirty (tor);
             }
         }
@@ -57,12 +57,50 @@ void        tr_torrentChangeMyPort (tr_torrent * session);
 tr_torrent* tr_torrentFindFromHashString (tr_session * session,
                                           const char * hashString);
 
+/**
+ * tr_torrentNew () in two halves, so that many torrents can be parsed
+ * in parallel when a session starts.
+ *
+ * tr_torrentParseMetainfo () parses the ctor's metainfo into `setmeInfo'
+ * without looking at the session's torrents, so it's safe to call from
+ * any thread as long as each thread has its own ctor.
+ *
+ * tr_torrentNewParsed () must be called in the event thread. It takes
+ * ownership of `info' but not of `resume', which is the torrent's
+ * .resume file as read by tr_torrentReadResume (), or NULL if it had none.
+ */
+tr_parse_result tr_torrentParseMetainfo (const tr_ctor * ctor,
+                                         tr_info       * setmeInfo,
+                                         bool          * setmeHasInfo,
+                                         size_t        * setmeInfoDictLength);
+
+tr_torrent* tr_torrentNewParsed (const tr_ctor * ctor,
+                                 tr_info       * info,
+                                 bool            hasInfo,
+                                 size_t          infoDictLength,
+                                 tr_variant    * resume,
+                                 int           * setme_error);
+
 tr_torrent* tr_torrentFindFromObfuscatedHash (tr_session    * session,
                                               const uint8_t * hash);
 
 bool        tr_torrentIsPieceTransferAllowed (const tr_torrent  * torrent,
                                               tr_direction        direction);
 
+/** @brief frees the threads that copy files for tr_torrentSetLocation ().
+    Called once the session's torrents are closed */
+void        tr_locationMoverFree (tr_session * session);
+
+/** @brief Private function that's exposed here only for unit tests.
+    Sets how many files the session copies at once (0 pauses copying),
+    and whether files are copied even where they could be renamed */
+void        tr_locationMoverSetLimits (tr_session * session,
+                                       int          maxThreads,
+                                       bool         alwaysCopy);
+
+/** @brief Private function that's exposed here only for unit tests */
+int         tr_locationMoverCountThreads (tr_session * session);
+
 
 
 #define tr_block(a, b) _tr_block (tor, a, b)
@@ -110,8 +148,47 @@ void             tr_torrentCheckSeedLimit (tr_torrent * tor);
 /** save a torrent's .resume file if it's changed since the last time it was saved */
 void             tr_torrentSave (tr_torrent * tor);
 
+/**
+ * Rereads info.files and info.pieceHashes from the .torrent file if they
+ * were freed by tr_torrentPageOutIfIdle (), and restores the per-piece
+ * state arrays. Anything that uses those on a torrent that might be
+ * stopped needs to call this first.
+ *
+ * @return false if the .torrent couldn't be reread. The tables are
+ *         still NULL then, and the torrent's local error is set.
+ */
+bool             tr_torrentPageIn (tr_torrent * tor);
+
+/** frees the torrent's file and piece tables if it's been stopped,
+    and unused, for at least `idleMinutes' */
+void             tr_torrentPageOutIfIdle (tr_torrent * tor, int idleMinutes);
+
 void             tr_torrentSetLocalError (tr_torrent * tor, const char * fmt, ...) TR_GNUC_PRINTF (2, 3);
 
+/**
+ * What the torrent's top-level file or folder looked like the last
+ * time its local data was known to be there. If it still looks the
+ * same at startup, the per-file check for missing data is put off
+ * until the data is first used. see tr_torrentCheckLocalData ()
+ */
+typedef struct tr_data_fingerprint
+{
+  char             * dir;
+  time_t             mtime;
+}
+tr_data_fingerprint;
+
+/** @brief gets the fingerprint to save in the .resume file.
+           The caller must tr_free () setme->dir if this returns true. */
+bool             tr_torrentGetDataFingerprint (tr_torrent          * tor,
+                                               tr_data_fingerprint * setme);
+
+/**
+ * @brief does the check for missing data that startup may have skipped
+ * @return false if the data's missing. The local error is set then.
+ */
+bool             tr_torrentCheckLocalData (tr_torrent * tor);
+
 
 
 typedef enum
@@ -129,6 +206,28 @@ tr_torrent_activity tr_torrentGetActivity (const tr_torrent * tor);
 
 struct tr_incomplete_metadata;
 
+/* torrent-get fields are grouped by what makes them change,
+ * so that a "since" query only resends the groups that did */
+typedef enum
+{
+    TR_FIELDS_STATS,  /* transfer progress, peers, activity */
+    TR_FIELDS_CONFIG, /* user-settable options */
+    TR_FIELDS_INFO,   /* metainfo; only changes on magnet completion or rename */
+    TR_FIELDS_COUNT
+}
+tr_field_group;
+
+/* tr_torrentStat () refreshes tr_stat a group of fields at a time,
+ * and skips the groups whose inputs haven't changed since last time */
+typedef enum
+{
+    TR_STAT_PROGRESS = (1 << 0), /* completion and sizes */
+    TR_STAT_SWARM    = (1 << 1), /* peer counts and availability */
+    TR_STAT_RATES    = (1 << 2), /* speeds, eta, seed ratio progress */
+    TR_STAT_ALL      = TR_STAT_PROGRESS | TR_STAT_SWARM | TR_STAT_RATES
+}
+tr_stat_group;
+
 /** @brief Torrent object */
 struct tr_torrent
 {
@@ -244,6 +343,44 @@ struct tr_torrent
     bool                       isDeleting;
     bool                       startAfterVerify;
     bool                       isDirty;
+
+    /* the parts of the last save that tr_torrentSaveResume () can reuse */
+    struct tr_resume_cache   * resumeCache;
+
+    /* each piece's state, one array per field, indexed by piece.
+     * scans over one field, like the piece picker's over pieceDND,
+     * don't drag the others into the cache with it */
+    time_t                   * pieceTimeChecked;
+    int8_t                   * piecePriority;  /* TR_PRI_HIGH, _NORMAL, or _LOW */
+    int8_t                   * pieceDND;       /* "do not download" flag */
+
+    /* when info.pieceHashes points into a read-only mapping of
+     * the .torrent file, that mapping. see mapPieceHashes () */
+    const void               * metainfoMap;
+    uint64_t                   metainfoMapSize;
+
+    /* a changed .torrent that can't be written until the verify
+     * thread is done reading the hashes from metainfoMap */
+    tr_variant               * pendingMetainfo;
+
+    /* while the torrent is idle, what's left of info.files and the
+     * piece state after they've been freed. see tr_torrentPageIn () */
+    struct tr_paged_info     * pagedInfo;
+    time_t                     infoUsedAt;
+
+    /* set once tr_torrentInfo () has handed &info to a client, which may
+     * hold on to it. Such torrents are never paged out */
+    bool                       infoIsShared;
+
+    /* a set-location whose files are being copied in the background.
+     * see startLocationMove () */
+    struct tr_location_move  * locationMove;
+
+    /* the fingerprint loaded from the .resume file. If it matched at
+     * startup, localDataUnchecked is true until the data's been checked */
+    tr_data_fingerprint        dataFingerprint;
+    bool                       localDataUnchecked;
+
     bool                       isQueued;
 
     bool                       magnetVerify;
@@ -257,12 +394,21 @@ struct tr_torrent
     time_t                     lastStatTime;
     tr_stat                    stats;
 
+    /* tr_stat_groups in `stats' that need to be refreshed */
+    int                        staleStats;
+
     tr_torrent *               next;
 
     int                        uniqueId;
 
+    /* the session revision at which each field group last changed */
+    uint64_t                   revision[TR_FIELDS_COUNT];
+
     struct tr_bandwidth        bandwidth;
 
+    /* name of the tr_bandwidth_group this torrent belongs to, or NULL */
+    char *                     bandwidthGroup;
+
     struct tr_swarm          * swarm;
 
     float                      desiredRatio;
@@ -375,6 +521,25 @@ static inline bool tr_isTorrent (const tr_torrent * tor)
         && (tr_isSession (tor->session));
 }
 
+/* note that fields in this group have changed, so that
+ * torrent-get's "since" cursor will pick them up */
+static inline
+void tr_torrentMarkChanged (tr_torrent * tor, tr_field_group group)
+{
+    tor->revision[group] = ++tor->session->torrentRevision;
+
+    /* user-settable options only feed into the seed ratio and eta */
+    tor->staleStats |= group == TR_FIELDS_CONFIG ? TR_STAT_RATES : TR_STAT_ALL;
+}
+
+/* note that some of tr_torrentStat ()'s fields need to be refreshed,
+ * for changes that don't otherwise call tr_torrentMarkChanged () */
+static inline
+void tr_torrentInvalidateStats (tr_torrent * tor, int groups)
+{
+    tor->staleStats |= groups;
+}
+
 /* set a flag indicating that the torrent's .resume file
  * needs to be saved when the torrent is closed */
 static inline
@@ -383,6 +548,10 @@ void tr_torrentSetDirty (tr_torrent * tor)
     assert (tr_isTorrent (tor));
 
     tor->isDirty = true;
+
+    /* anything worth saving is worth telling RPC clients about */
+    tr_torrentMarkChanged (tor, TR_FIELDS_STATS);
+    tr_torrentMarkChanged (tor, TR_FIELDS_CONFIG);
 }
 
 uint32_t tr_getBlockSize (uint32_t pieceSize);
@@ -424,6 +593,16 @@ void tr_torrentGotNewInfoDict (tr_torrent * tor);
 void tr_torrentSetSpeedLimit_Bps (tr_torrent *, tr_direction, unsigned int Bps);
 unsigned int tr_torrentGetSpeedLimit_Bps (const tr_torrent *, tr_direction);
 
+/**
+ * @brief share a speed limit with the other torrents in the named group.
+ * @param group the group's name, or NULL or "" to leave any group.
+ * @see tr_bandwidth_group
+ */
+void tr_torrentSetBandwidthGroup (tr_torrent * tor, const char * group);
+
+/** @return the name of the torrent's bandwidth group, or NULL if it has none */
+const char * tr_torrentGetBandwidthGroup (const tr_torrent * tor);
+
 /**
  * @return true if this piece needs to be tested
  */
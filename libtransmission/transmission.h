@@ -70,6 +70,11 @@ typedef int8_t tr_priority_t;
 
 #define TR_RPC_SESSION_ID_HEADER "X-Transmission-Session-Id"
 
+/* RPC clients that list this media type in their Accept header, or that
+ * send their request with it as the Content-Type, get bencoded responses
+ * instead of JSON. The request and response schemas are otherwise the same. */
+#define TR_RPC_BENC_CONTENT_TYPE "application/x-bencode"
+
 typedef enum
 {
     TR_PREALLOCATE_NONE   = 0,
@@ -1149,6 +1154,11 @@ enum
  * if move_from_previous_location is `true', the torrent's incompleteDir
  * will be clobberred s.t. additional files being added will be saved
  * to the torrent's downloadDir.
+ *
+ * Files that can't simply be renamed into the new location are copied
+ * there in the background while the torrent keeps using the old ones.
+ * setme_state stays TR_LOC_MOVING until the move is done, and the
+ * pointers must stay valid until then.
  */
 void tr_torrentSetLocation (tr_torrent       * torrent,
                             const char       * location,
@@ -1156,6 +1166,15 @@ void tr_torrentSetLocation (tr_torrent       * torrent,
                             volatile double  * setme_progress,
                             volatile int     * setme_state);
 
+/**
+ * @brief Stop a tr_torrentSetLocation () that's still copying files.
+ *
+ * The copies are removed, the torrent stays where it was,
+ * and the move's setme_state is set to TR_LOC_ERROR.
+ * Starting another tr_torrentSetLocation () does this too.
+ */
+void tr_torrentCancelSetLocation (tr_torrent * torrent);
+
 uint64_t tr_torrentGetBytesLeftToAllocate (const tr_torrent * torrent);
 
 /**
@@ -1314,6 +1333,13 @@ void tr_torrentSetFileDLs (tr_torrent             * torrent,
                            bool                     do_download);
 
 
+/**
+ * @brief Returns the torrent's metainfo.
+ *
+ * The pointer stays valid until the torrent is freed. To keep it so,
+ * a torrent whose info has been returned here is never paged out by
+ * the session's "idle-metainfo-unload-minutes" setting.
+ */
 const tr_info * tr_torrentInfo (const tr_torrent * torrent);
 
 /* Raw function to change the torrent's downloadDir field.
@@ -1339,11 +1365,7 @@ char* tr_torrentInfoGetMagnetLink (const tr_info * inf);
  * Returns a newly-allocated string with a magnet link of the torrent.
  * Use tr_free () to free the string when done.
  */
-static inline
-char* tr_torrentGetMagnetLink (const tr_torrent * tor)
-{
-    return tr_torrentInfoGetMagnetLink (tr_torrentInfo (tor));
-}
+char* tr_torrentGetMagnetLink (const tr_torrent * tor);
 
 /**
 ***
@@ -1755,16 +1777,6 @@ typedef struct tr_file
 }
 tr_file;
 
-/** @brief a part of tr_info that represents a single piece of the torrent's content */
-typedef struct tr_piece
-{
-    time_t   timeChecked;              /* the last time we tested this piece */
-    uint8_t  hash[SHA_DIGEST_LENGTH];  /* pieces hash */
-    int8_t   priority;                 /* TR_PRI_HIGH, _NORMAL, or _LOW */
-    int8_t   dnd;                      /* "do not download" flag */
-}
-tr_piece;
-
 /** @brief information about a torrent that comes from its metainfo file */
 struct tr_info
 {
@@ -1786,7 +1798,9 @@ struct tr_info
     char             * comment;
     char             * creator;
     tr_file          * files;
-    tr_piece         * pieces;
+
+    /* each piece's SHA-1 hash, one after another. see tr_infoPieceHash () */
+    const uint8_t    * pieceHashes;
 
     /* these trackers are sorted by tier */
     tr_tracker_info  * trackers;
@@ -1809,9 +1823,12 @@ struct tr_info
     bool               isFolder;
 };
 
-static inline bool tr_torrentHasMetadata (const tr_torrent * tor)
+bool tr_torrentHasMetadata (const tr_torrent * tor);
+
+/** @brief the SHA-1 hash of a piece, SHA_DIGEST_LENGTH bytes long */
+static inline const uint8_t * tr_infoPieceHash (const tr_info * inf, tr_piece_index_t piece)
 {
-    return tr_torrentInfo (tor)->fileCount > 0;
+    return inf->pieceHashes + (size_t)piece * SHA_DIGEST_LENGTH;
 }
 
 /**
@@ -2030,12 +2047,14 @@ tr_stat;
 
 /** Return a pointer to an tr_stat structure with updated information
     on the torrent. This is typically called by the GUI clients every
-    second or so to get a new snapshot of the torrent's status. */
+    second or so to get a new snapshot of the torrent's status.
+    Only the fields that may have changed since the last call are
+    recalculated, so polling torrents that are idle is cheap. */
 const tr_stat * tr_torrentStat (tr_torrent * torrent);
 
-/** Like tr_torrentStat (), but only recalculates the statistics if it's
-    been longer than a second since they were last calculated. This can
-    reduce the CPU load if you're calling tr_torrentStat () frequently. */
+/** Like tr_torrentStat (), but skips even the cheap fields if nothing
+    has changed within the current second. This is for callers such as
+    sort functions that look at the same torrent many times in a row. */
 const tr_stat * tr_torrentStatCached (tr_torrent * torrent);
 
 /** @deprecated */
@@ -22,6 +22,9 @@
 #include "ConvertUTF.h" /* tr_utf8_validate*/
 #include "platform.h"
 #include "crypto-utils.h" /* tr_rand_int_weak */
+#include "error.h"
+#include "error-types.h"
+#include "file.h"
 #include "utils.h"
 #include "web.h"
 
@@ -508,6 +511,93 @@ test_env (void)
   return 0;
 }
 
+static bool
+countCopiedBytes (uint64_t bytes, void * vcount)
+{
+  uint64_t * count = vcount;
+
+  *count += bytes;
+
+  return true;
+}
+
+static bool
+cancelCopy (uint64_t bytes, void * vcount)
+{
+  countCopiedBytes (bytes, vcount);
+
+  return false;
+}
+
+static int
+test_copy_file (void)
+{
+  size_t i;
+  size_t len;
+  uint64_t count;
+  uint8_t * contents;
+  uint8_t * copied;
+  tr_error * error = NULL;
+  const size_t size = 1024 * 1024 * 5 + 123; /* a few buffers' worth */
+  char * sandbox = libtest_sandbox_create ();
+  char * oldpath = tr_buildPath (sandbox, "old", NULL);
+  char * newpath = tr_buildPath (sandbox, "a", "b", "new", NULL);
+
+  contents = tr_new (uint8_t, size);
+  for (i=0; i<size; ++i)
+    contents[i] = (uint8_t) (i * 7);
+  libtest_create_file_with_contents (oldpath, contents, size);
+
+  /* copies the whole file, creating its directory and reporting progress */
+  count = 0;
+  check (tr_copyFile (oldpath, newpath, countCopiedBytes, &count, &error));
+  check (error == NULL);
+  check_uint_eq (size, count);
+  copied = tr_loadFile (newpath, &len, NULL);
+  check (copied != NULL);
+  check_uint_eq (size, len);
+  check (memcmp (contents, copied, size) == 0);
+  check (tr_sys_path_exists (oldpath, NULL));
+  tr_free (copied);
+
+  /* a cancelled copy leaves nothing behind */
+  check (tr_sys_path_remove (newpath, NULL));
+  count = 0;
+  check (!tr_copyFile (oldpath, newpath, cancelCopy, &count, &error));
+  check (error != NULL);
+  check_int_eq (TR_ERROR_ECANCELED, error->code);
+  check (count > 0);
+  check (count < size);
+  check (!tr_sys_path_exists (newpath, NULL));
+  tr_error_clear (&error);
+
+  /* ...even if it's cancelled after the last bytes were copied */
+  libtest_create_file_with_string_contents (oldpath, "hello, world!\n");
+  count = 0;
+  check (!tr_copyFile (oldpath, newpath, cancelCopy, &count, &error));
+  check (error != NULL);
+  check_int_eq (TR_ERROR_ECANCELED, error->code);
+  check_uint_eq (14, count);
+  check (!tr_sys_path_exists (newpath, NULL));
+  tr_error_clear (&error);
+  libtest_create_file_with_contents (oldpath, contents, size);
+
+  /* moving renames or copies it, then removes the old one */
+  check (tr_moveFile (oldpath, newpath, &error));
+  check (!tr_sys_path_exists (oldpath, NULL));
+  copied = tr_loadFile (newpath, &len, NULL);
+  check_uint_eq (size, len);
+  check (memcmp (contents, copied, size) == 0);
+  tr_free (copied);
+
+  tr_free (contents);
+  tr_free (newpath);
+  tr_free (oldpath);
+  libtest_sandbox_destroy (sandbox);
+  tr_free (sandbox);
+  return 0;
+}
+
 int
 main (void)
 {
@@ -524,7 +614,8 @@ main (void)
                              test_truncd,
                              test_url,
                              test_utf8,
-                             test_env };
+                             test_env,
+                             test_copy_file };
 
   return runTests (tests, NUM_TESTS (tests));
 }
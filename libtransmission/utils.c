@@ -7,8 +7,8 @@
  * $Id$
  */
 
-#ifdef HAVE_MEMMEM
- #define _GNU_SOURCE /* glibc's string.h needs this to pick up memmem */
+#if defined (HAVE_MEMMEM) || defined (HAVE_COPY_FILE_RANGE)
+ #define _GNU_SOURCE /* glibc needs this to pick up memmem () and copy_file_range () */
 #endif
 
 #if defined (XCODE_BUILD)
@@ -1454,45 +1454,132 @@ tr_strratio (char * buf, size_t buflen, double ratio, const char * infinity)
 ****
 ***/
 
-bool
-tr_moveFile (const char * oldpath, const char * newpath, tr_error ** error)
+static bool
+getOldFileInfo (const char * oldpath, tr_sys_path_info * info, tr_error ** error)
 {
-  tr_sys_file_t in;
-  tr_sys_file_t out;
-  char * buf = NULL;
-  tr_sys_path_info info;
-  uint64_t bytesLeft;
-  const size_t buflen = 1024 * 128; /* 128 KiB buffer */
-
-  /* make sure the old file exists */
-  if (!tr_sys_path_get_info (oldpath, 0, &info, error))
+  if (!tr_sys_path_get_info (oldpath, 0, info, error))
     {
       tr_error_prefix (error, "Unable to get information on old file: ");
       return false;
     }
-  if (info.type != TR_SYS_PATH_IS_FILE)
+  if (info->type != TR_SYS_PATH_IS_FILE)
     {
       tr_error_set_literal (error, TR_ERROR_EINVAL, "Old path does not point to a file.");
       return false;
     }
 
-  /* make sure the target directory exists */
-  {
-    char * newdir = tr_sys_path_dirname (newpath, error);
-    const bool i = newdir != NULL && tr_sys_dir_create (newdir, TR_SYS_DIR_CREATE_PARENTS, 0777, error);
-    tr_free (newdir);
-    if (!i)
-      {
-        tr_error_prefix (error, "Unable to create directory for new file: ");
-        return false;
-      }
-  }
+  return true;
+}
 
-  /* they might be on the same filesystem... */
-  if (tr_sys_path_rename (oldpath, newpath, NULL))
+static bool
+createParentDir (const char * newpath, tr_error ** error)
+{
+  char * newdir = tr_sys_path_dirname (newpath, error);
+  const bool ok = newdir != NULL && tr_sys_dir_create (newdir, TR_SYS_DIR_CREATE_PARENTS, 0777, error);
+
+  tr_free (newdir);
+
+  if (!ok)
+    tr_error_prefix (error, "Unable to create directory for new file: ");
+
+  return ok;
+}
+
+/* reads and writes this much at a time. Big enough that the disk
+   heads spend most of their time transferring rather than seeking when
+   several files are being copied at once, and small enough that a
+   cancelled copy notices quickly. */
+#define COPY_BUFFER_SIZE (1024 * 1024 * 4) /* 4 MiB */
+
+static bool
+copyFileContents (tr_sys_file_t            in,
+                  tr_sys_file_t            out,
+                  uint64_t                 bytesLeft,
+                  tr_copy_progress_func    progress_func,
+                  void                   * progress_user_data,
+                  tr_error              ** error)
+{
+  char * buf;
+  bool cancelled = false;
+
+#if defined (HAVE_COPY_FILE_RANGE) && !defined (_WIN32)
+  /* let the kernel copy it without bouncing it through userspace.
+     it can clone or offload the copy when the filesystem supports it */
+  while (bytesLeft > 0)
+    {
+      const ssize_t n = copy_file_range (in, NULL, out, NULL, MIN (bytesLeft, COPY_BUFFER_SIZE), 0);
+
+      if (n <= 0)
+        {
+          /* unsupported between these two files? fall back to read/write,
+             which picks up from wherever the kernel left off */
+          if (n < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP))
+            break;
+
+          tr_error_set_literal (error, n < 0 ? errno : TR_ERROR_EINVAL,
+                                n < 0 ? tr_strerror (errno) : "Old file is shorter than expected.");
+          return false;
+        }
+
+      bytesLeft -= n;
+
+      if (progress_func != NULL && !progress_func ((uint64_t) n, progress_user_data))
+        {
+          tr_error_set_literal (error, TR_ERROR_ECANCELED, "Copy was cancelled.");
+          return false;
+        }
+    }
+
+  if (bytesLeft == 0)
     return true;
+#endif
+
+  buf = tr_valloc (COPY_BUFFER_SIZE);
+  while (bytesLeft > 0)
+    {
+      const uint64_t bytesThisPass = MIN (bytesLeft, COPY_BUFFER_SIZE);
+      uint64_t numRead, bytesWritten;
+      if (!tr_sys_file_read (in, buf, bytesThisPass, &numRead, error))
+        break;
+      if (numRead == 0)
+        {
+          tr_error_set_literal (error, TR_ERROR_EINVAL, "Old file is shorter than expected.");
+          break;
+        }
+      if (!tr_sys_file_write (out, buf, numRead, &bytesWritten, error))
+        break;
+      assert (numRead == bytesWritten);
+      assert (bytesWritten <= bytesLeft);
+      bytesLeft -= bytesWritten;
+
+      if (progress_func != NULL && !progress_func (bytesWritten, progress_user_data))
+        {
+          tr_error_set_literal (error, TR_ERROR_ECANCELED, "Copy was cancelled.");
+          cancelled = true;
+          break;
+        }
+    }
+  tr_free (buf);
+
+  /* cancelling during the last pass still fails, even though it's all copied */
+  return bytesLeft == 0 && !cancelled;
+}
+
+bool
+tr_copyFile (const char             * oldpath,
+             const char             * newpath,
+             tr_copy_progress_func    progress_func,
+             void                   * progress_user_data,
+             tr_error              ** error)
+{
+  bool ok;
+  tr_sys_file_t in;
+  tr_sys_file_t out;
+  tr_sys_path_info info;
+
+  if (!getOldFileInfo (oldpath, &info, error) || !createParentDir (newpath, error))
+    return false;
 
-  /* copy the file */
   in = tr_sys_file_open (oldpath, TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL, 0, error);
   if (in == TR_BAD_SYS_FILE)
     {
@@ -1508,32 +1595,38 @@ tr_moveFile (const char * oldpath, const char * newpath, tr_error ** error)
       return false;
     }
 
-  buf = tr_valloc (buflen);
-  bytesLeft = info.size;
-  while (bytesLeft > 0)
-    {
-      const uint64_t bytesThisPass = MIN (bytesLeft, buflen);
-      uint64_t numRead, bytesWritten;
-      if (!tr_sys_file_read (in, buf, bytesThisPass, &numRead, error))
-        break;
-      if (!tr_sys_file_write (out, buf, numRead, &bytesWritten, error))
-        break;
-      assert (numRead == bytesWritten);
-      assert (bytesWritten <= bytesLeft);
-      bytesLeft -= bytesWritten;
-    }
+  ok = copyFileContents (in, out, info.size, progress_func, progress_user_data, error);
 
   /* cleanup */
-  tr_free (buf);
   tr_sys_file_close (out, NULL);
   tr_sys_file_close (in, NULL);
 
-  if (bytesLeft != 0)
+  if (!ok)
     {
       tr_error_prefix (error, "Unable to read/write: ");
-      return false;
+      tr_sys_path_remove (newpath, NULL);
     }
 
+  return ok;
+}
+
+bool
+tr_moveFile (const char * oldpath, const char * newpath, tr_error ** error)
+{
+  tr_sys_path_info info;
+
+  /* make sure the old file exists and the target directory exists */
+  if (!getOldFileInfo (oldpath, &info, error) || !createParentDir (newpath, error))
+    return false;
+
+  /* they might be on the same filesystem... */
+  if (tr_sys_path_rename (oldpath, newpath, NULL))
+    return true;
+
+  /* copy the file */
+  if (!tr_copyFile (oldpath, newpath, NULL, NULL, error))
+    return false;
+
   {
     tr_error * my_error = NULL;
     if (!tr_sys_path_remove (oldpath, &my_error))
@@ -426,7 +426,29 @@ int tr_gettimeofday (struct timeval * tv);
 
 
 /**
- * @brief move a file
+ * @brief called as tr_copyFile () makes progress
+ * @param bytes how many more bytes have been copied since the last call
+ * @return `True` to keep going, or `false` to cancel the copy
+ */
+typedef bool (*tr_copy_progress_func) (uint64_t bytes, void * user_data);
+
+/**
+ * @brief copy a file, creating the new file's directory if needed.
+ *
+ * Uses the kernel's copy offload where it's available. If the copy fails
+ * or is cancelled by `progress_func`, the partial new file is removed.
+ *
+ * @param progress_func optional callback, called from this thread
+ * @return `True` on success, `false` otherwise (with `error` set accordingly).
+ */
+bool tr_copyFile (const char             * oldpath,
+                  const char             * newpath,
+                  tr_copy_progress_func    progress_func,
+                  void                   * progress_user_data,
+                  struct tr_error       ** error) TR_GNUC_NONNULL (1,2);
+
+/**
+ * @brief move a file, renaming it if possible or else copying it
  * @return `True` on success, `false` otherwise (with `error` set accordingly).
  */
 bool tr_moveFile (const char       * oldpath,
@@ -19,7 +19,6 @@
 
 #define __LIBTRANSMISSION_VARIANT_MODULE__
 #include "transmission.h"
-#include "ptrarray.h"
 #include "utils.h" /* tr_snprintf() */
 #include "variant.h"
 #include "variant-common.h"
@@ -123,33 +122,23 @@ err:
 }
 
 static tr_variant*
-get_node (tr_ptrArray * stack, tr_quark * key, tr_variant * top, int * err)
+get_node (struct tr_variant_builder * b, tr_quark * key, int * err)
 {
-  tr_variant * node = NULL;
+  tr_variant * node;
 
-  if (tr_ptrArrayEmpty (stack))
+  if (tr_variantIsDict (tr_variantBuilderParent (b)))
     {
-      node = top;
+      node = *key ? tr_variantBuilderAdd (b, *key) : NULL;
+      *key = 0;
     }
   else
     {
-      tr_variant * parent = tr_ptrArrayBack (stack);
-
-      if (tr_variantIsList (parent))
-        {
-          node = tr_variantListAdd (parent);
-        }
-      else if (*key && tr_variantIsDict (parent))
-        {
-          node = tr_variantDictAdd (parent, *key);
-          *key = 0;
-        }
-      else
-        {
-          *err = EILSEQ;
-        }
+      node = tr_variantBuilderAdd (b, 0);
     }
 
+  if (node == NULL)
+    *err = EILSEQ;
+
   return node;
 }
 
@@ -159,18 +148,19 @@ get_node (tr_ptrArray * stack, tr_quark * key, tr_variant * top, int * err)
  * attack via maliciously-crafted bencoded data. (#667)
  */
 int
-tr_variantParseBenc (const void    * buf_in,
-                     const void    * bufend_in,
-                     tr_variant    * top,
-                     const char   ** setme_end)
+tr_variantParseBenc (const void              * buf_in,
+                     const void              * bufend_in,
+                     tr_variant              * top,
+                     const char             ** setme_end,
+                     struct tr_variant_arena * arena)
 {
   int err = 0;
   const uint8_t * buf = buf_in;
   const uint8_t * bufend = bufend_in;
-  tr_ptrArray stack = TR_PTR_ARRAY_INIT;
+  struct tr_variant_builder b;
   tr_quark key = 0;
 
-  tr_variantInit (top, 0);
+  tr_variantBuilderInit (&b, top, arena);
 
   while (buf != bufend)
     {
@@ -190,7 +180,7 @@ tr_variantParseBenc (const void    * buf_in,
             break;
           buf = end;
 
-          if ((v = get_node (&stack, &key, top, &err)))
+          if ((v = get_node (&b, &key, &err)))
             tr_variantInitInt (v, val);
         }
       else if (*buf == 'l') /* list */
@@ -199,10 +189,10 @@ tr_variantParseBenc (const void    * buf_in,
 
           ++buf;
 
-          if ((v = get_node (&stack, &key, top, &err)))
+          if ((v = get_node (&b, &key, &err)))
             {
               tr_variantInitList (v, 0);
-              tr_ptrArrayAppend (&stack, v);
+              tr_variantBuilderOpen (&b, v);
             }
         }
       else if (*buf == 'd') /* dict */
@@ -211,25 +201,25 @@ tr_variantParseBenc (const void    * buf_in,
 
           ++buf;
 
-          if ((v = get_node (&stack, &key, top, &err)))
+          if ((v = get_node (&b, &key, &err)))
             {
               tr_variantInitDict (v, 0);
-              tr_ptrArrayAppend (&stack, v);
+              tr_variantBuilderOpen (&b, v);
             }
         }
       else if (*buf == 'e') /* end of list or dict */
         {
           ++buf;
 
-          if (tr_ptrArrayEmpty (&stack) || (key != 0))
+          if ((tr_variantBuilderParent (&b) == NULL) || (key != 0))
             {
               err = EILSEQ;
               break;
             }
           else
             {
-              tr_ptrArrayPop (&stack);
-              if (tr_ptrArrayEmpty (&stack))
+              tr_variantBuilderClose (&b);
+              if (tr_variantBuilderParent (&b) == NULL)
                 break;
             }
         }
@@ -244,28 +234,43 @@ tr_variantParseBenc (const void    * buf_in,
             break;
           buf = end;
 
-          if (!key && !tr_ptrArrayEmpty(&stack) && tr_variantIsDict(tr_ptrArrayBack(&stack)))
-            key = tr_quark_new (str, str_len);
-          else if ((v = get_node (&stack, &key, top, &err)))
-            tr_variantInitStr (v, str, str_len);
+          if (!key && tr_variantIsDict (tr_variantBuilderParent (&b)))
+            {
+              key = tr_quark_new (str, str_len);
+            }
+          else if ((v = get_node (&b, &key, &err)))
+            {
+              if (arena != NULL)
+                {
+                  /* slide the string back over its ':' so that
+                   * the '\0' doesn't clobber the next token */
+                  char * in_place = (char*)str - 1;
+                  memmove (in_place, str, str_len);
+                  in_place[str_len] = '\0';
+                  tr_variantInitStrView (v, in_place, str_len);
+                }
+              else
+                {
+                  tr_variantInitStr (v, str, str_len);
+                }
+            }
         }
       else /* invalid bencoded text... march past it */
         {
           ++buf;
         }
 
-      if (tr_ptrArrayEmpty (&stack))
+      if (tr_variantBuilderParent (&b) == NULL)
         break;
     }
 
-  if (!err && (!top->type || !tr_ptrArrayEmpty(&stack)))
+  if (!err && (!top->type || (tr_variantBuilderParent (&b) != NULL)))
     err = EILSEQ;
 
   if (!err && setme_end)
     *setme_end = (const char*) buf;
 
-  tr_ptrArrayDestruct (&stack, NULL);
-  return err;
+  return tr_variantBuilderFinish (&b, err);
 }
 
 /****
@@ -0,0 +1,87 @@
+/*
+ * This file Copyright (C) 2016 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ * $Id$
+ */
+
+/* Measures tr_variant dictionary operations on big dicts:
+ * adding keys one at a time, looking them up, merging,
+ * and parsing a big benc dict.
+ *
+ * usage: variant-bench [key-count] */
+
+#include <stdio.h>
+#include <stdlib.h> /* atoi () */
+
+#include "transmission.h"
+#include "utils.h"
+#include "variant.h"
+
+#include "libtransmission-test.h"
+
+static uint64_t
+elapsed (uint64_t * begin)
+{
+  const uint64_t now = tr_time_msec ();
+  const uint64_t ret = now - *begin;
+  *begin = now;
+  return ret;
+}
+
+int
+main (int argc, char ** argv)
+{
+  int i;
+  size_t len;
+  char * benc;
+  int64_t sum = 0;
+  uint64_t begin;
+  tr_quark * keys;
+  tr_variant top;
+  tr_variant copy;
+  tr_variant parsed;
+  const int n = argc > 1 ? atoi (argv[1]) : 10000;
+
+  keys = tr_new (tr_quark, n);
+  for (i=0; i<n; ++i)
+    {
+      char buf[32];
+      tr_snprintf (buf, sizeof (buf), "bench-key-%d", i);
+      keys[i] = tr_quark_new (buf, TR_BAD_SIZE);
+    }
+
+  printf ("tr_variant dict with %d keys\n", n);
+
+  begin = tr_time_msec ();
+  tr_variantInitDict (&top, 0);
+  for (i=0; i<n; ++i)
+    tr_variantDictAddInt (&top, keys[i], i);
+  printf ("  add:    %6"PRIu64" ms\n", elapsed (&begin));
+
+  for (i=0; i<n; ++i)
+    {
+      int64_t val = 0;
+      tr_variantDictFindInt (&top, keys[i], &val);
+      sum += val;
+    }
+  printf ("  find:   %6"PRIu64" ms\n", elapsed (&begin));
+
+  tr_variantInitDict (&copy, 0);
+  tr_variantMergeDicts (&copy, &top);
+  printf ("  merge:  %6"PRIu64" ms\n", elapsed (&begin));
+
+  benc = tr_variantToStr (&top, TR_VARIANT_FMT_BENC, &len);
+  elapsed (&begin);
+  tr_variantFromBenc (&parsed, benc, len);
+  printf ("  parse:  %6"PRIu64" ms\n", elapsed (&begin));
+
+  tr_variantFree (&parsed);
+  tr_free (benc);
+  tr_variantFree (&copy);
+  tr_variantFree (&top);
+  tr_free (keys);
+  return sum == (int64_t)n * (n - 1) / 2 ? 0 : 1;
+}
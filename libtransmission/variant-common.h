@@ -38,11 +38,82 @@ void tr_variantToBufBenc (const tr_variant * top, struct evbuffer * buf);
 
 void tr_variantInit (tr_variant * v, char type);
 
-int tr_jsonParse (const char    * source, /* Such as a filename. Only when logging an error */
-                  const void    * vbuf,
-                  size_t          len,
-                  tr_variant    * setme_benc,
-                  const char   ** setme_end);
+/* for a string whose text outlives it and has a '\0' at str[len] */
+void tr_variantInitStrView (tr_variant * v, const char * str, size_t len);
+
+/***
+****  Arena
+***/
+
+struct tr_variant_arena;
+
+/* takes ownership of text, which is freed along with the arena */
+struct tr_variant_arena * tr_variantArenaNew (char * text, size_t text_len);
+
+void * tr_variantArenaAlloc (struct tr_variant_arena * arena, size_t size);
+
+void tr_variantArenaFree (struct tr_variant_arena * arena);
+
+/***
+****  Builder
+***/
+
+/**
+ * Used by the parsers to build a tree.
+ *
+ * Children are collected on a scratch stack until their container is
+ * closed, then moved into one array of exactly the right size -- from the
+ * arena if there is one, or else from the heap.
+ */
+struct tr_variant_builder
+{
+  tr_variant * top;
+  struct tr_variant_arena * arena;
+
+  /* the children of every open container */
+  tr_variant * nodes;
+  size_t n_nodes;
+  size_t n_nodes_alloc;
+
+  /* for each open container, where its children begin in nodes.
+   * a container's own node is just before its children, except for top. */
+  size_t * open;
+  size_t n_open;
+  size_t n_open_alloc;
+};
+
+void tr_variantBuilderInit (struct tr_variant_builder * b,
+                            tr_variant                * top,
+                            struct tr_variant_arena   * arena);
+
+/* the innermost open container, or NULL if there isn't one.
+ * like the nodes from tr_variantBuilderAdd (), only valid until the next add. */
+tr_variant * tr_variantBuilderParent (struct tr_variant_builder * b);
+
+/* returns a node for the caller to init, or NULL if there's no room for one */
+tr_variant * tr_variantBuilderAdd (struct tr_variant_builder * b, tr_quark key);
+
+/* the next children go into the list or dict that was just added */
+void tr_variantBuilderOpen (struct tr_variant_builder * b, tr_variant * container);
+
+void tr_variantBuilderClose (struct tr_variant_builder * b);
+
+/* On success, closes any containers that are still open and hands the
+ * arena to the top node. On failure, frees everything and clears top.
+ * Returns err. */
+int tr_variantBuilderFinish (struct tr_variant_builder * b, int err);
+
+/***
+****  Parsers
+***/
+
+/* if arena isn't NULL, vbuf is its text and strings are terminated in place */
+int tr_jsonParse (const char              * source, /* Such as a filename. Only when logging an error */
+                  const void              * vbuf,
+                  size_t                    len,
+                  tr_variant              * setme_benc,
+                  const char             ** setme_end,
+                  struct tr_variant_arena * arena);
 
 /** @brief Private function that's exposed here only for unit tests */
 int tr_bencParseInt (const uint8_t *  buf,
@@ -57,9 +128,11 @@ int tr_bencParseStr (const uint8_t *  buf,
                      const uint8_t ** setme_str,
                      size_t *         setme_strlen);
 
-int tr_variantParseBenc (const void     * buf,
-                         const void     * end,
-                         tr_variant     * top,
-                         const char ** setme_end);
+/* if arena isn't NULL, buf is its text and strings are terminated in place */
+int tr_variantParseBenc (const void              * buf,
+                         const void              * end,
+                         tr_variant              * top,
+                         const char             ** setme_end,
+                         struct tr_variant_arena * arena);
 
 
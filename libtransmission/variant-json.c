@@ -26,7 +26,6 @@
 #include "ConvertUTF.h"
 #include "list.h"
 #include "log.h"
-#include "ptrarray.h"
 #include "utils.h"
 #include "variant.h"
 #include "variant-common.h"
@@ -38,42 +37,36 @@ struct json_wrapper_data
 {
   int error;
   bool has_content;
-  tr_variant * top;
+  bool in_place; /* terminate strings in the arena's text */
   const char * key;
   size_t keylen;
   struct evbuffer * keybuf;
   struct evbuffer * strbuf;
   const char * source;
-  tr_ptrArray stack;
+  struct tr_variant_builder builder;
 };
 
 static tr_variant*
 get_node (struct jsonsl_st * jsn)
 {
-  tr_variant * parent;
   tr_variant * node = NULL;
   struct json_wrapper_data * data = jsn->data;
 
-  parent = tr_ptrArrayEmpty (&data->stack)
-         ? NULL
-         : tr_ptrArrayBack (&data->stack);
-
-  if (!parent)
-    {
-      node = data->top;
-    }
-  else if (tr_variantIsList (parent))
+  if (!tr_variantIsDict (tr_variantBuilderParent (&data->builder)))
     {
-      node = tr_variantListAdd (parent);
+      node = tr_variantBuilderAdd (&data->builder, 0);
     }
-  else if (tr_variantIsDict (parent) && (data->key!=NULL))
+  else if (data->key != NULL)
     {
-      node = tr_variantDictAdd (parent, tr_quark_new (data->key, data->keylen));
+      node = tr_variantBuilderAdd (&data->builder, tr_quark_new (data->key, data->keylen));
 
       data->key = NULL;
       data->keylen = 0;
     }
 
+  if (node == NULL)
+    data->error = EILSEQ;
+
   return node;
 }
 
@@ -128,16 +121,20 @@ action_callback_PUSH (jsonsl_t                  jsn,
     {
       case JSONSL_T_LIST:
         data->has_content = true;
-        node = get_node (jsn);
-        tr_variantInitList (node, 0);
-        tr_ptrArrayAppend (&data->stack, node);
+        if ((node = get_node (jsn)))
+          {
+            tr_variantInitList (node, 0);
+            tr_variantBuilderOpen (&data->builder, node);
+          }
         break;
 
       case JSONSL_T_OBJECT:
         data->has_content = true;
-        node = get_node (jsn);
-        tr_variantInitDict (node, 0);
-        tr_ptrArrayAppend (&data->stack, node);
+        if ((node = get_node (jsn)))
+          {
+            tr_variantInitDict (node, 0);
+            tr_variantBuilderOpen (&data->builder, node);
+          }
         break;
 
       default:
@@ -211,12 +208,23 @@ extract_escaped_string (const char       * in,
                       if (decode_hex_string (in, &val))
                         {
                           UTF32 str32_buf[2] = { val, 0 };
+                          unsigned int low = 0;
                           const UTF32 * str32_walk = str32_buf;
                           const UTF32 * str32_end = str32_buf + 1;
                           UTF8 str8_buf[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
                           UTF8 * str8_walk = str8_buf;
                           UTF8 * str8_end = str8_buf + 8;
 
+                          /* combine a UTF-16 surrogate pair */
+                          if ((0xd800 <= val) && (val <= 0xdbff) && (in_end - in >= 12)
+                              && (in[6] == '\\') && (in[7] == 'u')
+                              && decode_hex_string (in + 6, &low)
+                              && (0xdc00 <= low) && (low <= 0xdfff))
+                            {
+                              str32_buf[0] = 0x10000 + ((val - 0xd800) << 10) + (low - 0xdc00);
+                              in += 6;
+                            }
+
                           if (ConvertUTF32toUTF8 (&str32_walk, str32_end, &str8_walk, str8_end, 0) == 0)
                             {
                               const size_t len = str8_walk - str8_buf;
@@ -275,19 +283,56 @@ extract_string (jsonsl_t                  jsn,
   return ret;
 }
 
+/* Unescaping never makes a string longer, so the result fits where the
+ * escaped text was. The '\0' goes at most over the closing quote, which
+ * jsonsl has already moved past. */
+static const char *
+extract_string_in_place (jsonsl_t                  jsn,
+                         struct jsonsl_state_st  * state,
+                         size_t                  * len,
+                         struct evbuffer         * buf)
+{
+  const char * str = extract_string (jsn, state, len, buf);
+  char * in_place = (char*) jsn->base + state->pos_begin;
+
+  if (*in_place == '"')
+    in_place++;
+
+  if (str != in_place)
+    memcpy (in_place, str, *len);
+
+  in_place[*len] = '\0';
+  return in_place;
+}
+
 static void
 action_callback_POP (jsonsl_t                  jsn,
                      jsonsl_action_t           action  UNUSED,
                      struct jsonsl_state_st  * state,
                      const jsonsl_char_t     * buf     UNUSED)
 {
+  tr_variant * node;
   struct json_wrapper_data * data = jsn->data;
 
   if (state->type == JSONSL_T_STRING)
     {
       size_t len;
-      const char * str = extract_string (jsn, state, &len, data->strbuf);
-      tr_variantInitStr (get_node (jsn), str, len);
+
+      if (!(node = get_node (jsn)))
+        {
+          /* error already set */
+        }
+      else if (data->in_place)
+        {
+          const char * str = extract_string_in_place (jsn, state, &len, data->strbuf);
+          tr_variantInitStrView (node, str, len);
+        }
+      else
+        {
+          const char * str = extract_string (jsn, state, &len, data->strbuf);
+          tr_variantInitStr (node, str, len);
+        }
+
       data->has_content = true;
     }
   else if (state->type == JSONSL_T_HKEY)
@@ -297,7 +342,8 @@ action_callback_POP (jsonsl_t                  jsn,
     }
   else if ((state->type == JSONSL_T_LIST) || (state->type == JSONSL_T_OBJECT))
     {
-      tr_ptrArrayPop (&data->stack);
+      if (tr_variantBuilderParent (&data->builder) != NULL)
+        tr_variantBuilderClose (&data->builder);
     }
   else if (state->type == JSONSL_T_SPECIAL)
     {
@@ -305,34 +351,39 @@ action_callback_POP (jsonsl_t                  jsn,
         {
           const char * begin = jsn->base + state->pos_begin;
           data->has_content = true;
-          tr_variantInitReal (get_node (jsn), strtod (begin, NULL));
+          if ((node = get_node (jsn)))
+            tr_variantInitReal (node, strtod (begin, NULL));
         }
       else if (state->special_flags & JSONSL_SPECIALf_NUMERIC)
         {
           const char * begin = jsn->base + state->pos_begin;
           data->has_content = true;
-          tr_variantInitInt (get_node (jsn), evutil_strtoll (begin, NULL, 10));
+          if ((node = get_node (jsn)))
+            tr_variantInitInt (node, evutil_strtoll (begin, NULL, 10));
         }
       else if (state->special_flags & JSONSL_SPECIALf_BOOLEAN)
         {
           const bool b = (state->special_flags & JSONSL_SPECIALf_TRUE) != 0;
           data->has_content = true;
-          tr_variantInitBool (get_node (jsn), b);
+          if ((node = get_node (jsn)))
+            tr_variantInitBool (node, b);
         }
       else if (state->special_flags & JSONSL_SPECIALf_NULL)
         {
           data->has_content = true;
-          tr_variantInitQuark (get_node (jsn), TR_KEY_NONE);
+          if ((node = get_node (jsn)))
+            tr_variantInitQuark (node, TR_KEY_NONE);
         }
     }
 }
 
 int
-tr_jsonParse (const char     * source,
-              const void     * vbuf,
-              size_t           len,
-              tr_variant     * setme_variant,
-              const char    ** setme_end)
+tr_jsonParse (const char              * source,
+              const void              * vbuf,
+              size_t                    len,
+              tr_variant              * setme_variant,
+              const char             ** setme_end,
+              struct tr_variant_arena * arena)
 {
   int error;
   jsonsl_t jsn;
@@ -347,12 +398,12 @@ tr_jsonParse (const char     * source,
 
   data.error = 0;
   data.has_content = false;
+  data.in_place = arena != NULL;
   data.key = NULL;
-  data.top = setme_variant;
-  data.stack = TR_PTR_ARRAY_INIT;
   data.source = source;
   data.keybuf = evbuffer_new ();
   data.strbuf = evbuffer_new ();
+  tr_variantBuilderInit (&data.builder, setme_variant, arena);
 
   /* parse it */
   jsonsl_feed (jsn, vbuf, len);
@@ -369,9 +420,8 @@ tr_jsonParse (const char     * source,
   error = data.error;
   evbuffer_free (data.keybuf);
   evbuffer_free (data.strbuf);
-  tr_ptrArrayDestruct (&data.stack, NULL);
   jsonsl_destroy (jsn);
-  return error;
+  return tr_variantBuilderFinish (&data.builder, error);
 }
 
 /****
@@ -495,47 +545,114 @@ jsonBoolFunc (const tr_variant * val,
   jsonChildFunc (data);
 }
 
+static void
+jsonAppendReal (struct evbuffer * out, double d)
+{
+  if (fabs (d - (int)d) < 0.00001)
+    evbuffer_add_printf (out, "%d", (int)d);
+  else
+    evbuffer_add_printf (out, "%.4f", tr_truncd (d, 4));
+}
+
 static void
 jsonRealFunc (const tr_variant * val,
               void             * vdata)
 {
   struct jsonWalk * data = vdata;
 
-  if (fabs (val->val.d - (int)val->val.d) < 0.00001)
-    evbuffer_add_printf (data->out, "%d", (int)val->val.d);
-  else
-    evbuffer_add_printf (data->out, "%.4f", tr_truncd (val->val.d, 4));
+  jsonAppendReal (data->out, val->val.d);
 
   jsonChildFunc (data);
 }
 
+/* Word-at-a-time ("SWAR") test for whether any of the eight bytes in `w'
+ * needs escaping: control characters, '"', '\\', DEL, or non-ASCII.
+ * This lets us scan and bulk-copy the plain-ASCII runs that make up
+ * nearly all torrent names and file paths without per-byte branching. */
+#define JSON_ONES  UINT64_C(0x0101010101010101)
+#define JSON_HIGHS UINT64_C(0x8080808080808080)
+#define JSON_HAS_ZERO_BYTE(x) (((x) - JSON_ONES) & ~(x) & JSON_HIGHS)
+
+static inline bool
+jsonWordNeedsEscape (uint64_t w)
+{
+  return ((w | (w + JSON_ONES)) & JSON_HIGHS) /* >= 0x7f */
+      || (((w - JSON_ONES * 0x20) & ~w & JSON_HIGHS)) /* < 0x20 */
+      || JSON_HAS_ZERO_BYTE (w ^ (JSON_ONES * '"'))
+      || JSON_HAS_ZERO_BYTE (w ^ (JSON_ONES * '\\'));
+}
+
+static inline bool
+jsonByteNeedsEscape (unsigned char ch)
+{
+  return (ch < 0x20) || (ch >= 0x7f) || (ch == '"') || (ch == '\\');
+}
+
+/* returns how many bytes, starting at `begin', can be copied verbatim */
+static size_t
+jsonSafeRunLength (const unsigned char * begin, const unsigned char * end)
+{
+  const unsigned char * it = begin;
+
+  while (end - it >= 8)
+    {
+      uint64_t w;
+      memcpy (&w, it, 8);
+      if (jsonWordNeedsEscape (w))
+        break;
+      it += 8;
+    }
+
+  while (it != end && !jsonByteNeedsEscape (*it))
+    ++it;
+
+  return it - begin;
+}
+
+static char *
+jsonAppendUnicodeEscape (char * out, unsigned int ch)
+{
+  static const char hex[] = "0123456789abcdef";
+
+  *out++ = '\\';
+  *out++ = 'u';
+  *out++ = hex[(ch >> 12) & 0xf];
+  *out++ = hex[(ch >> 8) & 0xf];
+  *out++ = hex[(ch >> 4) & 0xf];
+  *out++ = hex[ch & 0xf];
+  return out;
+}
+
 static void
-jsonStringFunc (const tr_variant * val,
-                void             * vdata)
+jsonAppendString (struct evbuffer * out_buf, const char * str, size_t len)
 {
   char * out;
   char * outwalk;
-  char * outend;
   struct evbuffer_iovec vec[1];
-  struct jsonWalk * data = vdata;
-  const char * str;
-  size_t len;
   const unsigned char * it;
   const unsigned char * end;
 
-  tr_variantGetStr (val, &str, &len);
   it = (const unsigned char *) str;
   end = it + len;
 
-  evbuffer_reserve_space (data->out, len * 4, vec, 1);
+  /* worst case: every byte becomes a six-character \u escape */
+  evbuffer_reserve_space (out_buf, len * 6 + 2, vec, 1);
   out = vec[0].iov_base;
-  outend = out + vec[0].iov_len;
 
   outwalk = out;
   *outwalk++ = '"';
 
-  for (; it!=end; ++it)
+  while (it != end)
     {
+      const size_t run = jsonSafeRunLength (it, end);
+
+      memcpy (outwalk, it, run);
+      outwalk += run;
+      it += run;
+
+      if (it == end)
+        break;
+
       switch (*it)
         {
           case '\b': *outwalk++ = '\\'; *outwalk++ = 'b'; break;
@@ -547,29 +664,47 @@ jsonStringFunc (const tr_variant * val,
           case '\\': *outwalk++ = '\\'; *outwalk++ = '\\'; break;
 
           default:
-            if (isprint (*it))
-              {
-                *outwalk++ = *it;
-              }
-            else
-              {
-                const UTF8 * tmp = it;
-                UTF32 buf[1] = { 0 };
-                UTF32 * u32 = buf;
-                ConversionResult result = ConvertUTF8toUTF32 (&tmp, end, &u32, buf + 1, 0);
-                if (((result==conversionOK) || (result==targetExhausted)) && (tmp!=it))
-                  {
-                    outwalk += tr_snprintf (outwalk, outend-outwalk, "\\u%04x", (unsigned int)buf[0]);
-                    it = tmp - 1;
-                  }
-              }
-            break;
+            {
+              const UTF8 * tmp = it;
+              UTF32 buf[1] = { 0 };
+              UTF32 * u32 = buf;
+              ConversionResult result = ConvertUTF8toUTF32 (&tmp, end, &u32, buf + 1, 0);
+              if (((result==conversionOK) || (result==targetExhausted)) && (tmp!=it))
+                {
+                  if (buf[0] > 0xffff) /* needs a UTF-16 surrogate pair */
+                    {
+                      const UTF32 ch = buf[0] - 0x10000;
+                      outwalk = jsonAppendUnicodeEscape (outwalk, 0xd800 + (ch >> 10));
+                      outwalk = jsonAppendUnicodeEscape (outwalk, 0xdc00 + (ch & 0x3ff));
+                    }
+                  else
+                    {
+                      outwalk = jsonAppendUnicodeEscape (outwalk, buf[0]);
+                    }
+                  it = tmp - 1;
+                }
+              break;
+            }
         }
+
+      ++it;
     }
 
   *outwalk++ = '"';
   vec[0].iov_len = outwalk - out;
-  evbuffer_commit_space (data->out, vec, 1);
+  evbuffer_commit_space (out_buf, vec, 1);
+}
+
+static void
+jsonStringFunc (const tr_variant * val,
+                void             * vdata)
+{
+  struct jsonWalk * data = vdata;
+  const char * str;
+  size_t len;
+
+  tr_variantGetStr (val, &str, &len);
+  jsonAppendString (data->out, str, len);
 
   jsonChildFunc (data);
 }
@@ -626,8 +761,8 @@ static const struct VariantWalkFuncs walk_funcs = { jsonIntFunc,
                                                     jsonListBeginFunc,
                                                     jsonContainerEndFunc };
 
-void
-tr_variantToBufJson (const tr_variant * top, struct evbuffer * buf, bool lean)
+static void
+jsonWalkToBuf (const tr_variant * top, struct evbuffer * buf, bool lean)
 {
   struct jsonWalk data;
 
@@ -636,7 +771,173 @@ tr_variantToBufJson (const tr_variant * top, struct evbuffer * buf, bool lean)
   data.parents = NULL;
 
   tr_variantWalk (top, &walk_funcs, &data, true);
+}
+
+void
+tr_variantToBufJson (const tr_variant * top, struct evbuffer * buf, bool lean)
+{
+  jsonWalkToBuf (top, buf, lean);
 
   if (evbuffer_get_length (buf))
     evbuffer_add_printf (buf, "\n");
 }
+
+/****
+*****  Streaming writer
+****/
+
+void
+tr_jsonWriterInit (tr_jsonWriter * w, struct evbuffer * out, tr_variant_fmt fmt)
+{
+  memset (w, 0, sizeof (tr_jsonWriter));
+  w->out = out;
+  w->benc = fmt == TR_VARIANT_FMT_BENC;
+  w->isFirst[0] = true;
+}
+
+/* emit a comma if this isn't the first item in its container.
+ * benc has no separators. */
+static void
+jsonWriterSeparate (tr_jsonWriter * w)
+{
+  if (w->afterKey || w->benc)
+    w->afterKey = false;
+  else if (w->isFirst[w->depth])
+    w->isFirst[w->depth] = false;
+  else
+    evbuffer_add (w->out, ",", 1);
+}
+
+static void
+jsonWriterPush (tr_jsonWriter * w, char ch)
+{
+  jsonWriterSeparate (w);
+  evbuffer_add (w->out, &ch, 1);
+
+  assert (w->depth + 1 < TR_JSON_WRITER_MAX_DEPTH);
+  w->isFirst[++w->depth] = true;
+}
+
+static void
+jsonWriterPop (tr_jsonWriter * w, char ch)
+{
+  assert (w->depth > 0);
+  assert (!w->afterKey);
+
+  --w->depth;
+  evbuffer_add (w->out, &ch, 1);
+}
+
+void
+tr_jsonWriteDictBegin (tr_jsonWriter * w)
+{
+  jsonWriterPush (w, w->benc ? 'd' : '{');
+}
+
+void
+tr_jsonWriteDictEnd (tr_jsonWriter * w)
+{
+  jsonWriterPop (w, w->benc ? 'e' : '}');
+}
+
+void
+tr_jsonWriteListBegin (tr_jsonWriter * w)
+{
+  jsonWriterPush (w, w->benc ? 'l' : '[');
+}
+
+void
+tr_jsonWriteListEnd (tr_jsonWriter * w)
+{
+  jsonWriterPop (w, w->benc ? 'e' : ']');
+}
+
+static void
+bencAppendString (struct evbuffer * out, const char * str, size_t len)
+{
+  evbuffer_add_printf (out, "%zu:", len);
+  evbuffer_add (out, str, len);
+}
+
+void
+tr_jsonWriteKey (tr_jsonWriter * w, const tr_quark key)
+{
+  size_t len;
+  const char * str = tr_quark_get_string (key, &len);
+
+  assert (!w->afterKey);
+
+  jsonWriterSeparate (w);
+  if (w->benc)
+    {
+      bencAppendString (w->out, str, len);
+    }
+  else
+    {
+      jsonAppendString (w->out, str, len);
+      evbuffer_add (w->out, ":", 1);
+    }
+  w->afterKey = true;
+}
+
+void
+tr_jsonWriteInt (tr_jsonWriter * w, int64_t i)
+{
+  jsonWriterSeparate (w);
+  evbuffer_add_printf (w->out, w->benc ? "i%" PRId64 "e" : "%" PRId64, i);
+}
+
+void
+tr_jsonWriteReal (tr_jsonWriter * w, double d)
+{
+  jsonWriterSeparate (w);
+
+  if (w->benc)
+    {
+      char buf[128];
+      const int len = tr_snprintf (buf, sizeof (buf), "%f", d);
+      bencAppendString (w->out, buf, len);
+    }
+  else
+    {
+      jsonAppendReal (w->out, d);
+    }
+}
+
+void
+tr_jsonWriteBool (tr_jsonWriter * w, bool b)
+{
+  jsonWriterSeparate (w);
+
+  if (w->benc)
+    evbuffer_add (w->out, b ? "i1e" : "i0e", 3);
+  else if (b)
+    evbuffer_add (w->out, "true", 4);
+  else
+    evbuffer_add (w->out, "false", 5);
+}
+
+void
+tr_jsonWriteStr (tr_jsonWriter * w, const char * str, size_t len)
+{
+  if (str == NULL)
+    str = "";
+  if (len == TR_BAD_SIZE)
+    len = strlen (str);
+
+  jsonWriterSeparate (w);
+  if (w->benc)
+    bencAppendString (w->out, str, len);
+  else
+    jsonAppendString (w->out, str, len);
+}
+
+void
+tr_jsonWriteVariant (tr_jsonWriter * w, const tr_variant * v)
+{
+  jsonWriterSeparate (w);
+  if (w->benc)
+    tr_variantToBufBenc (v, w->out);
+  else
+    jsonWalkToBuf (v, w->out, true);
+}
@@ -546,6 +546,136 @@ testParse2 (void)
   return 0;
 }
 
+static int
+testBigDict (void)
+{
+  int i;
+  int64_t val;
+  const char * str;
+  tr_variant top;
+  tr_variant * child;
+  tr_quark keys[1000];
+  const int n = sizeof (keys) / sizeof (*keys);
+
+  for (i=0; i<n; ++i)
+    {
+      char buf[32];
+      tr_snprintf (buf, sizeof (buf), "big-dict-key-%d", i);
+      keys[i] = tr_quark_new (buf, TR_BAD_SIZE);
+    }
+
+  /* grow it well past the point where it gets indexed */
+  tr_variantInitDict (&top, 0);
+  for (i=0; i<n; ++i)
+    tr_variantDictAddInt (&top, keys[i], i);
+  check_uint_eq (n, top.val.l.count);
+  for (i=0; i<n; ++i)
+    {
+      check (tr_variantDictFindInt (&top, keys[i], &val));
+      check_int_eq (i, val);
+    }
+
+  /* re-adding a key replaces its value instead of adding another entry */
+  tr_variantDictAddInt (&top, keys[10], -10);
+  check_uint_eq (n, top.val.l.count);
+  check (tr_variantDictFindInt (&top, keys[10], &val));
+  check_int_eq (-10, val);
+
+  /* ...even when it changes type */
+  tr_variantDictAddStr (&top, keys[20], "twenty");
+  check_uint_eq (n, top.val.l.count);
+  check (tr_variantDictFindStr (&top, keys[20], &str, NULL));
+  check_streq ("twenty", str);
+
+  /* remove every other key; the rest must still be found */
+  for (i=0; i<n; i+=2)
+    check (tr_variantDictRemove (&top, keys[i]));
+  check_uint_eq (n/2, top.val.l.count);
+  for (i=0; i<n; ++i)
+    {
+      child = tr_variantDictFind (&top, keys[i]);
+      if (i % 2)
+        check (child != NULL);
+      else
+        check (child == NULL);
+    }
+  check (!tr_variantDictRemove (&top, keys[0]));
+
+  /* and they can be added back */
+  for (i=0; i<n; i+=2)
+    tr_variantDictAddInt (&top, keys[i], i);
+  check_uint_eq (n, top.val.l.count);
+  check (tr_variantDictFindInt (&top, keys[998], &val));
+  check_int_eq (998, val);
+
+  tr_variantFree (&top);
+  return 0;
+}
+
+static int
+testArena (void)
+{
+  int64_t i;
+  size_t len;
+  const char * str;
+  const char * end;
+  tr_variant top;
+  tr_variant * list;
+  static const char benc[] = "d4:listl5:alpha21:this one is too long!i42ee4:name16:sixteen-chars-ok3:numi7ee";
+  const tr_quark key_list = tr_quark_new ("list", TR_BAD_SIZE);
+  const tr_quark key_name = tr_quark_new ("name", TR_BAD_SIZE);
+  const tr_quark key_num = tr_quark_new ("num", TR_BAD_SIZE);
+
+  check_int_eq (0, tr_variantFromBuf (&top, TR_VARIANT_FMT_BENC, benc, strlen (benc),
+                                      NULL, &end, TR_VARIANT_PARSE_ARENA));
+  check (end == benc + strlen (benc));
+  check (top.val.l.arena != NULL);
+
+  /* strings are terminated in a private copy, not in the caller's text */
+  check_streq ("d4:listl5:alpha21:this one is too long!i42ee4:name16:sixteen-chars-ok3:numi7ee", benc);
+  check (tr_variantDictFindList (&top, key_list, &list));
+  check_uint_eq (3, tr_variantListSize (list));
+  check (tr_variantGetStr (tr_variantListChild (list, 0), &str, &len));
+  check_uint_eq (5, len);
+  check_streq ("alpha", str);
+  check (tr_variantGetStr (tr_variantListChild (list, 1), &str, &len));
+  check_uint_eq (21, len);
+  check_streq ("this one is too long!", str);
+  check (tr_variantGetInt (tr_variantListChild (list, 2), &i));
+  check_int_eq (42, i);
+  check (tr_variantDictFindStr (&top, key_name, &str, &len));
+  check_streq ("sixteen-chars-ok", str);
+
+  /* the tree can still be modified */
+  tr_variantListAddStr (list, "a string that goes on the heap");
+  check (tr_variantListRemove (list, 0));
+  check_uint_eq (3, tr_variantListSize (list));
+  check (tr_variantGetStr (tr_variantListChild (list, 0), &str, &len));
+  check_streq ("this one is too long!", str);
+  check (tr_variantGetStr (tr_variantListChild (list, 2), &str, &len));
+  check_streq ("a string that goes on the heap", str);
+  tr_variantDictAddStr (&top, key_name, "another name that goes on the heap");
+  check (tr_variantDictRemove (&top, key_num));
+  check (tr_variantDictFindStr (&top, key_name, &str, &len));
+  check_streq ("another name that goes on the heap", str);
+  tr_variantFree (&top);
+
+  /* a top-level string can't own the arena, so it gets a copy */
+  check_int_eq (0, tr_variantFromBuf (&top, TR_VARIANT_FMT_BENC, "20:a top-level string..", 23,
+                                      NULL, NULL, TR_VARIANT_PARSE_ARENA));
+  check (tr_variantGetStr (&top, &str, &len));
+  check_streq ("a top-level string..", str);
+  tr_variantFree (&top);
+
+  /* bad input doesn't leave a partial tree behind */
+  check (tr_variantFromBuf (&top, TR_VARIANT_FMT_BENC, benc, strlen (benc) - 3,
+                            NULL, NULL, TR_VARIANT_PARSE_ARENA) != 0);
+  check (!tr_variantIsDict (&top));
+  tr_variantFree (&top);
+
+  return 0;
+}
+
 int
 main (void)
 {
@@ -556,6 +686,8 @@ main (void)
                                     testMerge,
                                     testBool,
                                     testParse2,
+                                    testBigDict,
+                                    testArena,
                                     testStackSmash };
   return runTests (tests, NUM_TESTS (tests));
 }
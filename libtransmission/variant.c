@@ -167,6 +167,7 @@ tr_variant_string_get_string (const struct tr_variant_string * str)
       case TR_STRING_TYPE_BUF: ret = str->str.buf; break;
       case TR_STRING_TYPE_HEAP: ret = str->str.str; break;
       case TR_STRING_TYPE_QUARK: ret = str->str.str; break;
+      case TR_STRING_TYPE_VIEW: ret = str->str.str; break;
       default: ret = NULL;
     }
 
@@ -227,6 +228,148 @@ getStr (const tr_variant * v)
   return tr_variant_string_get_string (&v->val.s);
 }
 
+/***
+****  Dictionary index
+****
+****  Dicts are arrays searched linearly, which is fastest for the small
+****  dicts that make up nearly all of our settings, resume files, and
+****  RPC requests. Once a dict grows past DICT_INDEX_THRESHOLD entries,
+****  it also gets an open-addressed hash table of key -> position so that
+****  lookups and tr_variantDictAdd* () don't turn quadratic.
+***/
+
+enum
+{
+  DICT_INDEX_THRESHOLD = 32
+};
+
+struct tr_variant_index
+{
+  size_t mask;    /* slot count - 1; slot count is a power of two */
+  size_t * slots; /* position in vals + 1, or 0 if empty */
+};
+
+static inline size_t
+dictIndexHash (const tr_quark key, size_t mask)
+{
+  return (key * (size_t)2654435761u) & mask;
+}
+
+static void
+dictIndexInsert (struct tr_variant_index * index, const tr_variant * vals, size_t pos)
+{
+  size_t i = dictIndexHash (vals[pos].key, index->mask);
+
+  while (index->slots[i] != 0)
+    i = (i + 1) & index->mask;
+
+  index->slots[i] = pos + 1;
+}
+
+static void
+dictIndexFree (tr_variant * dict)
+{
+  struct tr_variant_index * index = dict->val.l.index;
+
+  if (index != NULL)
+    {
+      tr_free (index->slots);
+      tr_free (index);
+      dict->val.l.index = NULL;
+    }
+}
+
+/* (re)build the index so that it's at most half full */
+static void
+dictIndexRebuild (tr_variant * dict)
+{
+  size_t i;
+  size_t n = 64;
+  struct tr_variant_index * index;
+
+  while (n < dict->val.l.count * 2)
+    n *= 2u;
+
+  dictIndexFree (dict);
+
+  index = tr_new (struct tr_variant_index, 1);
+  index->mask = n - 1;
+  index->slots = tr_new0 (size_t, n);
+  for (i=0; i<dict->val.l.count; ++i)
+    dictIndexInsert (index, dict->val.l.vals, i);
+
+  dict->val.l.index = index;
+}
+
+/* returns the slot holding key, or the empty slot that ends its probe */
+static size_t
+dictIndexFindSlot (const tr_variant * dict, const tr_quark key)
+{
+  const struct tr_variant_index * index = dict->val.l.index;
+  size_t i = dictIndexHash (key, index->mask);
+
+  while ((index->slots[i] != 0) && (dict->val.l.vals[index->slots[i] - 1].key != key))
+    i = (i + 1) & index->mask;
+
+  return i;
+}
+
+/* note that vals[pos] was just appended */
+static void
+dictIndexOnAdd (tr_variant * dict, size_t pos)
+{
+  struct tr_variant_index * index = dict->val.l.index;
+
+  if (index == NULL)
+    {
+      if (dict->val.l.count >= DICT_INDEX_THRESHOLD)
+        dictIndexRebuild (dict);
+    }
+  else if (dict->val.l.count * 2 > index->mask + 1)
+    {
+      dictIndexRebuild (dict);
+    }
+  else
+    {
+      dictIndexInsert (index, dict->val.l.vals, pos);
+    }
+}
+
+/* note that the entry at pos is about to be removed,
+ * and that the last entry is about to be moved into its place */
+static void
+dictIndexOnRemove (tr_variant * dict, size_t pos)
+{
+  size_t i;
+  size_t j;
+  struct tr_variant_index * index = dict->val.l.index;
+  const size_t last = dict->val.l.count - 1;
+
+  if (index == NULL)
+    return;
+
+  /* empty pos's slot, then backward-shift the rest of its probe run
+   * so that no later key is cut off from its home slot */
+  i = dictIndexFindSlot (dict, dict->val.l.vals[pos].key);
+  index->slots[i] = 0;
+  for (j=(i+1)&index->mask; index->slots[j]!=0; j=(j+1)&index->mask)
+    {
+      const size_t home = dictIndexHash (dict->val.l.vals[index->slots[j] - 1].key, index->mask);
+
+      /* can the entry at j move back to i? only if its home isn't in (i, j] */
+      if (((j - home) & index->mask) >= ((j - i) & index->mask))
+        {
+          index->slots[i] = index->slots[j];
+          index->slots[j] = 0;
+          i = j;
+        }
+    }
+
+  /* the last entry is moving to pos */
+  if (pos != last)
+    index->slots[dictIndexFindSlot (dict, dict->val.l.vals[last].key)] = pos + 1;
+}
+
 static int
 dictIndexOf (const tr_variant * dict, const tr_quark key)
 {
@@ -236,6 +379,12 @@ dictIndexOf (const tr_variant * dict, const tr_quark key)
       const tr_variant * const begin = dict->val.l.vals;
       const tr_variant * const end = begin + dict->val.l.count;
 
+      if (dict->val.l.index != NULL)
+        {
+          const size_t pos = dict->val.l.index->slots[dictIndexFindSlot (dict, key)];
+          return (int)pos - 1;
+        }
+
       for (walk=begin; walk!=end; ++walk)
         if (walk->key == key)
           return walk - begin;
@@ -482,6 +631,17 @@ tr_variantInitStr (tr_variant * v, const void * str, size_t len)
   tr_variant_string_set_string (&v->val.s, str, len);
 }
 
+void
+tr_variantInitStrView (tr_variant * v, const char * str, size_t len)
+{
+  assert (str[len] == '\0');
+
+  tr_variantInit (v, TR_VARIANT_TYPE_STR);
+  v->val.s.type = TR_STRING_TYPE_VIEW;
+  v->val.s.str.str = str;
+  v->val.s.len = len;
+}
+
 void
 tr_variantInitBool (tr_variant * v, bool value)
 {
@@ -510,6 +670,13 @@ tr_variantInitList (tr_variant * v, size_t reserve_count)
   tr_variantListReserve (v, reserve_count);
 }
 
+/* vals that came from an arena aren't ours to realloc or free */
+static inline bool
+containerIsBorrowed (const tr_variant * v)
+{
+  return (v->val.l.alloc == 0) && (v->val.l.vals != NULL);
+}
+
 static void
 containerReserve (tr_variant * v, size_t count)
 {
@@ -524,7 +691,17 @@ containerReserve (tr_variant * v, size_t count)
       while (n < needed)
         n *= 2u;
 
-      v->val.l.vals = tr_renew (tr_variant, v->val.l.vals, n);
+      if (containerIsBorrowed (v))
+        {
+          tr_variant * vals = tr_new (tr_variant, n);
+          memcpy (vals, v->val.l.vals, v->val.l.count * sizeof (tr_variant));
+          v->val.l.vals = vals;
+        }
+      else
+        {
+          v->val.l.vals = tr_renew (tr_variant, v->val.l.vals, n);
+        }
+
       v->val.l.alloc = n;
     }
 }
@@ -652,6 +829,7 @@ tr_variantDictAdd (tr_variant      * dict,
   val = dict->val.l.vals + dict->val.l.count++;
   tr_variantInit (val, TR_VARIANT_TYPE_INT);
   val->key = key;
+  dictIndexOnAdd (dict, dict->val.l.count - 1);
   return val;
 }
 
@@ -785,6 +963,7 @@ tr_variantDictRemove (tr_variant     * dict,
     {
       const int last = dict->val.l.count - 1;
 
+      dictIndexOnRemove (dict, i);
       tr_variantFree (&dict->val.l.vals[i]);
 
       if (i != last)
@@ -798,6 +977,241 @@ tr_variantDictRemove (tr_variant     * dict,
   return removed;
 }
 
+/***
+****  Arena
+****
+****  Trees parsed with TR_VARIANT_PARSE_ARENA get their containers' vals
+****  and their strings from an arena that's owned by the root container.
+****  Those vals are borrowed: alloc is 0 although vals isn't NULL, and
+****  they're copied to the heap if the container ever needs to grow.
+***/
+
+enum
+{
+  ARENA_ALIGN = 8,
+  ARENA_MIN_BLOCK_SIZE = 4096,
+  ARENA_MAX_BLOCK_GROWTH = 8 * 1024 * 1024
+};
+
+struct tr_variant_arena_block
+{
+  struct tr_variant_arena_block * next;
+  size_t size;
+  size_t used;
+};
+
+struct tr_variant_arena
+{
+  char * text;
+  size_t next_block_size;
+  struct tr_variant_arena_block * blocks;
+};
+
+#define ARENA_ROUND_UP(n) (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+struct tr_variant_arena *
+tr_variantArenaNew (char * text, size_t text_len)
+{
+  struct tr_variant_arena * arena = tr_new0 (struct tr_variant_arena, 1);
+
+  arena->text = text;
+
+  /* a parsed tree usually needs a bit more room than its text,
+   * so this gets most of them into one or two blocks */
+  arena->next_block_size = MAX (ARENA_MIN_BLOCK_SIZE, ARENA_ROUND_UP (text_len));
+
+  return arena;
+}
+
+void *
+tr_variantArenaAlloc (struct tr_variant_arena * arena, size_t size)
+{
+  void * ret;
+  struct tr_variant_arena_block * block = arena->blocks;
+  const size_t header_size = ARENA_ROUND_UP (sizeof (struct tr_variant_arena_block));
+
+  size = ARENA_ROUND_UP (size);
+
+  if ((block == NULL) || (block->size - block->used < size))
+    {
+      size_t n = arena->next_block_size;
+      while (n < size)
+        n *= 2u;
+
+      block = tr_malloc (header_size + n);
+      block->next = arena->blocks;
+      block->size = n;
+      block->used = 0;
+      arena->blocks = block;
+
+      if (n < ARENA_MAX_BLOCK_GROWTH)
+        arena->next_block_size = n * 2u;
+    }
+
+  ret = (char*)block + header_size + block->used;
+  block->used += size;
+  return ret;
+}
+
+void
+tr_variantArenaFree (struct tr_variant_arena * arena)
+{
+  while (arena->blocks != NULL)
+    {
+      struct tr_variant_arena_block * next = arena->blocks->next;
+      tr_free (arena->blocks);
+      arena->blocks = next;
+    }
+
+  tr_free (arena->text);
+  tr_free (arena);
+}
+
+/***
+****  Builder
+***/
+
+void
+tr_variantBuilderInit (struct tr_variant_builder * b,
+                       tr_variant                * top,
+                       struct tr_variant_arena   * arena)
+{
+  memset (b, 0, sizeof (struct tr_variant_builder));
+  b->top = top;
+  b->arena = arena;
+
+  tr_variantInit (top, 0);
+}
+
+tr_variant *
+tr_variantBuilderParent (struct tr_variant_builder * b)
+{
+  size_t first;
+
+  if (b->n_open == 0)
+    return NULL;
+
+  first = b->open[b->n_open - 1];
+  return first == 0 ? b->top : &b->nodes[first - 1];
+}
+
+tr_variant *
+tr_variantBuilderAdd (struct tr_variant_builder * b, tr_quark key)
+{
+  tr_variant * node;
+
+  if (b->n_open == 0)
+    return b->top->type == 0 ? b->top : NULL;
+
+  if (b->n_nodes == b->n_nodes_alloc)
+    {
+      b->n_nodes_alloc = b->n_nodes_alloc ? b->n_nodes_alloc * 2u : 64u;
+      b->nodes = tr_renew (tr_variant, b->nodes, b->n_nodes_alloc);
+    }
+
+  node = &b->nodes[b->n_nodes++];
+  tr_variantInit (node, 0);
+  node->key = key;
+  return node;
+}
+
+void
+tr_variantBuilderOpen (struct tr_variant_builder * b, tr_variant * container)
+{
+  assert (tr_variantIsContainer (container));
+  assert (container->val.l.count == 0);
+
+  if (b->n_open == b->n_open_alloc)
+    {
+      b->n_open_alloc = b->n_open_alloc ? b->n_open_alloc * 2u : 16u;
+      b->open = tr_renew (size_t, b->open, b->n_open_alloc);
+    }
+
+  b->open[b->n_open++] = container == b->top ? 0 : (size_t)(container - b->nodes) + 1;
+}
+
+void
+tr_variantBuilderClose (struct tr_variant_builder * b)
+{
+  tr_variant * container;
+  size_t first;
+  size_t n;
+
+  assert (b->n_open > 0);
+
+  container = tr_variantBuilderParent (b);
+  first = b->open[--b->n_open];
+  n = b->n_nodes - first;
+
+  if (n == 0)
+    return;
+
+  if (b->arena != NULL)
+    {
+      container->val.l.vals = tr_variantArenaAlloc (b->arena, n * sizeof (tr_variant));
+      container->val.l.alloc = 0;
+    }
+  else
+    {
+      container->val.l.vals = tr_new (tr_variant, n);
+      container->val.l.alloc = n;
+    }
+
+  memcpy (container->val.l.vals, b->nodes + first, n * sizeof (tr_variant));
+  container->val.l.count = n;
+  b->n_nodes = first;
+
+  if (tr_variantIsDict (container) && (n >= DICT_INDEX_THRESHOLD))
+    dictIndexRebuild (container);
+}
+
+int
+tr_variantBuilderFinish (struct tr_variant_builder * b, int err)
+{
+  if (!err)
+    {
+      while (b->n_open > 0)
+        tr_variantBuilderClose (b);
+
+      if (b->arena == NULL)
+        {
+          /* nothing to hand over */
+        }
+      else if (tr_variantIsContainer (b->top))
+        {
+          b->top->val.l.arena = b->arena;
+        }
+      else
+        {
+          /* nothing can own the arena, so don't leave top pointing into it */
+          if (tr_variantIsString (b->top))
+            {
+              const char * str = b->top->val.s.str.str;
+              tr_variantInitStr (b->top, str, b->top->val.s.len);
+            }
+
+          tr_variantArenaFree (b->arena);
+        }
+    }
+  else
+    {
+      size_t i;
+
+      /* the open containers have no vals yet, so this frees each node once */
+      for (i=0; i<b->n_nodes; ++i)
+        tr_variantFree (&b->nodes[i]);
+      tr_variantFree (b->top);
+      tr_variantInit (b->top, 0);
+
+      if (b->arena != NULL)
+        tr_variantArenaFree (b->arena);
+    }
+
+  tr_free (b->nodes);
+  tr_free (b->open);
+  return err;
+}
+
 /***
 ****  BENC WALKING
 ***/
@@ -996,7 +1410,14 @@ freeStringFunc (const tr_variant * v, void * unused UNUSED)
 static void
 freeContainerEndFunc (const tr_variant * v, void * unused UNUSED)
 {
-  tr_free (v->val.l.vals);
+  dictIndexFree ((tr_variant*)v);
+
+  if (!containerIsBorrowed (v))
+    tr_free (v->val.l.vals);
+
+  /* this is the root of an arena tree, and all of it has been walked */
+  if (v->val.l.arena != NULL)
+    tr_variantArenaFree (v->val.l.arena);
 }
 
 static const struct VariantWalkFuncs freeWalkFuncs = { freeDummyFunc,
@@ -1303,7 +1724,7 @@ tr_variantFromFile (tr_variant      * setme,
   buf = tr_loadFile (filename, &buflen, error);
   if (buf != NULL)
     {
-      if (tr_variantFromBuf (setme, fmt, buf, buflen, filename, NULL) == 0)
+      if (tr_variantFromBuf (setme, fmt, buf, buflen, filename, NULL, TR_VARIANT_PARSE_DEFAULT) == 0)
         ret = true;
       else
         tr_error_set_literal (error, 0, _("Unable to parse file content"));
@@ -1320,11 +1741,24 @@ tr_variantFromBuf (tr_variant      * setme,
                    const void      * buf,
                    size_t            buflen,
                    const char      * optional_source,
-                   const char     ** setme_end)
+                   const char     ** setme_end,
+                   int               flags)
 {
   int err;
+  const char * text = buf;
+  const char * end = NULL;
+  struct tr_variant_arena * arena = NULL;
   struct locale_context locale_ctx;
 
+  /* the parsers write into the arena's copy of the text to terminate
+   * strings in place, so the caller's buffer is left alone */
+  if (flags & TR_VARIANT_PARSE_ARENA)
+    {
+      char * copy = tr_memdup (buf, buflen);
+      arena = tr_variantArenaNew (copy, buflen);
+      text = copy;
+    }
+
   /* parse with LC_NUMERIC="C" to ensure a "." decimal separator */
   use_numeric_locale (&locale_ctx, "C");
 
@@ -1332,15 +1766,19 @@ tr_variantFromBuf (tr_variant      * setme,
     {
       case TR_VARIANT_FMT_JSON:
       case TR_VARIANT_FMT_JSON_LEAN:
-        err = tr_jsonParse (optional_source, buf, buflen, setme, setme_end);
+        err = tr_jsonParse (optional_source, text, buflen, setme, &end, arena);
         break;
 
       default /* TR_VARIANT_FMT_BENC */:
-        err = tr_variantParseBenc (buf, ((const char*)buf)+buflen, setme, setme_end);
+        err = tr_variantParseBenc (text, text+buflen, setme, &end, arena);
         break;
     }
 
   /* restore the previous locale */
   restore_locale (&locale_ctx);
+
+  if ((setme_end != NULL) && (end != NULL))
+    *setme_end = (const char*)buf + (end - text);
+
   return err;
 }
@@ -36,7 +36,8 @@ typedef enum
 {
   TR_STRING_TYPE_QUARK,
   TR_STRING_TYPE_HEAP,
-  TR_STRING_TYPE_BUF
+  TR_STRING_TYPE_BUF,
+  TR_STRING_TYPE_VIEW /* points into an arena-parsed tree's text */
 }
 tr_string_type;
 
@@ -89,6 +90,8 @@ typedef struct tr_variant
           size_t alloc;
           size_t count;
           struct tr_variant * vals;
+          struct tr_variant_index * index; /* only for big dicts */
+          struct tr_variant_arena * arena; /* only on an arena tree's root */
         } l;
     }
   val;
@@ -126,13 +129,29 @@ bool tr_variantFromFile (tr_variant       * setme,
                          const char       * filename,
                          struct tr_error ** error);
 
-/* TR_VARIANT_FMT_JSON_LEAN and TR_VARIANT_FMT_JSON are equivalent here. */
+typedef enum
+{
+  TR_VARIANT_PARSE_DEFAULT = 0,
+
+  /* Build the tree in a few big blocks that tr_variantFree () releases
+   * all at once, and let parsed strings point into a private copy of the
+   * text instead of allocating each one. This is much faster for large
+   * input. The tree can still be modified, but its children mustn't be
+   * moved into another tree (e.g. by tr_variantDictSteal ()) because
+   * they'd outlive the blocks they point into. */
+  TR_VARIANT_PARSE_ARENA = (1 << 0)
+}
+tr_variant_parse_flags;
+
+/* TR_VARIANT_FMT_JSON_LEAN and TR_VARIANT_FMT_JSON are equivalent here.
+ * flags is a bitwise-or of tr_variant_parse_flags. */
 int tr_variantFromBuf (tr_variant     * setme,
                        tr_variant_fmt   fmt,
                        const void     * buf,
                        size_t           buflen,
                        const char     * optional_source,
-                       const char    ** setme_end);
+                       const char    ** setme_end,
+                       int              flags);
 
 static inline int
 tr_variantFromBenc (tr_variant * setme,
@@ -140,7 +159,8 @@ tr_variantFromBenc (tr_variant * setme,
                     size_t       buflen)
 {
   return tr_variantFromBuf (setme, TR_VARIANT_FMT_BENC,
-                            buf, buflen, NULL, NULL);
+                            buf, buflen, NULL, NULL,
+                            TR_VARIANT_PARSE_DEFAULT);
 }
 static inline int
 tr_variantFromBencFull (tr_variant  * setme,
@@ -154,7 +174,8 @@ tr_variantFromBencFull (tr_variant  * setme,
                             buf,
                             buflen,
                             source,
-                            setme_end);
+                            setme_end,
+                            TR_VARIANT_PARSE_DEFAULT);
 }
 static inline int
 tr_variantFromJsonFull (tr_variant  * setme,
@@ -168,7 +189,8 @@ tr_variantFromJsonFull (tr_variant  * setme,
                             buf,
                             buflen,
                             source,
-                            setme_end);
+                            setme_end,
+                            TR_VARIANT_PARSE_DEFAULT);
 }
 static inline int
 tr_variantFromJson (tr_variant  * setme,
@@ -180,7 +202,8 @@ tr_variantFromJson (tr_variant  * setme,
                             buf,
                             buflen,
                             NULL,
-                            NULL);
+                            NULL,
+                            TR_VARIANT_PARSE_DEFAULT);
 }
 static inline bool
 tr_variantIsType (const tr_variant * b, int type)
@@ -419,6 +442,50 @@ bool         tr_variantDictFindRaw     (tr_variant       * dict,
 void         tr_variantMergeDicts      (tr_variant       * dict_target,
                                         const tr_variant * dict_source);
 
+/***
+****  Streaming JSON
+***/
+
+/* arbitrary value... this is much deeper than our RPC responses go */
+#define TR_JSON_WRITER_MAX_DEPTH 32
+
+/**
+ * Writes lean JSON straight into an evbuffer, for large responses
+ * where building and then walking a tr_variant tree would be wasteful.
+ * Inside a dict, each value must be preceded by tr_jsonWriteKey ().
+ *
+ * With TR_VARIANT_FMT_BENC it writes benc instead, encoding reals and
+ * bools the same way tr_variantToBuf () does. Benc wants dict keys in
+ * sorted order, so callers must write them that way.
+ */
+typedef struct tr_jsonWriter
+{
+  struct evbuffer * out;
+  bool benc;
+  int depth;
+  bool afterKey;
+  bool isFirst[TR_JSON_WRITER_MAX_DEPTH];
+}
+tr_jsonWriter;
+
+void tr_jsonWriterInit     (tr_jsonWriter * w, struct evbuffer * out, tr_variant_fmt fmt);
+
+void tr_jsonWriteDictBegin (tr_jsonWriter * w);
+void tr_jsonWriteDictEnd   (tr_jsonWriter * w);
+void tr_jsonWriteListBegin (tr_jsonWriter * w);
+void tr_jsonWriteListEnd   (tr_jsonWriter * w);
+
+void tr_jsonWriteKey       (tr_jsonWriter * w, const tr_quark key);
+void tr_jsonWriteInt       (tr_jsonWriter * w, int64_t i);
+void tr_jsonWriteReal      (tr_jsonWriter * w, double d);
+void tr_jsonWriteBool      (tr_jsonWriter * w, bool b);
+
+/* if len is TR_BAD_SIZE, strlen (str) is used */
+void tr_jsonWriteStr       (tr_jsonWriter * w, const char * str, size_t len);
+
+/* serialize an existing tr_variant as the next value */
+void tr_jsonWriteVariant   (tr_jsonWriter * w, const tr_variant * v);
+
 /***
 ****
 ****
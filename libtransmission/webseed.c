@@ -473,7 +473,7 @@ task_request_next_chunk (struct tr_webseed_task * t)
       char range[64];
       char ** urls = t->webseed->file_urls;
 
-      const tr_info * inf = tr_torrentInfo (tor);
+      const tr_info * inf = &tor->info;
       const uint64_t remain = t->length - t->blocks_done * tor->blockSize
                             - evbuffer_get_length (t->content);
 
@@ -566,7 +566,7 @@ webseed_destruct (tr_peer * peer)
     {
       tr_file_index_t i;
       tr_torrent * tor = tr_torrentFindFromId (w->session, w->torrent_id);
-      const tr_info * inf = tr_torrentInfo (tor);
+      const tr_info * inf = &tor->info;
 
       for (i=0; i<inf->fileCount; ++i)
         tr_free (w->file_urls[i]);
@@ -600,7 +600,7 @@ tr_webseedNew (struct tr_torrent  * tor,
 {
   tr_webseed * w = tr_new0 (tr_webseed, 1);
   tr_peer * peer = &w->parent;
-  const tr_info * inf = tr_torrentInfo (tor);
+  const tr_info * inf = &tor->info;
 
   /* construct parent class */
   tr_peerConstruct (peer, tor);
@@ -399,7 +399,7 @@ OptionsDialog::onTimeout ()
     {
       const QByteArray result (myVerifyHash.result ());
       const bool matches = memcmp (result.constData (),
-                                   myInfo.pieces[myVerifyPieceIndex].hash,
+                                   tr_infoPieceHash (&myInfo, myVerifyPieceIndex),
                                    SHA_DIGEST_LENGTH) == 0;
       myVerifyFlags[myVerifyPieceIndex] = matches;
       myVerifyPiecePos = 0;
@@ -49,6 +49,7 @@ namespace
 RpcClient::RpcClient (QObject * parent):
   QObject (parent),
   mySession (nullptr),
+  myServerSpeaksBenc (false),
   myNAM (nullptr),
   myNextTag (0)
 {
@@ -60,6 +61,7 @@ RpcClient::stop ()
 {
   mySession = nullptr;
   mySessionId.clear ();
+  myServerSpeaksBenc = false;
   myUrl.clear ();
 
   if (myNAM != nullptr)
@@ -135,13 +137,21 @@ RpcClient::sendNetworkRequest (TrVariantPtr json, const QFutureInterface<RpcResp
   QNetworkRequest request;
   request.setUrl (myUrl);
   request.setRawHeader ("User-Agent", (qApp->applicationName () + QLatin1Char ('/') + QString::fromUtf8 (LONG_VERSION_STRING)).toUtf8 ());
-  request.setRawHeader ("Content-Type", "application/json; charset=UTF-8");
+  request.setRawHeader ("Accept", TR_RPC_BENC_CONTENT_TYPE ", application/json");
+
+  // once the server has answered in benc, talk benc to it too
+  if (myServerSpeaksBenc)
+    request.setRawHeader ("Content-Type", TR_RPC_BENC_CONTENT_TYPE);
+  else
+    request.setRawHeader ("Content-Type", "application/json; charset=UTF-8");
 
   if (!mySessionId.isEmpty ())
     request.setRawHeader (TR_RPC_SESSION_ID_HEADER, mySessionId.toUtf8 ());
 
   size_t rawJsonDataLength;
-  char * rawJsonData = tr_variantToStr (json.get (), TR_VARIANT_FMT_JSON_LEAN, &rawJsonDataLength);
+  char * rawJsonData = tr_variantToStr (json.get (),
+                                        myServerSpeaksBenc ? TR_VARIANT_FMT_BENC : TR_VARIANT_FMT_JSON_LEAN,
+                                        &rawJsonDataLength);
   QByteArray jsonData (rawJsonData, rawJsonDataLength);
   tr_free (rawJsonData);
 
@@ -265,11 +275,17 @@ RpcClient::networkRequestFinished (QNetworkReply *reply)
     {
       RpcResponse result;
 
-      const QByteArray jsonData = reply->readAll ().trimmed ();
+      const bool isBenc = reply->rawHeader ("Content-Type").startsWith (TR_RPC_BENC_CONTENT_TYPE);
+      const QByteArray jsonData = isBenc ? reply->readAll () : reply->readAll ().trimmed ();
       TrVariantPtr json = createVariant ();
-      if (tr_variantFromJson (json.get (), jsonData.constData (), jsonData.size ()) == 0)
+      if (tr_variantFromBuf (json.get (), isBenc ? TR_VARIANT_FMT_BENC : TR_VARIANT_FMT_JSON,
+                             jsonData.constData (), jsonData.size (),
+                             nullptr, nullptr, TR_VARIANT_PARSE_DEFAULT) == 0)
         result = parseResponseData (*json);
 
+      if (isBenc)
+        myServerSpeaksBenc = true;
+
       promise.setProgressValue (1);
       promise.reportFinished (&result);
     }
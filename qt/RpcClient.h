@@ -91,6 +91,7 @@ class RpcClient: public QObject
   private:
     tr_session * mySession;
     QString mySessionId;
+    bool myServerSpeaksBenc;
     QUrl myUrl;
     QNetworkAccessManager * myNAM;
     QHash<int64_t, QFutureInterface<RpcResponse>> myLocalRequests;
@@ -255,6 +255,7 @@ Session::Session (const QString& configDir, Prefs& prefs):
   myConfigDir (configDir),
   myPrefs (prefs),
   myBlocklistSize (-1),
+  myTorrentRevision (-1),
   mySession (0)
 {
   myStats.ratio = TR_RATIO_NA;
@@ -285,6 +286,7 @@ void
 Session::stop ()
 {
   myRpc.stop ();
+  myTorrentRevision = -1;
 
   if (mySession)
     {
@@ -509,10 +511,17 @@ Session::torrentRenamePath (const QSet<int>& ids, const QString& oldpath, const
 void
 Session::refreshTorrents (const QSet<int>& ids, const KeyList& keys)
 {
+  // once we have a revision cursor, ask for whatever changed since then
+  // instead of for whatever was recently active
+  const bool useSince = &ids == &recentlyActiveIds && myTorrentRevision > 0;
+
   tr_variant args;
   tr_variantInitDict (&args, 2);
   addList (tr_variantDictAddList (&args, TR_KEY_fields, 0), keys);
-  addOptionalIds (&args, ids);
+  if (useSince)
+    tr_variantDictAddInt (&args, TR_KEY_since, myTorrentRevision);
+  else
+    addOptionalIds (&args, ids);
 
   RpcQueue * q = new RpcQueue ();
 
@@ -524,13 +533,26 @@ Session::refreshTorrents (const QSet<int>& ids, const KeyList& keys)
 
   const bool allTorrents = ids.empty ();
   q->add (
-    [this, allTorrents] (const RpcResponse& r)
+    [this, allTorrents, useSince] (const RpcResponse& r)
     {
       tr_variant * torrents;
+      int64_t revision;
+
+      // no "removed" list means the server didn't know our cursor,
+      // e.g. because it restarted and renumbered its torrents
+      if (useSince && tr_variantDictFind (r.args.get (), TR_KEY_removed) == nullptr)
+        {
+          myTorrentRevision = -1;
+          initTorrents ();
+          return;
+        }
+
       if (tr_variantDictFindList (r.args.get (), TR_KEY_torrents, &torrents))
         emit torrentsUpdated (torrents, allTorrents);
       if (tr_variantDictFindList (r.args.get (), TR_KEY_removed, &torrents))
         emit torrentsRemoved (torrents);
+      if ((allTorrents || useSince) && tr_variantDictFindInt (r.args.get (), TR_KEY_revision, &revision))
+        myTorrentRevision = revision;
     });
 
   q->run ();
@@ -124,6 +124,7 @@ class Session: public QObject
     Prefs& myPrefs;
 
     int64_t myBlocklistSize;
+    int64_t myTorrentRevision;
     tr_session * mySession;
     QStringList myIdleJSON;
     tr_session_stats myStats;
@@ -132,19 +132,21 @@ TransmissionRemote.prototype = {
         this.sendRequest(o, callback, context, async);
     },
 
-    updateTorrents: function (torrentIds, fields, callback, context) {
+    updateTorrents: function (torrentIds, fields, callback, context, since) {
         var o = {
             method: 'torrent-get',
             arguments: {
                 'fields': fields
             }
         };
-        if (torrentIds) {
+        if (since) {
+            o['arguments'].since = since;
+        } else if (torrentIds) {
             o['arguments'].ids = torrentIds;
         };
         this.sendRequest(o, function (response) {
             var args = response['arguments'];
-            callback.call(context, args.torrents, args.removed);
+            callback.call(context, args.torrents, args.removed, args.revision);
         });
     },
 
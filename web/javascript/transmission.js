@@ -833,13 +833,36 @@ Transmission.prototype = {
         this.remote.updateTorrents(ids, fields, this.updateFromTorrentGet, this);
     },
 
+    // torrent-get with no ids or with a 'since' returns a revision cursor
+    // that the next refresh can use to only fetch what changed
+    updateTorrentsSince: function (ids, fields, since) {
+        this.remote.updateTorrents(ids, fields, function (updates, removed_ids, revision) {
+            // no 'removed' list means the server didn't know our cursor,
+            // e.g. because it restarted and renumbered its torrents
+            if (since && !removed_ids) {
+                this.deleteTorrents(Object.keys(this._torrents));
+                this.torrentRevision = null;
+                this.initializeTorrents();
+                return;
+            };
+            this.updateFromTorrentGet(updates, removed_ids);
+            if (revision) {
+                this.torrentRevision = revision;
+            };
+        }, this, since);
+    },
+
     refreshTorrents: function () {
         var callback = $.proxy(this.refreshTorrents, this);
         var msec = this[Prefs._RefreshRate] * 1000;
         var fields = ['id'].concat(Torrent.Fields.Stats);
 
         // send a request right now
-        this.updateTorrents('recently-active', fields);
+        if (this.torrentRevision) {
+            this.updateTorrentsSince(null, fields, this.torrentRevision);
+        } else {
+            this.updateTorrents('recently-active', fields);
+        };
 
         // schedule the next request
         clearTimeout(this.refreshTorrentsTimeout);
@@ -848,7 +871,7 @@ Transmission.prototype = {
 
     initializeTorrents: function () {
         var fields = ['id'].concat(Torrent.Fields.Metadata, Torrent.Fields.Stats);
-        this.updateTorrents(null, fields);
+        this.updateTorrentsSince(null, fields, null);
     },
 
     onRowClicked: function (ev) {